@@ -0,0 +1,125 @@
+#if !defined(B9_COMPILEQUEUE_HPP_)
+#define B9_COMPILEQUEUE_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace b9 {
+
+/// How soon a queued function is compiled. Higher priorities go first, and
+/// requests with the same priority go in order.
+enum class CompilePriority {
+  RECOMPILE,   //< Already jitted, and only slower until recompiled
+  INVOCATION,  //< Called often
+  BACKEDGE,    //< Looping, and stuck in the interpreter until compiled
+};
+
+inline const char *toString(CompilePriority priority) {
+  switch (priority) {
+    case CompilePriority::RECOMPILE:
+      return "recompile";
+    case CompilePriority::INVOCATION:
+      return "invocation";
+    case CompilePriority::BACKEDGE:
+      return "backedge";
+    default:
+      return "unknown";
+  }
+}
+
+inline std::ostream &operator<<(std::ostream &out, CompilePriority priority) {
+  return out << toString(priority);
+}
+
+/// What the background compiler did, and how long it took.
+struct CompileStats {
+  using Duration = std::chrono::duration<double, std::milli>;
+
+  std::size_t queued = 0;    //< Requests accepted
+  std::size_t compiled = 0;  //< Compiles that succeeded
+  std::size_t failed = 0;    //< Compiles that failed
+  std::size_t dropped = 0;   //< Requests rejected by a full queue
+  std::size_t maxDepth = 0;  //< The longest the queue got
+  Duration compileTime{0};   //< Total time spent compiling
+  Duration maxCompileTime{0};
+  Duration waitTime{0};      //< Total time requests spent queued
+  Duration maxWaitTime{0};
+};
+
+inline std::ostream &operator<<(std::ostream &out, const CompileStats &stats) {
+  auto done = stats.compiled + stats.failed;
+  auto average = [done](CompileStats::Duration total) {
+    return done == 0 ? 0 : total.count() / done;
+  };
+  out << "Compiles:     " << stats.compiled << " compiled, " << stats.failed
+      << " failed, " << stats.dropped << " dropped" << std::endl
+      << "Queue depth:  " << stats.maxDepth << " max" << std::endl
+      << "Compile time: " << average(stats.compileTime) << " ms avg, "
+      << stats.maxCompileTime.count() << " ms max" << std::endl
+      << "Queue wait:   " << average(stats.waitTime) << " ms avg, "
+      << stats.maxWaitTime.count() << " ms max";
+  return out;
+}
+
+/// A queue of functions to compile, serviced by a background thread. Threads
+/// that find a function hot queue it and carry on interpreting it. The
+/// compiler thread publishes the compiled code when it's done.
+class CompileQueue {
+ public:
+  /// Compile a function. Returns true if it compiled.
+  using Compile = std::function<bool(std::size_t functionIndex)>;
+
+  /// Start the compiler thread. At most `limit` requests wait at once.
+  CompileQueue(Compile compile, std::size_t limit);
+
+  CompileQueue(const CompileQueue &) = delete;
+
+  /// Stop the compiler thread. Requests still waiting are dropped.
+  ~CompileQueue() noexcept;
+
+  /// Ask for a function to be compiled. If it's already waiting, it moves up
+  /// to `priority` if that's higher. Returns false if the queue is full.
+  bool push(std::size_t functionIndex, CompilePriority priority);
+
+  /// Wait until every waiting request is compiled.
+  void drain();
+
+  /// The number of waiting requests.
+  std::size_t depth() const;
+
+  CompileStats stats() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Request {
+    std::size_t functionIndex;
+    CompilePriority priority;
+    std::size_t sequence;  //< Orders requests with the same priority
+    Clock::time_point queuedAt;
+  };
+
+  void work();
+
+  Compile compile_;
+  std::size_t limit_;
+  mutable std::mutex mutex_;
+  std::condition_variable pushed_;
+  std::condition_variable idle_;
+  std::vector<Request> requests_;  //< Small, so searched in place
+  std::size_t sequence_ = 0;
+  bool compiling_ = false;
+  bool stopping_ = false;
+  CompileStats stats_;
+  std::thread thread_;  //< Last, so it starts once everything else is set up
+};
+
+}  // namespace b9
+
+#endif  // B9_COMPILEQUEUE_HPP_
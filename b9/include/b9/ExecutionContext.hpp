@@ -2,10 +2,21 @@
 #define B9_EXECUTIONCONTEXT_HPP_
 
 #include <b9/OperandStack.hpp>
+#include <b9/ThreadedCode.hpp>
 #include <b9/VirtualMachine.hpp>
 
+#include <vector>
+
 namespace b9 {
 
+/// A b9 frame, saved by a call in the frame stack interpreter. Restored when
+/// the callee returns.
+struct Frame {
+  const ThreadedInstruction *returnIp;  //< The caller's FUNCTION_CALL
+  StackElement *args;                   //< The caller's arguments and locals
+  std::size_t functionIndex;            //< The caller
+};
+
 class ExecutionContext {
  public:
   ExecutionContext(VirtualMachine &virtualMachine, const Config &cfg);
@@ -23,6 +34,8 @@ class ExecutionContext {
   template <typename VisitorT>
   void visit(Om::Context &cx, VisitorT &visitor) {
     stack_.visit(cx, visitor);
+    jitRoots_.visit(cx, visitor);
+    virtualMachine_->visit(cx, visitor);
   }
 
   Om::RunContext &omContext() { return omContext_; }
@@ -33,18 +46,103 @@ class ExecutionContext {
 
   VirtualMachine *virtualMachine() const { return virtualMachine_; }
 
+  /// The function jitted code last called through a dispatch slot. Read by
+  /// the trampolines, which are shared by every function.
+  std::size_t dispatchIndex() const { return dispatchIndex_; }
+
   // Available externally for jit-to-primitive calls.
   void doPrimitiveCall(Parameter value);
 
   friend std::ostream &operator<<(std::ostream &stream,
                                   const ExecutionContext &ec);
 
+  /// The frames of the callers of the function being interpreted, when
+  /// running with the frame stack. The innermost caller is at the back.
+  const std::vector<Frame> &frames() const { return frames_; }
+
+  /// Translate a function's instructions into threaded code, for the threaded
+  /// interpreter. When `fuse` is set, common bytecode sequences are fused
+  /// into superinstructions. When `frameStack` is set, calls and returns
+  /// push and pop frames on the context's frame stack, instead of recursing
+  /// into the interpreter.
+  static ThreadedCode threadFunction(const FunctionDef &function,
+                                     bool fuse = false,
+                                     bool frameStack = false);
+
  private:
   friend class VirtualMachine;
   friend class ExecutionContextOffset;
 
+  // The slow paths of jitted object bytecodes
+  friend Om::RawValue(::jit_new_object)(ExecutionContext *context);
+  friend Om::RawValue(::jit_push_from_object)(ExecutionContext *context,
+                                              Om::RawValue object,
+                                              Parameter slotId,
+                                              InlineCache *cache);
+  friend void(::jit_pop_into_object)(ExecutionContext *context,
+                                     Om::RawValue object, Om::RawValue value,
+                                     Parameter slotId, InlineCache *cache);
+  friend void(::jit_system_collect)(ExecutionContext *context);
+  friend void(::jit_safepoint)(ExecutionContext *context);
+  friend Om::RawValue(::jit_deoptimize)(ExecutionContext *context,
+                                        std::size_t functionIndex,
+                                        std::size_t bytecodeIndex,
+                                        const Om::RawValue *vars,
+                                        StackElement *frame);
+
+  /// The threaded interpreter. Runs the code of function `functionIndex`,
+  /// starting at `ip`, until the function returns. The frame's arguments and
+  /// locals start at `args`.
+  ///
+  /// When `handlersOut` is not null, nothing is run. Instead, the address of
+  /// the handler table is written to `handlersOut`. This is how threaded code
+  /// gets a hold of the handler addresses, which are local to this function.
+  static StackElement runThreaded(ExecutionContext *context,
+                                  std::size_t functionIndex,
+                                  const ThreadedInstruction *ip,
+                                  StackElement *args,
+                                  const void *const **handlersOut = nullptr);
+
+  /// The switch interpreter's loop. When `checked`, every instruction and
+  /// the operand stack are checked before the instruction runs. Otherwise,
+  /// the code is trusted to have passed the verifier. Starts at
+  /// `startIndex`, with the function's operand stack already above its
+  /// locals. Runs the function's quick code when quickening.
+  template <bool checked>
+  StackElement runSwitch(std::size_t functionIndex, StackElement *args,
+                         std::size_t startIndex = 0);
+
+  /// Finish a call of speculating jitted code in the switch interpreter,
+  /// from `bytecodeIndex`. The arguments spilled to the operand stack start
+  /// at `args`, and the function's operand stack follows them. The rest of
+  /// the frame, boxed, is in `vars`. The interpreter's frame is rebuilt in
+  /// place before it resumes.
+  StackElement deoptimize(std::size_t functionIndex, std::size_t bytecodeIndex,
+                          const Om::RawValue *vars, StackElement *args);
+
+  /// Count a backedge of the interpreted function `functionIndex`. Returns
+  /// true if the running call should move into the JIT with doOsr.
+  bool doBackedge(std::size_t functionIndex);
+
+  /// Move the running call of `functionIndex`, with its frame at `args`,
+  /// into an OSR entry at `bytecodeIndex`. Returns true, and the function's
+  /// result, if the call ran to completion in the JIT.
+  bool doOsr(std::size_t functionIndex, std::size_t bytecodeIndex,
+             StackElement *args, StackElement &result);
+
   void doFunctionCall(Parameter value);
 
+  /// Start a TAIL_CALL of `callee` from the frame at `args`. The callee's
+  /// arguments are moved down over the frame, and the rest of it is popped.
+  /// Returns the callee's jitted code, for the caller to call. Otherwise,
+  /// returns nullptr, with the callee's registers pushed, so the caller can
+  /// interpret the callee in place.
+  JitFunction doTailCall(std::size_t callee, StackElement *args);
+
+  /// When speculating, note the arguments of an interpreted call that
+  /// aren't integers.
+  void profileArgs(std::size_t functionIndex, const StackElement *args);
+
   /// A helper for interpreter-to-jit transitions.
   Om::Value callJitFunction(JitFunction jitFunction, std::size_t argCount);
 
@@ -86,21 +184,52 @@ class ExecutionContext {
 
   void doStrPushConstant(Parameter value);
 
+  /// Allocate an object with the shared empty map.
+  Om::Object *newObject();
+
   void doNewObject();
 
-  void doPushFromObject(OMR::Om::Id slotId);
+  /// Load a slot. When `cache` isn't null, the lookup goes through it.
+  /// Returns the resolved lookup.
+  InlineCacheEntry doPushFromObject(OMR::Om::Id slotId,
+                                    InlineCache *cache = nullptr);
+
+  /// Store into a slot, adding it if needed. When `cache` isn't null, the
+  /// lookup and the transition go through it. Returns the resolved lookup.
+  InlineCacheEntry doPopIntoObject(OMR::Om::Id slotId,
+                                   InlineCache *cache = nullptr);
 
-  void doPopIntoObject(OMR::Om::Id slotId);
+  /// Load a slot at a known index. Returns false, without touching the stack,
+  /// if the object doesn't have the expected map.
+  bool doQuickPushFromObject(const InlineCacheEntry &slot);
+
+  /// Store into a slot at a known index. Returns false, without touching the
+  /// stack, if the object doesn't have the expected map.
+  bool doQuickPopIntoObject(const InlineCacheEntry &slot);
+
+  /// Call the jitted code of a quickened call. Returns false, without
+  /// touching the stack, if the callee's code has changed.
+  bool doQuickFunctionCall(const QuickCall &call);
 
   void doCallIndirect();
 
   void doSystemCollect();
 
+  /// Park here if another thread is stopping the world. Polled on every
+  /// call and backward jump, so collections never wait long for a thread.
+  void doSafepoint() { virtualMachine_->memoryManager().safepoint().poll(); }
+
   Om::RunContext omContext_;
   OperandStack stack_;
+  /// In passParam mode, jitted code keeps variables in registers, where the
+  /// collector can't see them. Before a call that can collect, each jitted
+  /// frame spills them to its area of this stack.
+  OperandStack jitRoots_;
+  std::vector<Frame> frames_;
   const Config *cfg_;
   VirtualMachine *virtualMachine_;
   Instruction *programCounter_ = 0;
+  std::size_t dispatchIndex_ = 0;
 };
 
 // static_assert(std::is_standard_layout<ExecutionContext>::value);
@@ -109,8 +238,12 @@ struct ExecutionContextOffset {
   static constexpr std::size_t OM_CONTEXT =
       offsetof(ExecutionContext, omContext_);
   static constexpr std::size_t STACK = offsetof(ExecutionContext, stack_);
+  static constexpr std::size_t JIT_ROOTS =
+      offsetof(ExecutionContext, jitRoots_);
   static constexpr std::size_t PROGRAM_COUNTER =
       offsetof(ExecutionContext, programCounter_);
+  static constexpr std::size_t DISPATCH_INDEX =
+      offsetof(ExecutionContext, dispatchIndex_);
 };
 
 }  // namespace b9
@@ -0,0 +1,185 @@
+#if !defined(B9_INLINECACHE_HPP_)
+#define B9_INLINECACHE_HPP_
+
+#include <OMR/Om/Cell.hpp>
+#include <OMR/Om/Context.hpp>
+#include <OMR/Om/ObjectMap.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+namespace b9 {
+
+namespace Om = ::OMR::Om;
+
+/// A cached slot lookup. Objects with `map` have the slot at `index`. For a
+/// store that adds the slot, `transition` is the map the object moves to, and
+/// `index` is the slot's index in that map. Otherwise, `transition` is null.
+struct InlineCacheEntry {
+  Om::ObjectMap *map;
+  Om::ObjectMap *transition;
+  Om::SlotIndex index;
+};
+
+/// The states of an InlineCache. A cache starts out empty, and only ever
+/// moves down this list.
+enum class InlineCacheState {
+  UNINITIALIZED,  //< No lookups yet
+  MONOMORPHIC,    //< Seen one map
+  POLYMORPHIC,    //< Seen a few maps, up to InlineCache::MAX_ENTRIES
+  MEGAMORPHIC,    //< Seen too many maps, no longer caching
+};
+
+inline const char *toString(InlineCacheState state) {
+  switch (state) {
+    case InlineCacheState::UNINITIALIZED:
+      return "uninitialized";
+    case InlineCacheState::MONOMORPHIC:
+      return "monomorphic";
+    case InlineCacheState::POLYMORPHIC:
+      return "polymorphic";
+    case InlineCacheState::MEGAMORPHIC:
+      return "megamorphic";
+    default:
+      return "unknown";
+  }
+}
+
+inline std::ostream &operator<<(std::ostream &out, InlineCacheState state) {
+  return out << toString(state);
+}
+
+/// The slot lookup cache of a single PUSH_FROM_OBJECT or POP_INTO_OBJECT
+/// instruction, keyed on the object's map.
+///
+/// The cached maps are GC roots. Maps aren't moved by the collector, but
+/// keeping them alive makes sure a map's address is never reused by a map
+/// with a different layout while it's in a cache.
+///
+/// Caches are shared by every thread running the VM. Lookups don't lock: an
+/// entry is written before the size that covers it is published, and is never
+/// written again. Inserts are rare, and take a spin lock. The hit and miss
+/// counters may lose updates when threads race, which is fine for stats.
+class InlineCache {
+ public:
+  /// The size of the polymorphic table.
+  static constexpr std::size_t MAX_ENTRIES = 4;
+
+  InlineCache() = default;
+
+  InlineCache(const InlineCache &) = delete;
+
+  /// Find the entry for `map`, or null. Counts a hit or a miss.
+  const InlineCacheEntry *find(const Om::ObjectMap *map) {
+    auto entry = lookup(map, size_.load(std::memory_order_acquire));
+    bump(entry != nullptr ? hits_ : misses_);
+    return entry;
+  }
+
+  /// Remember the result of a slow lookup. Once the table is full, the cache
+  /// turns megamorphic and is dropped.
+  void insert(const InlineCacheEntry &entry) {
+    while (lock_.test_and_set(std::memory_order_acquire)) {
+    }
+    auto size = size_.load(std::memory_order_relaxed);
+    if (megamorphic_.load(std::memory_order_relaxed)) {
+      // Nothing to do.
+    } else if (size == MAX_ENTRIES) {
+      megamorphic_.store(true, std::memory_order_relaxed);
+      size_.store(0, std::memory_order_release);
+    } else if (lookup(entry.map, size) == nullptr) {
+      // Another thread may have inserted the same map since our miss.
+      entries_[size] = entry;
+      size_.store(size + 1, std::memory_order_release);
+    }
+    lock_.clear(std::memory_order_release);
+  }
+
+  /// The cached entries, for the JIT to guard on. Empty once the cache is
+  /// megamorphic.
+  std::vector<InlineCacheEntry> entries() const {
+    auto size = size_.load(std::memory_order_acquire);
+    return std::vector<InlineCacheEntry>(entries_, entries_ + size);
+  }
+
+  InlineCacheState state() const {
+    if (megamorphic_.load(std::memory_order_relaxed)) {
+      return InlineCacheState::MEGAMORPHIC;
+    }
+    switch (size_.load(std::memory_order_relaxed)) {
+      case 0:
+        return InlineCacheState::UNINITIALIZED;
+      case 1:
+        return InlineCacheState::MONOMORPHIC;
+      default:
+        return InlineCacheState::POLYMORPHIC;
+    }
+  }
+
+  std::size_t hits() const { return hits_.load(std::memory_order_relaxed); }
+
+  std::size_t misses() const {
+    return misses_.load(std::memory_order_relaxed);
+  }
+
+  template <typename VisitorT>
+  void visit(Om::Context &cx, VisitorT &visitor) {
+    auto size = size_.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < size; i++) {
+      visitor.rootEdge(cx, this, (Om::Cell *)entries_[i].map);
+      if (entries_[i].transition != nullptr) {
+        visitor.rootEdge(cx, this, (Om::Cell *)entries_[i].transition);
+      }
+    }
+  }
+
+ private:
+  const InlineCacheEntry *lookup(const Om::ObjectMap *map,
+                                 std::size_t size) const {
+    for (std::size_t i = 0; i < size; i++) {
+      if (entries_[i].map == map) {
+        return &entries_[i];
+      }
+    }
+    return nullptr;
+  }
+
+  /// Count without a locked instruction. Racing threads may lose counts.
+  static void bump(std::atomic<std::size_t> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  InlineCacheEntry entries_[MAX_ENTRIES];
+  std::atomic<std::size_t> size_{0};
+  std::atomic<bool> megamorphic_{false};
+  std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+  std::atomic<std::size_t> hits_{0};
+  std::atomic<std::size_t> misses_{0};
+};
+
+/// Totals over all the inline caches of a VM.
+struct InlineCacheStats {
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+  std::size_t uninitialized = 0;  //< Caches in each state
+  std::size_t monomorphic = 0;
+  std::size_t polymorphic = 0;
+  std::size_t megamorphic = 0;
+};
+
+inline std::ostream &operator<<(std::ostream &out,
+                                const InlineCacheStats &stats) {
+  out << "IC hits:      " << stats.hits << std::endl
+      << "IC misses:    " << stats.misses << std::endl
+      << "IC states:    " << stats.uninitialized << " uninitialized, "
+      << stats.monomorphic << " monomorphic, " << stats.polymorphic
+      << " polymorphic, " << stats.megamorphic << " megamorphic";
+  return out;
+}
+
+}  // namespace b9
+
+#endif  // B9_INLINECACHE_HPP_
@@ -0,0 +1,71 @@
+#if !defined(B9_JITSTATS_HPP_)
+#define B9_JITSTATS_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+/// How hard the JIT works on a function. Every function is compiled at the
+/// baseline level first. With Config::recompile, ones that stay hot are
+/// compiled again at the hot level, with more inlining.
+enum class CompileLevel {
+  BASELINE,
+  HOT,
+};
+
+inline const char *toString(CompileLevel level) {
+  switch (level) {
+    case CompileLevel::BASELINE:
+      return "baseline";
+    case CompileLevel::HOT:
+      return "hot";
+    default:
+      return "unknown";
+  }
+}
+
+inline std::ostream &operator<<(std::ostream &out, CompileLevel level) {
+  return out << toString(level);
+}
+
+/// What the JIT did in one compile of a function, or of an OSR entry.
+struct CompileRecord {
+  using Duration = std::chrono::duration<double, std::milli>;
+
+  std::string function;
+  bool osr = false;
+  std::size_t osrIndex = 0;          //< Where the OSR entry starts
+  CompileLevel level = CompileLevel::BASELINE;
+  bool ok = false;
+  std::string error;                 //< Why the compile failed
+  Duration time{0};                  //< Wall time, including building the IL
+  std::size_t bytecodes = 0;         //< Built into IL, counting inlined bodies
+  std::vector<std::string> inlined;  //< The callees inlined, in order
+  const void *entry = nullptr;       //< The compiled code
+};
+
+/// The columns the JIT stats table can be sorted by. Names sort A to Z,
+/// everything else biggest first.
+enum class JitStatsSort { TIME, BYTECODES, INLINED, NAME };
+
+/// Parse the name of a JitStatsSort. Returns false if there's no such column.
+bool parseJitStatsSort(const std::string &name, JitStatsSort &sort);
+
+void sortCompileRecords(std::vector<CompileRecord> &records,
+                        JitStatsSort sort);
+
+/// Write one row per compile, in columns, after a header row.
+void writeJitStatsTable(std::ostream &out,
+                        const std::vector<CompileRecord> &records);
+
+/// Write the compiles as a JSON array of objects, one per compile.
+void writeJitStatsJson(std::ostream &out,
+                       const std::vector<CompileRecord> &records);
+
+}  // namespace b9
+
+#endif  // B9_JITSTATS_HPP_
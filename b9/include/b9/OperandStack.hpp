@@ -4,21 +4,75 @@
 #include <OMR/Om/Context.hpp>
 #include <OMR/Om/Value.hpp>
 
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
 namespace b9 {
 
 namespace Om = OMR::Om;
 
 using StackElement = Om::Value;
 
+/// Thrown when a frame doesn't fit on the operand stack.
+struct StackOverflowException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// The operand stack. Its memory is mapped when the stack is created, with a
+/// guard page at the end, but the OS only commits pages as the stack grows
+/// into them. Nothing is checked on push. Instead, the interpreter and jitted
+/// code reserve room for a whole frame when they enter a function. Code that
+/// pushes past the end anyway hits the guard page, rather than corrupting
+/// memory.
 class OperandStack {
  public:
-  static constexpr std::size_t SIZE = 1000;
+  /// The default size, in values.
+  static constexpr std::size_t DEFAULT_SIZE = 1 << 20;
+
+  explicit OperandStack(std::size_t size = DEFAULT_SIZE) {
+    std::size_t page = sysconf(_SC_PAGESIZE);
+    std::size_t bytes = (size * sizeof(StackElement) + page - 1) / page * page;
+    mappedBytes_ = bytes + page;
+
+    void *memory = mmap(nullptr, mappedBytes_, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (mprotect((char *)memory + bytes, page, PROT_NONE) != 0) {
+      munmap(memory, mappedBytes_);
+      throw std::runtime_error{"Failed to map the operand stack's guard page"};
+    }
+
+    stack_ = (StackElement *)memory;
+    top_ = stack_;
+    limit_ = stack_ + bytes / sizeof(StackElement);
+  }
 
-  OperandStack() noexcept : top_(&stack_[0]) {
-    memset(stack_, 0, sizeof(stack_));
+  ~OperandStack() noexcept { munmap(stack_, mappedBytes_); }
+
+  OperandStack(const OperandStack &) = delete;
+
+  OperandStack &operator=(const OperandStack &) = delete;
+
+  void reset() { top_ = stack_; }
+
+  /// True if `n` more values fit on the stack.
+  bool hasRoom(std::size_t n) const { return std::size_t(limit_ - top_) >= n; }
+
+  /// Make sure `n` more values fit on the stack, or throw a
+  /// StackOverflowException.
+  void reserve(std::size_t n) const {
+    if (!hasRoom(n)) {
+      throw StackOverflowException{"Operand stack overflow"};
+    }
   }
 
-  void reset() { top_ = &stack_[0]; }
+  /// The most values the stack can hold.
+  std::size_t size() const { return limit_ - stack_; }
 
   void push(const StackElement &value) {
     *top_ = value;
@@ -70,7 +124,9 @@ class OperandStack {
   friend class OperandStackOffset;
 
   StackElement *top_;
-  StackElement stack_[SIZE];
+  StackElement *stack_;
+  StackElement *limit_;
+  std::size_t mappedBytes_;
 };
 
 inline std::ostream &printStack(std::ostream &out, const OperandStack &stack) {
@@ -88,6 +144,7 @@ inline std::ostream &printStack(std::ostream &out, const OperandStack &stack) {
 struct OperandStackOffset {
   static constexpr std::size_t TOP = offsetof(OperandStack, top_);
   static constexpr std::size_t STACK = offsetof(OperandStack, stack_);
+  static constexpr std::size_t LIMIT = offsetof(OperandStack, limit_);
 };
 
 }  // namespace b9
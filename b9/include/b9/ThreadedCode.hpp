@@ -0,0 +1,28 @@
+#if !defined(B9_THREADEDCODE_HPP_)
+#define B9_THREADEDCODE_HPP_
+
+#include <b9/instructions.hpp>
+
+#include <vector>
+
+namespace b9 {
+
+/// An Instruction, pre-decoded for the threaded interpreter. The bytecode is
+/// replaced by the address of its handler, and the parameter is sign extended
+/// ahead of time, so dispatch is a single indirect jump. Superinstructions use
+/// the second operand. Object accesses and calls keep their bytecode index
+/// there, to find their inline cache or call counter.
+struct ThreadedInstruction {
+  const void *handler;
+  Parameter operand;
+  Parameter operand2;
+};
+
+/// The threaded form of a function's instructions. When superinstructions are
+/// fused, several Instructions share one ThreadedInstruction, and jump offsets
+/// are relative to the threaded code.
+using ThreadedCode = std::vector<ThreadedInstruction>;
+
+}  // namespace b9
+
+#endif  // B9_THREADEDCODE_HPP_
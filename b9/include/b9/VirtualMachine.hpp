@@ -1,11 +1,18 @@
 #ifndef B9_VIRTUALMACHINE_HPP_
 #define B9_VIRTUALMACHINE_HPP_
 
+#include <b9/CompileQueue.hpp>
+#include <b9/InlineCache.hpp>
+#include <b9/JitStats.hpp>
 #include <b9/OperandStack.hpp>
+#include <b9/ThreadedCode.hpp>
+#include <b9/WorkerPool.hpp>
 #include <b9/compiler/Compiler.hpp>
 #include <b9/instructions.hpp>
 #include <b9/module.hpp>
+#include <b9/optimize.hpp>
 
+#include <OMR/Infra/Span.hpp>
 #include <OMR/Om/Allocator.inl.hpp>
 #include <OMR/Om/Context.inl.hpp>
 #include <OMR/Om/Map.inl.hpp>
@@ -14,15 +21,21 @@
 #include <OMR/Om/ObjectMap.inl.hpp>
 #include <OMR/Om/RootRef.inl.hpp>
 #include <OMR/Om/Runtime.hpp>
+#include <OMR/Om/Safepoint.hpp>
 #include <OMR/Om/TransitionSet.inl.hpp>
 #include <OMR/Om/Traverse.hpp>
 #include <OMR/Om/Value.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <vector>
 
 extern "C" {
@@ -38,13 +51,42 @@ namespace Om = ::OMR::Om;
 class Compiler;
 class ExecutionContext;
 class VirtualMachine;
+struct ContextPool;
+struct WarmProfile;
 
 struct Config {
   std::size_t maxInlineDepth = 0;  //< The JIT's max inline depth
-  bool jit = false;                //< Enable the JIT
+  std::size_t inlineBudget = 256;  //< Most bytecodes inlined into a function
+  std::size_t inlineSize = 24;     //< Largest callee inlined anywhere
+  std::size_t inlineHotSize = 96;  //< Largest callee inlined at a hot call
+  bool verify = true;              //< Verify modules, else check as they run
+  bool optimize = false;           //< Optimize the bytecode on load, verifies
+  bool tailCalls = false;          //< Rewrite tail calls on load, verifies
+  std::size_t stackSize = OperandStack::DEFAULT_SIZE;  //< In values
+  std::size_t batchThreads = 0;    //< runBatch's workers, 0 for one per core
+  std::size_t compileThreads = 1;  //< generateAllCode's, 0 for one per core
+  bool jit = false;                //< Enable the JIT, which requires verify
+  bool tiered = false;             //< JIT functions when they get hot
+  std::size_t invocationThreshold = 1000;  //< Calls before a function is hot
+  std::size_t backedgeThreshold = 10000;   //< Backedges before it is hot
+  bool asyncCompile = false;       //< Compile hot functions in the background
+  std::size_t compileQueueLimit = 64;  //< Most functions waiting to compile
+  bool osr = false;                //< Move hot interpreted loops into the JIT
   bool directCall = false;         //< Enable direct JIT to JIT calls
   bool passParam = false;          //< Pass arguments in CPU registers
   bool lazyVmState = false;        //< Simulate the VM state
+  bool speculate = false;          //< Keep integer variables unboxed
+  std::size_t deoptLimit = 16;     //< Deopts before a function is recompiled
+  bool recompile = false;          //< Recompile hot jitted functions
+  std::size_t recompileThreshold = 10000;  //< Calls of jitted code till hot
+  std::size_t hotInlineDepth = 4;     //< Max inline depth of hot functions
+  std::size_t hotInlineBudget = 1024;  //< Bytecodes inlined into hot functions
+  bool inlineCache = true;         //< Cache object slot lookups
+  bool quicken = false;            //< Quicken the switch interpreter's code
+  bool threaded = false;           //< Use the threaded-code interpreter,
+                                   //< which requires verify
+  bool fuse = true;                //< Fuse superinstructions when threaded
+  bool frameStack = false;         //< Don't recurse on calls when threaded
   bool debug = false;              //< Enable debug code
   bool verbose = false;            //< Enable verbose printing and tracing
 };
@@ -53,9 +95,35 @@ inline std::ostream &operator<<(std::ostream &out, const Config &cfg) {
   out << std::boolalpha;
   out << "Mode:         " << (cfg.jit ? "JIT" : "Interpreter") << std::endl
       << "Inline depth: " << cfg.maxInlineDepth << std::endl
+      << "inline total: " << cfg.inlineBudget << std::endl
+      << "inline size:  " << cfg.inlineSize << std::endl
+      << "inline hot:   " << cfg.inlineHotSize << std::endl
+      << "verify:       " << cfg.verify << std::endl
+      << "optimize:     " << cfg.optimize << std::endl
+      << "tail calls:   " << cfg.tailCalls << std::endl
+      << "stack size:   " << cfg.stackSize << std::endl
+      << "batch pool:   " << cfg.batchThreads << std::endl
+      << "plan threads: " << cfg.compileThreads << std::endl
+      << "tiered:       " << cfg.tiered << std::endl
+      << "invocations:  " << cfg.invocationThreshold << std::endl
+      << "backedges:    " << cfg.backedgeThreshold << std::endl
+      << "async:        " << cfg.asyncCompile << std::endl
+      << "queue limit:  " << cfg.compileQueueLimit << std::endl
+      << "osr:          " << cfg.osr << std::endl
       << "directcall:   " << cfg.directCall << std::endl
       << "passparam:    " << cfg.passParam << std::endl
       << "lazyvmstate:  " << cfg.lazyVmState << std::endl
+      << "speculate:    " << cfg.speculate << std::endl
+      << "deopt limit:  " << cfg.deoptLimit << std::endl
+      << "recompile:    " << cfg.recompile << std::endl
+      << "recompile at: " << cfg.recompileThreshold << std::endl
+      << "hot depth:    " << cfg.hotInlineDepth << std::endl
+      << "hot budget:   " << cfg.hotInlineBudget << std::endl
+      << "inlinecache:  " << cfg.inlineCache << std::endl
+      << "quicken:      " << cfg.quicken << std::endl
+      << "threaded:     " << cfg.threaded << std::endl
+      << "fuse:         " << cfg.fuse << std::endl
+      << "framestack:   " << cfg.frameStack << std::endl
       << "debug:        " << cfg.debug;
   out << std::noboolalpha;
   return out;
@@ -65,36 +133,527 @@ struct BadFunctionCallException : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+/// Thrown by the VirtualMachine's constructor when the Config's options can't
+/// be used together.
+struct ConfigException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
 extern "C" typedef Om::RawValue (*JitFunction)(void *executionContext, ...);
 
+/// In passParam mode, jitted code takes at most this many of a function's
+/// arguments as native parameters, after the ExecutionContext: enough to fill
+/// the argument registers. The last arguments are passed natively. The ones
+/// before them are left on the operand stack, and the callee pops them when it
+/// returns, so functions of any arity can be called.
+constexpr std::size_t MAX_REGISTER_ARGS = 5;
+
+/// The number of a function's arguments passed as native parameters.
+inline std::size_t registerArgCount(std::size_t nargs) {
+  return std::min(nargs, MAX_REGISTER_ARGS);
+}
+
+/// How a function is being run.
+enum class Tier {
+  INTERPRETED,  //< Not compiled (yet)
+  QUEUED,       //< Waiting for the background compiler, still interpreted
+  COMPILED,     //< Calls go to jitted code
+  FAILED,       //< The JIT failed, the function stays interpreted
+};
+
+inline const char *toString(Tier tier) {
+  switch (tier) {
+    case Tier::INTERPRETED:
+      return "interpreted";
+    case Tier::QUEUED:
+      return "queued";
+    case Tier::COMPILED:
+      return "compiled";
+    case Tier::FAILED:
+      return "failed";
+    default:
+      return "unknown";
+  }
+}
+
+inline std::ostream &operator<<(std::ostream &out, Tier tier) {
+  return out << toString(tier);
+}
+
+/// A function's execution counters and current tier. The invocation and
+/// backedge counters only run in tiered mode, while the function is
+/// interpreted or queued. Every thread running the function bumps its
+/// counters without a lock, so they are relaxed atomics. The tier is only
+/// changed under the VM's compile lock, but read without it.
+struct FunctionProfile {
+  std::atomic<Tier> tier{Tier::INTERPRETED};
+  std::atomic<std::size_t> invocations{0};  //< Calls into the interpreter
+  std::atomic<std::size_t> backedges{0};  //< Backward jumps in the interpreter
+  std::atomic<std::size_t> deopts{0};     //< Failed speculations in its code
+  std::atomic<bool> loopQueued{false};    //< Queued at backedge priority
+  std::atomic<bool> deoptQueued{false};   //< Queued to recompile after deopts
+  std::atomic<bool> hotRequested{false};  //< Its baseline code got hot
+  std::atomic<bool> hotQueued{false};     //< Queued to recompile when hot
+  CompileLevel level = CompileLevel::BASELINE;  //< Of its jitted code
+};
+
+/// Why the JIT did or didn't inline a call. Every call site a compile can
+/// reach gets one, when the compile's inlining is planned, if inlining is
+/// enabled.
+struct InlineDecision {
+  std::string caller;
+  std::size_t bytecodeIndex = 0;  //< Of the call, in the caller
+  std::string callee;
+  std::size_t depth = 0;   //< Of the caller's body, 0 for the compiled function
+  std::size_t size = 0;    //< The callee's bytecodes
+  std::size_t calls = 0;   //< Calls the interpreter made at this site
+  double frequency = 0;    //< Calls per call of the compiled function
+  bool inlined = false;
+  const char *reason = "";
+};
+
+inline std::ostream &operator<<(std::ostream &out,
+                                const InlineDecision &decision) {
+  out << "Inline: " << decision.caller << "@" << decision.bytecodeIndex
+      << " -> " << decision.callee << " depth: " << decision.depth
+      << " size: " << decision.size << " calls: " << decision.calls
+      << " frequency: " << decision.frequency << " "
+      << (decision.inlined ? "inlined" : "not inlined") << " ("
+      << decision.reason << ")";
+  return out;
+}
+
+/// An instruction of quick code. Threads rewrite quick code while others run
+/// it, so every instruction is read and written as one atomic word.
+using QuickInstruction = std::atomic<RawInstruction>;
+
+/// The callee of a QUICK_FUNCTION_CALL, resolved when it was quickened.
+struct QuickCall {
+  std::size_t functionIndex;
+  std::size_t nargs;
+  JitFunction entry;
+};
+
+/// How many instructions were quickened, and how many of those fell back to
+/// their generic form.
+struct QuickenStats {
+  std::size_t quickened = 0;
+  std::size_t dequickened = 0;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const QuickenStats &stats) {
+  out << "Quickened:    " << stats.quickened << std::endl
+      << "Dequickened:  " << stats.dequickened;
+  return out;
+}
+
+/// What a VirtualMachine::runBatch did, and how long it took.
+struct BatchStats {
+  std::size_t calls = 0;
+  std::size_t threads = 0;  //< Workers, counting the calling thread
+  std::size_t steals = 0;   //< Times a worker took over another's calls
+  std::chrono::duration<double, std::milli> time{0};
+
+  /// Calls per second.
+  double throughput() const {
+    return time.count() == 0 ? 0 : calls / time.count() * 1000;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const BatchStats &stats) {
+  out << "Batch calls:  " << stats.calls << std::endl
+      << "Threads:      " << stats.threads << std::endl
+      << "Steals:       " << stats.steals << std::endl
+      << "Batch time:   " << stats.time.count() << " ms" << std::endl
+      << "Throughput:   " << stats.throughput() << " calls/s";
+  return out;
+}
+
+/// How generateAllCode spent its time.
+struct GenerateStats {
+  using Duration = std::chrono::duration<double, std::milli>;
+
+  std::size_t functions = 0;
+  Duration time{0};         //< From the start until the last code was installed
+  Duration compileTime{0};  //< Spent in the JIT, one function at a time
+  std::vector<Duration> threadTimes;         //< Spent planning, by worker
+  std::vector<std::size_t> threadFunctions;  //< Planned, by worker
+};
+
+inline std::ostream &operator<<(std::ostream &out,
+                                const GenerateStats &stats) {
+  out << "Compiled:     " << stats.functions << " functions in "
+      << stats.time.count() << " ms" << std::endl
+      << "JIT time:     " << stats.compileTime.count() << " ms";
+  for (std::size_t i = 0; i < stats.threadTimes.size(); i++) {
+    out << std::endl
+        << "Thread " << i << ":     " << stats.threadFunctions[i]
+        << " planned in " << stats.threadTimes[i].count() << " ms";
+  }
+  return out;
+}
+
+/// An ExecutionContext leased from a VirtualMachine's pool. The context is
+/// reset and goes back to the pool when the lease ends. Leases can't be
+/// copied, and must end on the thread that took them.
+class ContextLease {
+ public:
+  ContextLease(VirtualMachine &virtualMachine, ExecutionContext *context)
+      : virtualMachine_(&virtualMachine), context_(context) {}
+
+  ContextLease(ContextLease &&other) noexcept
+      : virtualMachine_(other.virtualMachine_), context_(other.context_) {
+    other.context_ = nullptr;
+  }
+
+  ContextLease(const ContextLease &) = delete;
+
+  /// End this lease, and take over `other`'s.
+  ContextLease &operator=(ContextLease &&other) noexcept;
+
+  ContextLease &operator=(const ContextLease &) = delete;
+
+  ~ContextLease() noexcept;
+
+  ExecutionContext &operator*() const { return *context_; }
+
+  ExecutionContext *operator->() const { return context_; }
+
+  ExecutionContext *get() const { return context_; }
+
+ private:
+  VirtualMachine *virtualMachine_;
+  ExecutionContext *context_;
+};
+
+/// A VirtualMachine can run on many threads at once. Every thread runs with
+/// its own ExecutionContext, leased from its pool, so it has its own operand
+/// stack, OMR VM thread and allocation TLH. The module's code and the
+/// compiled code are shared. Compilation is serialized, and compiled code is
+/// published atomically, so a thread sees either no code or finished code.
+/// Collections stop every thread running in the VM at a safepoint: on calls
+/// and backward jumps in the interpreters.
 class VirtualMachine {
  public:
   VirtualMachine(OMR::Om::ProcessRuntime &runtime, const Config &cfg);
 
   ~VirtualMachine() noexcept;
 
-  /// Load a module into the VM.
+  /// Lease an ExecutionContext from the calling thread's pool. The pool is
+  /// thread local, so leases take no lock. Contexts are only created when
+  /// the pool is empty, so after warm up, a lease costs finding the VM's
+  /// pool among the thread's, and a vector pop. Nested leases on one thread
+  /// get separate contexts. A thread's pool is freed when the thread exits,
+  /// or when the VM is destroyed, whichever comes first.
+  ContextLease leaseContext();
+
+  /// Put a leased context back in the calling thread's pool, after resetting
+  /// it. Called when a ContextLease ends.
+  void releaseContext(ExecutionContext *context) noexcept;
+
+  /// The number of contexts the VM has created, on all threads.
+  std::size_t contextCount() const;
+
+  /// Load a module into the VM. When verification is enabled, the module is
+  /// verified first, and a VerifyException is thrown if it fails. With
+  /// Config::optimize or Config::tailCalls, a copy of the module is loaded,
+  /// with its bytecode optimized, or its calls in tail position rewritten
+  /// into TAIL_CALLs. Both need the verifier's stack depths, so they verify
+  /// the module whatever the config, and throw a VerifyException even when
+  /// verification is disabled.
   void load(std::shared_ptr<const Module> module);
 
+  /// True if the loaded module passed the verifier. Verified code runs in the
+  /// switch interpreter without runtime checks.
+  bool verified() const { return !maxStackDepths_.empty(); }
+
+  /// The most values a function keeps on the operand stack, not counting its
+  /// arguments and registers. Only available when the module is verified.
+  std::size_t getMaxStackDepth(std::size_t functionIndex) const {
+    return maxStackDepths_[functionIndex];
+  }
+
+  /// The operand stack space a call to the function needs, not counting its
+  /// arguments, which the caller pushed. Unverified code has no bound on its
+  /// operand stack, so this is only its registers, and the checked
+  /// interpreter reserves room for every push as it goes.
+  std::size_t getFrameSize(std::size_t functionIndex) const {
+    return frameSizes_[functionIndex];
+  }
+
+  /// How long the verifier took on the loaded module.
+  std::chrono::duration<double, std::micro> verifyTime() const {
+    return verifyTime_;
+  }
+
+  /// What the optimizer did to the loaded module. Empty unless
+  /// Config::optimize is set.
+  const OptimizeStats &optimizeStats() const { return optimizeStats_; }
+
   StackElement run(const std::size_t index,
                    const std::vector<StackElement> &usrArgs);
 
   StackElement run(const std::string &name,
                    const std::vector<StackElement> &usrArgs);
 
+  /// Call a function once for every argument tuple, spread over a pool of
+  /// worker threads. `args` holds the tuples back to back, nargs values each,
+  /// in the order run takes them. The result of call i goes in `results[i]`,
+  /// so there are as many calls as results. Workers keep their context
+  /// between calls, and steal calls from each other when they run out.
+  /// Throws a BadFunctionCallException if the sizes don't match. If a call
+  /// throws, the batch stops early and the first exception is rethrown.
+  /// Batches run one at a time, and a batch can't start another.
+  BatchStats runBatch(std::size_t functionIndex,
+                      OMR::Infra::Span<const StackElement> args,
+                      OMR::Infra::Span<StackElement> results);
+
   const FunctionDef *getFunction(std::size_t index);
 
   PrimitiveFunction *getPrimitive(std::size_t index);
 
   JitFunction getJitAddress(std::size_t functionIndex);
 
+  /// Install a function's code, or remove it with nullptr. Patches the
+  /// function's dispatch slot too.
   void setJitAddress(std::size_t functionIndex, JitFunction value);
 
-  std::size_t getFunctionCount();
+  /// Where jitted code calls a function from. Holds the function's code once
+  /// it's compiled, and until then a trampoline that interprets it, so
+  /// callers compiled first still pick up the code. Doesn't move while the
+  /// module is loaded.
+  std::atomic<void *> *getDispatchSlot(std::size_t functionIndex) {
+    return &dispatchSlots_[functionIndex];
+  }
 
-  JitFunction generateCode(const std::size_t functionIndex);
+  /// The function's code, translated for the threaded interpreter. Only
+  /// available when the threaded interpreter is enabled.
+  const ThreadedInstruction *getThreadedCode(std::size_t functionIndex);
+
+  std::size_t getFunctionCount();
 
-  void generateAllCode();
+  /// Compile a function at `level`. Returns nullptr, after printing a
+  /// warning, if it fails.
+  JitFunction generateCode(const std::size_t functionIndex,
+                           CompileLevel level = CompileLevel::BASELINE);
+
+  /// Compile every function before anything runs, in order. First the
+  /// inlining of every compile is planned, on compileThreads threads. The
+  /// JIT isn't reentrant, so then the functions are compiled one at a time,
+  /// and each is installed before the next is compiled. A plan inlines the
+  /// callees compiled before its function, as compiling in order without
+  /// plans would. If a function fails to compile, the functions before it
+  /// are installed, and its CompilationException is thrown.
+  GenerateStats generateAllCode();
+
+  /// The tier the function is running in.
+  Tier getTier(std::size_t functionIndex) const {
+    return profiles_[functionIndex].tier;
+  }
+
+  const FunctionProfile &getProfile(std::size_t functionIndex) const {
+    return profiles_[functionIndex];
+  }
+
+  /// Record that an interpreted function stored something other than an
+  /// integer in a variable. Only recorded when speculating, and without a
+  /// lock.
+  void recordNonInteger(std::size_t functionIndex, std::size_t varIndex) {
+    nonIntegerVars_[functionIndex][varIndex].store(1,
+                                                    std::memory_order_relaxed);
+  }
+
+  /// True unless the variable has held something other than an integer, as
+  /// far as the interpreter and the deopts have seen. Speculating JIT code
+  /// keeps these variables unboxed.
+  bool isIntegerVar(std::size_t functionIndex, std::size_t varIndex) const {
+    return !nonIntegerVars_[functionIndex][varIndex].load(
+        std::memory_order_relaxed);
+  }
+
+  /// Recompile a function that stayed hot in jitted code at the hot level,
+  /// and install the code, or queue it to be recompiled with asyncCompile.
+  /// Called by the function's baseline code every time its call counter
+  /// reaches the recompile threshold, but only the first call asks for the
+  /// compile, so a failed one isn't tried again. The baseline code is left
+  /// in place, for the calls still running it. Returns true if the hot code
+  /// was compiled or queued by this call.
+  bool recompileHot(std::size_t functionIndex);
+
+  /// The call counter of a function's baseline code. Bumped and reset by the
+  /// code, without a lock. Doesn't move while the module is loaded.
+  std::size_t *getJitCounter(std::size_t functionIndex) {
+    return &jitCounters_[functionIndex];
+  }
+
+  /// Count a deopt of the function's jitted code. Every deoptLimit deopts,
+  /// the function is recompiled with what the deopts taught its feedback, or
+  /// queued to be recompiled with asyncCompile.
+  void countDeopt(std::size_t functionIndex, std::size_t bytecodeIndex);
+
+  /// Count a call to an interpreted function. In tiered mode, the function is
+  /// compiled once it reaches the invocation threshold, or queued for the
+  /// background compiler with asyncCompile.
+  void countInvocation(std::size_t functionIndex);
+
+  /// Count a backward jump taken in an interpreted function. In tiered mode,
+  /// the function is compiled once it reaches the backedge threshold, or
+  /// queued ahead of the called functions with asyncCompile. The running
+  /// invocation stays in the interpreter.
+  void countBackedge(std::size_t functionIndex);
+
+  /// Compile an interpreted function and install its code, so later calls
+  /// run jitted code. Returns true if the function is compiled. A function
+  /// that fails to compile is not retried. Throws a ConfigException without
+  /// the JIT.
+  bool tierUp(std::size_t functionIndex);
+
+  /// Queue an interpreted function for the background compiler. The function
+  /// is interpreted until its code is published. Returns false if the queue
+  /// is full, in which case it's queued again when it's next counted.
+  bool queueCompile(std::size_t functionIndex, CompilePriority priority);
+
+  /// Wait for the background compiler to finish every queued function.
+  void drainCompileQueue();
+
+  /// Counts and timings of the background compiler.
+  CompileStats compileStats() const;
+
+  /// The loaded module's function counters and the JIT config, to warm up a
+  /// later run with warmUp.
+  WarmProfile recordProfile() const;
+
+  /// Compile the functions that got hot in a profiled run, before anything
+  /// calls them. Functions are matched by name, and ones the module doesn't
+  /// have are skipped. Loops go first, then the most called. With
+  /// asyncCompile, they are queued for the background compiler instead, and
+  /// this doesn't wait. The hot functions' counters start from the recorded
+  /// counts, so the next profile still has them. Returns the number compiled
+  /// or queued. Throws a ConfigException without the JIT, and a
+  /// ProfileException if the profile's JIT options aren't this VM's.
+  std::size_t warmUp(const WarmProfile &profile);
+
+  /// Record an inlining decision of the JIT. Printed when verbose.
+  void logInlineDecision(const InlineDecision &decision);
+
+  /// Every inlining decision the JIT has made, in order.
+  std::vector<InlineDecision> inlineDecisions() const;
+
+  /// Record a compile of the JIT, whether or not it worked.
+  void logCompile(const CompileRecord &record);
+
+  /// Every compile of the JIT, in order, including OSR entries and
+  /// recompiles.
+  std::vector<CompileRecord> jitStats() const;
+
+  /// The OSR entry of a function at a bytecode index, compiled on first use.
+  /// `stackDepth` is the depth of the function's operand stack at that index.
+  /// Returns nullptr if there is no entry, or it failed to compile.
+  OsrFunction getOsrEntry(std::size_t functionIndex, std::size_t bytecodeIndex,
+                          std::size_t stackDepth);
+
+  /// The inline cache of the PUSH_FROM_OBJECT or POP_INTO_OBJECT at
+  /// `bytecodeIndex`. Null when inline caches are disabled.
+  InlineCache *getInlineCache(std::size_t functionIndex,
+                              std::size_t bytecodeIndex) {
+    if (!cfg_.inlineCache) {
+      return nullptr;
+    }
+    return &inlineCaches_[siteIndices_[functionIndex][bytecodeIndex]];
+  }
+
+  /// Count a call made by an interpreted function, by the bytecode index of
+  /// its FUNCTION_CALL or TAIL_CALL. Only counted in tiered mode. Like the
+  /// function counters, the call counters are relaxed atomics, bumped by
+  /// every thread without a lock.
+  void countCall(std::size_t functionIndex, std::size_t bytecodeIndex) {
+    callCounts_[siteIndices_[functionIndex][bytecodeIndex]].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+  /// The number of times the interpreter made the call at `bytecodeIndex`.
+  std::size_t getCallCount(std::size_t functionIndex,
+                           std::size_t bytecodeIndex) const {
+    return callCounts_[siteIndices_[functionIndex][bytecodeIndex]].load(
+        std::memory_order_relaxed);
+  }
+
+  /// The function's instructions as the switch interpreter runs them when
+  /// quickening, indexed like the function's. Other threads rewrite them
+  /// while it runs, so each is loaded atomically. Only available when
+  /// quickening is enabled.
+  const QuickInstruction *getQuickCode(std::size_t functionIndex) const {
+    return quickFunctions_[functionIndex].data();
+  }
+
+  /// The instruction at `bytecodeIndex` of the function's quick code.
+  Instruction getQuickInstruction(std::size_t functionIndex,
+                                  std::size_t bytecodeIndex) const {
+    return Instruction(getQuickCode(functionIndex)[bytecodeIndex].load(
+        std::memory_order_acquire));
+  }
+
+  /// Rewrite the PUSH_FROM_OBJECT or POP_INTO_OBJECT at `bytecodeIndex` into
+  /// its quick form, which only handles objects with `entry.map`.
+  void quickenObjectAccess(std::size_t functionIndex,
+                           std::size_t bytecodeIndex,
+                           const InlineCacheEntry &entry);
+
+  /// Rewrite the FUNCTION_CALL at `bytecodeIndex` into a direct call of the
+  /// callee's jitted code. Does nothing if the callee isn't compiled.
+  void quickenCall(std::size_t functionIndex, std::size_t bytecodeIndex);
+
+  /// Put back the generic form of a quick instruction whose guard failed. It
+  /// is never quickened again, so a polymorphic site doesn't keep flipping.
+  void dequicken(std::size_t functionIndex, std::size_t bytecodeIndex);
+
+  /// Keep the maps of an entry that jitted code guards on alive. Its inline
+  /// cache drops the entry if it turns megamorphic, but the code doesn't.
+  void pinJitSlot(const InlineCacheEntry &entry) {
+    std::lock_guard<std::mutex> lock(jitSlotsMutex_);
+    jitSlots_.push_back(entry);
+  }
+
+  const InlineCacheEntry &getQuickSlot(Parameter index) const {
+    return quickSlots_[index];
+  }
+
+  const QuickCall &getQuickCall(Parameter index) const {
+    return quickCalls_[index];
+  }
+
+  const QuickenStats &quickenStats() const { return quickenStats_; }
+
+  /// Hit, miss and state totals of all the inline caches.
+  InlineCacheStats inlineCacheStats() const;
+
+  /// The map of new objects. Sharing it makes objects built the same way
+  /// share maps, which is what inline caches are keyed on.
+  Om::ObjectMap *emptyObjectMap(Om::Context &cx);
+
+  template <typename VisitorT>
+  void visit(Om::Context &cx, VisitorT &visitor) {
+    auto emptyObjectMap = emptyObjectMap_.load(std::memory_order_relaxed);
+    if (emptyObjectMap != nullptr) {
+      visitor.rootEdge(cx, this, (Om::Cell *)emptyObjectMap);
+    }
+    for (auto &cache : inlineCaches_) {
+      cache.visit(cx, visitor);
+    }
+    for (auto &slot : quickSlots_) {
+      visitor.rootEdge(cx, this, (Om::Cell *)slot.map);
+      if (slot.transition != nullptr) {
+        visitor.rootEdge(cx, this, (Om::Cell *)slot.transition);
+      }
+    }
+    std::lock_guard<std::mutex> lock(jitSlotsMutex_);
+    for (auto &slot : jitSlots_) {
+      visitor.rootEdge(cx, this, (Om::Cell *)slot.map);
+      if (slot.transition != nullptr) {
+        visitor.rootEdge(cx, this, (Om::Cell *)slot.transition);
+      }
+    }
+  }
 
   const std::string& getString(int index);
 
@@ -109,6 +668,29 @@ class VirtualMachine {
   const Config &config() { return cfg_; }
 
  private:
+  /// Compile a function and publish its code, unless it was already
+  /// compiled, or failed. Called with compileMutex_ held.
+  bool compileLocked(std::size_t functionIndex);
+
+  /// Recompile a jitted function at `level` and publish its code. The old
+  /// code may still be running, so it's left in place, and stays installed
+  /// if the compile fails. Called with compileMutex_ held.
+  bool recompileLocked(std::size_t functionIndex, CompileLevel level);
+
+  /// Run a request of the background compiler: a recompile if one was
+  /// queued for the function, otherwise its first compile. Called with
+  /// compileMutex_ held.
+  bool compileQueued(std::size_t functionIndex);
+
+  /// The trampoline that interprets a function with `nargs` arguments, when
+  /// called through a dispatch slot.
+  void *dispatchTrampoline(std::size_t nargs) const;
+
+  /// Install a quick instruction, so that threads running the quick code
+  /// without a lock see its slot or call.
+  static void publishQuick(QuickInstruction &instruction, Instruction quick);
+
+  // The verifier's PRIMITIVE_COUNT and primitiveEffect must match this table.
   static constexpr PrimitiveFunction *const primitives_[] = {
       b9_prim_print_string, b9_prim_print_number, b9_prim_print_stack};
 
@@ -116,9 +698,69 @@ class VirtualMachine {
   OMR::Om::MemoryManager memoryManager_;
   std::shared_ptr<Compiler> compiler_;
   std::shared_ptr<const Module> module_;
-  std::vector<JitFunction> compiledFunctions_;
+  std::vector<std::atomic<JitFunction>> compiledFunctions_;
+  std::vector<std::atomic<void *>> dispatchSlots_;
+  std::vector<std::size_t> jitCounters_;
+  std::vector<std::size_t> maxStackDepths_;
+  std::vector<std::size_t> frameSizes_;
+  std::chrono::duration<double, std::micro> verifyTime_{0};
+  OptimizeStats optimizeStats_;
+  std::vector<FunctionProfile> profiles_;
+  // Threads record variables while others read them, like dequickened_.
+  std::vector<std::vector<std::atomic<std::uint8_t>>> nonIntegerVars_;
+  std::vector<std::map<std::size_t, OsrFunction>> osrEntries_;
+  std::vector<InlineCache> inlineCaches_;
+  // An object access's inline cache, or a call's counter, by bytecode index.
+  std::vector<std::vector<std::uint32_t>> siteIndices_;
+  std::vector<std::atomic<std::size_t>> callCounts_;
+  std::atomic<Om::ObjectMap *> emptyObjectMap_{nullptr};
+  std::vector<std::vector<QuickInstruction>> quickFunctions_;
+  std::vector<std::vector<std::atomic<bool>>> dequickened_;
+  std::vector<InlineCacheEntry> quickSlots_;
+  std::vector<QuickCall> quickCalls_;
+  QuickenStats quickenStats_;
+  // Grows while other threads run, since the compiler may be in the
+  // background, so it's locked.
+  std::mutex jitSlotsMutex_;
+  std::vector<InlineCacheEntry> jitSlots_;
+  std::vector<ThreadedCode> threadedFunctions_;
+  std::mutex compileMutex_;  //< Held while compiling, and for osrEntries_
+  std::mutex quickenMutex_;  //< Held while rewriting the quick code
+  std::mutex batchMutex_;    //< Held while running a batch
+  mutable std::mutex inlineLogMutex_;
+  std::vector<InlineDecision> inlineLog_;
+  mutable std::mutex compileLogMutex_;
+  std::vector<CompileRecord> compileLog_;
+  std::unique_ptr<WorkerPool> batchPool_;  //< Started by the first batch
+  std::unique_ptr<CompileQueue> compileQueue_;  //< With asyncCompile
+
+  /// The calling thread's pool, created by its first lease.
+  ContextPool &threadContextPool();
+
+  const std::size_t id_;  //< Never reused, unlike the VM's address
+  std::mutex contextPoolsMutex_;
+  std::vector<std::weak_ptr<ContextPool>> contextPools_;  //< Of every thread
+  std::atomic<std::size_t> contextCount_{0};
 };
 
+inline ContextLease &ContextLease::operator=(ContextLease &&other) noexcept {
+  if (this != &other) {
+    if (context_ != nullptr) {
+      virtualMachine_->releaseContext(context_);
+    }
+    virtualMachine_ = other.virtualMachine_;
+    context_ = other.context_;
+    other.context_ = nullptr;
+  }
+  return *this;
+}
+
+inline ContextLease::~ContextLease() noexcept {
+  if (context_ != nullptr) {
+    virtualMachine_->releaseContext(context_);
+  }
+}
+
 typedef StackElement (*Interpret)(ExecutionContext *context,
                                   const std::size_t functionIndex);
 
@@ -142,8 +784,55 @@ Om::RawValue interpret_2(ExecutionContext *context,
 Om::RawValue interpret_3(ExecutionContext *context,
                          const std::size_t functionIndex, Om::RawValue p1,
                          Om::RawValue p2, Om::RawValue p3);
+Om::RawValue interpret_4(ExecutionContext *context,
+                         const std::size_t functionIndex, Om::RawValue p1,
+                         Om::RawValue p2, Om::RawValue p3, Om::RawValue p4);
+Om::RawValue interpret_5(ExecutionContext *context,
+                         const std::size_t functionIndex, Om::RawValue p1,
+                         Om::RawValue p2, Om::RawValue p3, Om::RawValue p4,
+                         Om::RawValue p5);
 
 void primitive_call(ExecutionContext *context, Parameter value);
+
+// The initial targets of dispatch slots. jit_dispatch_n takes the last n
+// arguments, and interprets the function in the context's dispatchIndex.
+Om::RawValue jit_dispatch_0(ExecutionContext *context);
+Om::RawValue jit_dispatch_1(ExecutionContext *context, Om::RawValue p1);
+Om::RawValue jit_dispatch_2(ExecutionContext *context, Om::RawValue p1,
+                            Om::RawValue p2);
+Om::RawValue jit_dispatch_3(ExecutionContext *context, Om::RawValue p1,
+                            Om::RawValue p2, Om::RawValue p3);
+Om::RawValue jit_dispatch_4(ExecutionContext *context, Om::RawValue p1,
+                            Om::RawValue p2, Om::RawValue p3,
+                            Om::RawValue p4);
+Om::RawValue jit_dispatch_5(ExecutionContext *context, Om::RawValue p1,
+                            Om::RawValue p2, Om::RawValue p3,
+                            Om::RawValue p4, Om::RawValue p5);
+
+// The slow paths of jitted object bytecodes
+Om::RawValue jit_new_object(ExecutionContext *context);
+Om::RawValue jit_push_from_object(ExecutionContext *context,
+                                  Om::RawValue object, Parameter slotId,
+                                  InlineCache *cache);
+void jit_pop_into_object(ExecutionContext *context, Om::RawValue object,
+                         Om::RawValue value, Parameter slotId,
+                         InlineCache *cache);
+void jit_system_collect(ExecutionContext *context);
+
+// Called by jitted loops when another thread is stopping the world
+void jit_safepoint(ExecutionContext *context);
+
+// Called by baseline code that got hot
+void jit_recompile(ExecutionContext *context, std::size_t functionIndex);
+
+// Called by jitted code whose frame doesn't fit on the operand stack
+void jit_stack_overflow();
+
+// Leave speculating jitted code for the interpreter
+Om::RawValue jit_deoptimize(ExecutionContext *context,
+                            std::size_t functionIndex,
+                            std::size_t bytecodeIndex,
+                            const Om::RawValue *vars, StackElement *frame);
 }
 
 #endif  // B9_VIRTUALMACHINE_HPP_
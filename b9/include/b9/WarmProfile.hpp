@@ -0,0 +1,54 @@
+#if !defined(B9_WARMPROFILE_HPP_)
+#define B9_WARMPROFILE_HPP_
+
+#include <b9/VirtualMachine.hpp>
+
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+struct ProfileException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// A function's counters at the end of a profiled run.
+struct FunctionRecord {
+  std::string name;
+  std::size_t invocations = 0;
+  std::size_t backedges = 0;
+};
+
+/// Which functions got hot in a run, so the next run can compile them before
+/// it starts. Only tiered runs count calls and backedges, so only they make
+/// useful profiles.
+struct WarmProfile {
+  /// The config of the profiled run. Only the JIT options are recorded.
+  Config config;
+  std::vector<FunctionRecord> functions;
+
+  /// True if the function reached a threshold of the profiled run.
+  bool hot(const FunctionRecord &function) const {
+    return function.invocations >= config.invocationThreshold ||
+           function.backedges >= config.backedgeThreshold;
+  }
+};
+
+/// The key of the first JIT option recorded in the profile that `cfg` has set
+/// differently, or nullptr if they all match.
+const char *configMismatch(const WarmProfile &profile, const Config &cfg);
+
+/// Write a profile as text: a version line, one line per JIT option, and one
+/// line per function.
+void writeProfile(std::ostream &out, const WarmProfile &profile);
+
+/// Read a profile written by writeProfile. Throws a ProfileException if it's
+/// malformed.
+WarmProfile readProfile(std::istream &in);
+
+}  // namespace b9
+
+#endif  // B9_WARMPROFILE_HPP_
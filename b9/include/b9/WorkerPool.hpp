@@ -0,0 +1,109 @@
+#if !defined(B9_WORKERPOOL_HPP_)
+#define B9_WORKERPOOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace b9 {
+
+/// A fixed set of worker threads that all run the same task, then wait for
+/// the next one. The threads live as long as the pool, so anything they keep
+/// per thread, like their pooled ExecutionContexts, survives between tasks.
+class WorkerPool {
+ public:
+  /// A task. Called once on every worker, with the worker's index.
+  using Task = std::function<void(std::size_t worker)>;
+
+  /// A pool of `size` workers. The thread that calls run is worker 0, so
+  /// only size - 1 threads are started.
+  explicit WorkerPool(std::size_t size);
+
+  WorkerPool(const WorkerPool &) = delete;
+
+  ~WorkerPool() noexcept;
+
+  std::size_t size() const { return threads_.size() + 1; }
+
+  /// Run `task` on every worker, and wait for all of them. If the task
+  /// throws, the first exception is rethrown here, once every worker is done.
+  /// Runs don't nest, and only one thread may run tasks at a time.
+  void run(const Task &task);
+
+ private:
+  void work(std::size_t worker);
+
+  /// Call the task, catching what it throws.
+  void call(std::size_t worker);
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable started_;
+  std::condition_variable finished_;
+  const Task *task_ = nullptr;
+  std::size_t generation_ = 0;  //< Bumped for every task
+  std::size_t running_ = 0;     //< Workers still running the task
+  bool stopping_ = false;
+  std::exception_ptr error_;
+};
+
+/// Splits the index range [0, count) between workers. Every worker starts
+/// with an equal share, and takes chunks from the front of it. A worker that
+/// runs out steals the back half of another worker's share.
+class WorkRanges {
+ public:
+  /// The most indices a WorkRanges can split.
+  static constexpr std::size_t MAX_COUNT = UINT32_MAX;
+
+  WorkRanges(std::size_t count, std::size_t workers, std::size_t chunk);
+
+  /// The next chunk for `worker`, in [begin, end). Returns false when there
+  /// is no work left anywhere.
+  bool next(std::size_t worker, std::size_t &begin, std::size_t &end);
+
+  /// The number of successful steals.
+  std::size_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+ private:
+  /// A share, packed as begin << 32 | end, so owners and thieves can update
+  /// it with a single compare-exchange.
+  using Range = std::uint64_t;
+
+  static Range pack(std::uint64_t begin, std::uint64_t end) {
+    return begin << 32 | end;
+  }
+
+  static std::size_t begin(Range range) { return range >> 32; }
+
+  static std::size_t end(Range range) { return range & UINT32_MAX; }
+
+  /// Take up to a chunk from the front of the worker's own share.
+  bool take(std::size_t worker, std::size_t &first, std::size_t &last);
+
+  /// Move the back half of another worker's share into this worker's.
+  bool steal(std::size_t worker);
+
+  // Shares are a cache line apart, so owners don't contend. They're padded
+  // rather than aligned, as C++14's new ignores over-alignment.
+  struct Share {
+    std::atomic<Range> range;
+    char pad[64 - sizeof(std::atomic<Range>)];
+  };
+  static_assert(sizeof(Share) == 64, "a share is a cache line");
+
+  std::unique_ptr<Share[]> shares_;
+  std::size_t workers_;
+  std::size_t chunk_;
+  std::atomic<std::size_t> steals_{0};
+};
+
+}  // namespace b9
+
+#endif  // B9_WORKERPOOL_HPP_
@@ -1,6 +1,7 @@
 #if !defined(B9_COMPILER_HPP_)
 #define B9_COMPILER_HPP_
 
+#include "b9/JitStats.hpp"
 #include "b9/compiler/GlobalTypes.hpp"
 #include "b9/instructions.hpp"
 
@@ -9,6 +10,7 @@
 
 #include <OMR/Om/Value.hpp>
 
+#include <functional>
 #include <vector>
 
 namespace b9 {
@@ -20,18 +22,44 @@ class FunctionDef;
 class Stack;
 class VirtualMachine;
 class ExecutionContext;
+class MethodBuilder;
+struct InlinePlan;
+
+/// Whether a function has jitted code. See planInlining.
+using IsCompiled = std::function<bool(std::size_t functionIndex)>;
 
 extern "C" typedef Om::RawValue (*JitFunction)(void *executionContext, ...);
 
+/// An OSR entry. Continues an interpreted call in jitted code. The frame's
+/// arguments and locals start at `args`, and are popped when it returns.
+extern "C" typedef Om::RawValue (*OsrFunction)(void *executionContext,
+                                               Om::Value *args);
+
 /// Function not found exception.
 struct CompilationException : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+/// Builds and compiles functions. The JIT isn't reentrant, so the VM runs one
+/// compile at a time, under its compileMutex_.
 class Compiler {
  public:
   Compiler(VirtualMachine &virtualMachine, const Config &cfg);
-  JitFunction generateCode(const std::size_t functionIndex);
+
+  /// Compile a function at `level`. Callees are inlined if they have code
+  /// now.
+  JitFunction generateCode(const std::size_t functionIndex,
+                           CompileLevel level = CompileLevel::BASELINE);
+
+  /// Compile a function at `level`, inlining the calls `plan` inlines.
+  JitFunction generateCode(const std::size_t functionIndex,
+                           const InlinePlan &plan,
+                           CompileLevel level = CompileLevel::BASELINE);
+
+  /// Compile an OSR entry for the function, that starts running at
+  /// `bytecodeIndex`.
+  OsrFunction generateOsrCode(const std::size_t functionIndex,
+                              const std::size_t bytecodeIndex);
 
   const GlobalTypes &globalTypes() const { return globalTypes_; }
 
@@ -40,6 +68,16 @@ class Compiler {
   const TR::TypeDictionary &typeDictionary() const { return typeDictionary_; }
 
  private:
+  /// Says a function has code if the VM has its jitted code.
+  IsCompiled hasCode();
+
+  /// Log a plan's inlining decisions with the VM.
+  void logDecisions(const InlinePlan &plan);
+
+  /// Compile the builder's method, and log the compile with the VM. Returns
+  /// the entry point, or nullptr if it failed, with the reason in `record`.
+  void *compile(MethodBuilder &builder, CompileRecord &record);
+
   TR::TypeDictionary typeDictionary_;
   const GlobalTypes globalTypes_;
   VirtualMachine &virtualMachine_;
@@ -14,6 +14,7 @@ class GlobalTypes {
   TR::IlType *int64Ptr;
   TR::IlType *int32Ptr;
   TR::IlType *int16Ptr;
+  TR::IlType *int8Ptr;
 
   TR::IlType *stackElement;
   TR::IlType *stackElementPtr;
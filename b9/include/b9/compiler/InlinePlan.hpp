@@ -0,0 +1,46 @@
+#if !defined(B9_INLINEPLAN_HPP_)
+#define B9_INLINEPLAN_HPP_
+
+#include <b9/VirtualMachine.hpp>
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace b9 {
+
+/// A body built into a compile: the compiled function, or a callee inlined
+/// into it.
+struct InlinedBody {
+  std::size_t functionIndex = 0;
+  std::size_t depth = 0;  //< Of inlining, 0 for the compiled function
+  /// The verifier's operand stack depth on entry to each instruction.
+  std::vector<std::ptrdiff_t> stackDepths;
+  /// The callees inlined into this body, by the index of their call.
+  std::map<std::size_t, std::unique_ptr<InlinedBody>> callees;
+};
+
+/// Which calls a compile inlines. Planning only reads the module and the
+/// VM's counters, never the JIT, so threads can plan compiles at once.
+struct InlinePlan {
+  InlinedBody body;
+  std::vector<InlineDecision> decisions;  //< In the order they were made
+};
+
+/// Plan a compile of the function at `level`. Only callees that `compiled`
+/// says will have code of their own when the compile is built are inlined.
+/// Calls are decided in bytecode order, inlined callees depth first, so the
+/// plan doesn't depend on the order the JIT builds in.
+InlinePlan planInlining(VirtualMachine &virtualMachine,
+                        std::size_t functionIndex, CompileLevel level,
+                        const IsCompiled &compiled);
+
+/// Plan an OSR entry of the function, that starts at `osrIndex`.
+InlinePlan planOsrInlining(VirtualMachine &virtualMachine,
+                           std::size_t functionIndex, std::size_t osrIndex,
+                           const IsCompiled &compiled);
+
+}  // namespace b9
+
+#endif  // B9_INLINEPLAN_HPP_
@@ -4,6 +4,7 @@
 #include "b9/VirtualMachine.hpp"
 #include "b9/compiler/Compiler.hpp"
 #include "b9/compiler/GlobalTypes.hpp"
+#include "b9/compiler/InlinePlan.hpp"
 #include "b9/compiler/VirtualMachineState.hpp"
 #include "b9/instructions.hpp"
 
@@ -12,21 +13,51 @@
 #include <ilgen/MethodBuilder.hpp>
 #include <ilgen/TypeDictionary.hpp>
 
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 namespace b9 {
 
 class VirtualMachine;
 
 class MethodBuilder : public TR::MethodBuilder {
  public:
-  MethodBuilder(VirtualMachine &virtualMachine,
-                const std::size_t functionIndex);
+  /// Build a function at `level`, inlining the calls `plan` inlines.
+  MethodBuilder(VirtualMachine &virtualMachine, const std::size_t functionIndex,
+                const InlinePlan &plan,
+                CompileLevel level = CompileLevel::BASELINE);
+
+  /// Build an OSR entry, that continues an interpreted call of the function
+  /// at `osrIndex`. The interpreter's frame is passed as `osrArgs`.
+  MethodBuilder(VirtualMachine &virtualMachine, const std::size_t functionIndex,
+                const std::size_t osrIndex, const InlinePlan &plan);
 
   virtual bool buildIL();
 
+  /// The bytecodes built into IL, counting inlined bodies.
+  std::size_t bytecodeCount() const { return bytecodeCount_; }
+
+  /// The callees inlined, in the order they were built.
+  const std::vector<std::string> &inlinedCallees() const { return inlined_; }
+
+  /// Why buildIL failed. Empty if it didn't, or it doesn't know.
+  const std::string &error() const { return error_; }
+
  private:
+  /// Note why building failed, unless an earlier reason was noted. Returns
+  /// false.
+  bool fail(const std::string &reason);
+
   void defineFunctions();
   void defineLocals();
   void defineParameters();
+  void defineMethod();
+
+  /// Take over the interpreter's frame in an OSR entry.
+  void buildOsrEntry(const FunctionDef *function);
 
   /// For a single bytecode, generate the
   bool generateILForBytecode(
@@ -35,10 +66,18 @@ class MethodBuilder : public TR::MethodBuilder {
       std::size_t instructionIndex,
       TR::BytecodeBuilder *jumpToBuilderForInlinedReturn);
 
+  /// Add the builders of a body, whose variables start at `firstArgument`,
+  /// and fall into it from `currentBuilder`. Without a builder, it's the top
+  /// level function, appended to the method. An inlined body's returns go to
+  /// `jumpToBuilderForInlinedReturn`.
   bool inlineProgramIntoBuilder(
-      const std::size_t functionIndex, bool isTopLevel,
-      TR::BytecodeBuilder *currentBuilder = 0,
-      TR::BytecodeBuilder *jumpToBuilderForInlinedReturn = 0);
+      const InlinedBody &plan, int32_t firstArgument,
+      TR::BytecodeBuilder *currentBuilder = nullptr,
+      TR::BytecodeBuilder *jumpToBuilderForInlinedReturn = nullptr);
+
+  /// Generate IL for the bytecodes on the worklist, of every body, until
+  /// it's empty.
+  bool generateIL();
 
   // Helpers
 
@@ -46,12 +85,129 @@ class MethodBuilder : public TR::MethodBuilder {
 
   void push(TR::BytecodeBuilder *builder, TR::IlValue *value);
 
+  /// Pop a value without unboxing it, for values that may not be integers.
+  TR::IlValue *popBoxed(TR::BytecodeBuilder *builder);
+
+  /// Push an already boxed value.
+  void pushBoxed(TR::BytecodeBuilder *builder, TR::IlValue *value);
+
+  /// The boxed value `depth` values below the top of the stack, left there.
+  TR::IlValue *peekBoxed(TR::BytecodeBuilder *builder, std::size_t depth = 0);
+
+  /// Box an integer. The boxed value remembers where it came from, so
+  /// unboxing it again is free.
+  TR::IlValue *box(TR::IlBuilder *builder, TR::IlValue *value);
+
+  /// The integer in a boxed value, which is assumed to be an integer.
+  TR::IlValue *unbox(TR::IlBuilder *builder, TR::IlValue *value);
+
+  /// 1 if a boxed value is an integer, otherwise 0.
+  TR::IlValue *isInteger(TR::IlBuilder *builder, TR::IlValue *value);
+
+  // Speculation
+
+  /// True if the variable at `index`, after the inlining skew, is kept
+  /// unboxed, as the interpreter never saw it hold anything but an integer.
+  bool isUnboxedVar(std::size_t index) const;
+
+  /// Check the arguments kept unboxed, and unbox them.
+  void buildSpeculatedArgs(const FunctionDef *function);
+
+  /// Deoptimize at `bytecodeIndex` unless `value` is an integer. Values the
+  /// JIT boxed itself are known integers, and aren't checked.
+  void guardInteger(TR::BytecodeBuilder *builder, TR::IlValue *value,
+                    std::size_t bytecodeIndex);
+
+  /// Call the interpreter to finish the call from `bytecodeIndex`, with the
+  /// frame's variables in `vars`. Returns the call's result.
+  TR::IlValue *callDeoptimize(TR::IlBuilder *builder,
+                              std::size_t bytecodeIndex, TR::IlValue *vars);
+
+  /// Turn a TAIL_CALL of the function being compiled into a jump back to
+  /// its start, `entry`. The arguments replace the function's own, and the
+  /// registers are cleared.
+  void buildSelfTailCall(TR::BytecodeBuilder *builder,
+                         const FunctionDef *function,
+                         std::size_t bytecodeIndex,
+                         TR::BytecodeBuilder *entry);
+
+  /// Call a function through its dispatch slot, with the `count` arguments
+  /// that go in registers. Returns the result.
+  TR::IlValue *callThroughSlot(TR::IlBuilder *builder,
+                               std::size_t functionIndex, std::size_t count,
+                               TR::IlValue *const *args);
+
+  /// On a backward jump, park in the safepoint if another thread is stopping
+  /// the world, so a jitted loop doesn't hold up a collection.
+  void buildSafepointPoll(TR::BytecodeBuilder *builder,
+                          const FunctionDef *function, Instruction instruction);
+
+  // GC roots
+
+  /// Before a call that can collect, store the variables of `function`, and
+  /// of the functions it is inlined into, to the frame's roots. Only needed
+  /// in passParam mode, where they live in compiler locals.
+  void spillRoots(TR::IlBuilder *builder, const FunctionDef *function);
+
+  /// Reserve the frame's roots at entry, once the body is built and the
+  /// spills are known.
+  void buildRootsPrologue(const FunctionDef *function);
+
+  /// Check at entry that the frame, with the frames of every inlined callee,
+  /// fits on the operand stack, and that the roots fit on the root stack.
+  /// Built once the body is, like the roots prologue.
+  void buildStackCheck();
+
+  /// True if fewer than `count` values fit between `top` and the end of the
+  /// OperandStack at `stack`.
+  TR::IlValue *noRoom(TR::IlBuilder *builder, TR::IlValue *stack,
+                      TR::IlValue *top, std::size_t count);
+
+  /// Count calls of baseline code, and have the VM recompile the function
+  /// at the hot level once there are enough.
+  void buildRecompileCounter();
+
+  /// Release the frame's roots, before returning.
+  void popRoots(TR::IlBuilder *builder);
+
   void drop(TR::BytecodeBuilder *builder);
 
   TR::IlValue *loadVarIndex(TR::IlBuilder *builder, int varindex);
 
   void storeVarIndex(TR::IlBuilder *builder, int varindex, TR::IlValue *value);
 
+  /// The name of the compiler local that holds a variable in passParam mode.
+  /// Inlined functions' variables follow their caller's. Names are made as
+  /// needed, and live as long as the builder.
+  const char *varName(std::size_t index);
+
+  /// Builds the fast path of an object access, for an object whose map
+  /// matched `entry`. Gets the object's address and its cell header.
+  using GuardHit =
+      std::function<void(TR::IlBuilder *builder, const InlineCacheEntry &entry,
+                         TR::IlValue *address, TR::IlValue *header)>;
+
+  /// Builds the slow path of an object access.
+  using GuardMiss = std::function<void(TR::IlBuilder *builder)>;
+
+  /// The entries of an object access's inline cache when it's compiled. The
+  /// code guards on them, so their maps are pinned. Sets `cache` to the
+  /// site's cache, or null if caches are disabled.
+  std::vector<InlineCacheEntry> guardedEntries(const FunctionDef *function,
+                                               std::size_t bytecodeIndex,
+                                               InlineCache *&cache);
+
+  /// Compare the map of the boxed `object` with each entry's map in turn, and
+  /// build the `hit` path of the first match. Anything else, including
+  /// values that aren't objects, takes the `miss` path.
+  void buildShapeGuards(TR::IlBuilder *builder, TR::IlValue *object,
+                        const std::vector<InlineCacheEntry> &entries,
+                        const GuardHit &hit, const GuardMiss &miss);
+
+  /// The address of a slot, from the address of its object.
+  TR::IlValue *slotAddress(TR::IlBuilder *builder, TR::IlValue *address,
+                           Om::SlotIndex index);
+
   // Bytecode Handlers
 
   void handle_bc_push_constant(TR::BytecodeBuilder *builder,
@@ -76,6 +232,14 @@ class MethodBuilder : public TR::MethodBuilder {
                      TR::BytecodeBuilder *nextBuilder);
   void handle_bc_call(TR::BytecodeBuilder *builder,
                       TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_push_from_object(TR::BytecodeBuilder *builder,
+                                  const FunctionDef *function,
+                                  std::size_t bytecodeIndex,
+                                  TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_pop_into_object(TR::BytecodeBuilder *builder,
+                                 const FunctionDef *function,
+                                 std::size_t bytecodeIndex,
+                                 TR::BytecodeBuilder *nextBuilder);
   void handle_bc_jmp(
       TR::BytecodeBuilder *builder,
       const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
@@ -118,8 +282,37 @@ class MethodBuilder : public TR::MethodBuilder {
   const GlobalTypes &globalTypes_;
   const Config &cfg_;
   const std::size_t functionIndex_;
-  int32_t maxInlineDepth_;
+  const bool osr_ = false;
+  const std::size_t entryIndex_ = 0;  //< Where the top level function starts
+  const CompileLevel level_ = CompileLevel::BASELINE;
+  std::string name_;
+  const InlinePlan &plan_;
+
+  /// A body whose builders were added: the function's own, or an inlined
+  /// callee's.
+  struct Body {
+    const InlinedBody *plan;
+    const FunctionDef *function;
+    std::size_t firstBytecode;  //< Of its builders, among every body's
+    int32_t firstArgument;      //< Of its variables, among every body's
+    std::vector<TR::BytecodeBuilder *> builders;
+    TR::BytecodeBuilder *returnTo;  //< Where its returns go, if inlined
+  };
+
+  std::deque<Body> bodies_;  //< In bytecode order, never moves its bodies
+  Body *body_ = nullptr;     //< The body being generated
+  std::size_t bytecodeIndexCount_ = 0;  //< Of every body's builders
   int32_t firstArgumentIndex = 0;
+  std::deque<std::string> varNames_;  //< Never moves the names it holds
+  std::vector<bool> integerVars_;  //< Unboxed, by variable, when speculating
+  std::unordered_map<TR::IlValue *, TR::IlValue *> unboxed_;  //< By box
+  TR::IlBuilder *stackCheck_ = nullptr;     //< Filled in after the body
+  TR::IlBuilder *rootsPrologue_ = nullptr;  //< Filled in after the body
+  std::size_t frameSize_ = 0;  //< Of the body and every inlined callee
+  std::size_t rootCount_ = 0;  //< Variables spilled by the widest spill
+  std::size_t bytecodeCount_ = 0;
+  std::vector<std::string> inlined_;
+  std::string error_;
 };
 
 }  // namespace b9
@@ -0,0 +1,61 @@
+#ifndef B9_FUSION_HPP_
+#define B9_FUSION_HPP_
+
+#include <b9/instructions.hpp>
+#include <b9/module.hpp>
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace b9 {
+
+/// A decoded instruction, as produced by fuseInstructions. Superinstructions
+/// carry up to two operands. Jump operands are relative to the fused stream.
+struct FusedInstruction {
+  ByteCode byteCode;
+  Parameter operand;
+  Parameter operand2;
+};
+
+/// The largest variable index that can be packed into a VAR_CONST_JMP_*
+/// superinstruction.
+static constexpr Parameter MAX_PACKED_VAR = 0xFF;
+
+/// Pack a variable index and a constant into the second operand of a
+/// VAR_CONST_JMP_* superinstruction.
+inline Parameter packVarConst(Parameter var, Parameter constant) {
+  return Parameter((std::uint32_t(constant) << 8) | std::uint32_t(var));
+}
+
+/// Unpack the variable index from a packed operand.
+inline Parameter unpackVar(Parameter packed) { return packed & MAX_PACKED_VAR; }
+
+/// Unpack the constant from a packed operand.
+inline Parameter unpackConst(Parameter packed) { return packed >> 8; }
+
+/// Rewrite common bytecode sequences into superinstructions, and fix up the
+/// jump offsets. A sequence is never fused when one of its instructions,
+/// other than the first, is the target of a jump. When `origins` is not null,
+/// it is filled with the index of the first original instruction of every
+/// fused instruction.
+std::vector<FusedInstruction> fuseInstructions(
+    const std::vector<Instruction> &instructions,
+    std::vector<std::size_t> *origins = nullptr);
+
+/// A pair of adjacent bytecodes, and how often it occurs.
+struct BytecodePairCount {
+  ByteCode first;
+  ByteCode second;
+  std::size_t count;
+};
+
+/// Count the adjacent bytecode pairs in every function of a module, most
+/// frequent first. Pairs where the second bytecode is a jump target are not
+/// counted, since they can't be fused. This is the profile the set of
+/// superinstructions is chosen from.
+std::vector<BytecodePairCount> countBytecodePairs(const Module &module);
+
+}  // namespace b9
+
+#endif  // B9_FUSION_HPP_
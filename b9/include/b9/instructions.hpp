@@ -70,6 +70,11 @@ enum class ByteCode : RawByteCode {
   // Jump if two strings are not equal
   STR_JMP_NEQ = 0x17,
 
+  // Call a Base9 function, and return its result. Only the callee's
+  // arguments are on the operand stack, and the next instruction is a
+  // FUNCTION_RETURN. Produced by rewriteTailCalls.
+  TAIL_CALL = 0x18,
+
   // Object Bytecodes
 
   NEW_OBJECT = 0x20,
@@ -81,6 +86,43 @@ enum class ByteCode : RawByteCode {
   CALL_INDIRECT = 0x23,
 
   SYSTEM_COLLECT = 0x24,
+
+  // Internal ByteCodes
+
+  // Superinstructions, produced by fuseInstructions when a module is loaded
+  // into the threaded interpreter. They never appear in a serialized module.
+
+  // PUSH_FROM_VAR a; PUSH_FROM_VAR b; INT_ADD
+  VAR_VAR_INT_ADD = 0x30,
+  // INT_ADD; POP_INTO_VAR a
+  INT_ADD_POP_INTO_VAR = 0x31,
+  // PUSH_FROM_VAR a; INT_PUSH_CONSTANT c; INT_ADD
+  VAR_CONST_INT_ADD = 0x32,
+  // PUSH_FROM_VAR a; INT_PUSH_CONSTANT c; INT_SUB
+  VAR_CONST_INT_SUB = 0x33,
+  // PUSH_FROM_VAR a; INT_PUSH_CONSTANT c; INT_JMP_EQ
+  VAR_CONST_JMP_EQ = 0x34,
+  // PUSH_FROM_VAR a; INT_PUSH_CONSTANT c; INT_JMP_NEQ
+  VAR_CONST_JMP_NEQ = 0x35,
+  // PUSH_FROM_VAR a; INT_PUSH_CONSTANT c; INT_JMP_GT
+  VAR_CONST_JMP_GT = 0x36,
+  // PUSH_FROM_VAR a; INT_PUSH_CONSTANT c; INT_JMP_GE
+  VAR_CONST_JMP_GE = 0x37,
+  // PUSH_FROM_VAR a; INT_PUSH_CONSTANT c; INT_JMP_LT
+  VAR_CONST_JMP_LT = 0x38,
+  // PUSH_FROM_VAR a; INT_PUSH_CONSTANT c; INT_JMP_LE
+  VAR_CONST_JMP_LE = 0x39,
+
+  // Quick instructions, rewritten in place by the quickening interpreter after
+  // the generic instruction first runs. The parameter indexes the VM's
+  // resolved data. They never appear in a serialized module.
+
+  // PUSH_FROM_OBJECT on an object with a known map
+  QUICK_PUSH_FROM_OBJECT = 0x40,
+  // POP_INTO_OBJECT on an object with a known map
+  QUICK_POP_INTO_OBJECT = 0x41,
+  // FUNCTION_CALL to a compiled function
+  QUICK_FUNCTION_CALL = 0x42,
 };
 
 inline const char *toString(ByteCode bc) {
@@ -133,6 +175,8 @@ inline const char *toString(ByteCode bc) {
       return "str_jmp_eq";
     case ByteCode::STR_JMP_NEQ:
       return "str_jmp_neq";
+    case ByteCode::TAIL_CALL:
+      return "tail_call";
     case ByteCode::NEW_OBJECT:
       return "new_object";
     case ByteCode::PUSH_FROM_OBJECT:
@@ -143,6 +187,32 @@ inline const char *toString(ByteCode bc) {
       return "call_indirect";
     case ByteCode::SYSTEM_COLLECT:
       return "system_collect";
+    case ByteCode::VAR_VAR_INT_ADD:
+      return "var_var_int_add";
+    case ByteCode::INT_ADD_POP_INTO_VAR:
+      return "int_add_pop_into_var";
+    case ByteCode::VAR_CONST_INT_ADD:
+      return "var_const_int_add";
+    case ByteCode::VAR_CONST_INT_SUB:
+      return "var_const_int_sub";
+    case ByteCode::VAR_CONST_JMP_EQ:
+      return "var_const_jmp_eq";
+    case ByteCode::VAR_CONST_JMP_NEQ:
+      return "var_const_jmp_neq";
+    case ByteCode::VAR_CONST_JMP_GT:
+      return "var_const_jmp_gt";
+    case ByteCode::VAR_CONST_JMP_GE:
+      return "var_const_jmp_ge";
+    case ByteCode::VAR_CONST_JMP_LT:
+      return "var_const_jmp_lt";
+    case ByteCode::VAR_CONST_JMP_LE:
+      return "var_const_jmp_le";
+    case ByteCode::QUICK_PUSH_FROM_OBJECT:
+      return "quick_push_from_object";
+    case ByteCode::QUICK_POP_INTO_OBJECT:
+      return "quick_pop_into_object";
+    case ByteCode::QUICK_FUNCTION_CALL:
+      return "quick_function_call";
     default:
       return "UNKNOWN_BYTECODE";
   }
@@ -153,6 +223,31 @@ inline std::ostream &operator<<(std::ostream &out, ByteCode bc) {
   return out << toString(bc);
 }
 
+/// True if the bytecode's parameter is a jump offset. The target of a jump at
+/// index `i` with offset `p` is the instruction at `i + p + 1`.
+inline bool isJump(ByteCode bc) {
+  switch (bc) {
+    case ByteCode::JMP:
+    case ByteCode::INT_JMP_EQ:
+    case ByteCode::INT_JMP_NEQ:
+    case ByteCode::INT_JMP_GT:
+    case ByteCode::INT_JMP_GE:
+    case ByteCode::INT_JMP_LT:
+    case ByteCode::INT_JMP_LE:
+    case ByteCode::STR_JMP_EQ:
+    case ByteCode::STR_JMP_NEQ:
+    case ByteCode::VAR_CONST_JMP_EQ:
+    case ByteCode::VAR_CONST_JMP_NEQ:
+    case ByteCode::VAR_CONST_JMP_GT:
+    case ByteCode::VAR_CONST_JMP_GE:
+    case ByteCode::VAR_CONST_JMP_LT:
+    case ByteCode::VAR_CONST_JMP_LE:
+      return true;
+    default:
+      return false;
+  }
+}
+
 using RawInstruction = std::uint32_t;
 
 /// The 24bit immediate encoded in an instruction. Note that parameters are
@@ -253,6 +348,7 @@ inline std::ostream &operator<<(std::ostream &out, Instruction i) {
       break;
     // 1 parameter
     case ByteCode::FUNCTION_CALL:
+    case ByteCode::TAIL_CALL:
     case ByteCode::PRIMITIVE_CALL:
     case ByteCode::JMP:
     case ByteCode::PUSH_FROM_VAR:
@@ -0,0 +1,91 @@
+#ifndef B9_OPTIMIZE_HPP_
+#define B9_OPTIMIZE_HPP_
+
+#include <b9/module.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+/// The bytecode optimizer's passes. Every pass rewrites one function at a
+/// time, and keeps it verifiable.
+enum class OptimizerPass {
+  /// Remove the instructions no path reaches.
+  DEAD_CODE,
+  /// Compute integer arithmetic and comparisons on constants.
+  CONSTANT_FOLDING,
+  /// Retarget jumps to jumps, and drop jumps to the next instruction.
+  JUMP_THREADING,
+  /// Remove stores to variables that are never read again, and variables
+  /// copied onto themselves.
+  REDUNDANT_STORES,
+  /// Remove DUPLICATEs whose copy is dropped, and values pushed only to be
+  /// dropped.
+  PEEPHOLE,
+};
+
+inline const char *toString(OptimizerPass pass) {
+  switch (pass) {
+    case OptimizerPass::DEAD_CODE:
+      return "dce";
+    case OptimizerPass::CONSTANT_FOLDING:
+      return "fold";
+    case OptimizerPass::JUMP_THREADING:
+      return "jumps";
+    case OptimizerPass::REDUNDANT_STORES:
+      return "stores";
+    case OptimizerPass::PEEPHOLE:
+      return "peephole";
+    default:
+      return "unknown";
+  }
+}
+
+inline std::ostream &operator<<(std::ostream &out, OptimizerPass pass) {
+  return out << toString(pass);
+}
+
+/// Parse the name of an OptimizerPass. Returns false if there's no such pass.
+bool parseOptimizerPass(const std::string &name, OptimizerPass &pass);
+
+/// Every pass, in the order the optimizer runs them.
+const std::vector<OptimizerPass> &allOptimizerPasses();
+
+/// What one pass did to a module, over every round.
+struct PassStats {
+  using Duration = std::chrono::duration<double, std::milli>;
+
+  OptimizerPass pass;
+  std::size_t rewrites = 0;  //< Patterns matched and rewritten
+  std::size_t removed = 0;   //< Instructions removed
+  Duration time{0};
+};
+
+/// What the optimizer did to a module.
+struct OptimizeStats {
+  std::size_t before = 0;  //< Instructions before, not counting END_SECTIONs
+  std::size_t after = 0;   //< Instructions after
+  std::size_t rounds = 0;  //< Times the passes ran, until nothing changed
+  std::vector<PassStats> passes;
+};
+
+/// Optimize every function of a module in place. The passes run in order,
+/// and run again while they find something to rewrite, up to a few rounds.
+/// Jumps are fixed up as instructions are removed. Throws a VerifyException
+/// if the module doesn't verify, since the passes rely on the verifier's
+/// guarantees.
+OptimizeStats optimize(
+    Module &module,
+    const std::vector<OptimizerPass> &passes = allOptimizerPasses());
+
+/// Write one row per pass, in columns, after a header row, and then the
+/// module's size before and after.
+void writeOptimizeStats(std::ostream &out, const OptimizeStats &stats);
+
+}  // namespace b9
+
+#endif  // B9_OPTIMIZE_HPP_
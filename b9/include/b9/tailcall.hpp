@@ -0,0 +1,19 @@
+#ifndef B9_TAILCALL_HPP_
+#define B9_TAILCALL_HPP_
+
+#include <b9/module.hpp>
+
+#include <cstddef>
+
+namespace b9 {
+
+/// Rewrite every FUNCTION_CALL in tail position into a TAIL_CALL. A call is
+/// in tail position when the next instruction is a FUNCTION_RETURN, and the
+/// operand stack holds nothing but the call's arguments. The FUNCTION_RETURN
+/// stays, since other paths may jump to it. Returns the number of calls
+/// rewritten. Throws a VerifyException if a function doesn't verify.
+std::size_t rewriteTailCalls(Module &module);
+
+}  // namespace b9
+
+#endif  // B9_TAILCALL_HPP_
@@ -0,0 +1,65 @@
+#ifndef B9_VERIFIER_HPP_
+#define B9_VERIFIER_HPP_
+
+#include <b9/instructions.hpp>
+#include <b9/module.hpp>
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace b9 {
+
+/// Thrown when a module fails verification.
+struct VerifyException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// The number of values an instruction pops off the operand stack, and the
+/// number it pushes back.
+struct StackEffect {
+  std::size_t pops;
+  std::size_t pushes;
+};
+
+/// The number of primitives a module may call. Matches the VM's primitive
+/// table.
+static constexpr std::size_t PRIMITIVE_COUNT = 3;
+
+/// The stack effect of the primitive at `index`.
+StackEffect primitiveEffect(std::size_t index);
+
+/// Check the bytecode and parameter of the instruction at `index`, and return
+/// its stack effect. Throws a VerifyException if the instruction is malformed.
+/// Only the instruction itself is checked, not the paths to it. The checked
+/// interpreter runs this before every instruction.
+StackEffect checkInstruction(const Module &module, const FunctionDef &function,
+                             std::size_t index);
+
+/// Check a function and return its maximum operand stack depth, not counting
+/// its arguments and registers. A verified function:
+///  - ends with END_SECTION, and has no other END_SECTION,
+///  - only uses bytecodes the interpreter implements,
+///  - only jumps to its own instructions, and never runs off its end,
+///  - only uses locals below nargs + nregs,
+///  - only calls functions, primitives and strings that exist,
+///  - has the same stack depth at every instruction, whatever the path to
+///    it, and never pops below its locals,
+///  - only makes tail calls with nothing but the arguments on the stack, and
+///    a FUNCTION_RETURN after the call.
+/// Throws a VerifyException naming the function and the instruction.
+std::size_t verifyFunction(const Module &module, std::size_t functionIndex);
+
+/// Verify a function, and return its stack depth on entry to every
+/// instruction, not counting its arguments and registers. Instructions that
+/// are never reached have a depth of -1. The END_SECTION has no entry.
+std::vector<std::ptrdiff_t> stackDepths(const Module &module,
+                                        std::size_t functionIndex);
+
+/// Verify every function of a module. Returns the maximum operand stack depth
+/// of each function.
+std::vector<std::size_t> verify(const Module &module);
+
+}  // namespace b9
+
+#endif  // B9_VERIFIER_HPP_
@@ -0,0 +1,101 @@
+#include <b9/CompileQueue.hpp>
+
+#include <algorithm>
+
+namespace b9 {
+
+CompileQueue::CompileQueue(Compile compile, std::size_t limit)
+    : compile_(std::move(compile)),
+      limit_(limit),
+      thread_([this] { work(); }) {}
+
+CompileQueue::~CompileQueue() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  pushed_.notify_all();
+  thread_.join();
+}
+
+bool CompileQueue::push(std::size_t functionIndex, CompilePriority priority) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &request : requests_) {
+    if (request.functionIndex == functionIndex) {
+      request.priority = std::max(request.priority, priority);
+      return true;
+    }
+  }
+  if (requests_.size() >= limit_) {
+    stats_.dropped++;
+    return false;
+  }
+  requests_.push_back({functionIndex, priority, sequence_++, Clock::now()});
+  stats_.queued++;
+  stats_.maxDepth = std::max(stats_.maxDepth, requests_.size());
+  pushed_.notify_one();
+  return true;
+}
+
+void CompileQueue::drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return requests_.empty() && !compiling_; });
+}
+
+std::size_t CompileQueue::depth() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return requests_.size();
+}
+
+CompileStats CompileQueue::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void CompileQueue::work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    pushed_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+    if (stopping_) {
+      return;
+    }
+
+    // The highest priority request, oldest first.
+    auto next = std::min_element(
+        requests_.begin(), requests_.end(),
+        [](const Request &lhs, const Request &rhs) {
+          if (lhs.priority != rhs.priority) {
+            return lhs.priority > rhs.priority;
+          }
+          return lhs.sequence < rhs.sequence;
+        });
+    auto request = *next;
+    requests_.erase(next);
+    compiling_ = true;
+
+    lock.unlock();
+    auto start = Clock::now();
+    auto ok = compile_(request.functionIndex);
+    auto end = Clock::now();
+    lock.lock();
+
+    CompileStats::Duration wait = start - request.queuedAt;
+    CompileStats::Duration time = end - start;
+    stats_.waitTime += wait;
+    stats_.maxWaitTime = std::max(stats_.maxWaitTime, wait);
+    stats_.compileTime += time;
+    stats_.maxCompileTime = std::max(stats_.maxCompileTime, time);
+    if (ok) {
+      stats_.compiled++;
+    } else {
+      stats_.failed++;
+    }
+
+    compiling_ = false;
+    if (requests_.empty()) {
+      idle_.notify_all();
+    }
+  }
+}
+
+}  // namespace b9
@@ -8,6 +8,7 @@
 #include <dlfcn.h>
 #include <cassert>
 #include <cerrno>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -27,6 +28,7 @@ GlobalTypes::GlobalTypes(TR::TypeDictionary &td) {
   int64Ptr = td.PointerTo(TR::Int64);
   int32Ptr = td.PointerTo(TR::Int32);
   int16Ptr = td.PointerTo(TR::Int16);
+  int8Ptr = td.PointerTo(TR::Int8);
 
   // Basic VM Data
 
@@ -42,6 +44,7 @@ GlobalTypes::GlobalTypes(TR::TypeDictionary &td) {
   operandStack = td.DefineStruct(os);
   td.DefineField(os, "top_", td.PointerTo(stackElementPtr), OperandStackOffset::TOP);
   td.DefineField(os, "stack_", stackElementPtr, OperandStackOffset::STACK);
+  td.DefineField(os, "limit_", stackElementPtr, OperandStackOffset::LIMIT);
   td.CloseStruct(os);
 
   operandStackPtr = td.PointerTo(operandStack);
@@ -50,6 +53,10 @@ GlobalTypes::GlobalTypes(TR::TypeDictionary &td) {
   executionContext = td.DefineStruct(ec);
   // td.DefineField(ec, "omContext", ???, ExecutionContextOffset::OM_CONTEXT);
   td.DefineField(ec, "stack_", operandStack, ExecutionContextOffset::STACK);
+  td.DefineField(ec, "jitRoots_", operandStack,
+                 ExecutionContextOffset::JIT_ROOTS);
+  td.DefineField(ec, "dispatchIndex_", td.Int64,
+                 ExecutionContextOffset::DISPATCH_INDEX);
   // td.DefineField(ec, "programCounter", ???,
   // ExecutionContextOffset::PROGRAM_COUNTER);
   td.CloseStruct(ec);
@@ -63,28 +70,101 @@ Compiler::Compiler(VirtualMachine &virtualMachine, const Config &cfg)
       virtualMachine_(virtualMachine),
       cfg_(cfg) {}
 
-JitFunction Compiler::generateCode(const std::size_t functionIndex) {
+IsCompiled Compiler::hasCode() {
+  return [this](std::size_t functionIndex) {
+    return virtualMachine_.getJitAddress(functionIndex) != nullptr;
+  };
+}
+
+void Compiler::logDecisions(const InlinePlan &plan) {
+  for (const auto &decision : plan.decisions) {
+    virtualMachine_.logInlineDecision(decision);
+  }
+}
+
+JitFunction Compiler::generateCode(const std::size_t functionIndex,
+                                   CompileLevel level) {
+  return generateCode(
+      functionIndex,
+      planInlining(virtualMachine_, functionIndex, level, hasCode()), level);
+}
+
+JitFunction Compiler::generateCode(const std::size_t functionIndex,
+                                   const InlinePlan &plan,
+                                   CompileLevel level) {
   const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
-  MethodBuilder methodBuilder(virtualMachine_, functionIndex);
+  logDecisions(plan);
+  MethodBuilder methodBuilder(virtualMachine_, functionIndex, plan, level);
 
   if (cfg_.debug)
     std::cout << "MethodBuilder for function: " << function->name
               << " is constructed" << std::endl;
 
-  uint8_t *result = nullptr;
-  auto rc = compileMethodBuilder(&methodBuilder, &result);
+  CompileRecord record;
+  record.function = function->name;
+  record.level = level;
+  void *result = compile(methodBuilder, record);
 
-  if (rc != 0) {
+  if (result == nullptr) {
     std::cout << "Failed to compile function: " << function->name
               << " nargs: " << function->nargs << std::endl;
-    throw b9::CompilationException{"IL generation failed"};
+    throw b9::CompilationException{record.error};
   }
 
   if (cfg_.debug)
-    std::cout << "Compilation completed with return code: " << rc
-              << ", code address: " << static_cast<void *>(result) << std::endl;
+    std::cout << "Compilation completed, code address: " << result
+              << std::endl;
 
   return (JitFunction)result;
 }
 
+OsrFunction Compiler::generateOsrCode(const std::size_t functionIndex,
+                                      const std::size_t bytecodeIndex) {
+  const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
+  auto plan = planOsrInlining(virtualMachine_, functionIndex, bytecodeIndex,
+                              hasCode());
+  logDecisions(plan);
+  MethodBuilder methodBuilder(virtualMachine_, functionIndex, bytecodeIndex,
+                              plan);
+
+  if (cfg_.debug)
+    std::cout << "MethodBuilder for OSR entry: " << function->name << " @"
+              << bytecodeIndex << " is constructed" << std::endl;
+
+  CompileRecord record;
+  record.function = function->name;
+  record.osr = true;
+  record.osrIndex = bytecodeIndex;
+  void *result = compile(methodBuilder, record);
+
+  if (result == nullptr) {
+    std::cout << "Failed to compile OSR entry: " << function->name << " @"
+              << bytecodeIndex << std::endl;
+    throw b9::CompilationException{record.error};
+  }
+
+  return (OsrFunction)result;
+}
+
+void *Compiler::compile(MethodBuilder &builder, CompileRecord &record) {
+  auto start = std::chrono::steady_clock::now();
+  uint8_t *result = nullptr;
+  auto rc = compileMethodBuilder(&builder, &result);
+  record.time = std::chrono::steady_clock::now() - start;
+
+  record.bytecodes = builder.bytecodeCount();
+  record.inlined = builder.inlinedCallees();
+  record.ok = rc == 0;
+  if (record.ok) {
+    record.entry = result;
+  } else if (!builder.error().empty()) {
+    record.error = builder.error();
+  } else {
+    record.error = "IL generation failed with return code " +
+                   std::to_string(rc);
+  }
+  virtualMachine_.logCompile(record);
+  return record.ok ? result : nullptr;
+}
+
 }  // namespace b9
@@ -1,6 +1,8 @@
 #include <b9/ExecutionContext.hpp>
 #include <b9/VirtualMachine.hpp>
 #include <b9/compiler/Compiler.hpp>
+#include <b9/fusion.hpp>
+#include <b9/verifier.hpp>
 
 #include <omrgc.h>
 #include <OMR/Om/Allocator.inl.hpp>
@@ -14,6 +16,7 @@
 #include "Jit.hpp"
 
 #include <sys/time.h>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -27,6 +30,8 @@ namespace b9 {
 ExecutionContext::ExecutionContext(VirtualMachine &virtualMachine,
                                    const Config &cfg)
     : omContext_(virtualMachine.memoryManager()),
+      stack_(cfg.stackSize),
+      jitRoots_(cfg.passParam ? cfg.stackSize : 0),
       virtualMachine_(&virtualMachine),
       cfg_(&cfg) {
   omContext().userRoots().push_back(
@@ -35,6 +40,8 @@ ExecutionContext::ExecutionContext(VirtualMachine &virtualMachine,
 
 void ExecutionContext::reset() {
   stack_.reset();
+  jitRoots_.reset();
+  frames_.clear();
   programCounter_ = 0;
 }
 
@@ -47,27 +54,32 @@ Om::Value ExecutionContext::callJitFunction(JitFunction jitFunction,
   Om::RawValue result = 0;
 
   if (cfg_->passParam) {
-    switch (nargs) {
-      case 0: {
+    // Only the last arguments are passed natively. The rest stay on the
+    // operand stack, and the callee pops them.
+    static_assert(MAX_REGISTER_ARGS == 5, "Call with every register count");
+    Om::RawValue p[MAX_REGISTER_ARGS];
+    auto count = registerArgCount(nargs);
+    for (auto i = count; i > 0; i--) {
+      p[i - 1] = pop().raw();
+    }
+    switch (count) {
+      case 0:
         result = jitFunction(this);
-      } break;
-      case 1: {
-        StackElement p1 = pop();
-        result = jitFunction(this, p1.raw());
-      } break;
-      case 2: {
-        StackElement p2 = pop();
-        StackElement p1 = pop();
-        result = jitFunction(this, p1.raw(), p2.raw());
-      } break;
-      case 3: {
-        StackElement p3 = pop();
-        StackElement p2 = pop();
-        StackElement p1 = pop();
-        result = (*jitFunction)(this, p1.raw(), p2.raw(), p3.raw());
-      } break;
-      default:
-        throw std::runtime_error{"Need to add handlers for more parameters"};
+        break;
+      case 1:
+        result = jitFunction(this, p[0]);
+        break;
+      case 2:
+        result = jitFunction(this, p[0], p[1]);
+        break;
+      case 3:
+        result = jitFunction(this, p[0], p[1], p[2]);
+        break;
+      case 4:
+        result = jitFunction(this, p[0], p[1], p[2], p[3]);
+        break;
+      case 5:
+        result = jitFunction(this, p[0], p[1], p[2], p[3], p[4]);
         break;
     }
   } else {
@@ -82,20 +94,76 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
   auto argsCount = function->nargs;
   auto jitFunction = virtualMachine_->getJitAddress(functionIndex);
 
+  // The only stack check of a verified frame. The checked interpreter
+  // reserves room for each push of an unverified one.
+  stack_.reserve(virtualMachine_->getFrameSize(functionIndex));
+  doSafepoint();
+
+  if (jitFunction == nullptr && cfg_->tiered) {
+    virtualMachine_->countInvocation(functionIndex);
+    jitFunction = virtualMachine_->getJitAddress(functionIndex);
+  }
+
   if (jitFunction) {
     return callJitFunction(jitFunction, argsCount);
   }
 
   // interpret the method otherwise
-  const Instruction *instructionPointer = function->instructions.data();
-
   StackElement *args = stack_.top() - function->nargs;
   stack_.pushn(function->nregs);
+  profileArgs(functionIndex, args);
+
+  if (cfg_->threaded) {
+    return runThreaded(this, functionIndex,
+                       virtualMachine_->getThreadedCode(functionIndex), args);
+  }
+
+  if (virtualMachine_->verified()) {
+    return runSwitch<false>(functionIndex, args);
+  }
+  return runSwitch<true>(functionIndex, args);
+}
+
+template <bool checked>
+StackElement ExecutionContext::runSwitch(std::size_t functionIndex,
+                                         StackElement *args,
+                                         std::size_t startIndex) {
+  auto function = virtualMachine_->getFunction(functionIndex);
+  const Instruction *code = function->instructions.data();
+  const QuickInstruction *quick =
+      cfg_->quicken ? virtualMachine_->getQuickCode(functionIndex) : nullptr;
+  const Instruction *instructionPointer = code + startIndex;
+  const Instruction *end = code + function->instructions.size();
+  const StackElement *locals = args + function->nargs + function->nregs;
 
-  while (*instructionPointer != END_SECTION) {
-    switch (instructionPointer->byteCode()) {
+  // Verified code never reaches its END_SECTION.
+  while (!checked || *instructionPointer != END_SECTION) {
+    const Instruction *current = instructionPointer;
+    // The instruction pointer walks the function's own code. When
+    // quickening, what runs is the quick code at the same index, loaded once.
+    const Instruction instruction =
+        quick != nullptr
+            ? Instruction(quick[current - code].load(std::memory_order_acquire))
+            : *current;
+    if (checked) {
+      // Quick instructions are checked as the instruction they replaced.
+      auto effect = checkInstruction(*virtualMachine_->module(), *function,
+                                     current - code);
+      if (stack_.top() - effect.pops < locals) {
+        throw std::runtime_error("Operand stack underflow");
+      }
+      stack_.reserve(effect.pushes);
+    }
+    switch (instruction.byteCode()) {
       case ByteCode::FUNCTION_CALL:
-        doFunctionCall(instructionPointer->parameter());
+        if (cfg_->tiered) {
+          virtualMachine_->countCall(functionIndex, instructionPointer - code);
+        }
+        doFunctionCall(instruction.parameter());
+        if (cfg_->quicken) {
+          virtualMachine_->quickenCall(functionIndex,
+                                       instructionPointer - code);
+        }
         break;
       case ByteCode::FUNCTION_RETURN: {
         auto result = stack_.pop();
@@ -103,11 +171,32 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
         return result;
         break;
       }
+      case ByteCode::TAIL_CALL: {
+        std::size_t callee = instruction.parameter();
+        if (cfg_->tiered) {
+          virtualMachine_->countCall(functionIndex, instructionPointer - code);
+        }
+        auto jitFunction = doTailCall(callee, args);
+        if (jitFunction != nullptr) {
+          return callJitFunction(jitFunction,
+                                 virtualMachine_->getFunction(callee)->nargs);
+        }
+        // Run the callee from its start, in this frame.
+        functionIndex = callee;
+        function = virtualMachine_->getFunction(callee);
+        code = function->instructions.data();
+        quick = cfg_->quicken ? virtualMachine_->getQuickCode(callee) : nullptr;
+        end = code + function->instructions.size();
+        locals = args + function->nargs + function->nregs;
+        instructionPointer = code;
+        programCounter_++;
+        continue;
+      }
       case ByteCode::PRIMITIVE_CALL:
-        doPrimitiveCall(instructionPointer->parameter());
+        doPrimitiveCall(instruction.parameter());
         break;
       case ByteCode::JMP:
-        instructionPointer += instructionPointer->parameter();
+        instructionPointer += instruction.parameter();
         break;
       case ByteCode::DUPLICATE:
         doDuplicate();
@@ -116,11 +205,15 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
         doDrop();
         break;
       case ByteCode::PUSH_FROM_VAR:
-        doPushFromVar(args, instructionPointer->parameter());
+        doPushFromVar(args, instruction.parameter());
         break;
       case ByteCode::POP_INTO_VAR:
+        if (cfg_->speculate && !stack_.peek().isInteger()) {
+          virtualMachine_->recordNonInteger(functionIndex,
+                                            instruction.parameter());
+        }
         // TODO bad name, push or pop?
-        doPushIntoVar(args, instructionPointer->parameter());
+        doPushIntoVar(args, instruction.parameter());
         break;
       case ByteCode::INT_ADD:
         doIntAdd();
@@ -135,31 +228,31 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
         doIntDiv();
         break;
       case ByteCode::INT_PUSH_CONSTANT:
-        doIntPushConstant(instructionPointer->parameter());
+        doIntPushConstant(instruction.parameter());
         break;
       case ByteCode::INT_NOT:
         doIntNot();
         break;
       case ByteCode::INT_JMP_EQ:
-        instructionPointer += doIntJmpEq(instructionPointer->parameter());
+        instructionPointer += doIntJmpEq(instruction.parameter());
         break;
       case ByteCode::INT_JMP_NEQ:
-        instructionPointer += doIntJmpNeq(instructionPointer->parameter());
+        instructionPointer += doIntJmpNeq(instruction.parameter());
         break;
       case ByteCode::INT_JMP_GT:
-        instructionPointer += doIntJmpGt(instructionPointer->parameter());
+        instructionPointer += doIntJmpGt(instruction.parameter());
         break;
       case ByteCode::INT_JMP_GE:
-        instructionPointer += doIntJmpGe(instructionPointer->parameter());
+        instructionPointer += doIntJmpGe(instruction.parameter());
         break;
       case ByteCode::INT_JMP_LT:
-        instructionPointer += doIntJmpLt(instructionPointer->parameter());
+        instructionPointer += doIntJmpLt(instruction.parameter());
         break;
       case ByteCode::INT_JMP_LE:
-        instructionPointer += doIntJmpLe(instructionPointer->parameter());
+        instructionPointer += doIntJmpLe(instruction.parameter());
         break;
       case ByteCode::STR_PUSH_CONSTANT:
-        doStrPushConstant(instructionPointer->parameter());
+        doStrPushConstant(instruction.parameter());
         break;
       case ByteCode::STR_JMP_EQ:
         // TODO
@@ -170,11 +263,52 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
       case ByteCode::NEW_OBJECT:
         doNewObject();
         break;
-      case ByteCode::PUSH_FROM_OBJECT:
-        doPushFromObject(OMR::Om::Id(instructionPointer->parameter()));
+      case ByteCode::PUSH_FROM_OBJECT: {
+        std::size_t index = instructionPointer - code;
+        auto slot =
+            doPushFromObject(OMR::Om::Id(instruction.parameter()),
+                             virtualMachine_->getInlineCache(functionIndex,
+                                                             index));
+        if (cfg_->quicken) {
+          virtualMachine_->quickenObjectAccess(functionIndex, index, slot);
+        }
+      } break;
+      case ByteCode::POP_INTO_OBJECT: {
+        std::size_t index = instructionPointer - code;
+        auto slot =
+            doPopIntoObject(OMR::Om::Id(instruction.parameter()),
+                            virtualMachine_->getInlineCache(functionIndex,
+                                                            index));
+        if (cfg_->quicken) {
+          virtualMachine_->quickenObjectAccess(functionIndex, index, slot);
+        }
+      } break;
+      // When a quick instruction's guard fails, put the generic instruction
+      // back and run it instead.
+      case ByteCode::QUICK_PUSH_FROM_OBJECT:
+        if (!doQuickPushFromObject(virtualMachine_->getQuickSlot(
+                instruction.parameter()))) {
+          virtualMachine_->dequicken(functionIndex, instructionPointer - code);
+          continue;
+        }
         break;
-      case ByteCode::POP_INTO_OBJECT:
-        doPopIntoObject(OMR::Om::Id(instructionPointer->parameter()));
+      case ByteCode::QUICK_POP_INTO_OBJECT:
+        if (!doQuickPopIntoObject(virtualMachine_->getQuickSlot(
+                instruction.parameter()))) {
+          virtualMachine_->dequicken(functionIndex, instructionPointer - code);
+          continue;
+        }
+        break;
+      case ByteCode::QUICK_FUNCTION_CALL:
+        // A failed guard retries as a FUNCTION_CALL, which counts the call.
+        if (!doQuickFunctionCall(virtualMachine_->getQuickCall(
+                instruction.parameter()))) {
+          virtualMachine_->dequicken(functionIndex, instructionPointer - code);
+          continue;
+        }
+        if (cfg_->tiered) {
+          virtualMachine_->countCall(functionIndex, instructionPointer - code);
+        }
         break;
       case ByteCode::CALL_INDIRECT:
         doCallIndirect();
@@ -188,20 +322,533 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
     }
     instructionPointer++;
     programCounter_++;
+    if (checked && (instructionPointer < code || instructionPointer >= end)) {
+      throw std::runtime_error("Jump out of function");
+    }
+    if (instructionPointer <= current) {
+      doSafepoint();
+      if (cfg_->tiered && doBackedge(functionIndex)) {
+        StackElement result;
+        std::size_t target = instructionPointer - code;
+        if (doOsr(functionIndex, target, args, result)) {
+          return result;
+        }
+      }
+    }
   }
   throw std::runtime_error("Reached end of function");
 }
 
+/// Threaded Interpreter
+
+/// The number of bytecodes in the threaded interpreter's handler table. Every
+/// RawByteCode at or beyond this is unknown. The table has extra entries at
+/// the end: the handler for unknown bytecodes, and the frame stack call and
+/// return handlers, which replace FUNCTION_CALL and FUNCTION_RETURN.
+static constexpr std::size_t THREADED_HANDLER_COUNT =
+    RawByteCode(ByteCode::VAR_CONST_JMP_LE) + 1;
+static constexpr std::size_t FRAME_CALL_HANDLER = THREADED_HANDLER_COUNT + 1;
+static constexpr std::size_t FRAME_RETURN_HANDLER = THREADED_HANDLER_COUNT + 2;
+
+/// Map an index into a function's threaded code to the index of the bytecode
+/// it starts at. Superinstructions are fused again, which is only worth it
+/// because this is only needed to enter OSR.
+static std::size_t threadedToBytecodeIndex(const FunctionDef &function,
+                                           std::size_t threadedIndex,
+                                           bool fuse) {
+  if (!fuse) {
+    return threadedIndex;
+  }
+  std::vector<std::size_t> origins;
+  fuseInstructions(function.instructions, &origins);
+  return origins[threadedIndex];
+}
+
+StackElement ExecutionContext::runThreaded(ExecutionContext *context,
+                                           std::size_t functionIndex,
+                                           const ThreadedInstruction *ip,
+                                           StackElement *args,
+                                           const void *const **handlersOut) {
+  // Indexed by RawByteCode. Unassigned bytecodes map to UNKNOWN.
+  static const void *const handlers[THREADED_HANDLER_COUNT + 3] = {
+      &&END_SECTION,        // 0x00
+      &&FUNCTION_CALL,      // 0x01
+      &&FUNCTION_RETURN,    // 0x02
+      &&PRIMITIVE_CALL,     // 0x03
+      &&JMP,                // 0x04
+      &&DUPLICATE,          // 0x05
+      &&DROP,               // 0x06
+      &&PUSH_FROM_VAR,      // 0x07
+      &&POP_INTO_VAR,       // 0x08
+      &&INT_ADD,            // 0x09
+      &&INT_SUB,            // 0x0a
+      &&INT_MUL,            // 0x0b
+      &&INT_DIV,            // 0x0c
+      &&INT_PUSH_CONSTANT,  // 0x0d
+      &&INT_NOT,            // 0x0e
+      &&INT_JMP_EQ,         // 0x0f
+      &&INT_JMP_NEQ,        // 0x10
+      &&INT_JMP_GT,         // 0x11
+      &&INT_JMP_GE,         // 0x12
+      &&INT_JMP_LT,         // 0x13
+      &&INT_JMP_LE,         // 0x14
+      &&STR_PUSH_CONSTANT,  // 0x15
+      &&STR_JMP_EQ,         // 0x16
+      &&STR_JMP_NEQ,        // 0x17
+      &&TAIL_CALL,          // 0x18
+      &&UNKNOWN,            // 0x19
+      &&UNKNOWN,            // 0x1a
+      &&UNKNOWN,            // 0x1b
+      &&UNKNOWN,            // 0x1c
+      &&UNKNOWN,            // 0x1d
+      &&UNKNOWN,            // 0x1e
+      &&UNKNOWN,            // 0x1f
+      &&NEW_OBJECT,         // 0x20
+      &&PUSH_FROM_OBJECT,   // 0x21
+      &&POP_INTO_OBJECT,    // 0x22
+      &&CALL_INDIRECT,      // 0x23
+      &&SYSTEM_COLLECT,     // 0x24
+      &&UNKNOWN,            // 0x25
+      &&UNKNOWN,            // 0x26
+      &&UNKNOWN,            // 0x27
+      &&UNKNOWN,            // 0x28
+      &&UNKNOWN,            // 0x29
+      &&UNKNOWN,            // 0x2a
+      &&UNKNOWN,            // 0x2b
+      &&UNKNOWN,            // 0x2c
+      &&UNKNOWN,            // 0x2d
+      &&UNKNOWN,            // 0x2e
+      &&UNKNOWN,            // 0x2f
+      &&VAR_VAR_INT_ADD,    // 0x30
+      &&INT_ADD_POP_INTO_VAR,  // 0x31
+      &&VAR_CONST_INT_ADD,  // 0x32
+      &&VAR_CONST_INT_SUB,  // 0x33
+      &&VAR_CONST_JMP_EQ,   // 0x34
+      &&VAR_CONST_JMP_NEQ,  // 0x35
+      &&VAR_CONST_JMP_GT,   // 0x36
+      &&VAR_CONST_JMP_GE,   // 0x37
+      &&VAR_CONST_JMP_LT,   // 0x38
+      &&VAR_CONST_JMP_LE,   // 0x39
+      &&UNKNOWN,            // THREADED_HANDLER_COUNT
+      &&FRAME_CALL,         // FRAME_CALL_HANDLER
+      &&FRAME_RETURN,       // FRAME_RETURN_HANDLER
+  };
+
+  if (handlersOut != nullptr) {
+    *handlersOut = handlers;
+    return StackElement();
+  }
+
+// Jump to the handler of the current instruction.
+#define DISPATCH() goto *ip->handler
+
+// Advance to the next instruction and jump to its handler.
+#define NEXT() \
+  do {           \
+    ++ip;        \
+    DISPATCH();  \
+  } while (0)
+
+// Jump by `delta`, then go to the next instruction. Backedges poll the
+// safepoint, and are counted when tiering.
+#define JUMP(delta)                  \
+  do {                               \
+    Parameter jump = (delta);        \
+    ip += jump;                      \
+    if (jump < 0) {                  \
+      context->doSafepoint();        \
+      if (cfg.tiered) {              \
+        goto BACKEDGE;               \
+      }                              \
+    }                                \
+    NEXT();                          \
+  } while (0)
+
+// Compare a local with a constant, and take the jump if `op` holds.
+#define VAR_CONST_JMP(op)                                          \
+  do {                                                             \
+    std::int32_t var = args[unpackVar(ip->operand2)].getInteger(); \
+    if (var op unpackConst(ip->operand2)) {                        \
+      JUMP(ip->operand);                                           \
+    }                                                              \
+    NEXT();                                                        \
+  } while (0)
+
+  const Config &cfg = *context->cfg_;
+  OperandStack &stack = context->stack_;
+  std::vector<Frame> &frames = context->frames_;
+
+  // Frames below this belong to the callers of this run. Returning at this
+  // depth leaves the interpreter.
+  const std::size_t entryDepth = frames.size();
+
+  DISPATCH();
+
+END_SECTION:
+  throw std::runtime_error("Reached end of function");
+FUNCTION_CALL:
+  if (cfg.tiered) {
+    context->virtualMachine_->countCall(functionIndex, ip->operand2);
+  }
+  context->doFunctionCall(ip->operand);
+  NEXT();
+FUNCTION_RETURN: {
+  auto result = stack.pop();
+  stack.restore(args);
+  return result;
+}
+TAIL_CALL: {
+  auto callee = std::size_t(ip->operand);
+  auto virtualMachine = context->virtualMachine_;
+  if (cfg.tiered) {
+    virtualMachine->countCall(functionIndex, ip->operand2);
+  }
+  auto jitFunction = context->doTailCall(callee, args);
+  if (jitFunction != nullptr) {
+    stack.push(context->callJitFunction(
+        jitFunction, virtualMachine->getFunction(callee)->nargs));
+    goto FRAME_RETURN;
+  }
+  // Run the callee from its start, in this frame. Its return is this
+  // frame's, so the frame stack is left alone.
+  functionIndex = callee;
+  ip = virtualMachine->getThreadedCode(callee);
+  DISPATCH();
+}
+PRIMITIVE_CALL:
+  context->doPrimitiveCall(ip->operand);
+  NEXT();
+JMP:
+  JUMP(ip->operand);
+DUPLICATE:
+  context->doDuplicate();
+  NEXT();
+DROP:
+  context->doDrop();
+  NEXT();
+PUSH_FROM_VAR:
+  context->doPushFromVar(args, ip->operand);
+  NEXT();
+POP_INTO_VAR:
+  if (context->cfg_->speculate && !stack.peek().isInteger()) {
+    context->virtualMachine_->recordNonInteger(functionIndex, ip->operand);
+  }
+  context->doPushIntoVar(args, ip->operand);
+  NEXT();
+INT_ADD:
+  context->doIntAdd();
+  NEXT();
+INT_SUB:
+  context->doIntSub();
+  NEXT();
+INT_MUL:
+  context->doIntMul();
+  NEXT();
+INT_DIV:
+  context->doIntDiv();
+  NEXT();
+INT_PUSH_CONSTANT:
+  context->doIntPushConstant(ip->operand);
+  NEXT();
+INT_NOT:
+  context->doIntNot();
+  NEXT();
+INT_JMP_EQ:
+  JUMP(context->doIntJmpEq(ip->operand));
+INT_JMP_NEQ:
+  JUMP(context->doIntJmpNeq(ip->operand));
+INT_JMP_GT:
+  JUMP(context->doIntJmpGt(ip->operand));
+INT_JMP_GE:
+  JUMP(context->doIntJmpGe(ip->operand));
+INT_JMP_LT:
+  JUMP(context->doIntJmpLt(ip->operand));
+INT_JMP_LE:
+  JUMP(context->doIntJmpLe(ip->operand));
+STR_PUSH_CONSTANT:
+  context->doStrPushConstant(ip->operand);
+  NEXT();
+STR_JMP_EQ:
+  // TODO
+  NEXT();
+STR_JMP_NEQ:
+  // TODO
+  NEXT();
+NEW_OBJECT:
+  context->doNewObject();
+  NEXT();
+// The second operand of object accesses is their bytecode index.
+PUSH_FROM_OBJECT:
+  context->doPushFromObject(
+      OMR::Om::Id(ip->operand),
+      context->virtualMachine_->getInlineCache(functionIndex, ip->operand2));
+  NEXT();
+POP_INTO_OBJECT:
+  context->doPopIntoObject(
+      OMR::Om::Id(ip->operand),
+      context->virtualMachine_->getInlineCache(functionIndex, ip->operand2));
+  NEXT();
+CALL_INDIRECT:
+  context->doCallIndirect();
+  NEXT();
+SYSTEM_COLLECT:
+  context->doSystemCollect();
+  NEXT();
+VAR_VAR_INT_ADD: {
+  std::int32_t left = args[ip->operand].getInteger();
+  std::int32_t right = args[ip->operand2].getInteger();
+  stack.push(StackElement().setInteger(left + right));
+  NEXT();
+}
+INT_ADD_POP_INTO_VAR: {
+  std::int32_t right = stack.pop().getInteger();
+  std::int32_t left = stack.pop().getInteger();
+  args[ip->operand].setInteger(left + right);
+  NEXT();
+}
+VAR_CONST_INT_ADD: {
+  std::int32_t left = args[ip->operand].getInteger();
+  stack.push(StackElement().setInteger(left + ip->operand2));
+  NEXT();
+}
+VAR_CONST_INT_SUB: {
+  std::int32_t left = args[ip->operand].getInteger();
+  stack.push(StackElement().setInteger(left - ip->operand2));
+  NEXT();
+}
+VAR_CONST_JMP_EQ:
+  VAR_CONST_JMP(==);
+VAR_CONST_JMP_NEQ:
+  VAR_CONST_JMP(!=);
+VAR_CONST_JMP_GT:
+  VAR_CONST_JMP(>);
+VAR_CONST_JMP_GE:
+  VAR_CONST_JMP(>=);
+VAR_CONST_JMP_LT:
+  VAR_CONST_JMP(<);
+VAR_CONST_JMP_LE:
+  VAR_CONST_JMP(<=);
+UNKNOWN:
+  throw std::runtime_error("Unknown bytecode");
+FRAME_CALL: {
+  auto callee = std::size_t(ip->operand);
+  auto virtualMachine = context->virtualMachine_;
+  if (cfg.tiered) {
+    virtualMachine->countCall(functionIndex, ip->operand2);
+  }
+  if (cfg.tiered && virtualMachine->getJitAddress(callee) == nullptr) {
+    virtualMachine->countInvocation(callee);
+  }
+  if (virtualMachine->getJitAddress(callee) != nullptr) {
+    context->doFunctionCall(ip->operand);
+    NEXT();
+  }
+  auto function = virtualMachine->getFunction(callee);
+  stack.reserve(virtualMachine->getFrameSize(callee));
+  context->doSafepoint();
+  frames.push_back({ip, args, functionIndex});
+  functionIndex = callee;
+  args = stack.top() - function->nargs;
+  stack.pushn(function->nregs);
+  context->profileArgs(callee, args);
+  ip = virtualMachine->getThreadedCode(callee);
+  DISPATCH();
+}
+FRAME_RETURN: {
+  auto result = stack.pop();
+  stack.restore(args);
+  if (frames.size() == entryDepth) {
+    return result;
+  }
+  const Frame &caller = frames.back();
+  ip = caller.returnIp;
+  args = caller.args;
+  functionIndex = caller.functionIndex;
+  frames.pop_back();
+  stack.push(result);
+  NEXT();
+}
+BACKEDGE: {
+  if (!context->doBackedge(functionIndex)) {
+    NEXT();
+  }
+  // ip is just before the jump target.
+  auto virtualMachine = context->virtualMachine_;
+  auto target = ip + 1 - virtualMachine->getThreadedCode(functionIndex);
+  auto bytecodeIndex = threadedToBytecodeIndex(
+      *virtualMachine->getFunction(functionIndex), target, cfg.fuse);
+  StackElement result;
+  if (!context->doOsr(functionIndex, bytecodeIndex, args, result)) {
+    NEXT();
+  }
+  // The OSR entry popped the frame. Return through the frame stack, if the
+  // function was called through it.
+  if (frames.size() == entryDepth) {
+    return result;
+  }
+  stack.push(result);
+  goto FRAME_RETURN;
+}
+
+#undef VAR_CONST_JMP
+#undef JUMP
+#undef NEXT
+#undef DISPATCH
+}
+
+ThreadedCode ExecutionContext::threadFunction(const FunctionDef &function,
+                                              bool fuse, bool frameStack) {
+  const void *const *handlers = nullptr;
+  runThreaded(nullptr, 0, nullptr, nullptr, &handlers);
+
+  auto handlerFor = [handlers, frameStack](ByteCode bc) {
+    if (frameStack && bc == ByteCode::FUNCTION_CALL) {
+      return handlers[FRAME_CALL_HANDLER];
+    }
+    if (frameStack && bc == ByteCode::FUNCTION_RETURN) {
+      return handlers[FRAME_RETURN_HANDLER];
+    }
+    return handlers[std::min<std::size_t>(RawByteCode(bc),
+                                          THREADED_HANDLER_COUNT)];
+  };
+
+  ThreadedCode code;
+  code.reserve(function.instructions.size());
+
+  std::vector<FusedInstruction> instructions;
+  std::vector<std::size_t> origins;
+
+  if (fuse) {
+    instructions = fuseInstructions(function.instructions, &origins);
+  } else {
+    for (std::size_t i = 0; i < function.instructions.size(); i++) {
+      auto instruction = function.instructions[i];
+      instructions.push_back(
+          {instruction.byteCode(), instruction.parameter(), 0});
+      origins.push_back(i);
+    }
+  }
+
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    auto instruction = instructions[i];
+    // Object accesses find their inline cache, and calls their counter, by
+    // bytecode index.
+    if (instruction.byteCode == ByteCode::PUSH_FROM_OBJECT ||
+        instruction.byteCode == ByteCode::POP_INTO_OBJECT ||
+        instruction.byteCode == ByteCode::FUNCTION_CALL ||
+        instruction.byteCode == ByteCode::TAIL_CALL) {
+      instruction.operand2 = origins[i];
+    }
+    code.push_back({handlerFor(instruction.byteCode), instruction.operand,
+                    instruction.operand2});
+  }
+
+  return code;
+}
+
 void ExecutionContext::push(StackElement value) { stack_.push(value); }
 
 StackElement ExecutionContext::pop() { return stack_.pop(); }
 
+bool ExecutionContext::doBackedge(std::size_t functionIndex) {
+  virtualMachine_->countBackedge(functionIndex);
+  return cfg_->osr &&
+         virtualMachine_->getTier(functionIndex) == Tier::COMPILED;
+}
+
+bool ExecutionContext::doOsr(std::size_t functionIndex,
+                             std::size_t bytecodeIndex, StackElement *args,
+                             StackElement &result) {
+  auto function = virtualMachine_->getFunction(functionIndex);
+  std::size_t stackDepth =
+      stack_.top() - args - function->nargs - function->nregs;
+  auto osrEntry =
+      virtualMachine_->getOsrEntry(functionIndex, bytecodeIndex, stackDepth);
+  if (osrEntry == nullptr) {
+    return false;
+  }
+
+  if (cfg_->verbose) {
+    std::cout << "Int: OSR into " << function->name << " @" << bytecodeIndex
+              << std::endl;
+  }
+
+  result = Om::Value(Om::FROM_RAW, osrEntry(this, args));
+  return true;
+}
+
+StackElement ExecutionContext::deoptimize(std::size_t functionIndex,
+                                          std::size_t bytecodeIndex,
+                                          const Om::RawValue *vars,
+                                          StackElement *args) {
+  auto function = virtualMachine_->getFunction(functionIndex);
+  std::size_t count = function->nargs + function->nregs;
+  std::size_t spilled = function->nargs - registerArgCount(function->nargs);
+
+  // Make room for the registers and the arguments that were passed natively,
+  // between the spilled arguments and the operand stack.
+  StackElement *operands = args + spilled;
+  std::size_t depth = stack_.top() - operands;
+  stack_.reserve(count - spilled);
+  std::copy_backward(operands, operands + depth, args + count + depth);
+  for (std::size_t i = 0; i < count; i++) {
+    args[i] = StackElement(Om::FROM_RAW, vars[i]);
+    if (!args[i].isInteger()) {
+      virtualMachine_->recordNonInteger(functionIndex, i);
+    }
+  }
+  stack_.restore(args + count + depth);
+
+  virtualMachine_->countDeopt(functionIndex, bytecodeIndex);
+
+  if (virtualMachine_->verified()) {
+    return runSwitch<false>(functionIndex, args, bytecodeIndex);
+  }
+  return runSwitch<true>(functionIndex, args, bytecodeIndex);
+}
+
 void ExecutionContext::doFunctionCall(Parameter value) {
   auto f = virtualMachine_->getFunction((std::size_t)value);
   auto result = interpret(value);
   push(result);
 }
 
+JitFunction ExecutionContext::doTailCall(std::size_t callee,
+                                         StackElement *args) {
+  auto function = virtualMachine_->getFunction(callee);
+  std::memmove(args, stack_.top() - function->nargs,
+               function->nargs * sizeof(StackElement));
+  stack_.restore(args + function->nargs);
+
+  // From here on, it's the entry of interpret, without the recursion.
+  stack_.reserve(virtualMachine_->getFrameSize(callee));
+  doSafepoint();
+
+  auto jitFunction = virtualMachine_->getJitAddress(callee);
+  if (jitFunction == nullptr && cfg_->tiered) {
+    virtualMachine_->countInvocation(callee);
+    jitFunction = virtualMachine_->getJitAddress(callee);
+  }
+  if (jitFunction == nullptr) {
+    stack_.pushn(function->nregs);
+    profileArgs(callee, args);
+  }
+  return jitFunction;
+}
+
+void ExecutionContext::profileArgs(std::size_t functionIndex,
+                                   const StackElement *args) {
+  if (!cfg_->speculate) {
+    return;
+  }
+  auto function = virtualMachine_->getFunction(functionIndex);
+  for (std::size_t i = 0; i < function->nargs; i++) {
+    if (!args[i].isInteger()) {
+      virtualMachine_->recordNonInteger(functionIndex, i);
+    }
+  }
+}
+
 void ExecutionContext::doFunctionReturn(StackElement returnVal) {
   // TODO
 }
@@ -332,42 +979,73 @@ void ExecutionContext::doStrPushConstant(Parameter param) {
   stack_.push(OMR::Om::Value().setInteger(param));
 }
 
+Om::Object *ExecutionContext::newObject() {
+  Om::RootRef<Om::ObjectMap> map(*this,
+                                 virtualMachine_->emptyObjectMap(*this));
+  return OMR::Om::Object::allocate(*this, map);
+}
+
 // ( -- object )
 void ExecutionContext::doNewObject() {
-  auto ref = OMR::Om::Object::allocate(*this);
-  stack_.push(OMR::Om::Value(ref));
+  stack_.push(OMR::Om::Value(newObject()));
 }
 
 // ( object -- value )
-void ExecutionContext::doPushFromObject(Om::Id slotId) {
+InlineCacheEntry ExecutionContext::doPushFromObject(Om::Id slotId,
+                                                    InlineCache *cache) {
   auto value = stack_.pop();
   if (!value.isPtr()) {
     throw std::runtime_error("Accessing non-object value as an object.");
   }
   auto obj = value.getPtr<Om::Object>();
+
+  if (cache != nullptr) {
+    auto entry = cache->find(obj->map());
+    if (entry != nullptr) {
+      stack_.push(Om::Object::getValue(*this, obj, entry->index));
+      return *entry;
+    }
+  }
+
   Om::SlotDescriptor descriptor;
   auto found = Om::Object::lookup(*this, obj, slotId, descriptor);
-  if (found) {
-    Om::Value result;
-    result = Om::Object::getValue(*this, obj, descriptor);
-    stack_.push(result);
-  } else {
+  if (!found) {
     throw std::runtime_error("Accessing an object's field that doesn't exist.");
   }
+
+  InlineCacheEntry resolved{obj->map(), nullptr, descriptor};
+  if (cache != nullptr) {
+    cache->insert(resolved);
+  }
+  stack_.push(Om::Object::getValue(*this, obj, descriptor));
+  return resolved;
 }
 
-// ( object value -- )
-void ExecutionContext::doPopIntoObject(Om::Id slotId) {
+// ( value object -- )
+InlineCacheEntry ExecutionContext::doPopIntoObject(Om::Id slotId,
+                                                   InlineCache *cache) {
   if (!stack_.peek().isPtr()) {
     throw std::runtime_error("Accessing non-object as an object");
   }
 
-  std::size_t offset = 0;
   auto object = stack_.pop().getPtr<Om::Object>();
 
+  if (cache != nullptr) {
+    auto entry = cache->find(object->map());
+    if (entry != nullptr) {
+      if (entry->transition != nullptr) {
+        object->map(entry->transition);
+      }
+      Om::Object::setValue(*this, object, entry->index, pop());
+      return *entry;
+    }
+  }
+
   Om::SlotDescriptor descriptor;
   bool found = Om::Object::lookup(*this, object, slotId, descriptor);
 
+  InlineCacheEntry resolved{object->map(), nullptr, descriptor};
+
   if (!found) {
     static constexpr Om::SlotType type(Om::Id(0), Om::CoreType::VALUE);
 
@@ -375,14 +1053,56 @@ void ExecutionContext::doPopIntoObject(Om::Id slotId) {
     auto map = Om::Object::transition(*this, root, {{type, slotId}});
     assert(map != nullptr);
 
-    // TODO: Get the descriptor fast after a single-slot transition.
-    Om::Object::lookup(*this, object, slotId, descriptor);
+    // The transition adds a single slot, so it's the first slot of the new
+    // map, and there's no need to look it up again.
     object = root.get();
+    resolved.transition = map;
+    resolved.index = *map->slotDescriptors().begin();
+  }
+
+  if (cache != nullptr) {
+    cache->insert(resolved);
   }
 
   auto val = pop();
-  Om::Object::setValue(*this, object, descriptor, val);
+  Om::Object::setValue(*this, object, resolved.index, val);
+  // TODO: Write barrier the object on store.
+  return resolved;
+}
+
+// ( object -- value )
+bool ExecutionContext::doQuickPushFromObject(const InlineCacheEntry &slot) {
+  auto value = stack_.peek();
+  if (!value.isPtr() || value.getPtr<Om::Object>()->map() != slot.map) {
+    return false;
+  }
+  stack_.pop();
+  stack_.push(Om::Object::getValue(*this, value.getPtr<Om::Object>(),
+                                   slot.index));
+  return true;
+}
+
+// ( value object -- )
+bool ExecutionContext::doQuickPopIntoObject(const InlineCacheEntry &slot) {
+  auto value = stack_.peek();
+  if (!value.isPtr() || value.getPtr<Om::Object>()->map() != slot.map) {
+    return false;
+  }
+  auto object = stack_.pop().getPtr<Om::Object>();
+  if (slot.transition != nullptr) {
+    object->map(slot.transition);
+  }
+  Om::Object::setValue(*this, object, slot.index, pop());
   // TODO: Write barrier the object on store.
+  return true;
+}
+
+bool ExecutionContext::doQuickFunctionCall(const QuickCall &call) {
+  if (virtualMachine_->getJitAddress(call.functionIndex) != call.entry) {
+    return false;
+  }
+  push(callJitFunction(call.entry, call.nargs));
+  return true;
 }
 
 void ExecutionContext::doCallIndirect() {
@@ -0,0 +1,198 @@
+#include <b9/compiler/InlinePlan.hpp>
+#include <b9/verifier.hpp>
+
+#include <algorithm>
+
+namespace b9 {
+
+namespace {
+
+/// The instructions of a body that can run, starting at `start`.
+std::vector<bool> reachableFrom(const std::vector<Instruction> &instructions,
+                                std::size_t start) {
+  std::vector<bool> reached(instructions.size(), false);
+  std::vector<std::size_t> worklist = {start};
+  while (!worklist.empty()) {
+    auto index = worklist.back();
+    worklist.pop_back();
+    if (index >= instructions.size() || reached[index]) {
+      continue;
+    }
+    reached[index] = true;
+    auto instruction = instructions[index];
+    switch (instruction.byteCode()) {
+      case ByteCode::FUNCTION_RETURN:
+      case ByteCode::END_SECTION:
+        break;
+      case ByteCode::JMP:
+        worklist.push_back(index + instruction.parameter() + 1);
+        break;
+      case ByteCode::INT_JMP_EQ:
+      case ByteCode::INT_JMP_NEQ:
+      case ByteCode::INT_JMP_LT:
+      case ByteCode::INT_JMP_LE:
+      case ByteCode::INT_JMP_GT:
+      case ByteCode::INT_JMP_GE:
+        worklist.push_back(index + instruction.parameter() + 1);
+        worklist.push_back(index + 1);
+        break;
+      default:
+        worklist.push_back(index + 1);
+        break;
+    }
+  }
+  return reached;
+}
+
+class Planner {
+ public:
+  Planner(VirtualMachine &virtualMachine, std::size_t functionIndex,
+          CompileLevel level, bool osr, const IsCompiled &compiled)
+      : virtualMachine_(virtualMachine),
+        cfg_(virtualMachine.config()),
+        functionIndex_(functionIndex),
+        osr_(osr),
+        compiled_(compiled),
+        maxInlineDepth_(level == CompileLevel::HOT ? cfg_.hotInlineDepth
+                                                   : cfg_.maxInlineDepth),
+        inlineBudget_(level == CompileLevel::HOT ? cfg_.hotInlineBudget
+                                                 : cfg_.inlineBudget) {}
+
+  InlinePlan plan(std::size_t entryIndex) {
+    InlinePlan plan;
+    plan.body.functionIndex = functionIndex_;
+    planBody(plan.body, entryIndex, 1, plan.decisions);
+    return plan;
+  }
+
+ private:
+  /// Decide the calls of `body`, which runs `frequency` times per call of
+  /// the compiled function.
+  void planBody(InlinedBody &body, std::size_t entryIndex, double frequency,
+                std::vector<InlineDecision> &decisions) {
+    const auto &module = *virtualMachine_.module();
+    const auto &instructions =
+        module.functions[body.functionIndex].instructions;
+    body.stackDepths = stackDepths(module, body.functionIndex);
+
+    // Only directly called callees, with their arguments in parameters, can
+    // be inlined.
+    if (!cfg_.directCall || !cfg_.passParam || maxInlineDepth_ == 0) {
+      return;
+    }
+
+    auto reached = reachableFrom(instructions, entryIndex);
+    for (std::size_t index = 0; index < instructions.size(); index++) {
+      auto instruction = instructions[index];
+      auto byteCode = instruction.byteCode();
+      if (!reached[index] || (byteCode != ByteCode::FUNCTION_CALL &&
+                              byteCode != ByteCode::TAIL_CALL)) {
+        continue;
+      }
+      std::size_t calleeIndex = instruction.parameter();
+      bool self = calleeIndex == functionIndex_ && !osr_;
+      // The function's own tail calls are jumps back to its start.
+      if (byteCode == ByteCode::TAIL_CALL && self && body.depth == 0) {
+        continue;
+      }
+
+      double calleeFrequency;
+      bool calleeCompiled = self || compiled_(calleeIndex);
+      if (!shouldInline(body, index, calleeIndex, calleeCompiled, frequency,
+                        calleeFrequency, decisions)) {
+        continue;
+      }
+      auto callee = std::make_unique<InlinedBody>();
+      callee->functionIndex = calleeIndex;
+      callee->depth = body.depth + 1;
+      planBody(*callee, 0, calleeFrequency, decisions);
+      body.callees[index] = std::move(callee);
+    }
+  }
+
+  /// Decide whether to inline the call at `bytecodeIndex` of `caller`, and
+  /// record the decision. Callees that fit the inlining budget are inlined
+  /// when they are small, or when they are bigger but the call is hot: made
+  /// at least once per call of the compiled function, going by the
+  /// interpreter's counts. Calls the interpreter never made aren't inlined.
+  /// Sets `calleeFrequency` to the callee's calls per call of the compiled
+  /// function.
+  bool shouldInline(const InlinedBody &caller, std::size_t bytecodeIndex,
+                    std::size_t calleeIndex, bool calleeCompiled,
+                    double frequency, double &calleeFrequency,
+                    std::vector<InlineDecision> &decisions) {
+    const auto &functions = virtualMachine_.module()->functions;
+    const auto &callee = functions[calleeIndex];
+
+    InlineDecision decision;
+    decision.caller = functions[caller.functionIndex].name;
+    decision.bytecodeIndex = bytecodeIndex;
+    decision.callee = callee.name;
+    decision.depth = caller.depth;
+    decision.size = callee.instructions.size();
+
+    // Without tiering there are no counts, so every call counts as hot.
+    calleeFrequency = frequency;
+    if (cfg_.tiered) {
+      decision.calls =
+          virtualMachine_.getCallCount(caller.functionIndex, bytecodeIndex);
+      std::size_t invocations =
+          virtualMachine_.getProfile(caller.functionIndex)
+              .invocations.load(std::memory_order_relaxed);
+      calleeFrequency *=
+          double(decision.calls) / std::max<std::size_t>(invocations, 1);
+    }
+    decision.frequency = calleeFrequency;
+
+    if (caller.depth >= maxInlineDepth_) {
+      decision.reason = "too deep";
+    } else if (!calleeCompiled) {
+      decision.reason = "callee not compiled";
+    } else if (decision.size > inlineBudget_) {
+      decision.reason = "over budget";
+    } else if (cfg_.tiered && decision.calls == 0) {
+      decision.reason = "never called";
+    } else if (decision.size <= cfg_.inlineSize) {
+      decision.inlined = true;
+      decision.reason = "small";
+    } else if (decision.size <= cfg_.inlineHotSize && calleeFrequency >= 1) {
+      decision.inlined = true;
+      decision.reason = "hot";
+    } else {
+      decision.reason = "too big";
+    }
+
+    if (decision.inlined) {
+      inlineBudget_ -= decision.size;
+    }
+    decisions.push_back(decision);
+    return decision.inlined;
+  }
+
+  VirtualMachine &virtualMachine_;
+  const Config &cfg_;
+  const std::size_t functionIndex_;
+  const bool osr_;
+  const IsCompiled &compiled_;
+  const std::size_t maxInlineDepth_;
+  std::size_t inlineBudget_;  //< Bytecodes that can still be inlined
+};
+
+}  // namespace
+
+InlinePlan planInlining(VirtualMachine &virtualMachine,
+                        std::size_t functionIndex, CompileLevel level,
+                        const IsCompiled &compiled) {
+  return Planner(virtualMachine, functionIndex, level, false, compiled)
+      .plan(0);
+}
+
+InlinePlan planOsrInlining(VirtualMachine &virtualMachine,
+                           std::size_t functionIndex, std::size_t osrIndex,
+                           const IsCompiled &compiled) {
+  return Planner(virtualMachine, functionIndex, CompileLevel::BASELINE, true,
+                 compiled)
+      .plan(osrIndex);
+}
+
+}  // namespace b9
@@ -0,0 +1,144 @@
+#include <b9/JitStats.hpp>
+
+#include <algorithm>
+#include <iomanip>
+
+namespace b9 {
+
+static std::string displayName(const CompileRecord &record) {
+  auto name = record.function;
+  if (record.osr) {
+    name += "$osr" + std::to_string(record.osrIndex);
+  }
+  if (record.level != CompileLevel::BASELINE) {
+    name += std::string("$") + toString(record.level);
+  }
+  return name;
+}
+
+bool parseJitStatsSort(const std::string &name, JitStatsSort &sort) {
+  if (name == "time") {
+    sort = JitStatsSort::TIME;
+  } else if (name == "bytecodes") {
+    sort = JitStatsSort::BYTECODES;
+  } else if (name == "inlined") {
+    sort = JitStatsSort::INLINED;
+  } else if (name == "name") {
+    sort = JitStatsSort::NAME;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void sortCompileRecords(std::vector<CompileRecord> &records,
+                        JitStatsSort sort) {
+  std::stable_sort(
+      records.begin(), records.end(),
+      [sort](const CompileRecord &lhs, const CompileRecord &rhs) {
+        switch (sort) {
+          case JitStatsSort::TIME:
+            return lhs.time > rhs.time;
+          case JitStatsSort::BYTECODES:
+            return lhs.bytecodes > rhs.bytecodes;
+          case JitStatsSort::INLINED:
+            return lhs.inlined.size() > rhs.inlined.size();
+          case JitStatsSort::NAME:
+          default:
+            return displayName(lhs) < displayName(rhs);
+        }
+      });
+}
+
+void writeJitStatsTable(std::ostream &out,
+                        const std::vector<CompileRecord> &records) {
+  auto flags = out.flags();
+  auto precision = out.precision();
+  std::size_t width = 8;
+  for (const auto &record : records) {
+    width = std::max(width, displayName(record).size());
+  }
+
+  out << std::left << std::setw(width) << "Function" << std::right
+      << "  Status" << std::setw(12) << "Time (ms)" << std::setw(11)
+      << "Bytecodes" << std::setw(9) << "Inlined" << std::setw(20) << "Entry"
+      << "  Notes" << std::endl;
+
+  for (const auto &record : records) {
+    out << std::left << std::setw(width) << displayName(record) << std::right
+        << (record.ok ? "  ok    " : "  failed") << std::setw(12)
+        << std::fixed << std::setprecision(3) << record.time.count()
+        << std::setw(11) << record.bytecodes << std::setw(9)
+        << record.inlined.size() << std::setw(20);
+    if (record.entry != nullptr) {
+      out << record.entry;
+    } else {
+      out << "-";
+    }
+    out << "  ";
+    if (record.ok) {
+      for (std::size_t i = 0; i < record.inlined.size(); i++) {
+        out << (i == 0 ? "" : ",") << record.inlined[i];
+      }
+    } else {
+      out << record.error;
+    }
+    out << std::endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+static void writeJsonString(std::ostream &out, const std::string &string) {
+  out << '"';
+  for (unsigned char c : string) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c)
+          << std::dec << std::setfill(' ');
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+void writeJitStatsJson(std::ostream &out,
+                       const std::vector<CompileRecord> &records) {
+  out << "[";
+  for (std::size_t i = 0; i < records.size(); i++) {
+    const auto &record = records[i];
+    out << (i == 0 ? "" : ",") << std::endl << "  {\"function\": ";
+    writeJsonString(out, record.function);
+    out << ", \"osr\": ";
+    if (record.osr) {
+      out << record.osrIndex;
+    } else {
+      out << "null";
+    }
+    out << ", \"ok\": " << (record.ok ? "true" : "false") << ", \"error\": ";
+    if (record.ok) {
+      out << "null";
+    } else {
+      writeJsonString(out, record.error);
+    }
+    out << ", \"level\": \"" << record.level << "\""
+        << ", \"timeMs\": " << record.time.count()
+        << ", \"bytecodes\": " << record.bytecodes << ", \"inlined\": [";
+    for (std::size_t j = 0; j < record.inlined.size(); j++) {
+      out << (j == 0 ? "" : ", ");
+      writeJsonString(out, record.inlined[j]);
+    }
+    out << "], \"entry\": ";
+    if (record.entry != nullptr) {
+      out << "\"" << record.entry << "\"";
+    } else {
+      out << "null";
+    }
+    out << "}";
+  }
+  out << std::endl << "]" << std::endl;
+}
+
+}  // namespace b9
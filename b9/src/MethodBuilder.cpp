@@ -3,27 +3,64 @@
 #include "b9/compiler/Compiler.hpp"
 #include "b9/instructions.hpp"
 
+#include <OMR/Om/Object.hpp>
 #include <ilgen/VirtualMachineOperandStack.hpp>
 #include <ilgen/VirtualMachineRegister.hpp>
 #include <ilgen/VirtualMachineRegisterInStruct.hpp>
 
+#include <algorithm>
+
 namespace b9 {
 
 MethodBuilder::MethodBuilder(VirtualMachine &virtualMachine,
-                             const std::size_t functionIndex)
+                             const std::size_t functionIndex,
+                             const InlinePlan &plan, CompileLevel level)
+    : TR::MethodBuilder(&virtualMachine.compiler()->typeDictionary()),
+      virtualMachine_(virtualMachine),
+      cfg_(virtualMachine.config()),
+      level_(level),
+      globalTypes_(virtualMachine.compiler()->globalTypes()),
+      functionIndex_(functionIndex),
+      name_(virtualMachine.getFunction(functionIndex)->name),
+      plan_(plan) {
+  defineMethod();
+}
+
+MethodBuilder::MethodBuilder(VirtualMachine &virtualMachine,
+                             const std::size_t functionIndex,
+                             const std::size_t osrIndex,
+                             const InlinePlan &plan)
     : TR::MethodBuilder(&virtualMachine.compiler()->typeDictionary()),
       virtualMachine_(virtualMachine),
       cfg_(virtualMachine.config()),
-      maxInlineDepth_(cfg_.maxInlineDepth),
       globalTypes_(virtualMachine.compiler()->globalTypes()),
-      functionIndex_(functionIndex) {
-  const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
+      functionIndex_(functionIndex),
+      osr_(true),
+      entryIndex_(osrIndex),
+      name_(virtualMachine.getFunction(functionIndex)->name + "$osr" +
+            std::to_string(osrIndex)),
+      plan_(plan) {
+  defineMethod();
+}
+
+void MethodBuilder::defineMethod() {
+  const FunctionDef *function = virtualMachine_.getFunction(functionIndex_);
+
+  // Only variables in compiler locals can be unboxed. OSR entries take over
+  // boxed frames, so they don't speculate.
+  if (cfg_.speculate && cfg_.passParam && !osr_) {
+    for (std::size_t i = 0; i < function->nargs + function->nregs; i++) {
+      integerVars_.push_back(
+          virtualMachine_.isIntegerVar(functionIndex_, i));
+    }
+  }
 
   /// TODO: The __LINE__/__FILE__ stuff is 100% bogus, this is about as bad.
   DefineLine("<unknown");
   DefineFile(function->name.c_str());
 
-  DefineName(function->name.c_str());
+  // OSR entries get their own name, so self calls still go to the function.
+  DefineName(name_.c_str());
 
   DefineReturnType(globalTypes().stackElement);
 
@@ -36,14 +73,35 @@ MethodBuilder::MethodBuilder(VirtualMachine &virtualMachine,
   AllLocalsHaveBeenDefined();
 }
 
-static const char *argsAndTempNames[] = {
-    "arg00", "arg01", "arg02", "arg03", "arg04", "arg05", "arg06",
-    "arg07", "arg08", "arg09", "arg10", "arg11", "arg12", "arg13",
-    "arg14", "arg15", "arg16", "arg17", "arg18", "arg19", "arg20",
-    "arg21", "arg22", "arg23", "arg24", "arg25", "arg26", "arg27",
-    "arg28", "arg29", "arg30", "arg31", "arg32"};
-#define MAX_ARGS_TEMPS_AVAIL \
-  (sizeof(argsAndTempNames) / sizeof(argsAndTempNames[0]))
+/// The JIT to interpreter transitions, by the number of arguments passed in
+/// registers.
+static const char *const interpretNames[] = {
+    "interpret_0", "interpret_1", "interpret_2",
+    "interpret_3", "interpret_4", "interpret_5"};
+static void *const interpretEntries[] = {
+    (void *)&interpret_0, (void *)&interpret_1, (void *)&interpret_2,
+    (void *)&interpret_3, (void *)&interpret_4, (void *)&interpret_5};
+static_assert(sizeof(interpretNames) / sizeof(interpretNames[0]) ==
+                  MAX_REGISTER_ARGS + 1,
+              "Every register count needs a transition");
+
+// Only used for their signatures, by calls through dispatch slots.
+static const char *const dispatchNames[] = {
+    "jit_dispatch_0", "jit_dispatch_1", "jit_dispatch_2",
+    "jit_dispatch_3", "jit_dispatch_4", "jit_dispatch_5"};
+static void *const dispatchEntries[] = {
+    (void *)&jit_dispatch_0, (void *)&jit_dispatch_1, (void *)&jit_dispatch_2,
+    (void *)&jit_dispatch_3, (void *)&jit_dispatch_4, (void *)&jit_dispatch_5};
+static_assert(sizeof(dispatchNames) / sizeof(dispatchNames[0]) ==
+                  MAX_REGISTER_ARGS + 1,
+              "Every register count needs a dispatch signature");
+
+const char *MethodBuilder::varName(std::size_t index) {
+  while (varNames_.size() <= index) {
+    varNames_.push_back("arg" + std::to_string(varNames_.size()));
+  }
+  return varNames_[index].c_str();
+}
 
 /// The first argument is always executionContext.
 /// The remaining function arguments are only passed as native arguments in
@@ -57,9 +115,17 @@ void MethodBuilder::defineParameters() {
   /// first argument is always the execution context
   DefineParameter("executionContext", globalTypes().executionContextPtr);
 
+  /// OSR entries take the interpreter's frame instead of the arguments.
+  if (osr_) {
+    DefineParameter("osrArgs", globalTypes().stackElementPtr);
+    return;
+  }
+
+  // The arguments that don't fit in registers are on the operand stack.
   if (cfg_.passParam) {
-    for (int i = 0; i < function->nargs; i++) {
-      DefineParameter(argsAndTempNames[i], globalTypes().stackElement);
+    auto spilled = function->nargs - registerArgCount(function->nargs);
+    for (std::size_t i = spilled; i < function->nargs; i++) {
+      DefineParameter(varName(i), globalTypes().stackElement);
     }
   }
 }
@@ -80,53 +146,75 @@ void MethodBuilder::defineLocals() {
   // Address of the current stack top
   DefineLocal("stackTop", globalTypes().stackElementPtr);
 
+  // The value loaded by an object access, on either of its paths
+  DefineLocal("objectValue", globalTypes().stackElement);
+
   if (cfg_.passParam) {
+    // The base of the frame's area on the context's root stack
+    DefineLocal("roots", globalTypes().stackElementPtr);
+
     // for locals we pre-define all the locals we could use, for the toplevel
     // and all the inlined names which are simply referenced via a skew to reach
     // past callers functions args/temps
-    for (std::size_t i = function->nargs;
-         i < (function->nregs + function->nargs); i++) {
-      DefineLocal(argsAndTempNames[i], globalTypes().stackElement);
+    // In an OSR entry, the arguments are locals too, and so are the
+    // arguments that were passed on the operand stack.
+    auto spilled = function->nargs - registerArgCount(function->nargs);
+    for (std::size_t i = 0; i < (function->nregs + function->nargs); i++) {
+      if (osr_ || i < spilled || i >= function->nargs) {
+        DefineLocal(varName(i), globalTypes().stackElement);
+      }
     }
   }
 }
 
 void MethodBuilder::defineFunctions() {
-  int functionIndex = 0;
-  while (functionIndex < virtualMachine_.getFunctionCount()) {
-    if (virtualMachine_.getJitAddress(functionIndex) != nullptr) {
-      auto function = virtualMachine_.getFunction(functionIndex);
-      auto name = function->name.c_str();
-      DefineFunction(name, (char *)__FILE__, name,
-                     (void *)virtualMachine_.getJitAddress(functionIndex),
-                     Int64, function->nargs, globalTypes().stackElement,
-                     globalTypes().stackElement, globalTypes().stackElement,
-                     globalTypes().stackElement, globalTypes().stackElement,
-                     globalTypes().stackElement, globalTypes().stackElement,
-                     globalTypes().stackElement);
-    }
-    functionIndex++;
-  }
-
-  DefineFunction((char *)"interpret_0", (char *)__FILE__, "interpret_0",
-                 (void *)&interpret_0, Int64, 2,
-                 globalTypes().executionContextPtr, globalTypes().int32Ptr);
-  DefineFunction((char *)"interpret_1", (char *)__FILE__, "interpret_1",
-                 (void *)&interpret_1, Int64, 3,
-                 globalTypes().executionContextPtr, globalTypes().int32Ptr,
-                 globalTypes().stackElement);
-  DefineFunction((char *)"interpret_2", (char *)__FILE__, "interpret_2",
-                 (void *)&interpret_2, Int64, 4,
-                 globalTypes().executionContextPtr, globalTypes().int32Ptr,
-                 globalTypes().stackElement, globalTypes().stackElement);
-  DefineFunction((char *)"interpret_3", (char *)__FILE__, "interpret_3",
-                 (void *)&interpret_3, Int64, 5,
-                 globalTypes().executionContextPtr, globalTypes().int32Ptr,
-                 globalTypes().stackElement, globalTypes().stackElement,
-                 globalTypes().stackElement);
+  // Other functions are called through their dispatch slots, which hold
+  // either their code or a trampoline with the same signature.
+  for (std::size_t count = 0; count <= MAX_REGISTER_ARGS; count++) {
+    DefineFunction((char *)interpretNames[count], (char *)__FILE__,
+                   interpretNames[count], interpretEntries[count], Int64,
+                   2 + count, globalTypes().executionContextPtr,
+                   globalTypes().int32Ptr, globalTypes().stackElement,
+                   globalTypes().stackElement, globalTypes().stackElement,
+                   globalTypes().stackElement, globalTypes().stackElement);
+    DefineFunction((char *)dispatchNames[count], (char *)__FILE__,
+                   dispatchNames[count], dispatchEntries[count], Int64,
+                   1 + count, globalTypes().executionContextPtr,
+                   globalTypes().stackElement, globalTypes().stackElement,
+                   globalTypes().stackElement, globalTypes().stackElement,
+                   globalTypes().stackElement);
+  }
   DefineFunction((char *)"primitive_call", (char *)__FILE__, "primitive_call",
                  (void *)&primitive_call, NoType, 2,
                  globalTypes().executionContextPtr, Int32);
+  DefineFunction((char *)"jit_new_object", (char *)__FILE__, "jit_new_object",
+                 (void *)&jit_new_object, Int64, 1,
+                 globalTypes().executionContextPtr);
+  DefineFunction((char *)"jit_push_from_object", (char *)__FILE__,
+                 "jit_push_from_object", (void *)&jit_push_from_object, Int64,
+                 4, globalTypes().executionContextPtr,
+                 globalTypes().stackElement, Int32, Address);
+  DefineFunction((char *)"jit_pop_into_object", (char *)__FILE__,
+                 "jit_pop_into_object", (void *)&jit_pop_into_object, NoType,
+                 5, globalTypes().executionContextPtr,
+                 globalTypes().stackElement, globalTypes().stackElement, Int32,
+                 Address);
+  DefineFunction((char *)"jit_system_collect", (char *)__FILE__,
+                 "jit_system_collect", (void *)&jit_system_collect, NoType, 1,
+                 globalTypes().executionContextPtr);
+  DefineFunction((char *)"jit_safepoint", (char *)__FILE__, "jit_safepoint",
+                 (void *)&jit_safepoint, NoType, 1,
+                 globalTypes().executionContextPtr);
+  DefineFunction((char *)"jit_recompile", (char *)__FILE__, "jit_recompile",
+                 (void *)&jit_recompile, NoType, 2,
+                 globalTypes().executionContextPtr, Int64);
+  DefineFunction((char *)"jit_stack_overflow", (char *)__FILE__,
+                 "jit_stack_overflow", (void *)&jit_stack_overflow, NoType,
+                 0);
+  DefineFunction((char *)"jit_deoptimize", (char *)__FILE__, "jit_deoptimize",
+                 (void *)&jit_deoptimize, Int64, 5,
+                 globalTypes().executionContextPtr, Int64, Int64,
+                 globalTypes().stackElementPtr, globalTypes().stackElementPtr);
   // DefineFunction((char *)"b9PrintStack", (char *)__FILE__, "b9PrintStack",
   //                (void *)&b9PrintStack, NoType, 4, globalTypes().addressPtr,
   //                Int64, Int64, Int64);
@@ -139,13 +227,10 @@ void MethodBuilder::defineFunctions() {
   if (cfg_.lazyVmState) QSTACK(b)->Drop(b, toDrop);
 
 bool MethodBuilder::inlineProgramIntoBuilder(
-    const std::size_t functionIndex, bool isTopLevel,
+    const InlinedBody &plan, int32_t firstArgument,
     TR::BytecodeBuilder *currentBuilder,
     TR::BytecodeBuilder *jumpToBuilderForInlinedReturn) {
-  bool success = true;
-  maxInlineDepth_--;
-  const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
-  const Instruction *program = function->instructions.data();
+  const FunctionDef *function = virtualMachine_.getFunction(plan.functionIndex);
 
   // Create a BytecodeBuilder for each Bytecode
   auto numberOfBytecodes = function->instructions.size();
@@ -155,41 +240,63 @@ bool MethodBuilder::inlineProgramIntoBuilder(
       std::cerr << "unexpected EMPTY function body for " << function->name
                 << std::endl;
     }
-    return false;
+    return fail("empty function body: " + function->name);
   }
 
   if (cfg_.debug)
     std::cout << "Creating " << numberOfBytecodes << " bytecode builders"
               << std::endl;
 
-  // create the builders
-
-  std::vector<TR::BytecodeBuilder *> builderTable;
-  builderTable.reserve(numberOfBytecodes);
-  for (int i = 0; i < numberOfBytecodes; i++) {
-    builderTable.push_back(OrphanBytecodeBuilder(i));
+  // create the builders. The worklist goes by bytecode index, so every body
+  // numbers its builders after the bodies before it.
+
+  Body body;
+  body.plan = &plan;
+  body.function = function;
+  body.firstBytecode = bytecodeIndexCount_;
+  body.firstArgument = firstArgument;
+  body.returnTo = jumpToBuilderForInlinedReturn;
+  body.builders.reserve(numberOfBytecodes);
+  for (std::size_t i = 0; i < numberOfBytecodes; i++) {
+    body.builders.push_back(OrphanBytecodeBuilder(bytecodeIndexCount_ + i));
   }
+  bytecodeIndexCount_ += numberOfBytecodes;
+  bodies_.push_back(std::move(body));
 
-  // Get the first Builder
+  // Get the first Builder. The top level function may start elsewhere when
+  // it's an OSR entry.
 
-  TR::BytecodeBuilder *builder = builderTable[0];
+  bool isTopLevel = currentBuilder == nullptr;
+  TR::BytecodeBuilder *builder =
+      bodies_.back().builders[isTopLevel ? entryIndex_ : 0];
 
   if (isTopLevel) {
     AppendBuilder(builder);
   } else {
     currentBuilder->AddFallThroughBuilder(builder);
   }
+  return true;
+}
 
-  // Gen IL
-  bool ok = true;
-
-  for (std::size_t index = GetNextBytecodeFromWorklist(); index != -1;
+bool MethodBuilder::generateIL() {
+  for (int32_t index = GetNextBytecodeFromWorklist(); index != -1;
        index = GetNextBytecodeFromWorklist()) {
-    ok = generateILForBytecode(function, builderTable, index,
-                               jumpToBuilderForInlinedReturn);
-    if (!ok) break;
+    // The last body that starts at or before the index.
+    auto found = std::upper_bound(
+        bodies_.begin(), bodies_.end(), std::size_t(index),
+        [](std::size_t index, const Body &body) {
+          return index < body.firstBytecode;
+        });
+    body_ = &*(found - 1);
+    firstArgumentIndex = body_->firstArgument;
+    bool ok = generateILForBytecode(body_->function, body_->builders,
+                                    index - body_->firstBytecode,
+                                    body_->returnTo);
+    if (!ok) {
+      return false;
+    }
   }
-  return ok;
+  return true;
 }
 
 bool MethodBuilder::buildIL() {
@@ -218,6 +325,32 @@ bool MethodBuilder::buildIL() {
     setVMState(new OMR::VirtualMachineState());
   }
 
+  // The frame's roots start at the top of the root stack. How many there are
+  // is only known once the body is built.
+  if (cfg_.passParam) {
+    TR::IlValue *roots = StructFieldInstanceAddress(
+        "b9::ExecutionContext", "jitRoots_", Load("executionContext"));
+    Store("roots", LoadIndirect("b9::OperandStack", "top_", roots));
+  }
+
+  // The stack check goes before anything is pushed, but how much the inlined
+  // callees push is only known once the body is built too.
+  frameSize_ = virtualMachine_.getFrameSize(functionIndex_);
+  stackCheck_ = OrphanBuilder();
+  AppendBuilder(stackCheck_);
+  if (cfg_.passParam) {
+    rootsPrologue_ = OrphanBuilder();
+    AppendBuilder(rootsPrologue_);
+  }
+
+  if (osr_) {
+    buildOsrEntry(function);
+    bool ok = inlineProgramIntoBuilder(plan_.body, 0) && generateIL();
+    buildStackCheck();
+    buildRootsPrologue(function);
+    return ok;
+  }
+
   /// When this function exits, we reset the stack top to the beginning of
   /// entry. The calling convention is callee-cleanup, so at exit we pop all
   /// the args off the operand stack.
@@ -229,7 +362,21 @@ bool MethodBuilder::buildIL() {
                                      ConstInt32(-function->nargs));
     Store("stackBase", stackBase);
   } else {
-    Store("stackBase", stackTop);
+    // The arguments that didn't fit in registers were left on the operand
+    // stack. Copy them into locals, and pop them on return.
+    auto spilled = function->nargs - registerArgCount(function->nargs);
+    if (spilled == 0) {
+      Store("stackBase", stackTop);
+    } else {
+      TR::IlValue *stackBase = IndexAt(globalTypes().stackElementPtr, stackTop,
+                                       ConstInt32(-spilled));
+      Store("stackBase", stackBase);
+      for (std::size_t i = 0; i < spilled; i++) {
+        TR::IlValue *address = IndexAt(globalTypes().stackElementPtr,
+                                       Load("stackBase"), ConstInt32(i));
+        Store(varName(i), LoadAt(globalTypes().stackElementPtr, address));
+      }
+    }
   }
 
   // Locals are stored on the stack. Bump the stackTop by the number of
@@ -244,14 +391,313 @@ bool MethodBuilder::buildIL() {
     StoreIndirect("b9::OperandStack", "top_", stack, newStackTop);
   }
 
-  // initialize all locals to 0
+  if (cfg_.recompile && level_ == CompileLevel::BASELINE) {
+    buildRecompileCounter();
+  }
+
+  buildSpeculatedArgs(function);
+
+  // initialize all locals to the integer 0
   auto argsCount = function->nargs;
   auto regsCount = function->nregs;
   for (int i = argsCount; i < argsCount + regsCount; i++) {
-    storeVarIndex(this, i, this->ConstInt64(0));
+    storeVarIndex(this, i, this->ConstInt64(Om::BoxKindTag::INTEGER));
   }
 
-  return inlineProgramIntoBuilder(functionIndex_, true);
+  bool ok = inlineProgramIntoBuilder(plan_.body, 0) && generateIL();
+  buildStackCheck();
+  buildRootsPrologue(function);
+  return ok;
+}
+
+/// The interpreter's frame is already on the operand stack: the arguments,
+/// then the locals, then the operand stack of the function. Leave it there,
+/// and point stackBase at it, so returning pops it. In passParam mode, the
+/// arguments and locals are copied into the compiler's locals.
+void MethodBuilder::buildOsrEntry(const FunctionDef *function) {
+  Store("stackBase", Load("osrArgs"));
+
+  if (cfg_.passParam) {
+    auto count = function->nargs + function->nregs;
+    for (int i = 0; i < count; i++) {
+      TR::IlValue *address = IndexAt(globalTypes().stackElementPtr,
+                                     Load("osrArgs"), ConstInt32(i));
+      Store(varName(i),
+            LoadAt(globalTypes().stackElementPtr, address));
+    }
+  }
+}
+
+/// The verifier made sure only the arguments are on the operand stack, so
+/// it's empty once they're popped, as it was at the start.
+void MethodBuilder::buildSelfTailCall(TR::BytecodeBuilder *builder,
+                                      const FunctionDef *function,
+                                      std::size_t bytecodeIndex,
+                                      TR::BytecodeBuilder *entry) {
+  auto argsCount = function->nargs;
+
+  // Check the arguments kept unboxed while they are all still on the stack,
+  // so a deopt finishes the call in the interpreter.
+  for (std::size_t i = 0; i < argsCount; i++) {
+    if (isUnboxedVar(i)) {
+      guardInteger(builder, peekBoxed(builder, argsCount - 1 - i),
+                   bytecodeIndex);
+    }
+  }
+
+  std::vector<TR::IlValue *> args(argsCount);
+  for (std::size_t i = argsCount; i > 0; i--) {
+    args[i - 1] = popBoxed(builder);
+  }
+  for (std::size_t i = 0; i < argsCount; i++) {
+    storeVarIndex(builder, i, args[i]);
+  }
+  for (std::size_t i = argsCount; i < argsCount + function->nregs; i++) {
+    storeVarIndex(builder, i, builder->ConstInt64(Om::BoxKindTag::INTEGER));
+  }
+  builder->Goto(entry);
+}
+
+/// The counter is bumped without a lock, so calls racing on it may lose
+/// counts, or skip any one value. It's reset once it reaches the threshold,
+/// not when it equals it, so a skipped value only delays the recompile. The
+/// VM asks for the hot compile once, however many calls see the threshold.
+void MethodBuilder::buildRecompileCounter() {
+  void *counterAddress = virtualMachine_.getJitCounter(functionIndex_);
+  TR::IlValue *counter = ConstAddress(counterAddress);
+  TR::IlValue *count =
+      Add(LoadAt(globalTypes().int64Ptr, counter), ConstInt64(1));
+  StoreAt(counter, count);
+
+  // count >= recompileThreshold, which is at least 1.
+  TR::IlBuilder *recompile = nullptr;
+  IfThen(&recompile,
+         GreaterThan(count, ConstInt64(cfg_.recompileThreshold - 1)));
+  recompile->StoreAt(recompile->ConstAddress(counterAddress),
+                     recompile->ConstInt64(0));
+  recompile->Call("jit_recompile", 2, recompile->Load("executionContext"),
+                  recompile->ConstInt64(functionIndex_));
+}
+
+/// The arguments kept unboxed arrive boxed. If they are all integers, unbox
+/// them. Otherwise, the whole call runs in the interpreter.
+void MethodBuilder::buildSpeculatedArgs(const FunctionDef *function) {
+  TR::IlValue *integers = nullptr;
+  for (std::size_t i = 0; i < function->nargs; i++) {
+    if (!isUnboxedVar(i)) {
+      continue;
+    }
+    auto integer = isInteger(this, Load(varName(i)));
+    integers = integers == nullptr ? integer : And(integers, integer);
+  }
+  if (integers == nullptr) {
+    return;
+  }
+
+  TR::IlBuilder *fail = nullptr;
+  IfThen(&fail, EqualTo(integers, ConstInt32(0)));
+  auto count = function->nargs + function->nregs;
+  auto vars = fail->CreateLocalArray(count, globalTypes().stackElement);
+  for (std::size_t i = 0; i < count; i++) {
+    auto value = i < function->nargs
+                     ? fail->Load(varName(i))
+                     : fail->ConstInt64(Om::BoxKindTag::INTEGER);
+    fail->StoreAt(fail->IndexAt(globalTypes().stackElementPtr, vars,
+                                fail->ConstInt32(i)),
+                  value);
+  }
+  popRoots(fail);
+  fail->Return(callDeoptimize(fail, 0, vars));
+
+  for (std::size_t i = 0; i < function->nargs; i++) {
+    if (isUnboxedVar(i)) {
+      Store(varName(i), unbox(this, Load(varName(i))));
+    }
+  }
+}
+
+void MethodBuilder::guardInteger(TR::BytecodeBuilder *builder,
+                                 TR::IlValue *value,
+                                 std::size_t bytecodeIndex) {
+  if (unboxed_.count(value) != 0) {
+    return;
+  }
+  TR::IlBuilder *fail = nullptr;
+  builder->IfThen(&fail, builder->EqualTo(isInteger(builder, value),
+                                          builder->ConstInt32(0)));
+
+  // The interpreter's frame is the operand stack as it was before this
+  // bytecode, and every variable, boxed.
+  builder->vmState()->Commit(fail);
+  auto count = integerVars_.size();
+  auto vars = fail->CreateLocalArray(count, globalTypes().stackElement);
+  for (std::size_t i = 0; i < count; i++) {
+    fail->StoreAt(fail->IndexAt(globalTypes().stackElementPtr, vars,
+                                fail->ConstInt32(i)),
+                  loadVarIndex(fail, i));
+  }
+  popRoots(fail);
+  fail->Return(callDeoptimize(fail, bytecodeIndex, vars));
+}
+
+TR::IlValue *MethodBuilder::callDeoptimize(TR::IlBuilder *builder,
+                                           std::size_t bytecodeIndex,
+                                           TR::IlValue *vars) {
+  return builder->Call("jit_deoptimize", 5, builder->Load("executionContext"),
+                       builder->ConstInt64(functionIndex_),
+                       builder->ConstInt64(bytecodeIndex), vars,
+                       builder->Load("stackBase"));
+}
+
+/// The flag is read without a fence. A stop that is missed on one backedge
+/// is seen on a later one, and the thread stopping the world waits for it.
+void MethodBuilder::buildSafepointPoll(TR::BytecodeBuilder *builder,
+                                       const FunctionDef *function,
+                                       Instruction instruction) {
+  if (instruction.parameter() >= 0) {
+    return;
+  }
+  auto flag = virtualMachine_.memoryManager().safepoint().requestedFlag();
+  TR::IlBuilder *park = nullptr;
+  builder->IfThen(&park,
+                  builder->NotEqualTo(
+                      builder->LoadAt(globalTypes().int8Ptr,
+                                      builder->ConstAddress((void *)flag)),
+                      builder->ConstInt8(0)));
+
+  // A collection while parked sees the frame's roots and operand stack.
+  spillRoots(park, function);
+  builder->vmState()->Commit(park);
+  park->Call("jit_safepoint", 1, park->Load("executionContext"));
+}
+
+void MethodBuilder::spillRoots(TR::IlBuilder *builder,
+                               const FunctionDef *function) {
+  if (!cfg_.passParam) {
+    return;
+  }
+  // Objects never move, so nothing is reloaded after the call.
+  std::size_t count = firstArgumentIndex + function->nargs + function->nregs;
+  for (std::size_t i = 0; i < count; i++) {
+    if (isUnboxedVar(i)) {
+      continue;
+    }
+    builder->StoreAt(builder->IndexAt(globalTypes().stackElementPtr,
+                                      builder->Load("roots"),
+                                      builder->ConstInt32(i)),
+                     builder->Load(varName(i)));
+  }
+  rootCount_ = std::max(rootCount_, count);
+}
+
+void MethodBuilder::buildRootsPrologue(const FunctionDef *function) {
+  if (rootCount_ == 0) {
+    return;
+  }
+  auto b = rootsPrologue_;
+  TR::IlValue *roots = b->StructFieldInstanceAddress(
+      "b9::ExecutionContext", "jitRoots_", b->Load("executionContext"));
+  b->StoreIndirect("b9::OperandStack", "top_", roots,
+                   b->IndexAt(globalTypes().stackElementPtr, b->Load("roots"),
+                              b->ConstInt32(rootCount_)));
+
+  // Every spill stores the function's own boxed variables. The others, an
+  // inlined callee's or unboxed ones, could be left holding dead objects from
+  // an earlier frame, so clear them.
+  std::size_t count = function->nargs + function->nregs;
+  for (std::size_t i = 0; i < rootCount_; i++) {
+    if (i < count && !isUnboxedVar(i)) {
+      continue;
+    }
+    b->StoreAt(b->IndexAt(globalTypes().stackElementPtr, b->Load("roots"),
+                          b->ConstInt32(i)),
+               b->ConstInt64(Om::BoxKindTag::INTEGER));
+  }
+}
+
+void MethodBuilder::buildStackCheck() {
+  auto b = stackCheck_;
+  TR::IlBuilder *overflow = nullptr;
+  b->IfThen(&overflow,
+            noRoom(b, b->Load("stack"), b->Load("stackTop"), frameSize_));
+  overflow->Call("jit_stack_overflow", 0);
+
+  if (rootCount_ > 0) {
+    TR::IlValue *roots = b->StructFieldInstanceAddress(
+        "b9::ExecutionContext", "jitRoots_", b->Load("executionContext"));
+    TR::IlBuilder *rootsOverflow = nullptr;
+    b->IfThen(&rootsOverflow, noRoom(b, roots, b->Load("roots"), rootCount_));
+    rootsOverflow->Call("jit_stack_overflow", 0);
+  }
+}
+
+TR::IlValue *MethodBuilder::noRoom(TR::IlBuilder *builder, TR::IlValue *stack,
+                                   TR::IlValue *top, std::size_t count) {
+  TR::IlValue *limit =
+      builder->LoadIndirect("b9::OperandStack", "limit_", stack);
+  TR::IlValue *room = builder->Sub(builder->ConvertTo(Int64, limit),
+                                   builder->ConvertTo(Int64, top));
+  return builder->LessThan(
+      room, builder->ConstInt64(count * sizeof(StackElement)));
+}
+
+void MethodBuilder::popRoots(TR::IlBuilder *builder) {
+  if (!cfg_.passParam) {
+    return;
+  }
+  TR::IlValue *roots = builder->StructFieldInstanceAddress(
+      "b9::ExecutionContext", "jitRoots_", builder->Load("executionContext"));
+  builder->StoreIndirect("b9::OperandStack", "top_", roots,
+                         builder->Load("roots"));
+}
+
+TR::IlValue *MethodBuilder::callThroughSlot(TR::IlBuilder *builder,
+                                            std::size_t functionIndex,
+                                            std::size_t count,
+                                            TR::IlValue *const *args) {
+  TR::IlValue *p[MAX_REGISTER_ARGS] = {};
+  for (std::size_t i = 0; i < count; i++) {
+    p[i] = args[i];
+  }
+  // The trampolines are shared, so they find the callee in the context.
+  auto context = builder->Load("executionContext");
+  builder->StoreIndirect("b9::ExecutionContext", "dispatchIndex_", context,
+                         builder->ConstInt64(functionIndex));
+  // Slots are patched with a single store, so a plain load sees either the
+  // old target or the new one.
+  auto slot =
+      builder->ConstAddress(virtualMachine_.getDispatchSlot(functionIndex));
+  auto target = builder->LoadAt(globalTypes().addressPtr, slot);
+  return builder->ComputedCall(dispatchNames[count], 2 + count, target,
+                               context, p[0], p[1], p[2], p[3], p[4]);
+}
+
+bool MethodBuilder::isUnboxedVar(std::size_t index) const {
+  return index < integerVars_.size() && integerVars_[index];
+}
+
+TR::IlValue *MethodBuilder::isInteger(TR::IlBuilder *builder,
+                                      TR::IlValue *value) {
+  return builder->EqualTo(
+      builder->And(value, builder->ConstInt64(Om::BoxKindTag::MASK)),
+      builder->ConstInt64(Om::BoxKindTag::INTEGER));
+}
+
+TR::IlValue *MethodBuilder::box(TR::IlBuilder *builder, TR::IlValue *value) {
+  auto boxed =
+      builder->Or(builder->And(value, builder->ConstInt64(Om::VALUE_MASK)),
+                  builder->ConstInt64(Om::BoxKindTag::INTEGER));
+  unboxed_[boxed] = value;
+  return boxed;
+}
+
+TR::IlValue *MethodBuilder::unbox(TR::IlBuilder *builder, TR::IlValue *value) {
+  auto found = unboxed_.find(value);
+  if (found != unboxed_.end()) {
+    return found->second;
+  }
+  // Integers are 32 bits, sign extended.
+  return builder->ConvertTo(Int64, builder->ConvertTo(Int32, value));
 }
 
 TR::IlValue *MethodBuilder::loadVarIndex(TR::IlBuilder *builder, int varindex) {
@@ -261,14 +707,15 @@ TR::IlValue *MethodBuilder::loadVarIndex(TR::IlBuilder *builder, int varindex) {
 
   TR::IlValue *result = nullptr;
 
-  if (cfg_.passParam) {
-    result = builder->Load(argsAndTempNames[varindex]);
+  if (isUnboxedVar(varindex)) {
+    result = box(builder, builder->Load(varName(varindex)));
+  } else if (cfg_.passParam) {
+    result = builder->Load(varName(varindex));
   } else {
     TR::IlValue *args = builder->Load("stackBase");
     TR::IlValue *address = builder->IndexAt(globalTypes().stackElementPtr, args,
                                             builder->ConstInt32(varindex));
-    TR::IlValue *data = builder->LoadAt(globalTypes().stackElementPtr, address);
-    result = builder->And(builder->ConstInt64(Om::VALUE_MASK), data);
+    result = builder->LoadAt(globalTypes().stackElementPtr, address);
   }
 
   return result;
@@ -280,19 +727,25 @@ void MethodBuilder::storeVarIndex(TR::IlBuilder *builder, int varindex,
     varindex += firstArgumentIndex;
   }
 
-  if (cfg_.passParam) {
-    builder->Store(argsAndTempNames[varindex], value);
+  if (isUnboxedVar(varindex)) {
+    builder->Store(varName(varindex), unbox(builder, value));
+  } else if (cfg_.passParam) {
+    builder->Store(varName(varindex), value);
   } else {
     TR::IlValue *args = builder->Load("stackBase");
     TR::IlValue *address = builder->IndexAt(globalTypes().stackElementPtr, args,
                                             builder->ConstInt32(varindex));
-    // this needs to be encoded for the GC to walk the stack.
-    builder->StoreAt(
-        address,
-        builder->Or(builder->ConstInt64(Om::BoxKindTag::INTEGER), value));
+    builder->StoreAt(address, value);
   }
 }
 
+bool MethodBuilder::fail(const std::string &reason) {
+  if (error_.empty()) {
+    error_ = reason;
+  }
+  return false;
+}
+
 bool MethodBuilder::generateILForBytecode(
     const FunctionDef *function,
     std::vector<TR::BytecodeBuilder *> bytecodeBuilderTable,
@@ -310,12 +763,14 @@ bool MethodBuilder::generateILForBytecode(
   if (nullptr == builder) {
     if (cfg_.debug)
       std::cout << "unexpected NULL BytecodeBuilder!" << std::endl;
-    return false;
+    return fail("no builder for " + function->name + "@" +
+                std::to_string(instructionIndex));
   }
+  bytecodeCount_++;
 
   TR::BytecodeBuilder *nextBytecodeBuilder = nullptr;
 
-  if (instructionIndex + 1 <= program.size()) {
+  if (instructionIndex + 1 < program.size()) {
     nextBytecodeBuilder = bytecodeBuilderTable[instructionIndex + 1];
   }
 
@@ -336,31 +791,49 @@ bool MethodBuilder::generateILForBytecode(
 
   switch (instruction.byteCode()) {
     case ByteCode::PUSH_FROM_VAR:
-      push(builder, loadVarIndex(builder, instruction.parameter()));
+      pushBoxed(builder, loadVarIndex(builder, instruction.parameter()));
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
       break;
     case ByteCode::POP_INTO_VAR:
-      storeVarIndex(builder, instruction.parameter(), pop(builder));
+      // Only the function's own variables are unboxed, never an inlined
+      // callee's.
+      if (body_->plan->depth == 0 && isUnboxedVar(instruction.parameter())) {
+        guardInteger(builder, peekBoxed(builder), instructionIndex);
+      }
+      storeVarIndex(builder, instruction.parameter(), popBoxed(builder));
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
       break;
     case ByteCode::FUNCTION_RETURN: {
-      auto result = pop(builder);
+      auto result = popBoxed(builder);
+
+      // An inlined callee returns to its caller. Its operand stack sits on
+      // top of the caller's, so drop what it left under the result, which
+      // the verifier counted.
+      if (jumpToBuilderForInlinedReturn != nullptr) {
+        auto depth = body_->plan->stackDepths[instructionIndex];
+        for (std::ptrdiff_t i = 1; i < depth; i++) {
+          drop(builder);
+        }
+        pushBoxed(builder, result);
+        builder->AddFallThroughBuilder(jumpToBuilderForInlinedReturn);
+        break;
+      }
 
       TR::IlValue *stack = builder->StructFieldInstanceAddress(
           "b9::ExecutionContext", "stack_", builder->Load("executionContext"));
 
       builder->StoreIndirect("b9::OperandStack", "top_", stack,
                              builder->Load("stackBase"));
+      popRoots(builder);
 
-      builder->Return(
-          builder->Or(result, builder->ConstInt64(Om::BoxKindTag::INTEGER)));
+      builder->Return(result);
     } break;
     case ByteCode::DUPLICATE: {
-      auto x = pop(builder);
-      push(builder, x);
-      push(builder, x);
+      auto x = popBoxed(builder);
+      pushBoxed(builder, x);
+      pushBoxed(builder, x);
       if (nextBytecodeBuilder) {
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
       }
@@ -371,30 +844,37 @@ bool MethodBuilder::generateILForBytecode(
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
       break;
     case ByteCode::JMP:
+      buildSafepointPoll(builder, function, instruction);
       handle_bc_jmp(builder, bytecodeBuilderTable, program, instructionIndex,
                     nextBytecodeBuilder);
       break;
     case ByteCode::INT_JMP_EQ:
+      buildSafepointPoll(builder, function, instruction);
       handle_bc_jmp_eq(builder, bytecodeBuilderTable, program, instructionIndex,
                        nextBytecodeBuilder);
       break;
     case ByteCode::INT_JMP_NEQ:
+      buildSafepointPoll(builder, function, instruction);
       handle_bc_jmp_neq(builder, bytecodeBuilderTable, program,
                         instructionIndex, nextBytecodeBuilder);
       break;
     case ByteCode::INT_JMP_LT:
+      buildSafepointPoll(builder, function, instruction);
       handle_bc_jmp_lt(builder, bytecodeBuilderTable, program, instructionIndex,
                        nextBytecodeBuilder);
       break;
     case ByteCode::INT_JMP_LE:
+      buildSafepointPoll(builder, function, instruction);
       handle_bc_jmp_le(builder, bytecodeBuilderTable, program, instructionIndex,
                        nextBytecodeBuilder);
       break;
     case ByteCode::INT_JMP_GT:
+      buildSafepointPoll(builder, function, instruction);
       handle_bc_jmp_gt(builder, bytecodeBuilderTable, program, instructionIndex,
                        nextBytecodeBuilder);
       break;
     case ByteCode::INT_JMP_GE:
+      buildSafepointPoll(builder, function, instruction);
       handle_bc_jmp_ge(builder, bytecodeBuilderTable, program, instructionIndex,
                        nextBytecodeBuilder);
       break;
@@ -430,6 +910,7 @@ bool MethodBuilder::generateILForBytecode(
     case ByteCode::PRIMITIVE_CALL: {
       const std::size_t callindex = instruction.parameter();
 
+      spillRoots(builder, function);
       builder->vmState()->Commit(builder);
       TR::IlValue *result =
           builder->Call("primitive_call", 2, builder->Load("executionContext"),
@@ -438,25 +919,28 @@ bool MethodBuilder::generateILForBytecode(
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
     } break;
-    case ByteCode::FUNCTION_CALL: {
+    case ByteCode::FUNCTION_CALL:
+    case ByteCode::TAIL_CALL: {
       const std::size_t callindex = instruction.parameter();
       const FunctionDef *callee = virtualMachine_.getFunction(callindex);
       const Instruction *tocall = callee->instructions.data();
       const std::uint32_t argsCount = callee->nargs;
-      const std::uint32_t regsCount = callee->nregs;
+
+      // Other tail calls are built as a call, that falls through to the
+      // FUNCTION_RETURN after it.
+      if (instruction.byteCode() == ByteCode::TAIL_CALL &&
+          callindex == functionIndex_ && !osr_ && body_->plan->depth == 0) {
+        buildSelfTailCall(builder, function, instructionIndex,
+                          bytecodeBuilderTable[0]);
+        break;
+      }
 
       if (cfg_.directCall) {
         if (cfg_.debug)
           std::cout << "Handling direct calls to " << callee->name << std::endl;
-        const char *interpretName[] = {"interpret_0", "interpret_1",
-                                       "interpret_2", "interpret_3"};
-        const char *nameToCall = interpretName[argsCount];
-        bool interp = true;
-        if (callee == function ||
-            virtualMachine_.getJitAddress(callindex) != nullptr) {
-          nameToCall = callee->name.c_str();
-          interp = false;
-        }
+        // A function calls itself directly. OSR entries have their own
+        // name, so they go through the slot like any other caller.
+        bool self = callindex == functionIndex_ && !osr_;
 
         if (cfg_.passParam) {
           if (cfg_.debug) {
@@ -464,63 +948,70 @@ bool MethodBuilder::generateILForBytecode(
                       << std::endl;
           }
 
-          // Attempt to inline the function we're calling
-          if (maxInlineDepth_ >= 0 && !interp) {
+          auto inlined = body_->plan->callees.find(instructionIndex);
+          if (inlined != body_->plan->callees.end()) {
             int32_t save = firstArgumentIndex;
             int32_t skipLocals = function->nargs + function->nregs;
-            int32_t spaceNeeded = argsCount + regsCount;
             firstArgumentIndex += skipLocals;
+            // The callee's operand stack goes on top of the caller's.
+            frameSize_ += virtualMachine_.getFrameSize(callindex);
+            inlined_.push_back(callee->name);
             // no need to define locals here, the outer program registered
             // all locals. it means some locals will be reused which will
             // affect liveness of a variable
-            if ((firstArgumentIndex + spaceNeeded) < MAX_ARGS_TEMPS_AVAIL) {
-              int storeInto = argsCount;
-              while (storeInto-- > 0) {
-                // firstArgumentIndex is added in storeVarIndex
-                storeVarIndex(builder, storeInto, pop(builder));
-              }
-
-              bool result = inlineProgramIntoBuilder(callindex, false, builder,
-                                                     nextBytecodeBuilder);
-              if (!result) {
-                std::cerr << "Failed inlineProgramIntoBuilder" << std::endl;
-                return result;
-              }
-
-              if (cfg_.debug)
-                std::cout << "Successfully inlined: " << callee->name
-                          << std::endl;
-              firstArgumentIndex = save;
-              break;
+            int storeInto = argsCount;
+            while (storeInto-- > 0) {
+              // firstArgumentIndex is added in storeVarIndex
+              storeVarIndex(builder, storeInto, popBoxed(builder));
+            }
+            // The callee's registers start as the integer 0, as they would
+            // in its own frame. They are spilled as roots, too.
+            for (std::size_t i = argsCount; i < argsCount + callee->nregs;
+                 i++) {
+              storeVarIndex(builder, i,
+                            builder->ConstInt64(Om::BoxKindTag::INTEGER));
             }
-            std::cerr << "SKIP INLINE DUE TO EXCESSIVE TEMPS NEEDED"
-                      << std::endl;
-          }
 
-          if (argsCount > 8) {
-            throw std::runtime_error{
-                "Need to add handlers for more parameters"};
+            // The callee's body is built from the worklist, like the rest.
+            bool result = inlineProgramIntoBuilder(
+                *inlined->second, firstArgumentIndex, builder,
+                nextBytecodeBuilder);
+            firstArgumentIndex = save;
+            if (!result) {
+              std::cerr << "Failed inlineProgramIntoBuilder" << std::endl;
+              return result;
+            }
+
+            if (cfg_.debug)
+              std::cout << "Successfully inlined: " << callee->name
+                        << std::endl;
             break;
           }
 
-          TR::IlValue *p[8];
-          memset(p, 0, sizeof(p));
-          int popInto = argsCount;
-          while (popInto--) {
-            p[popInto] = pop(builder);
+          // The last arguments go in registers. The rest stay on the operand
+          // stack, where the callee pops them.
+          auto count = registerArgCount(argsCount);
+          auto spilled = argsCount - count;
+          TR::IlValue *p[MAX_REGISTER_ARGS] = {};
+          for (auto i = count; i > 0; i--) {
+            p[i - 1] = popBoxed(builder);
           }
-          if (interp) {
-            TR::IlValue *result = builder->Call(
-                nameToCall, 2 + argsCount, builder->Load("executionContext"),
-                builder->ConstInt32(callindex), p[0], p[1], p[2], p[3], p[4],
-                p[5], p[6], p[7]);
-            push(builder, result);
+          // The callee can collect, so the rest of the operand stack goes
+          // to memory, even when every argument is in a register.
+          spillRoots(builder, function);
+          builder->vmState()->Commit(builder);
+          TR::IlValue *result;
+          if (self) {
+            result = builder->Call(callee->name.c_str(), 1 + count,
+                                   builder->Load("executionContext"), p[0],
+                                   p[1], p[2], p[3], p[4]);
           } else {
-            TR::IlValue *result = builder->Call(
-                nameToCall, argsCount + 1, builder->Load("executionContext"),
-                p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
-            push(builder, result);
+            result = callThroughSlot(builder, callindex, count, p);
+          }
+          if (spilled > 0) {
+            QRELOAD_DROP(builder, spilled);
           }
+          pushBoxed(builder, result);
         } else {
           if (cfg_.debug) {
             std::cout << "Parameters are on stack to the function call"
@@ -528,20 +1019,14 @@ bool MethodBuilder::generateILForBytecode(
           }
           TR::IlValue *result;
           builder->vmState()->Commit(builder);
-          if (interp) {
-            if (cfg_.debug)
-              std::cout << "calling interpreter " << nameToCall << std::endl;
-            result =
-                builder->Call(nameToCall, 2, builder->Load("executionContext"),
-                              builder->ConstInt32(callindex));
+          if (self) {
+            result = builder->Call(callee->name.c_str(), 1,
+                                   builder->Load("executionContext"));
           } else {
-            if (cfg_.debug)
-              std::cout << "calling " << nameToCall << " directly" << std::endl;
-            result =
-                builder->Call(nameToCall, 1, builder->Load("executionContext"));
+            result = callThroughSlot(builder, callindex, 0, nullptr);
           }
           QRELOAD_DROP(builder, argsCount);
-          push(builder, result);
+          pushBoxed(builder, result);
         }
       } else {
         // only use interpreter to dispatch the calls
@@ -554,17 +1039,43 @@ bool MethodBuilder::generateILForBytecode(
             builder->Call("interpret_0", 2, builder->Load("executionContext"),
                           builder->ConstInt32(callindex));
         QRELOAD_DROP(builder, argsCount);
-        push(builder, result);
+        pushBoxed(builder, result);
       }
 
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
     } break;
+    case ByteCode::NEW_OBJECT: {
+      // Allocating can collect, and the collector walks the operand stack.
+      spillRoots(builder, function);
+      builder->vmState()->Commit(builder);
+      pushBoxed(builder, builder->Call("jit_new_object", 1,
+                                       builder->Load("executionContext")));
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+    } break;
+    case ByteCode::PUSH_FROM_OBJECT:
+      handle_bc_push_from_object(builder, function, instructionIndex,
+                                 nextBytecodeBuilder);
+      break;
+    case ByteCode::POP_INTO_OBJECT:
+      handle_bc_pop_into_object(builder, function, instructionIndex,
+                                nextBytecodeBuilder);
+      break;
+    case ByteCode::SYSTEM_COLLECT:
+      spillRoots(builder, function);
+      builder->vmState()->Commit(builder);
+      builder->Call("jit_system_collect", 1, builder->Load("executionContext"));
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
     default:
       if (cfg_.debug) {
         std::cout << "Cannot handle unknown bytecode: returning" << std::endl;
       }
-      handled = false;
+      handled = fail(std::string("can't compile ") +
+                     toString(instruction.byteCode()) + " in " +
+                     function->name + "@" + std::to_string(instructionIndex));
       break;
   }
 
@@ -735,17 +1246,187 @@ void MethodBuilder::handle_bc_not(TR::BytecodeBuilder *builder,
   builder->AddFallThroughBuilder(nextBuilder);
 }
 
-void MethodBuilder::drop(TR::BytecodeBuilder *builder) { pop(builder); }
+std::vector<InlineCacheEntry> MethodBuilder::guardedEntries(
+    const FunctionDef *function, std::size_t bytecodeIndex,
+    InlineCache *&cache) {
+  std::size_t index = function - virtualMachine_.module()->functions.data();
+  cache = virtualMachine_.getInlineCache(index, bytecodeIndex);
+  if (cache == nullptr) {
+    return {};
+  }
+  auto entries = cache->entries();
+  for (const auto &entry : entries) {
+    virtualMachine_.pinJitSlot(entry);
+  }
+  return entries;
+}
+
+void MethodBuilder::buildShapeGuards(
+    TR::IlBuilder *builder, TR::IlValue *object,
+    const std::vector<InlineCacheEntry> &entries, const GuardHit &hit,
+    const GuardMiss &miss) {
+  TR::IlBuilder *isObject = nullptr;
+  TR::IlBuilder *notObject = nullptr;
+  builder->IfThenElse(
+      &isObject, &notObject,
+      builder->EqualTo(
+          builder->And(object, builder->ConstInt64(Om::BoxKindTag::MASK)),
+          builder->ConstInt64(Om::BoxKindTag::POINTER)));
+  miss(notObject);
+
+  auto address = isObject->And(object, isObject->ConstInt64(Om::VALUE_MASK));
+  auto header = isObject->LoadAt(
+      globalTypes().stackElementPtr,
+      isObject->ConvertTo(
+          globalTypes().stackElementPtr,
+          isObject->Add(address,
+                        isObject->ConstInt64(Om::ObjectOffsets::header))));
+  auto map = isObject->UnsignedShiftR(
+      header, isObject->ConstInt32(Om::Cell::MAP_SHIFT));
+
+  // Most sites are monomorphic, so the first compare usually hits.
+  TR::IlBuilder *current = isObject;
+  for (const auto &entry : entries) {
+    TR::IlBuilder *match = nullptr;
+    TR::IlBuilder *next = nullptr;
+    auto expected = reinterpret_cast<std::int64_t>(&entry.map->baseMap());
+    current->IfThenElse(&match, &next,
+                        current->EqualTo(map, current->ConstInt64(expected)));
+    hit(match, entry, address, header);
+    current = next;
+  }
+  miss(current);
+}
+
+TR::IlValue *MethodBuilder::slotAddress(TR::IlBuilder *builder,
+                                        TR::IlValue *address,
+                                        Om::SlotIndex index) {
+  return builder->ConvertTo(
+      globalTypes().stackElementPtr,
+      builder->Add(address,
+                   builder->ConstInt64(Om::ObjectOffsets::slot(index))));
+}
+
+// ( object -- value )
+void MethodBuilder::handle_bc_push_from_object(TR::BytecodeBuilder *builder,
+                                               const FunctionDef *function,
+                                               std::size_t bytecodeIndex,
+                                               TR::BytecodeBuilder *nextBuilder) {
+  Parameter slotId = function->instructions[bytecodeIndex].parameter();
+  InlineCache *cache;
+  auto entries = guardedEntries(function, bytecodeIndex, cache);
+  auto object = popBoxed(builder);
+
+  auto slowPath = [&](TR::IlBuilder *b) {
+    builder->vmState()->Commit(b);
+    b->Store("objectValue",
+             b->Call("jit_push_from_object", 4, b->Load("executionContext"),
+                     object, b->ConstInt32(slotId), b->ConstAddress(cache)));
+  };
+
+  if (entries.empty()) {
+    slowPath(builder);
+  } else {
+    buildShapeGuards(
+        builder, object, entries,
+        [&](TR::IlBuilder *b, const InlineCacheEntry &entry,
+            TR::IlValue *address, TR::IlValue *header) {
+          b->Store("objectValue",
+                   b->LoadAt(globalTypes().stackElementPtr,
+                             slotAddress(b, address, entry.index)));
+        },
+        slowPath);
+  }
+
+  pushBoxed(builder, builder->Load("objectValue"));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+// ( value object -- )
+void MethodBuilder::handle_bc_pop_into_object(TR::BytecodeBuilder *builder,
+                                              const FunctionDef *function,
+                                              std::size_t bytecodeIndex,
+                                              TR::BytecodeBuilder *nextBuilder) {
+  Parameter slotId = function->instructions[bytecodeIndex].parameter();
+  InlineCache *cache;
+  auto entries = guardedEntries(function, bytecodeIndex, cache);
+  auto object = popBoxed(builder);
+  auto value = popBoxed(builder);
+
+  // Adding a slot allocates a map, which can collect.
+  auto slowPath = [&](TR::IlBuilder *b) {
+    spillRoots(b, function);
+    builder->vmState()->Commit(b);
+    b->Call("jit_pop_into_object", 5, b->Load("executionContext"), object,
+            value, b->ConstInt32(slotId), b->ConstAddress(cache));
+  };
+
+  if (entries.empty()) {
+    slowPath(builder);
+  } else {
+    buildShapeGuards(
+        builder, object, entries,
+        [&](TR::IlBuilder *b, const InlineCacheEntry &entry,
+            TR::IlValue *address, TR::IlValue *header) {
+          if (entry.transition != nullptr) {
+            auto transition = Om::CellHeader(&entry.transition->baseMap())
+                              << Om::Cell::MAP_SHIFT;
+            auto flags = b->And(header, b->ConstInt64(Om::Cell::FLAGS_MASK));
+            b->StoreAt(
+                b->ConvertTo(
+                    globalTypes().stackElementPtr,
+                    b->Add(address,
+                           b->ConstInt64(Om::ObjectOffsets::header))),
+                b->Or(flags, b->ConstInt64(transition)));
+          }
+          b->StoreAt(slotAddress(b, address, entry.index), value);
+        },
+        slowPath);
+  }
+
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::drop(TR::BytecodeBuilder *builder) { popBoxed(builder); }
 
 /// output is an unboxed value.
 TR::IlValue *MethodBuilder::pop(TR::BytecodeBuilder *builder) {
+  return unbox(builder, popBoxed(builder));
+}
+
+/// input is an unboxed value.
+void MethodBuilder::push(TR::BytecodeBuilder *builder, TR::IlValue *value) {
+  pushBoxed(builder, box(builder, value));
+}
+
+TR::IlValue *MethodBuilder::peekBoxed(TR::BytecodeBuilder *builder,
+                                      std::size_t depth) {
   if (cfg_.lazyVmState) {
     VirtualMachineState *vmState =
         dynamic_cast<VirtualMachineState *>(builder->vmState());
 
-    TR::IlValue *boxedInt = vmState->_stack->Pop(builder);
+    return vmState->_stack->Pick(depth);
+  } else {
+    TR::IlValue *stack = builder->StructFieldInstanceAddress(
+        "b9::ExecutionContext", "stack_", builder->Load("executionContext"));
+
+    TR::IlValue *stackTop =
+        builder->LoadIndirect("b9::OperandStack", "top_", stack);
 
-    return builder->And(boxedInt, builder->ConstInt64(Om::VALUE_MASK));
+    return builder->LoadAt(
+        globalTypes().stackElementPtr,
+        builder->IndexAt(globalTypes().stackElementPtr, stackTop,
+                         builder->ConstInt32(-1 - int32_t(depth))));
+  }
+}
+
+/// output is a boxed value.
+TR::IlValue *MethodBuilder::popBoxed(TR::BytecodeBuilder *builder) {
+  if (cfg_.lazyVmState) {
+    VirtualMachineState *vmState =
+        dynamic_cast<VirtualMachineState *>(builder->vmState());
+
+    return vmState->_stack->Pop(builder);
   } else {
     TR::IlValue *stack = builder->StructFieldInstanceAddress(
         "b9::ExecutionContext", "stack_", builder->Load("executionContext"));
@@ -758,23 +1439,18 @@ TR::IlValue *MethodBuilder::pop(TR::BytecodeBuilder *builder) {
 
     builder->StoreIndirect("b9::OperandStack", "top_", stack, newStackTop);
 
-    TR::IlValue *boxedInt =
-        builder->LoadAt(globalTypes().stackElementPtr, newStackTop);
-
-    return builder->And(boxedInt, builder->ConstInt64(Om::VALUE_MASK));
+    return builder->LoadAt(globalTypes().stackElementPtr, newStackTop);
   }
 }
 
-/// input is an unboxed value.
-void MethodBuilder::push(TR::BytecodeBuilder *builder, TR::IlValue *value) {
+/// input is a boxed value.
+void MethodBuilder::pushBoxed(TR::BytecodeBuilder *builder,
+                              TR::IlValue *value) {
   if (cfg_.lazyVmState) {
     VirtualMachineState *vmState =
         dynamic_cast<VirtualMachineState *>(builder->vmState());
 
-    auto boxedInt =
-        builder->Or(value, builder->ConstInt64(Om::BoxKindTag::INTEGER));
-
-    vmState->_stack->Push(builder, boxedInt);
+    vmState->_stack->Push(builder, value);
   } else {
     TR::IlValue *stack = builder->StructFieldInstanceAddress(
         "b9::ExecutionContext", "stack_", builder->Load("executionContext"));
@@ -782,11 +1458,8 @@ void MethodBuilder::push(TR::BytecodeBuilder *builder, TR::IlValue *value) {
     TR::IlValue *stackTop =
         builder->LoadIndirect("b9::OperandStack", "top_", stack);
 
-    auto boxedInt =
-        builder->Or(value, builder->ConstInt64(Om::BoxKindTag::INTEGER));
-
     builder->StoreAt(stackTop,
-                     builder->ConvertTo(globalTypes().stackElement, boxedInt));
+                     builder->ConvertTo(globalTypes().stackElement, value));
 
     TR::IlValue *newStackTop = builder->IndexAt(
         globalTypes().stackElementPtr, stackTop, builder->ConstInt32(1));
@@ -0,0 +1,108 @@
+#include <b9/WarmProfile.hpp>
+
+#include <sstream>
+
+namespace b9 {
+
+static const char *const PROFILE_MAGIC = "b9profile";
+static const int PROFILE_VERSION = 1;
+
+void writeProfile(std::ostream &out, const WarmProfile &profile) {
+  const auto &cfg = profile.config;
+  out << PROFILE_MAGIC << " " << PROFILE_VERSION << std::endl
+      << "jit " << cfg.jit << std::endl
+      << "tiered " << cfg.tiered << std::endl
+      << "invocations " << cfg.invocationThreshold << std::endl
+      << "backedges " << cfg.backedgeThreshold << std::endl
+      << "osr " << cfg.osr << std::endl
+      << "inline " << cfg.maxInlineDepth << std::endl
+      << "directcall " << cfg.directCall << std::endl
+      << "passparam " << cfg.passParam << std::endl
+      << "lazyvmstate " << cfg.lazyVmState << std::endl;
+  // The name goes last, so it can hold anything but a newline.
+  for (const auto &function : profile.functions) {
+    out << "function " << function.invocations << " " << function.backedges
+        << " " << function.name << std::endl;
+  }
+  if (!out) {
+    throw ProfileException{"Error writing profile"};
+  }
+}
+
+const char *configMismatch(const WarmProfile &profile, const Config &cfg) {
+  const auto &recorded = profile.config;
+  if (recorded.jit != cfg.jit) return "jit";
+  if (recorded.tiered != cfg.tiered) return "tiered";
+  if (recorded.invocationThreshold != cfg.invocationThreshold) {
+    return "invocations";
+  }
+  if (recorded.backedgeThreshold != cfg.backedgeThreshold) return "backedges";
+  if (recorded.osr != cfg.osr) return "osr";
+  if (recorded.maxInlineDepth != cfg.maxInlineDepth) return "inline";
+  if (recorded.directCall != cfg.directCall) return "directcall";
+  if (recorded.passParam != cfg.passParam) return "passparam";
+  if (recorded.lazyVmState != cfg.lazyVmState) return "lazyvmstate";
+  return nullptr;
+}
+
+WarmProfile readProfile(std::istream &in) {
+  std::string line;
+  std::string magic;
+  int version = 0;
+  if (!std::getline(in, line) ||
+      !(std::istringstream(line) >> magic >> version) ||
+      magic != PROFILE_MAGIC) {
+    throw ProfileException{"Not a profile"};
+  }
+  if (version != PROFILE_VERSION) {
+    throw ProfileException{"Unsupported profile version " +
+                           std::to_string(version)};
+  }
+
+  WarmProfile profile;
+  auto &cfg = profile.config;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string key;
+    fields >> key;
+    bool ok;
+    if (key == "function") {
+      FunctionRecord function;
+      ok = static_cast<bool>(fields >> function.invocations >>
+                             function.backedges);
+      fields.get();  // The space before the name
+      ok = ok && std::getline(fields, function.name) &&
+           !function.name.empty();
+      profile.functions.push_back(std::move(function));
+    } else if (key == "jit") {
+      ok = static_cast<bool>(fields >> cfg.jit);
+    } else if (key == "tiered") {
+      ok = static_cast<bool>(fields >> cfg.tiered);
+    } else if (key == "invocations") {
+      ok = static_cast<bool>(fields >> cfg.invocationThreshold);
+    } else if (key == "backedges") {
+      ok = static_cast<bool>(fields >> cfg.backedgeThreshold);
+    } else if (key == "osr") {
+      ok = static_cast<bool>(fields >> cfg.osr);
+    } else if (key == "inline") {
+      ok = static_cast<bool>(fields >> cfg.maxInlineDepth);
+    } else if (key == "directcall") {
+      ok = static_cast<bool>(fields >> cfg.directCall);
+    } else if (key == "passparam") {
+      ok = static_cast<bool>(fields >> cfg.passParam);
+    } else if (key == "lazyvmstate") {
+      ok = static_cast<bool>(fields >> cfg.lazyVmState);
+    } else {
+      throw ProfileException{"Unknown profile entry: " + key};
+    }
+    if (!ok) {
+      throw ProfileException{"Malformed profile line: " + line};
+    }
+  }
+  return profile;
+}
+
+}  // namespace b9
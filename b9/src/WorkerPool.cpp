@@ -0,0 +1,140 @@
+#include <b9/WorkerPool.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+namespace b9 {
+
+WorkerPool::WorkerPool(std::size_t size) {
+  for (std::size_t worker = 1; worker < size; worker++) {
+    threads_.emplace_back([this, worker] { work(worker); });
+  }
+}
+
+WorkerPool::~WorkerPool() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  started_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkerPool::run(const Task &task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(task_ == nullptr);
+    task_ = &task;
+    error_ = nullptr;
+    running_ = threads_.size();
+    generation_++;
+  }
+  started_.notify_all();
+
+  call(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_.wait(lock, [this] { return running_ == 0; });
+  task_ = nullptr;
+  if (error_ != nullptr) {
+    std::rethrow_exception(error_);
+  }
+}
+
+void WorkerPool::work(std::size_t worker) {
+  std::size_t generation = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    started_.wait(lock,
+                  [&] { return stopping_ || generation_ != generation; });
+    if (stopping_) {
+      return;
+    }
+    generation = generation_;
+
+    lock.unlock();
+    call(worker);
+    lock.lock();
+
+    if (--running_ == 0) {
+      finished_.notify_one();
+    }
+  }
+}
+
+void WorkerPool::call(std::size_t worker) {
+  try {
+    (*task_)(worker);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_ == nullptr) {
+      error_ = std::current_exception();
+    }
+  }
+}
+
+WorkRanges::WorkRanges(std::size_t count, std::size_t workers,
+                       std::size_t chunk)
+    : shares_(new Share[workers]), workers_(workers), chunk_(chunk) {
+  assert(count <= MAX_COUNT);
+  assert(workers > 0 && chunk > 0);
+  for (std::size_t i = 0; i < workers; i++) {
+    shares_[i].range.store(
+        pack(count * i / workers, count * (i + 1) / workers),
+        std::memory_order_relaxed);
+  }
+}
+
+bool WorkRanges::next(std::size_t worker, std::size_t &first,
+                      std::size_t &last) {
+  while (!take(worker, first, last)) {
+    if (!steal(worker)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool WorkRanges::take(std::size_t worker, std::size_t &first,
+                      std::size_t &last) {
+  auto &share = shares_[worker].range;
+  auto range = share.load(std::memory_order_relaxed);
+  do {
+    if (begin(range) == end(range)) {
+      return false;
+    }
+    first = begin(range);
+    last = std::min(first + chunk_, end(range));
+  } while (!share.compare_exchange_weak(range, pack(last, end(range)),
+                                        std::memory_order_relaxed));
+  return true;
+}
+
+bool WorkRanges::steal(std::size_t worker) {
+  // Look at the other workers in turn, starting with the next one, so
+  // thieves spread out over the victims.
+  for (std::size_t i = 1; i < workers_; i++) {
+    auto victim = (worker + i) % workers_;
+    auto &share = shares_[victim].range;
+    auto range = share.load(std::memory_order_relaxed);
+    while (begin(range) != end(range)) {
+      // Take the back half, rounded up, so the last index can be stolen.
+      auto size = end(range) - begin(range);
+      auto middle = begin(range) + size / 2;
+      if (share.compare_exchange_weak(range, pack(begin(range), middle),
+                                      std::memory_order_relaxed)) {
+        // This worker's share is empty, and nobody steals from an empty
+        // share, so it can be set directly.
+        shares_[worker].range.store(pack(middle, end(range)),
+                                    std::memory_order_relaxed);
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace b9
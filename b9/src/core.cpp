@@ -1,6 +1,11 @@
 #include <b9/VirtualMachine.hpp>
 #include <b9/ExecutionContext.hpp>
 #include <b9/compiler/Compiler.hpp>
+#include <b9/compiler/InlinePlan.hpp>
+#include <b9/WarmProfile.hpp>
+#include <b9/optimize.hpp>
+#include <b9/tailcall.hpp>
+#include <b9/verifier.hpp>
 
 #include <OMR/Om/Allocator.inl.hpp>
 #include <OMR/Om/ArrayBuffer.inl.hpp>
@@ -15,6 +20,7 @@
 #include <Jit.hpp>
 
 #include <sys/time.h>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -27,13 +33,69 @@ namespace b9 {
 
 constexpr PrimitiveFunction *const VirtualMachine::primitives_[3];
 
+/// Identifies each VirtualMachine to the threads' context pools.
+static std::atomic<std::size_t> nextVirtualMachineId{0};
+
+/// The contexts one thread keeps for one VirtualMachine. Only the thread
+/// leases and releases them, without a lock. The lock is taken to free them,
+/// by whichever of the thread and the VM goes first.
+struct ContextPool {
+  explicit ContextPool(std::size_t vmId) : vmId(vmId) {}
+
+  const std::size_t vmId;
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ExecutionContext>> contexts;
+  bool released = false;  //< The VM was destroyed
+};
+
+namespace {
+
+/// The calling thread's context pools, one for each VM it leased from.
+struct ThreadContextPools {
+  ~ThreadContextPools() noexcept {
+    // A VM being destroyed waits on the lock, so it's still alive here if
+    // it hasn't freed the pool yet.
+    for (auto &pool : pools) {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      pool->contexts.clear();
+    }
+  }
+
+  std::vector<std::shared_ptr<ContextPool>> pools;
+};
+
+thread_local ThreadContextPools threadContextPools;
+
+}  // namespace
+
 VirtualMachine::VirtualMachine(OMR::Om::ProcessRuntime &runtime,
                                const Config &cfg)
     : cfg_{cfg},
       memoryManager_(runtime),
-      compiler_{nullptr} {
+      compiler_{nullptr},
+      id_(nextVirtualMachineId++) {
   if (cfg_.verbose) std::cout << "VM initializing..." << std::endl;
 
+  if (cfg_.tiered && !cfg_.jit) {
+    throw ConfigException{"tiered requires jit"};
+  }
+  // The threaded interpreter never checks the code, so it only runs verified
+  // code.
+  if (cfg_.threaded && !cfg_.verify) {
+    throw ConfigException{"threaded requires verify"};
+  }
+  // Neither does jitted code, and it needs the verifier's stack depths to
+  // check its frames.
+  if (cfg_.jit && !cfg_.verify) {
+    throw ConfigException{"jit requires verify"};
+  }
+  if (cfg_.deoptLimit == 0) {
+    throw ConfigException{"deoptLimit must be at least 1"};
+  }
+  if (cfg_.recompile && cfg_.recompileThreshold == 0) {
+    throw ConfigException{"recompileThreshold must be at least 1"};
+  }
+
   if (cfg_.jit) {
     auto ok = initializeJit();
     if (!ok) {
@@ -41,18 +103,154 @@ VirtualMachine::VirtualMachine(OMR::Om::ProcessRuntime &runtime,
     }
 
     compiler_ = std::make_shared<Compiler>(*this, cfg_);
+
+    if (cfg_.asyncCompile) {
+      compileQueue_.reset(new CompileQueue(
+          [this](std::size_t functionIndex) {
+            std::lock_guard<std::mutex> lock(compileMutex_);
+            return compileQueued(functionIndex);
+          },
+          cfg_.compileQueueLimit));
+    }
   }
 }
 
 VirtualMachine::~VirtualMachine() noexcept {
+  // Stop the background compiler before the JIT goes away.
+  compileQueue_.reset();
+  // Free the contexts of threads that are still running. Their pools are
+  // left empty, and dropped by their next lease from another VM.
+  {
+    std::lock_guard<std::mutex> lock(contextPoolsMutex_);
+    for (const auto &weak : contextPools_) {
+      if (auto pool = weak.lock()) {
+        std::lock_guard<std::mutex> poolLock(pool->mutex);
+        pool->contexts.clear();
+        pool->released = true;
+      }
+    }
+  }
   if (cfg_.jit) {
     shutdownJit();
   }
 }
 
 void VirtualMachine::load(std::shared_ptr<const Module> module) {
+  optimizeStats_ = OptimizeStats();
+  if (cfg_.optimize || cfg_.tailCalls) {
+    auto rewritten = std::make_shared<Module>(*module);
+    // Optimize first: threaded jumps put more calls in tail position.
+    if (cfg_.optimize) {
+      optimizeStats_ = optimize(*rewritten);
+    }
+    if (cfg_.tailCalls) {
+      rewriteTailCalls(*rewritten);
+    }
+    module = rewritten;
+  }
+
+  maxStackDepths_.clear();
+  verifyTime_ = verifyTime_.zero();
+  if (cfg_.verify) {
+    auto start = std::chrono::steady_clock::now();
+    auto maxStackDepths = verify(*module);
+    verifyTime_ = std::chrono::steady_clock::now() - start;
+    maxStackDepths_ = std::move(maxStackDepths);
+  }
+
   module_ = module;
-  compiledFunctions_.reserve(getFunctionCount());
+
+  frameSizes_.clear();
+  for (std::size_t i = 0; i < getFunctionCount(); i++) {
+    const auto &function = module_->functions[i];
+    auto depth = verified() ? maxStackDepths_[i] : 0;
+    frameSizes_.push_back(function.nregs + depth);
+  }
+
+  compiledFunctions_ =
+      std::vector<std::atomic<JitFunction>>(getFunctionCount());
+  for (auto &compiled : compiledFunctions_) {
+    compiled.store(nullptr, std::memory_order_relaxed);
+  }
+  dispatchSlots_ = std::vector<std::atomic<void *>>(getFunctionCount());
+  for (std::size_t i = 0; i < getFunctionCount(); i++) {
+    dispatchSlots_[i].store(dispatchTrampoline(module_->functions[i].nargs),
+                            std::memory_order_relaxed);
+  }
+  jitCounters_.assign(getFunctionCount(), 0);
+  profiles_ = std::vector<FunctionProfile>(getFunctionCount());
+  nonIntegerVars_.clear();
+  for (const auto &function : module_->functions) {
+    nonIntegerVars_.emplace_back(function.nargs + function.nregs);
+  }
+  {
+    std::lock_guard<std::mutex> lock(inlineLogMutex_);
+    inlineLog_.clear();
+  }
+  {
+    std::lock_guard<std::mutex> lock(compileLogMutex_);
+    compileLog_.clear();
+  }
+  osrEntries_.assign(getFunctionCount(), {});
+
+  // Give every object access its own inline cache, and every call its own
+  // counter.
+  std::size_t objectAccesses = 0;
+  std::size_t calls = 0;
+  siteIndices_.clear();
+  for (const auto &function : module_->functions) {
+    std::vector<std::uint32_t> indices(function.instructions.size(), 0);
+    for (std::size_t i = 0; i < function.instructions.size(); i++) {
+      auto bc = function.instructions[i].byteCode();
+      if (bc == ByteCode::PUSH_FROM_OBJECT || bc == ByteCode::POP_INTO_OBJECT) {
+        indices[i] = objectAccesses++;
+      } else if (bc == ByteCode::FUNCTION_CALL ||
+                 bc == ByteCode::TAIL_CALL) {
+        indices[i] = calls++;
+      }
+    }
+    siteIndices_.push_back(std::move(indices));
+  }
+  inlineCaches_ = std::vector<InlineCache>(objectAccesses);
+  callCounts_ = std::vector<std::atomic<std::size_t>>(calls);
+  for (auto &count : callCounts_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+  {
+    std::lock_guard<std::mutex> lock(jitSlotsMutex_);
+    jitSlots_.clear();
+  }
+
+  if (cfg_.quicken) {
+    quickFunctions_.clear();
+    dequickened_.clear();
+    for (const auto &function : module_->functions) {
+      quickFunctions_.emplace_back(function.instructions.size());
+      auto &quick = quickFunctions_.back();
+      for (std::size_t i = 0; i < quick.size(); i++) {
+        quick[i].store(function.instructions[i].raw(),
+                       std::memory_order_relaxed);
+      }
+      dequickened_.emplace_back(function.instructions.size());
+    }
+    // Every site is quickened at most once, so the tables never grow past
+    // this, and never move under the threads reading them.
+    quickSlots_.clear();
+    quickSlots_.reserve(objectAccesses);
+    quickCalls_.clear();
+    quickCalls_.reserve(calls);
+    quickenStats_ = QuickenStats();
+  }
+
+  if (cfg_.threaded) {
+    threadedFunctions_.clear();
+    threadedFunctions_.reserve(getFunctionCount());
+    for (const auto &function : module_->functions) {
+      threadedFunctions_.push_back(
+          ExecutionContext::threadFunction(function, cfg_.fuse,
+                                           cfg_.frameStack));
+    }
+  }
 }
 
 /// ByteCode Interpreter
@@ -62,12 +260,37 @@ JitFunction VirtualMachine::getJitAddress(std::size_t functionIndex) {
   if (functionIndex >= compiledFunctions_.size()) {
     return nullptr;
   }
-  return compiledFunctions_[functionIndex];
+  return compiledFunctions_[functionIndex].load(std::memory_order_acquire);
 }
 
 void VirtualMachine::setJitAddress(std::size_t functionIndex,
                                    JitFunction value) {
-  compiledFunctions_[functionIndex] = value;
+  // Publish the code once it's complete. Threads that see the new address
+  // see the code behind it.
+  compiledFunctions_[functionIndex].store(value, std::memory_order_release);
+
+  // Jitted callers pick up the new code on their next call.
+  void *target = value != nullptr
+                     ? (void *)value
+                     : dispatchTrampoline(getFunction(functionIndex)->nargs);
+  dispatchSlots_[functionIndex].store(target, std::memory_order_release);
+}
+
+void *VirtualMachine::dispatchTrampoline(std::size_t nargs) const {
+  static void *const trampolines[] = {
+      (void *)&jit_dispatch_0, (void *)&jit_dispatch_1,
+      (void *)&jit_dispatch_2, (void *)&jit_dispatch_3,
+      (void *)&jit_dispatch_4, (void *)&jit_dispatch_5};
+  static_assert(sizeof(trampolines) / sizeof(trampolines[0]) ==
+                    MAX_REGISTER_ARGS + 1,
+                "Every register count needs a trampoline");
+  // Without passParam, every argument is on the operand stack.
+  return trampolines[cfg_.passParam ? registerArgCount(nargs) : 0];
+}
+
+const ThreadedInstruction *VirtualMachine::getThreadedCode(
+    std::size_t functionIndex) {
+  return threadedFunctions_[functionIndex].data();
 }
 
 PrimitiveFunction *VirtualMachine::getPrimitive(std::size_t index) {
@@ -78,9 +301,10 @@ const FunctionDef *VirtualMachine::getFunction(std::size_t index) {
   return &module_->functions[index];
 }
 
-JitFunction VirtualMachine::generateCode(const std::size_t functionIndex) {
+JitFunction VirtualMachine::generateCode(const std::size_t functionIndex,
+                                         CompileLevel level) {
   try {
-    return compiler_->generateCode(functionIndex);
+    return compiler_->generateCode(functionIndex, level);
   } catch (const CompilationException &e) {
     auto f = getFunction(functionIndex);
     std::cerr << "Warning: Failed to compile " << f << std::endl;
@@ -97,18 +321,490 @@ std::size_t VirtualMachine::getFunctionCount() {
   return module_->functions.size();
 }
 
-void VirtualMachine::generateAllCode() {
-  assert(cfg_.jit);
-  auto functionIndex = 0;
+GenerateStats VirtualMachine::generateAllCode() {
+  if (!cfg_.jit) {
+    throw ConfigException{"generateAllCode requires jit"};
+  }
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  auto count = getFunctionCount();
+  std::size_t threads = cfg_.compileThreads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::max<std::size_t>(1, std::min(threads, count));
 
-  while (functionIndex < getFunctionCount()) {
+  GenerateStats stats;
+  stats.functions = count;
+  stats.threadTimes.assign(threads, GenerateStats::Duration(0));
+  stats.threadFunctions.assign(threads, 0);
+
+  // Planning doesn't touch the JIT, so it runs on every thread. Each plan
+  // inlines the callees that will be installed before its function is.
+  std::vector<InlinePlan> plans(count);
+  auto plan = [&](std::size_t worker, std::size_t first, std::size_t last) {
+    auto planStart = Clock::now();
+    for (auto functionIndex = first; functionIndex < last; functionIndex++) {
+      plans[functionIndex] = planInlining(
+          *this, functionIndex, CompileLevel::BASELINE,
+          [&](std::size_t callee) {
+            return callee < functionIndex || getJitAddress(callee) != nullptr;
+          });
+    }
+    stats.threadTimes[worker] += Clock::now() - planStart;
+    stats.threadFunctions[worker] += last - first;
+  };
+  if (threads == 1) {
+    plan(0, 0, count);
+  } else {
+    WorkerPool pool(threads);
+    WorkRanges ranges(count, threads, 1);
+    pool.run([&](std::size_t worker) {
+      std::size_t first, last;
+      while (ranges.next(worker, first, last)) {
+        plan(worker, first, last);
+      }
+    });
+  }
+
+  // The JIT isn't reentrant, so this takes the lock of every other compile.
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  for (std::size_t functionIndex = 0; functionIndex < count;
+       functionIndex++) {
     if (cfg_.debug)
       std::cout << "\nJitting function: " << getFunction(functionIndex)->name
                 << std::endl;
-    auto func = compiler_->generateCode(functionIndex);
-    compiledFunctions_.push_back(func);
-    ++functionIndex;
+    auto compileStart = Clock::now();
+    auto func = compiler_->generateCode(functionIndex, plans[functionIndex]);
+    stats.compileTime += Clock::now() - compileStart;
+    setJitAddress(functionIndex, func);
+    profiles_[functionIndex].tier = Tier::COMPILED;
+  }
+  stats.time = Clock::now() - start;
+  return stats;
+}
+
+void VirtualMachine::countInvocation(std::size_t functionIndex) {
+  auto &profile = profiles_[functionIndex];
+  auto invocations =
+      profile.invocations.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (invocations >= cfg_.invocationThreshold) {
+    if (compileQueue_ != nullptr) {
+      queueCompile(functionIndex, CompilePriority::INVOCATION);
+    } else {
+      tierUp(functionIndex);
+    }
+  }
+}
+
+void VirtualMachine::countBackedge(std::size_t functionIndex) {
+  auto &profile = profiles_[functionIndex];
+  auto backedges =
+      profile.backedges.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (backedges >= cfg_.backedgeThreshold) {
+    if (compileQueue_ != nullptr) {
+      queueCompile(functionIndex, CompilePriority::BACKEDGE);
+    } else {
+      tierUp(functionIndex);
+    }
+  }
+}
+
+bool VirtualMachine::tierUp(std::size_t functionIndex) {
+  if (!cfg_.jit) {
+    throw ConfigException{"tierUp requires jit"};
+  }
+  // Past the threshold, every count lands here. Settled functions don't
+  // take the lock, like queueCompile.
+  auto tier = profiles_[functionIndex].tier.load(std::memory_order_relaxed);
+  if (tier == Tier::COMPILED || tier == Tier::FAILED) {
+    return tier == Tier::COMPILED;
+  }
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  return compileLocked(functionIndex);
+}
+
+bool VirtualMachine::queueCompile(std::size_t functionIndex,
+                                  CompilePriority priority) {
+  assert(compileQueue_ != nullptr);
+  auto &profile = profiles_[functionIndex];
+  auto tier = profile.tier.load(std::memory_order_relaxed);
+  if (tier != Tier::INTERPRETED && tier != Tier::QUEUED) {
+    return true;
+  }
+  // A queued function is only pushed again once, when its loop crosses the
+  // backedge threshold while it's waiting, to move it up the queue. The
+  // latch is only set once the push succeeds, so a full queue is retried.
+  if (tier == Tier::QUEUED &&
+      (priority != CompilePriority::BACKEDGE ||
+       profile.loopQueued.load(std::memory_order_relaxed))) {
+    return true;
+  }
+  if (!compileQueue_->push(functionIndex, priority)) {
+    return false;
+  }
+  if (priority == CompilePriority::BACKEDGE) {
+    profile.loopQueued.store(true, std::memory_order_relaxed);
+  }
+  if (cfg_.verbose && tier == Tier::INTERPRETED) {
+    std::cout << "Queueing: " << getFunction(functionIndex)->name
+              << " priority: " << priority << std::endl;
+  }
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  if (profile.tier == Tier::INTERPRETED) {
+    profile.tier = Tier::QUEUED;
+  }
+  return true;
+}
+
+void VirtualMachine::drainCompileQueue() {
+  if (compileQueue_ != nullptr) {
+    compileQueue_->drain();
+  }
+}
+
+CompileStats VirtualMachine::compileStats() const {
+  if (compileQueue_ == nullptr) {
+    return CompileStats();
+  }
+  return compileQueue_->stats();
+}
+
+WarmProfile VirtualMachine::recordProfile() const {
+  WarmProfile profile;
+  profile.config = cfg_;
+  for (std::size_t i = 0; i < module_->functions.size(); i++) {
+    profile.functions.push_back(
+        {module_->functions[i].name,
+         profiles_[i].invocations.load(std::memory_order_relaxed),
+         profiles_[i].backedges.load(std::memory_order_relaxed)});
+  }
+  return profile;
+}
+
+std::size_t VirtualMachine::warmUp(const WarmProfile &profile) {
+  if (!cfg_.jit) {
+    throw ConfigException{"warmUp requires jit"};
+  }
+  // Another config makes other functions hot, and compiles them differently.
+  if (auto option = configMismatch(profile, cfg_)) {
+    throw ProfileException{std::string("Profile was taken with another ") +
+                           option + " option"};
+  }
+  std::vector<std::pair<std::size_t, const FunctionRecord *>> hot;
+  for (const auto &function : profile.functions) {
+    if (!profile.hot(function)) {
+      continue;
+    }
+    std::size_t functionIndex;
+    try {
+      functionIndex = module_->getFunctionIndex(function.name);
+    } catch (const FunctionNotFoundException &) {
+      continue;
+    }
+    auto &counters = profiles_[functionIndex];
+    counters.invocations.store(
+        std::max(counters.invocations.load(std::memory_order_relaxed),
+                 function.invocations),
+        std::memory_order_relaxed);
+    counters.backedges.store(
+        std::max(counters.backedges.load(std::memory_order_relaxed),
+                 function.backedges),
+        std::memory_order_relaxed);
+    hot.emplace_back(functionIndex, &function);
+  }
+
+  auto loops = [&](const FunctionRecord &function) {
+    return function.backedges >= profile.config.backedgeThreshold;
+  };
+  std::stable_sort(hot.begin(), hot.end(), [&](const auto &lhs,
+                                               const auto &rhs) {
+    if (loops(*lhs.second) != loops(*rhs.second)) {
+      return loops(*lhs.second);
+    }
+    return lhs.second->invocations > rhs.second->invocations;
+  });
+
+  std::size_t count = 0;
+  for (const auto &entry : hot) {
+    if (cfg_.verbose) {
+      std::cout << "Warming up: " << entry.second->name << std::endl;
+    }
+    if (compileQueue_ != nullptr) {
+      auto priority = loops(*entry.second) ? CompilePriority::BACKEDGE
+                                           : CompilePriority::INVOCATION;
+      count += queueCompile(entry.first, priority);
+    } else {
+      count += tierUp(entry.first);
+    }
+  }
+  return count;
+}
+
+bool VirtualMachine::compileLocked(std::size_t functionIndex) {
+  auto &profile = profiles_[functionIndex];
+  if (profile.tier == Tier::COMPILED || profile.tier == Tier::FAILED) {
+    return profile.tier == Tier::COMPILED;
+  }
+
+  if (cfg_.verbose) {
+    std::cout << "Tiering up: " << getFunction(functionIndex)->name
+              << " invocations: " << profile.invocations
+              << " backedges: " << profile.backedges << std::endl;
+  }
+
+  auto func = generateCode(functionIndex);
+  if (func == nullptr) {
+    profile.tier = Tier::FAILED;
+    return false;
+  }
+
+  setJitAddress(functionIndex, func);
+  profile.tier = Tier::COMPILED;
+  return true;
+}
+
+void VirtualMachine::countDeopt(std::size_t functionIndex,
+                                std::size_t bytecodeIndex) {
+  auto &profile = profiles_[functionIndex];
+  auto deopts = profile.deopts.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (cfg_.verbose) {
+    std::cout << "Deoptimizing: " << getFunction(functionIndex)->name << "@"
+              << bytecodeIndex << " deopts: " << deopts << std::endl;
+  }
+  if (deopts % cfg_.deoptLimit != 0) {
+    return;
+  }
+
+  // The deopting code keeps running meanwhile, so with a background compiler
+  // the mutator doesn't wait for the recompile.
+  if (compileQueue_ != nullptr) {
+    if (!profile.deoptQueued.exchange(true, std::memory_order_relaxed) &&
+        !compileQueue_->push(functionIndex, CompilePriority::RECOMPILE)) {
+      profile.deoptQueued.store(false, std::memory_order_relaxed);
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  recompileLocked(functionIndex, profile.level);
+}
+
+bool VirtualMachine::recompileLocked(std::size_t functionIndex,
+                                     CompileLevel level) {
+  if (cfg_.verbose) {
+    std::cout << "Recompiling: " << getFunction(functionIndex)->name
+              << " level: " << level << std::endl;
+  }
+  // New calls get the new code, through the dispatch slot for jitted
+  // callers.
+  auto func = generateCode(functionIndex, level);
+  if (func == nullptr) {
+    return false;
+  }
+  setJitAddress(functionIndex, func);
+  profiles_[functionIndex].level = level;
+  return true;
+}
+
+bool VirtualMachine::compileQueued(std::size_t functionIndex) {
+  auto &profile = profiles_[functionIndex];
+  auto hot = profile.hotQueued.exchange(false, std::memory_order_relaxed);
+  auto deopt = profile.deoptQueued.exchange(false, std::memory_order_relaxed);
+  if (!hot && !deopt) {
+    return compileLocked(functionIndex);
   }
+  // The queue holds one request per function. The hot code is compiled with
+  // the latest feedback, so it stands in for a deopt recompile too.
+  if (hot && recompileLocked(functionIndex, CompileLevel::HOT)) {
+    return true;
+  }
+  return deopt && recompileLocked(functionIndex, profile.level);
+}
+
+bool VirtualMachine::recompileHot(std::size_t functionIndex) {
+  auto &profile = profiles_[functionIndex];
+  if (profile.hotRequested.exchange(true, std::memory_order_relaxed)) {
+    return false;
+  }
+
+  // Like a deopt recompile, the mutator doesn't wait for it with a
+  // background compiler. If the queue is full, the next time the counter
+  // reaches the threshold asks again.
+  if (compileQueue_ != nullptr) {
+    profile.hotQueued.store(true, std::memory_order_relaxed);
+    if (!compileQueue_->push(functionIndex, CompilePriority::RECOMPILE)) {
+      profile.hotQueued.store(false, std::memory_order_relaxed);
+      profile.hotRequested.store(false, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  return recompileLocked(functionIndex, CompileLevel::HOT);
+}
+
+void VirtualMachine::logInlineDecision(const InlineDecision &decision) {
+  if (cfg_.verbose) {
+    std::cout << decision << std::endl;
+  }
+  std::lock_guard<std::mutex> lock(inlineLogMutex_);
+  inlineLog_.push_back(decision);
+}
+
+std::vector<InlineDecision> VirtualMachine::inlineDecisions() const {
+  std::lock_guard<std::mutex> lock(inlineLogMutex_);
+  return inlineLog_;
+}
+
+void VirtualMachine::logCompile(const CompileRecord &record) {
+  std::lock_guard<std::mutex> lock(compileLogMutex_);
+  compileLog_.push_back(record);
+}
+
+std::vector<CompileRecord> VirtualMachine::jitStats() const {
+  std::lock_guard<std::mutex> lock(compileLogMutex_);
+  return compileLog_;
+}
+
+OsrFunction VirtualMachine::getOsrEntry(std::size_t functionIndex,
+                                        std::size_t bytecodeIndex,
+                                        std::size_t stackDepth) {
+  assert(cfg_.jit);
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  auto &entries = osrEntries_[functionIndex];
+  auto found = entries.find(bytecodeIndex);
+  if (found != entries.end()) {
+    return found->second;
+  }
+
+  OsrFunction entry = nullptr;
+
+  // The simulated operand stack of lazyVmState starts out empty, so it can
+  // only take over a frame with nothing on its operand stack.
+  if (!cfg_.lazyVmState || stackDepth == 0) {
+    if (cfg_.verbose) {
+      std::cout << "Compiling OSR entry: " << getFunction(functionIndex)->name
+                << " @" << bytecodeIndex << std::endl;
+    }
+    try {
+      entry = compiler_->generateOsrCode(functionIndex, bytecodeIndex);
+    } catch (const CompilationException &e) {
+      std::cerr << "Warning: Failed to compile OSR entry for "
+                << getFunction(functionIndex)->name << std::endl;
+      std::cerr << "    with error: " << e.what() << std::endl;
+    }
+  }
+
+  entries[bytecodeIndex] = entry;
+  return entry;
+}
+
+void VirtualMachine::quickenObjectAccess(std::size_t functionIndex,
+                                         std::size_t bytecodeIndex,
+                                         const InlineCacheEntry &entry) {
+  if (dequickened_[functionIndex][bytecodeIndex].load(
+          std::memory_order_relaxed)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(quickenMutex_);
+  const auto &original =
+      module_->functions[functionIndex].instructions[bytecodeIndex];
+  auto &instruction = quickFunctions_[functionIndex][bytecodeIndex];
+  // Another thread may have quickened it, or given up on it, first.
+  if (instruction.load(std::memory_order_relaxed) != original.raw() ||
+      dequickened_[functionIndex][bytecodeIndex]) {
+    return;
+  }
+  auto quick = original.byteCode() == ByteCode::PUSH_FROM_OBJECT
+                   ? ByteCode::QUICK_PUSH_FROM_OBJECT
+                   : ByteCode::QUICK_POP_INTO_OBJECT;
+  quickSlots_.push_back(entry);
+  publishQuick(instruction, Instruction(quick, quickSlots_.size() - 1));
+  quickenStats_.quickened++;
+}
+
+void VirtualMachine::quickenCall(std::size_t functionIndex,
+                                 std::size_t bytecodeIndex) {
+  const auto &original =
+      module_->functions[functionIndex].instructions[bytecodeIndex];
+  std::size_t callee = original.parameter();
+  auto entry = getJitAddress(callee);
+  if (entry == nullptr ||
+      dequickened_[functionIndex][bytecodeIndex].load(
+          std::memory_order_relaxed)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(quickenMutex_);
+  auto &instruction = quickFunctions_[functionIndex][bytecodeIndex];
+  if (instruction.load(std::memory_order_relaxed) != original.raw() ||
+      dequickened_[functionIndex][bytecodeIndex]) {
+    return;
+  }
+  quickCalls_.push_back({callee, getFunction(callee)->nargs, entry});
+  publishQuick(instruction,
+               Instruction(ByteCode::QUICK_FUNCTION_CALL,
+                           quickCalls_.size() - 1));
+  quickenStats_.quickened++;
+}
+
+void VirtualMachine::publishQuick(QuickInstruction &instruction,
+                                  Instruction quick) {
+  // Other threads read the quick code without a lock. They see either the
+  // old or the new instruction, and the release store makes sure the slot
+  // or call it refers to is written first.
+  instruction.store(quick.raw(), std::memory_order_release);
+}
+
+void VirtualMachine::dequicken(std::size_t functionIndex,
+                               std::size_t bytecodeIndex) {
+  std::lock_guard<std::mutex> lock(quickenMutex_);
+  if (dequickened_[functionIndex][bytecodeIndex]) {
+    return;
+  }
+  quickFunctions_[functionIndex][bytecodeIndex].store(
+      module_->functions[functionIndex].instructions[bytecodeIndex].raw(),
+      std::memory_order_release);
+  dequickened_[functionIndex][bytecodeIndex] = true;
+  quickenStats_.dequickened++;
+}
+
+InlineCacheStats VirtualMachine::inlineCacheStats() const {
+  InlineCacheStats stats;
+  for (const auto &cache : inlineCaches_) {
+    stats.hits += cache.hits();
+    stats.misses += cache.misses();
+    switch (cache.state()) {
+      case InlineCacheState::UNINITIALIZED:
+        stats.uninitialized++;
+        break;
+      case InlineCacheState::MONOMORPHIC:
+        stats.monomorphic++;
+        break;
+      case InlineCacheState::POLYMORPHIC:
+        stats.polymorphic++;
+        break;
+      case InlineCacheState::MEGAMORPHIC:
+        stats.megamorphic++;
+        break;
+    }
+  }
+  return stats;
+}
+
+Om::ObjectMap *VirtualMachine::emptyObjectMap(Om::Context &cx) {
+  auto map = emptyObjectMap_.load(std::memory_order_acquire);
+  if (map != nullptr) {
+    return map;
+  }
+  // Allocating may collect, which waits for the other threads, so no lock is
+  // held. When threads race, the first map wins, and the others are garbage.
+  map = Om::ObjectMap::allocate(cx);
+  Om::ObjectMap *expected = nullptr;
+  if (!emptyObjectMap_.compare_exchange_strong(expected, map,
+                                               std::memory_order_acq_rel)) {
+    return expected;
+  }
+  return map;
 }
 
 StackElement VirtualMachine::run(const std::string &name,
@@ -121,8 +817,6 @@ StackElement VirtualMachine::run(const std::size_t functionIndex,
   auto function = getFunction(functionIndex);
   auto argsCount = function->nargs;
 
-  ExecutionContext *executionContext = new ExecutionContext(*this, cfg_);
-
   if (cfg_.verbose) {
     std::cout << "+++++++++++++++++++++++" << std::endl;
     std::cout << "Running function: " << function->name
@@ -137,16 +831,141 @@ StackElement VirtualMachine::run(const std::size_t functionIndex,
     throw BadFunctionCallException{message};
   }
 
+  auto executionContext = leaseContext();
+
+  // Collections stop this thread at its next safepoint poll.
+  Om::SafepointScope attached(memoryManager_.safepoint());
+
   // push user defined arguments to send to the program
+  executionContext->stack().reserve(argsCount);
   for (std::size_t i = 0; i < argsCount; i++) {
     auto idx = argsCount - i - 1;
     auto arg = usrArgs[idx];
     executionContext->push(arg);
   }
 
-  StackElement result = executionContext->interpret(functionIndex);
+  return executionContext->interpret(functionIndex);
+}
+
+/// The number of calls a batch worker takes at a time. Big enough to make
+/// taking them cheap, small enough to leave calls to steal.
+static constexpr std::size_t BATCH_CHUNK = 64;
+
+BatchStats VirtualMachine::runBatch(std::size_t functionIndex,
+                                    OMR::Infra::Span<const StackElement> args,
+                                    OMR::Infra::Span<StackElement> results) {
+  auto function = getFunction(functionIndex);
+  auto argsCount = function->nargs;
+  auto calls = results.length();
+
+  if (args.length() != calls * argsCount) {
+    std::stringstream ss;
+    ss << function->name << " - Got " << args.length()
+       << " arguments for a batch of " << calls << " calls, expected "
+       << calls * argsCount;
+    throw BadFunctionCallException{ss.str()};
+  }
+
+  std::lock_guard<std::mutex> lock(batchMutex_);
+  if (batchPool_ == nullptr) {
+    auto threads = cfg_.batchThreads;
+    if (threads == 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    batchPool_.reset(new WorkerPool(threads));
+  }
+
+  BatchStats stats;
+  stats.calls = calls;
+  stats.threads = batchPool_->size();
+  auto start = std::chrono::steady_clock::now();
+
+  for (std::size_t offset = 0; offset < calls;
+       offset += WorkRanges::MAX_COUNT) {
+    auto count = std::min(calls - offset, WorkRanges::MAX_COUNT);
+    WorkRanges ranges(count, batchPool_->size(), BATCH_CHUNK);
+    std::atomic<bool> failed{false};
+
+    batchPool_->run([&](std::size_t worker) {
+      auto executionContext = leaseContext();
+      Om::SafepointScope attached(memoryManager_.safepoint());
+      std::size_t first, last;
+      try {
+        while (!failed.load(std::memory_order_relaxed) &&
+               ranges.next(worker, first, last)) {
+          for (std::size_t i = offset + first; i < offset + last; i++) {
+            // Arguments go on the stack the same way as in run.
+            auto tuple = args.value() + i * argsCount;
+            executionContext->stack().reserve(argsCount);
+            for (std::size_t j = argsCount; j > 0; j--) {
+              executionContext->push(tuple[j - 1]);
+            }
+            results[i] = executionContext->interpret(functionIndex);
+          }
+        }
+      } catch (...) {
+        failed.store(true, std::memory_order_relaxed);
+        throw;
+      }
+    });
+
+    stats.steals += ranges.steals();
+  }
+
+  stats.time = std::chrono::steady_clock::now() - start;
+  return stats;
+}
+
+ContextPool &VirtualMachine::threadContextPool() {
+  auto &pools = threadContextPools.pools;
+  for (auto &pool : pools) {
+    if (pool->vmId == id_) {
+      return *pool;
+    }
+  }
+
+  // The thread's first lease from this VM. Drop the pools of the VMs that
+  // are gone, so a thread that outlives many VMs doesn't pile them up.
+  pools.erase(std::remove_if(pools.begin(), pools.end(),
+                             [](const std::shared_ptr<ContextPool> &pool) {
+                               std::lock_guard<std::mutex> lock(pool->mutex);
+                               return pool->released;
+                             }),
+              pools.end());
+  auto pool = std::make_shared<ContextPool>(id_);
+  {
+    std::lock_guard<std::mutex> lock(contextPoolsMutex_);
+    contextPools_.erase(
+        std::remove_if(contextPools_.begin(), contextPools_.end(),
+                       [](const std::weak_ptr<ContextPool> &pool) {
+                         return pool.expired();
+                       }),
+        contextPools_.end());
+    contextPools_.push_back(pool);
+  }
+  pools.push_back(pool);
+  return *pool;
+}
+
+ContextLease VirtualMachine::leaseContext() {
+  auto &contexts = threadContextPool().contexts;
+  if (contexts.empty()) {
+    contextCount_.fetch_add(1, std::memory_order_relaxed);
+    return ContextLease(*this, new ExecutionContext(*this, cfg_));
+  }
+  auto context = contexts.back().release();
+  contexts.pop_back();
+  return ContextLease(*this, context);
+}
 
-  return result;
+void VirtualMachine::releaseContext(ExecutionContext *context) noexcept {
+  // A reset context holds no GC roots while it waits in the pool.
+  context->reset();
+  threadContextPool().contexts.emplace_back(context);
+}
+
+std::size_t VirtualMachine::contextCount() const {
+  return contextCount_.load(std::memory_order_relaxed);
 }
 
 }  // namespace b9
@@ -154,6 +973,9 @@ StackElement VirtualMachine::run(const std::size_t functionIndex,
 //
 // Jit to Interpreter transitions
 //
+// interpret_n takes the last n arguments of the call. Any before them were
+// left on the operand stack by the caller.
+//
 
 extern "C" {
 
@@ -185,9 +1007,104 @@ RawValue interpret_3(ExecutionContext *context, const std::size_t functionIndex,
   return (RawValue)context->interpret(functionIndex);
 }
 
+RawValue interpret_4(ExecutionContext *context, const std::size_t functionIndex,
+                     RawValue p1, RawValue p2, RawValue p3, RawValue p4) {
+  context->push(Value{Om::FROM_RAW, p1});
+  context->push(Value{Om::FROM_RAW, p2});
+  context->push(Value{Om::FROM_RAW, p3});
+  context->push(Value{Om::FROM_RAW, p4});
+  return (RawValue)context->interpret(functionIndex);
+}
+
+RawValue interpret_5(ExecutionContext *context, const std::size_t functionIndex,
+                     RawValue p1, RawValue p2, RawValue p3, RawValue p4,
+                     RawValue p5) {
+  context->push(Value{Om::FROM_RAW, p1});
+  context->push(Value{Om::FROM_RAW, p2});
+  context->push(Value{Om::FROM_RAW, p3});
+  context->push(Value{Om::FROM_RAW, p4});
+  context->push(Value{Om::FROM_RAW, p5});
+  return (RawValue)context->interpret(functionIndex);
+}
+
+// The trampolines in dispatch slots. The caller put the function's index in
+// the context, since every function with the same register count shares one.
+
+RawValue jit_dispatch_0(ExecutionContext *context) {
+  return interpret_0(context, context->dispatchIndex());
+}
+
+RawValue jit_dispatch_1(ExecutionContext *context, RawValue p1) {
+  return interpret_1(context, context->dispatchIndex(), p1);
+}
+
+RawValue jit_dispatch_2(ExecutionContext *context, RawValue p1, RawValue p2) {
+  return interpret_2(context, context->dispatchIndex(), p1, p2);
+}
+
+RawValue jit_dispatch_3(ExecutionContext *context, RawValue p1, RawValue p2,
+                        RawValue p3) {
+  return interpret_3(context, context->dispatchIndex(), p1, p2, p3);
+}
+
+RawValue jit_dispatch_4(ExecutionContext *context, RawValue p1, RawValue p2,
+                        RawValue p3, RawValue p4) {
+  return interpret_4(context, context->dispatchIndex(), p1, p2, p3, p4);
+}
+
+RawValue jit_dispatch_5(ExecutionContext *context, RawValue p1, RawValue p2,
+                        RawValue p3, RawValue p4, RawValue p5) {
+  return interpret_5(context, context->dispatchIndex(), p1, p2, p3, p4, p5);
+}
+
 // For primitive calls
 void primitive_call(ExecutionContext *context, Parameter value) {
   context->doPrimitiveCall(value);
 }
 
+//
+// Slow paths of the jitted object bytecodes. The jitted code passes the
+// values it popped, and gets back the value to push, so the operand stack is
+// left as it was. Anything that can collect sees the committed stack.
+//
+
+RawValue jit_new_object(ExecutionContext *context) {
+  return Value(context->newObject()).raw();
+}
+
+RawValue jit_push_from_object(ExecutionContext *context, RawValue object,
+                              Parameter slotId, InlineCache *cache) {
+  context->push(Value{Om::FROM_RAW, object});
+  context->doPushFromObject(Id(slotId), cache);
+  return context->pop().raw();
+}
+
+void jit_pop_into_object(ExecutionContext *context, RawValue object,
+                         RawValue value, Parameter slotId,
+                         InlineCache *cache) {
+  context->push(Value{Om::FROM_RAW, value});
+  context->push(Value{Om::FROM_RAW, object});
+  context->doPopIntoObject(Id(slotId), cache);
+}
+
+void jit_system_collect(ExecutionContext *context) {
+  context->doSystemCollect();
+}
+
+void jit_safepoint(ExecutionContext *context) { context->doSafepoint(); }
+
+void jit_recompile(ExecutionContext *context, std::size_t functionIndex) {
+  context->virtualMachine()->recompileHot(functionIndex);
+}
+
+void jit_stack_overflow() {
+  throw StackOverflowException{"Operand stack overflow"};
+}
+
+RawValue jit_deoptimize(ExecutionContext *context, std::size_t functionIndex,
+                        std::size_t bytecodeIndex, const RawValue *vars,
+                        StackElement *frame) {
+  return context->deoptimize(functionIndex, bytecodeIndex, vars, frame).raw();
+}
+
 }  // extern "C"
@@ -0,0 +1,192 @@
+#include <b9/fusion.hpp>
+#include <b9/instructions.hpp>
+#include <b9/module.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace b9 {
+
+/// Mark every instruction that is the target of a jump. The result has one
+/// extra entry, for jumps to the end of the function.
+static std::vector<bool> findJumpTargets(
+    const std::vector<Instruction> &instructions) {
+  std::vector<bool> targets(instructions.size() + 1, false);
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    if (isJump(instructions[i].byteCode())) {
+      auto target = i + instructions[i].parameter() + 1;
+      if (target < targets.size()) {
+        targets[target] = true;
+      }
+    }
+  }
+  return targets;
+}
+
+/// The superinstruction for PUSH_FROM_VAR; INT_PUSH_CONSTANT; <bc>, or
+/// END_SECTION if there isn't one.
+static ByteCode varConstSuperinstruction(ByteCode bc) {
+  switch (bc) {
+    case ByteCode::INT_ADD:
+      return ByteCode::VAR_CONST_INT_ADD;
+    case ByteCode::INT_SUB:
+      return ByteCode::VAR_CONST_INT_SUB;
+    case ByteCode::INT_JMP_EQ:
+      return ByteCode::VAR_CONST_JMP_EQ;
+    case ByteCode::INT_JMP_NEQ:
+      return ByteCode::VAR_CONST_JMP_NEQ;
+    case ByteCode::INT_JMP_GT:
+      return ByteCode::VAR_CONST_JMP_GT;
+    case ByteCode::INT_JMP_GE:
+      return ByteCode::VAR_CONST_JMP_GE;
+    case ByteCode::INT_JMP_LT:
+      return ByteCode::VAR_CONST_JMP_LT;
+    case ByteCode::INT_JMP_LE:
+      return ByteCode::VAR_CONST_JMP_LE;
+    default:
+      return ByteCode::END_SECTION;
+  }
+}
+
+/// Decode the instruction at `index`, fusing it with the instructions that
+/// follow when they form a superinstruction. Returns the number of
+/// instructions consumed.
+static std::size_t fuseAt(const std::vector<Instruction> &instructions,
+                          const std::vector<bool> &targets, std::size_t index,
+                          FusedInstruction &result) {
+  // The bytecode at index + offset, or END_SECTION if that instruction can't
+  // be part of a superinstruction starting at index. Only the first
+  // instruction of a superinstruction may be a jump target.
+  auto next = [&](std::size_t offset) {
+    auto i = index + offset;
+    if (i >= instructions.size() || (offset != 0 && targets[i])) {
+      return ByteCode::END_SECTION;
+    }
+    return instructions[i].byteCode();
+  };
+
+  auto param = [&](std::size_t offset) {
+    return instructions[index + offset].parameter();
+  };
+
+  switch (next(0)) {
+    case ByteCode::PUSH_FROM_VAR:
+      if (next(1) == ByteCode::PUSH_FROM_VAR &&
+          next(2) == ByteCode::INT_ADD) {
+        result = {ByteCode::VAR_VAR_INT_ADD, param(0), param(1)};
+        return 3;
+      }
+      if (next(1) == ByteCode::INT_PUSH_CONSTANT) {
+        auto fused = varConstSuperinstruction(next(2));
+        if (fused == ByteCode::VAR_CONST_INT_ADD ||
+            fused == ByteCode::VAR_CONST_INT_SUB) {
+          result = {fused, param(0), param(1)};
+          return 3;
+        }
+        if (fused != ByteCode::END_SECTION && param(0) <= MAX_PACKED_VAR &&
+            param(0) >= 0) {
+          // The jump offset is fixed up once the whole function is fused.
+          result = {fused, param(2), packVarConst(param(0), param(1))};
+          return 3;
+        }
+      }
+      break;
+    case ByteCode::INT_ADD:
+      if (next(1) == ByteCode::POP_INTO_VAR) {
+        result = {ByteCode::INT_ADD_POP_INTO_VAR, param(1), 0};
+        return 2;
+      }
+      break;
+    default:
+      break;
+  }
+
+  result = {instructions[index].byteCode(), param(0), 0};
+  return 1;
+}
+
+std::vector<FusedInstruction> fuseInstructions(
+    const std::vector<Instruction> &instructions,
+    std::vector<std::size_t> *origins) {
+  auto targets = findJumpTargets(instructions);
+
+  std::vector<FusedInstruction> fused;
+  fused.reserve(instructions.size());
+
+  if (origins != nullptr) {
+    origins->clear();
+  }
+
+  // The index of every original instruction in the fused stream.
+  std::vector<std::size_t> newIndex(instructions.size() + 1);
+
+  // For every fused instruction, the original index of its last instruction.
+  // When the fused instruction jumps, this is the original jump.
+  std::vector<std::size_t> lastIndex;
+  lastIndex.reserve(instructions.size());
+
+  std::size_t index = 0;
+  while (index < instructions.size()) {
+    FusedInstruction instruction;
+    auto length = fuseAt(instructions, targets, index, instruction);
+    for (std::size_t i = 0; i < length; i++) {
+      newIndex[index + i] = fused.size();
+    }
+    lastIndex.push_back(index + length - 1);
+    if (origins != nullptr) {
+      origins->push_back(index);
+    }
+    fused.push_back(instruction);
+    index += length;
+  }
+  newIndex[instructions.size()] = fused.size();
+
+  // Fix up jump offsets.
+  for (std::size_t i = 0; i < fused.size(); i++) {
+    if (!isJump(fused[i].byteCode)) {
+      continue;
+    }
+    auto jump = lastIndex[i];
+    auto target = jump + instructions[jump].parameter() + 1;
+    if (target < newIndex.size()) {
+      fused[i].operand = Parameter(newIndex[target]) - Parameter(i) - 1;
+    }
+  }
+
+  return fused;
+}
+
+std::vector<BytecodePairCount> countBytecodePairs(const Module &module) {
+  std::map<std::pair<ByteCode, ByteCode>, std::size_t> counts;
+
+  for (const auto &function : module.functions) {
+    const auto &instructions = function.instructions;
+    auto targets = findJumpTargets(instructions);
+    for (std::size_t i = 1; i < instructions.size(); i++) {
+      auto second = instructions[i].byteCode();
+      if (targets[i] || second == ByteCode::END_SECTION) {
+        continue;
+      }
+      counts[{instructions[i - 1].byteCode(), second}]++;
+    }
+  }
+
+  std::vector<BytecodePairCount> result;
+  result.reserve(counts.size());
+  for (const auto &entry : counts) {
+    result.push_back({entry.first.first, entry.first.second, entry.second});
+  }
+
+  std::stable_sort(result.begin(), result.end(),
+                   [](const BytecodePairCount &lhs,
+                      const BytecodePairCount &rhs) {
+                     return lhs.count > rhs.count;
+                   });
+
+  return result;
+}
+
+}  // namespace b9
@@ -0,0 +1,524 @@
+#include <b9/instructions.hpp>
+#include <b9/module.hpp>
+#include <b9/optimize.hpp>
+#include <b9/verifier.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <vector>
+
+namespace b9 {
+
+namespace {
+
+/// The most times the passes run over a module. Most modules stop changing
+/// after two or three rounds.
+constexpr std::size_t MAX_ROUNDS = 8;
+
+/// The range of an INT_PUSH_CONSTANT's 24bit parameter.
+constexpr std::int64_t MIN_PARAMETER = -0x80'0000;
+constexpr std::int64_t MAX_PARAMETER = 0x7F'FFFF;
+
+/// A pass rewrites the instructions of one function in place. It replaces
+/// instructions, and marks the ones it removes, but never moves them, so
+/// jump offsets stay valid until compact() runs. Returns the number of
+/// rewrites.
+using PassFunction = std::size_t (*)(Module &module, std::size_t index,
+                                     std::vector<bool> &removed);
+
+/// Mark every instruction that is the target of a jump. The result has one
+/// extra entry, for jumps to the end of the function.
+std::vector<bool> findJumpTargets(
+    const std::vector<Instruction> &instructions) {
+  std::vector<bool> targets(instructions.size() + 1, false);
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    if (isJump(instructions[i].byteCode())) {
+      auto target = i + instructions[i].parameter() + 1;
+      if (target < targets.size()) {
+        targets[target] = true;
+      }
+    }
+  }
+  return targets;
+}
+
+/// True if the instruction ends a straight line of code: it jumps, returns,
+/// or ends the function.
+bool isControl(ByteCode bc) {
+  return isJump(bc) || bc == ByteCode::FUNCTION_RETURN ||
+         bc == ByteCode::TAIL_CALL || bc == ByteCode::END_SECTION;
+}
+
+/// Drop the removed instructions. A jump to a removed instruction goes to
+/// the next instruction that stays, so passes must only remove instructions
+/// that can be skipped that way. Returns the number of instructions removed.
+std::size_t compact(std::vector<Instruction> &instructions,
+                    const std::vector<bool> &removed) {
+  // Where each instruction ends up. A removed instruction maps to the
+  // instruction after it.
+  std::vector<std::ptrdiff_t> newIndex(instructions.size() + 1);
+  std::ptrdiff_t kept = 0;
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    newIndex[i] = kept;
+    if (!removed[i]) {
+      kept++;
+    }
+  }
+  newIndex[instructions.size()] = kept;
+
+  if (std::size_t(kept) == instructions.size()) {
+    return 0;
+  }
+
+  std::vector<Instruction> result;
+  result.reserve(kept);
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    if (removed[i]) {
+      continue;
+    }
+    auto instruction = instructions[i];
+    auto target = std::ptrdiff_t(i) + instruction.parameter() + 1;
+    // Unreachable jumps aren't verified, and may point anywhere.
+    if (isJump(instruction.byteCode()) && target >= 0 &&
+        std::size_t(target) < instructions.size()) {
+      instruction.parameter(newIndex[target] - newIndex[i] - 1);
+    }
+    result.push_back(instruction);
+  }
+  auto count = instructions.size() - result.size();
+  instructions = std::move(result);
+  return count;
+}
+
+/// Fold `INT_PUSH_CONSTANT a; INT_PUSH_CONSTANT b; <op>` when the op is
+/// integer arithmetic or an integer conditional jump, and
+/// `INT_PUSH_CONSTANT a; INT_NOT`. The last instruction of the pattern is
+/// rewritten and the others removed, so jumps into the pattern still work.
+/// A sum that doesn't fit a parameter isn't folded.
+std::size_t foldConstants(Module &module, std::size_t index,
+                          std::vector<bool> &removed) {
+  auto &instructions = module.functions[index].instructions;
+  auto targets = findJumpTargets(instructions);
+  auto end = instructions.size() - 1;
+  std::size_t count = 0;
+
+  auto isConstant = [&](std::size_t i) {
+    return instructions[i].byteCode() == ByteCode::INT_PUSH_CONSTANT;
+  };
+
+  for (std::size_t i = 0; i + 1 < end; i++) {
+    if (!isConstant(i) || targets[i + 1]) {
+      continue;
+    }
+    std::int64_t left = instructions[i].parameter();
+
+    if (instructions[i + 1].byteCode() == ByteCode::INT_NOT) {
+      instructions[i + 1].set(ByteCode::INT_PUSH_CONSTANT, !left);
+      removed[i] = true;
+      count++;
+      i += 1;
+      continue;
+    }
+
+    if (i + 2 >= end || !isConstant(i + 1) || targets[i + 2]) {
+      continue;
+    }
+    std::int64_t right = instructions[i + 1].parameter();
+    auto &op = instructions[i + 2];
+
+    bool arithmetic = true;
+    std::int64_t value = 0;
+    bool taken = false;
+    switch (op.byteCode()) {
+      case ByteCode::INT_ADD:
+        value = left + right;
+        break;
+      case ByteCode::INT_SUB:
+        value = left - right;
+        break;
+      case ByteCode::INT_MUL:
+        value = left * right;
+        break;
+      case ByteCode::INT_DIV:
+        if (right == 0) {
+          continue;
+        }
+        value = left / right;
+        break;
+      case ByteCode::INT_JMP_EQ:
+        arithmetic = false;
+        taken = left == right;
+        break;
+      case ByteCode::INT_JMP_NEQ:
+        arithmetic = false;
+        taken = left != right;
+        break;
+      case ByteCode::INT_JMP_GT:
+        arithmetic = false;
+        taken = left > right;
+        break;
+      case ByteCode::INT_JMP_GE:
+        arithmetic = false;
+        taken = left >= right;
+        break;
+      case ByteCode::INT_JMP_LT:
+        arithmetic = false;
+        taken = left < right;
+        break;
+      case ByteCode::INT_JMP_LE:
+        arithmetic = false;
+        taken = left <= right;
+        break;
+      default:
+        continue;
+    }
+
+    if (arithmetic) {
+      if (value < MIN_PARAMETER || value > MAX_PARAMETER) {
+        continue;
+      }
+      op.set(ByteCode::INT_PUSH_CONSTANT, Parameter(value));
+    } else if (taken) {
+      op.byteCode(ByteCode::JMP);
+    } else {
+      removed[i + 2] = true;
+    }
+    removed[i] = true;
+    removed[i + 1] = true;
+    count++;
+    i += 2;
+  }
+  return count;
+}
+
+/// Point every jump past the JMPs it lands on, turn JMPs to a
+/// FUNCTION_RETURN into the return, and remove JMPs to the next instruction.
+std::size_t threadJumps(Module &module, std::size_t index,
+                        std::vector<bool> &removed) {
+  auto &instructions = module.functions[index].instructions;
+  auto depths = stackDepths(module, index);
+  auto end = instructions.size() - 1;
+  std::size_t count = 0;
+
+  for (std::size_t i = 0; i < end; i++) {
+    auto &instruction = instructions[i];
+    if (depths[i] < 0 || !isJump(instruction.byteCode())) {
+      continue;
+    }
+
+    auto original = std::ptrdiff_t(i) + instruction.parameter() + 1;
+    auto target = original;
+    // A chain longer than the function is a loop of JMPs; leave it be.
+    std::size_t hops = 0;
+    while (instructions[target].byteCode() == ByteCode::JMP && hops < end) {
+      target = target + instructions[target].parameter() + 1;
+      hops++;
+    }
+    if (hops == end) {
+      target = original;
+    }
+
+    if (target != original) {
+      instruction.parameter(Parameter(target - std::ptrdiff_t(i) - 1));
+      count++;
+    }
+
+    if (instruction.byteCode() != ByteCode::JMP) {
+      continue;
+    }
+    if (instructions[target].byteCode() == ByteCode::FUNCTION_RETURN) {
+      instruction.set(ByteCode::FUNCTION_RETURN, 0);
+      count++;
+    } else if (std::size_t(target) == i + 1) {
+      removed[i] = true;
+      count++;
+    }
+  }
+  return count;
+}
+
+/// Remove the instructions the verifier never reaches.
+std::size_t removeDeadCode(Module &module, std::size_t index,
+                           std::vector<bool> &removed) {
+  auto depths = stackDepths(module, index);
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < depths.size(); i++) {
+    if (depths[i] < 0) {
+      removed[i] = true;
+      count++;
+    }
+  }
+  return count;
+}
+
+/// The variables live on entry to every instruction. A variable is live if
+/// some path from the instruction reads it before writing it. Nothing is live
+/// at unreachable instructions.
+std::vector<std::vector<bool>> liveVariables(
+    const FunctionDef &function, const std::vector<std::ptrdiff_t> &depths) {
+  const auto &instructions = function.instructions;
+  auto end = instructions.size() - 1;
+  auto variables = function.nargs + function.nregs;
+  std::vector<std::vector<bool>> live(end + 1,
+                                      std::vector<bool>(variables, false));
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (std::size_t i = end; i-- > 0;) {
+      if (depths[i] < 0) {
+        continue;
+      }
+      auto instruction = instructions[i];
+      auto bc = instruction.byteCode();
+      std::vector<bool> in(variables, false);
+      if (isJump(bc)) {
+        auto target = i + instruction.parameter() + 1;
+        for (std::size_t v = 0; v < variables; v++) {
+          in[v] = in[v] || live[target][v];
+        }
+      }
+      if (bc != ByteCode::JMP && bc != ByteCode::FUNCTION_RETURN) {
+        for (std::size_t v = 0; v < variables; v++) {
+          in[v] = in[v] || live[i + 1][v];
+        }
+      }
+      if (bc == ByteCode::POP_INTO_VAR) {
+        in[instruction.parameter()] = false;
+      } else if (bc == ByteCode::PUSH_FROM_VAR) {
+        in[instruction.parameter()] = true;
+      }
+      if (in != live[i]) {
+        live[i] = std::move(in);
+        changed = true;
+      }
+    }
+  }
+  return live;
+}
+
+/// Remove `PUSH_FROM_VAR x; POP_INTO_VAR x`, and `POP_INTO_VAR x;
+/// PUSH_FROM_VAR x` when x isn't read again, which leaves the value on the
+/// stack. Any other POP_INTO_VAR to a variable that isn't read again becomes
+/// a DROP.
+std::size_t removeRedundantStores(Module &module, std::size_t index,
+                                  std::vector<bool> &removed) {
+  auto &function = module.functions[index];
+  auto &instructions = function.instructions;
+  auto targets = findJumpTargets(instructions);
+  auto depths = stackDepths(module, index);
+  auto live = liveVariables(function, depths);
+  auto end = instructions.size() - 1;
+  std::size_t count = 0;
+
+  for (std::size_t i = 0; i < end; i++) {
+    if (depths[i] < 0) {
+      continue;
+    }
+    auto instruction = instructions[i];
+    auto bc = instruction.byteCode();
+    auto next = instructions[i + 1];
+    bool sameVariable = next.parameter() == instruction.parameter();
+
+    if (bc == ByteCode::PUSH_FROM_VAR && sameVariable && !targets[i + 1] &&
+        next.byteCode() == ByteCode::POP_INTO_VAR) {
+      removed[i] = true;
+      removed[i + 1] = true;
+      count++;
+      i += 1;
+      continue;
+    }
+
+    if (bc != ByteCode::POP_INTO_VAR) {
+      continue;
+    }
+    auto variable = instruction.parameter();
+    if (sameVariable && !targets[i + 1] &&
+        next.byteCode() == ByteCode::PUSH_FROM_VAR &&
+        !live[i + 2][variable]) {
+      removed[i] = true;
+      removed[i + 1] = true;
+      count++;
+      i += 1;
+    } else if (!live[i + 1][variable]) {
+      instructions[i].set(ByteCode::DROP, 0);
+      count++;
+    }
+  }
+  return count;
+}
+
+/// True if the instruction pushes a value and has no other effect.
+bool isPurePush(ByteCode bc) {
+  return bc == ByteCode::PUSH_FROM_VAR || bc == ByteCode::INT_PUSH_CONSTANT ||
+         bc == ByteCode::STR_PUSH_CONSTANT || bc == ByteCode::DUPLICATE;
+}
+
+/// Remove `<push>; DROP`, and a DUPLICATE whose copy is consumed by
+/// straight-line code that then drops the original. The compiler emits
+/// `DUPLICATE; POP_INTO_VAR x; DROP` for every assignment statement.
+std::size_t peephole(Module &module, std::size_t index,
+                     std::vector<bool> &removed) {
+  const auto &function = module.functions[index];
+  const auto &instructions = function.instructions;
+  auto targets = findJumpTargets(instructions);
+  auto depths = stackDepths(module, index);
+  auto end = instructions.size() - 1;
+  std::size_t count = 0;
+
+  for (std::size_t i = 0; i + 1 < end; i++) {
+    auto bc = instructions[i].byteCode();
+    if (depths[i] < 0) {
+      continue;
+    }
+
+    if (isPurePush(bc) && !targets[i + 1] &&
+        instructions[i + 1].byteCode() == ByteCode::DROP) {
+      removed[i] = true;
+      removed[i + 1] = true;
+      count++;
+      i += 1;
+      continue;
+    }
+
+    if (bc != ByteCode::DUPLICATE) {
+      continue;
+    }
+    // Between the DUPLICATE and the DROP, the code may use the copy, but
+    // nothing under it, and must end with only the original left.
+    auto base = depths[i];
+    for (std::size_t j = i + 1; j < end && !targets[j]; j++) {
+      auto jbc = instructions[j].byteCode();
+      if (jbc == ByteCode::DROP && depths[j] == base) {
+        removed[i] = true;
+        removed[j] = true;
+        count++;
+        i = j;
+        break;
+      }
+      if (isControl(jbc) ||
+          depths[j] - std::ptrdiff_t(
+                          checkInstruction(module, function, j).pops) <
+              base) {
+        break;
+      }
+    }
+  }
+  return count;
+}
+
+struct PassInfo {
+  OptimizerPass pass;
+  PassFunction run;
+};
+
+const PassInfo PASSES[] = {
+    {OptimizerPass::DEAD_CODE, removeDeadCode},
+    {OptimizerPass::CONSTANT_FOLDING, foldConstants},
+    {OptimizerPass::JUMP_THREADING, threadJumps},
+    {OptimizerPass::REDUNDANT_STORES, removeRedundantStores},
+    {OptimizerPass::PEEPHOLE, peephole},
+};
+
+PassFunction passFunction(OptimizerPass pass) {
+  for (const auto &info : PASSES) {
+    if (info.pass == pass) {
+      return info.run;
+    }
+  }
+  return nullptr;
+}
+
+std::size_t countInstructions(const Module &module) {
+  std::size_t count = 0;
+  for (const auto &function : module.functions) {
+    count += function.instructions.size() - 1;
+  }
+  return count;
+}
+
+}  // namespace
+
+bool parseOptimizerPass(const std::string &name, OptimizerPass &pass) {
+  for (const auto &info : PASSES) {
+    if (name == toString(info.pass)) {
+      pass = info.pass;
+      return true;
+    }
+  }
+  return false;
+}
+
+const std::vector<OptimizerPass> &allOptimizerPasses() {
+  static const std::vector<OptimizerPass> passes = {
+      OptimizerPass::DEAD_CODE, OptimizerPass::CONSTANT_FOLDING,
+      OptimizerPass::JUMP_THREADING, OptimizerPass::REDUNDANT_STORES,
+      OptimizerPass::PEEPHOLE};
+  return passes;
+}
+
+OptimizeStats optimize(Module &module,
+                       const std::vector<OptimizerPass> &passes) {
+  verify(module);
+
+  OptimizeStats stats;
+  stats.before = countInstructions(module);
+  for (auto pass : passes) {
+    PassStats passStats;
+    passStats.pass = pass;
+    stats.passes.push_back(passStats);
+  }
+
+  bool changed = true;
+  while (changed && stats.rounds < MAX_ROUNDS) {
+    changed = false;
+    stats.rounds++;
+    for (auto &passStats : stats.passes) {
+      auto run = passFunction(passStats.pass);
+      auto start = std::chrono::steady_clock::now();
+      for (std::size_t i = 0; i < module.functions.size(); i++) {
+        auto &instructions = module.functions[i].instructions;
+        std::vector<bool> removed(instructions.size(), false);
+        auto rewrites = run(module, i, removed);
+        if (rewrites != 0) {
+          passStats.rewrites += rewrites;
+          passStats.removed += compact(instructions, removed);
+          changed = true;
+        }
+      }
+      passStats.time += std::chrono::steady_clock::now() - start;
+    }
+  }
+
+  stats.after = countInstructions(module);
+
+  // Every pass keeps its function verifiable. Check, rather than hand the
+  // VM a broken module.
+  verify(module);
+  return stats;
+}
+
+void writeOptimizeStats(std::ostream &out, const OptimizeStats &stats) {
+  auto flags = out.flags();
+  auto precision = out.precision();
+
+  out << std::left << std::setw(10) << "Pass" << std::right << std::setw(10)
+      << "Rewrites" << std::setw(9) << "Removed" << std::setw(12)
+      << "Time (ms)" << std::endl;
+  for (const auto &pass : stats.passes) {
+    out << std::left << std::setw(10) << toString(pass.pass) << std::right
+        << std::setw(10) << pass.rewrites << std::setw(9) << pass.removed
+        << std::setw(12) << std::fixed << std::setprecision(3)
+        << pass.time.count() << std::endl;
+  }
+  out << "Instructions: " << stats.before << " -> " << stats.after << " in "
+      << stats.rounds << (stats.rounds == 1 ? " round" : " rounds")
+      << std::endl;
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace b9
@@ -0,0 +1,35 @@
+#include <b9/instructions.hpp>
+#include <b9/module.hpp>
+#include <b9/tailcall.hpp>
+#include <b9/verifier.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace b9 {
+
+std::size_t rewriteTailCalls(Module &module) {
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < module.functions.size(); i++) {
+    auto depths = stackDepths(module, i);
+    auto &instructions = module.functions[i].instructions;
+    // The last instruction is an END_SECTION, so instructions[j + 1] is in
+    // bounds.
+    for (std::size_t j = 0; j + 1 < instructions.size(); j++) {
+      auto instruction = instructions[j];
+      if (instruction.byteCode() != ByteCode::FUNCTION_CALL ||
+          instructions[j + 1].byteCode() != ByteCode::FUNCTION_RETURN) {
+        continue;
+      }
+      const auto &callee = module.functions[instruction.parameter()];
+      if (depths[j] != std::ptrdiff_t(callee.nargs)) {
+        continue;
+      }
+      instructions[j].byteCode(ByteCode::TAIL_CALL);
+      count++;
+    }
+  }
+  return count;
+}
+
+}  // namespace b9
@@ -0,0 +1,207 @@
+#include <b9/instructions.hpp>
+#include <b9/module.hpp>
+#include <b9/verifier.hpp>
+
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+StackEffect primitiveEffect(std::size_t index) {
+  // print_string, print_number and print_stack all push 0 when done.
+  static constexpr StackEffect effects[PRIMITIVE_COUNT] = {
+      {1, 1}, {1, 1}, {0, 1}};
+  return effects[index];
+}
+
+/// Throw a VerifyException about the instruction at `index`.
+[[noreturn]] static void fail(const FunctionDef &function, std::size_t index,
+                              const std::string &problem) {
+  std::stringstream message;
+  message << function.name << " @" << index << " ";
+  if (index < function.instructions.size()) {
+    message << function.instructions[index];
+  }
+  message << ": " << problem;
+  throw VerifyException{message.str()};
+}
+
+StackEffect checkInstruction(const Module &module, const FunctionDef &function,
+                             std::size_t index) {
+  auto instruction = function.instructions[index];
+  auto param = instruction.parameter();
+
+  switch (instruction.byteCode()) {
+    case ByteCode::FUNCTION_CALL:
+    case ByteCode::TAIL_CALL:
+      if (param < 0 || std::size_t(param) >= module.functions.size()) {
+        fail(function, index, "call to a function that doesn't exist");
+      }
+      return {module.functions[param].nargs, 1};
+    case ByteCode::FUNCTION_RETURN:
+      return {1, 0};
+    case ByteCode::PRIMITIVE_CALL:
+      if (param < 0 || std::size_t(param) >= PRIMITIVE_COUNT) {
+        fail(function, index, "call to a primitive that doesn't exist");
+      }
+      return primitiveEffect(param);
+    case ByteCode::DUPLICATE:
+      return {1, 2};
+    case ByteCode::DROP:
+      return {1, 0};
+    case ByteCode::PUSH_FROM_VAR:
+    case ByteCode::POP_INTO_VAR:
+      if (param < 0 || std::size_t(param) >= function.nargs + function.nregs) {
+        fail(function, index, "local variable out of range");
+      }
+      return instruction.byteCode() == ByteCode::PUSH_FROM_VAR
+                 ? StackEffect{0, 1}
+                 : StackEffect{1, 0};
+    case ByteCode::INT_ADD:
+    case ByteCode::INT_SUB:
+    case ByteCode::INT_MUL:
+    case ByteCode::INT_DIV:
+      return {2, 1};
+    case ByteCode::INT_PUSH_CONSTANT:
+      return {0, 1};
+    case ByteCode::INT_NOT:
+      return {1, 1};
+    case ByteCode::JMP:
+      return {0, 0};
+    case ByteCode::INT_JMP_EQ:
+    case ByteCode::INT_JMP_NEQ:
+    case ByteCode::INT_JMP_GT:
+    case ByteCode::INT_JMP_GE:
+    case ByteCode::INT_JMP_LT:
+    case ByteCode::INT_JMP_LE:
+      return {2, 0};
+    case ByteCode::STR_PUSH_CONSTANT:
+      if (param < 0 || std::size_t(param) >= module.strings.size()) {
+        fail(function, index, "string constant out of range");
+      }
+      return {0, 1};
+    case ByteCode::NEW_OBJECT:
+      return {0, 1};
+    case ByteCode::PUSH_FROM_OBJECT:
+      return {1, 1};
+    case ByteCode::POP_INTO_OBJECT:
+      return {2, 0};
+    case ByteCode::SYSTEM_COLLECT:
+      return {0, 0};
+    case ByteCode::END_SECTION:
+      fail(function, index, "END_SECTION before the end of the function");
+    case ByteCode::STR_JMP_EQ:
+    case ByteCode::STR_JMP_NEQ:
+    case ByteCode::CALL_INDIRECT:
+      fail(function, index, "bytecode isn't implemented by the interpreter");
+    default:
+      // Unknown bytecodes, superinstructions and quick instructions. The
+      // internal bytecodes never appear in a module.
+      fail(function, index, "unknown bytecode");
+  }
+}
+
+/// Check a function, filling in `depths`, and return its maximum stack depth.
+static std::size_t checkFunction(const Module &module,
+                                 std::size_t functionIndex,
+                                 std::vector<std::ptrdiff_t> &depths) {
+  const auto &function = module.functions[functionIndex];
+  const auto &instructions = function.instructions;
+
+  if (instructions.empty() || instructions.back() != END_SECTION) {
+    fail(function, instructions.size(), "missing END_SECTION");
+  }
+  auto end = instructions.size() - 1;
+  if (end == 0) {
+    fail(function, 0, "empty function");
+  }
+
+  // The stack depth on entry to every instruction, or -1 if it hasn't been
+  // reached yet. Unreachable instructions are never run, so they aren't
+  // checked. The compiler leaves dead jumps after returns.
+  depths.assign(end, -1);
+  std::vector<std::size_t> worklist;
+  std::size_t maxDepth = 0;
+
+  auto reach = [&](std::size_t from, std::ptrdiff_t target,
+                   std::ptrdiff_t depth) {
+    if (target < 0 || std::size_t(target) > end) {
+      fail(function, from, "jump out of the function");
+    }
+    if (std::size_t(target) == end) {
+      fail(function, from, "runs off the end of the function");
+    }
+    if (depths[target] == -1) {
+      depths[target] = depth;
+      worklist.push_back(target);
+    } else if (depths[target] != depth) {
+      std::stringstream problem;
+      problem << "reaches @" << target << " with stack depth " << depth
+              << ", but it was reached with " << depths[target];
+      fail(function, from, problem.str());
+    }
+  };
+
+  reach(0, 0, 0);
+  while (!worklist.empty()) {
+    auto index = worklist.back();
+    worklist.pop_back();
+
+    auto instruction = instructions[index];
+    auto effect = checkInstruction(module, function, index);
+    auto depth = depths[index];
+
+    if (std::size_t(depth) < effect.pops) {
+      fail(function, index, "pops an empty stack");
+    }
+
+    auto bc = instruction.byteCode();
+    if (bc == ByteCode::TAIL_CALL) {
+      if (std::size_t(depth) != effect.pops) {
+        fail(function, index, "tail call with values under its arguments");
+      }
+      if (instructions[index + 1].byteCode() != ByteCode::FUNCTION_RETURN) {
+        fail(function, index, "tail call isn't followed by a return");
+      }
+    }
+
+    depth = depth - effect.pops + effect.pushes;
+    if (std::size_t(depth) > maxDepth) {
+      maxDepth = depth;
+    }
+
+    if (isJump(bc)) {
+      reach(index, std::ptrdiff_t(index) + instruction.parameter() + 1, depth);
+    }
+    if (bc != ByteCode::JMP && bc != ByteCode::FUNCTION_RETURN) {
+      reach(index, index + 1, depth);
+    }
+  }
+
+  return maxDepth;
+}
+
+std::size_t verifyFunction(const Module &module, std::size_t functionIndex) {
+  std::vector<std::ptrdiff_t> depths;
+  return checkFunction(module, functionIndex, depths);
+}
+
+std::vector<std::ptrdiff_t> stackDepths(const Module &module,
+                                        std::size_t functionIndex) {
+  std::vector<std::ptrdiff_t> depths;
+  checkFunction(module, functionIndex, depths);
+  return depths;
+}
+
+std::vector<std::size_t> verify(const Module &module) {
+  std::vector<std::size_t> maxDepths;
+  maxDepths.reserve(module.functions.size());
+  for (std::size_t i = 0; i < module.functions.size(); i++) {
+    maxDepths.push_back(verifyFunction(module, i));
+  }
+  return maxDepths;
+}
+
+}  // namespace b9
@@ -2,24 +2,46 @@
 #include <fstream>
 
 #include <b9/deserialize.hpp>
+#include <b9/fusion.hpp>
 #include <b9/module.hpp>
 
+#include <cstring>
+
 using namespace b9;
 
+/// Print the module's bytecode pair frequencies, most frequent first.
+static void printPairs(const Module& module) {
+  for (const auto& pair : countBytecodePairs(module)) {
+    std::cout << pair.count << "\t" << pair.first << " " << pair.second
+              << std::endl;
+  }
+}
+
 extern "C" int main(int argc, char** argv) {
   std::ifstream infile;
   std::streambuf* inbuffer = nullptr;
+  bool pairs = false;
+  int arg = 1;
 
-  if (argc == 1) {
+  if (arg < argc && strcmp(argv[arg], "-pairs") == 0) {
+    pairs = true;
+    arg++;
+  }
+
+  if (arg == argc) {
     inbuffer = std::cin.rdbuf();
   }
   else {
-    infile.open(argv[1], std::ios::in | std::ios::binary);
+    infile.open(argv[arg], std::ios::in | std::ios::binary);
     inbuffer = infile.rdbuf();
   }
 
   std::istream in(inbuffer);
 
   auto module = deserialize(in);
-  std::cout << *module;
+  if (pairs) {
+    printPairs(*module);
+  } else {
+    std::cout << *module;
+  }
 }
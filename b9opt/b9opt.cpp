@@ -0,0 +1,137 @@
+#include <b9/deserialize.hpp>
+#include <b9/module.hpp>
+#include <b9/optimize.hpp>
+#include <b9/serialize.hpp>
+#include <b9/tailcall.hpp>
+#include <b9/verifier.hpp>
+
+#include <strings.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// B9opt's usage string. Printed when run with -help.
+static const char* usage =
+    "Usage: b9opt [<option>...] <in.b9mod> <out.b9mod>\n"
+    "   Or: b9opt -help\n"
+    "Options:\n"
+    "  -passes <list>: Run only these passes, comma separated, from dce,\n"
+    "                 fold, jumps, stores and peephole (default: all)\n"
+    "  -tailcall:     Rewrite calls in tail position into TAIL_CALLs\n"
+    "  -stats:        Print what each pass did\n"
+    "  -help:         Print this help message";
+
+/// The b9opt program's configuration.
+struct OptConfig {
+  const char* inName = nullptr;
+  const char* outName = nullptr;
+  std::vector<b9::OptimizerPass> passes = b9::allOptimizerPasses();
+  bool tailCalls = false;
+  bool stats = false;
+};
+
+/// Parse a comma separated list of pass names.
+static bool parsePasses(const char* list,
+                        std::vector<b9::OptimizerPass>& passes) {
+  passes.clear();
+  std::istringstream in(list);
+  std::string name;
+  while (std::getline(in, name, ',')) {
+    b9::OptimizerPass pass;
+    if (!b9::parseOptimizerPass(name, pass)) {
+      std::cerr << "Unknown pass: " << name << std::endl;
+      return false;
+    }
+    passes.push_back(pass);
+  }
+  return true;
+}
+
+/// Parse CLI arguments and set up the config.
+static bool parseArguments(OptConfig& cfg, const int argc, char* argv[]) {
+  int i = 1;
+
+  for (; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (strcasecmp(arg, "-help") == 0) {
+      std::cout << usage << std::endl;
+      exit(EXIT_SUCCESS);
+    } else if (strcasecmp(arg, "-passes") == 0) {
+      if (i + 1 == argc || !parsePasses(argv[++i], cfg.passes)) {
+        return false;
+      }
+    } else if (strcasecmp(arg, "-tailcall") == 0) {
+      cfg.tailCalls = true;
+    } else if (strcasecmp(arg, "-stats") == 0) {
+      cfg.stats = true;
+    } else if (arg[0] == '-') {
+      std::cerr << "Unrecognized option: " << arg << std::endl;
+      return false;
+    } else {
+      break;
+    }
+  }
+
+  if (i + 2 != argc) {
+    std::cerr << "b9opt takes an input and an output module" << std::endl;
+    return false;
+  }
+  cfg.inName = argv[i];
+  cfg.outName = argv[i + 1];
+  return true;
+}
+
+static void run(const OptConfig& cfg) {
+  std::ifstream in(cfg.inName, std::ios_base::in | std::ios_base::binary);
+  if (!in) {
+    throw b9::DeserializeException{std::string("Can't open ") + cfg.inName};
+  }
+  auto module = b9::deserialize(in);
+
+  auto stats = b9::optimize(*module, cfg.passes);
+  std::size_t tailCalls = 0;
+  if (cfg.tailCalls) {
+    tailCalls = b9::rewriteTailCalls(*module);
+  }
+
+  std::ofstream out(cfg.outName, std::ios_base::out | std::ios_base::binary);
+  if (!out) {
+    throw b9::SerializeException{std::string("Can't open ") + cfg.outName};
+  }
+  b9::serialize(out, *module);
+
+  if (cfg.stats) {
+    b9::writeOptimizeStats(std::cout, stats);
+    if (cfg.tailCalls) {
+      std::cout << "Tail calls:   " << tailCalls << std::endl;
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  OptConfig cfg;
+
+  if (!parseArguments(cfg, argc, argv)) {
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  try {
+    run(cfg);
+  } catch (const b9::DeserializeException& e) {
+    std::cerr << "Failed to load module: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  } catch (const b9::VerifyException& e) {
+    std::cerr << "Failed to verify module: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  } catch (const b9::SerializeException& e) {
+    std::cerr << "Failed to write module: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  exit(EXIT_SUCCESS);
+}
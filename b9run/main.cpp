@@ -1,6 +1,8 @@
 #include <b9/ExecutionContext.hpp>
+#include <b9/WarmProfile.hpp>
 #include <b9/compiler/Compiler.hpp>
 #include <b9/deserialize.hpp>
+#include <b9/verifier.hpp>
 
 #include <OMR/Om/Context.inl.hpp>
 #include <OMR/Om/MemoryManager.inl.hpp>
@@ -18,15 +20,54 @@
 static const char* usage =
     "Usage: b9run [<option>...] [--] <module> [<arg>...]\n"
     "   Or: b9run -help\n"
+    "Interpreter Options:\n"
+    "  -noverify:     Don't verify the module, check the code as it runs,\n"
+    "                 which is slower\n"
+    "  -threaded:     Use the threaded-code interpreter, which needs verified\n"
+    "                 code\n"
+    "  -nofuse:       Don't fuse superinstructions in threaded code\n"
+    "  -framestack:   Keep threaded calls off the C stack\n"
+    "  -noinlinecache: Don't cache object slot lookups\n"
+    "  -quicken:      Rewrite instructions into quick forms as they run\n"
+    "  -tailcall:     Reuse the caller's frame for calls in tail position,\n"
+    "                 verifies the module even with -noverify\n"
+    "  -optimize:     Optimize the module's bytecode before running it,\n"
+    "                 verifies the module even with -noverify\n"
     "Jit Options:\n"
-    "  -jit:          Enable the jit\n"
+    "  -jit:          Enable the jit, which needs verified code\n"
     "  -directcall:   make direct jit to jit calls\n"
     "  -passparam:    Pass arguments in CPU registers\n"
     "  -lazyvmstate:  Only update the VM state as needed\n"
+    "  -speculate:    Keep integer variables unboxed, deoptimize if wrong\n"
+    "  -deoptlimit <n>: Deopts before a function is recompiled (default: 16)\n"
+    "  -recompile:    Recompile hot jitted functions with more inlining\n"
+    "  -recompilecalls <n>: Calls of jitted code before a function is hot\n"
+    "                 (default: 10000)\n"
+    "  -hotinline <n>: Max inline depth of hot functions (default: 4)\n"
+    "  -hotinlinebudget <n>: Most bytecodes inlined per hot function\n"
+    "                 (default: 1024)\n"
+    "  -tiered:       Only jit functions once they get hot\n"
+    "  -invocations <n>: Calls before a function is hot (default: 1000)\n"
+    "  -backedges <n>: Backedges before a function is hot (default: 10000)\n"
+    "  -osr:          Move hot loops from the interpreter into the jit\n"
+    "  -async:        Compile hot functions on a background thread\n"
+    "  -compilequeue <n>: Most functions waiting to compile (default: 64)\n"
+    "  -compilethreads <n>: Threads planning the up front compiles, 0 for\n"
+    "                 one per core (default: 1)\n"
+    "  -profilein <file>: Compile the hot functions of a profile up front.\n"
+    "                 It must be of a run with the same jit options\n"
+    "  -profileout <file>: Write a profile of the hot functions at exit\n"
+    "  -jitstats <table|json>: Print every compile of the jit at exit\n"
+    "  -jitsort <column>: Sort the table by time, bytecodes, inlined or name\n"
+    "                 (default: time)\n"
     "Run Options:\n"
     "  -function <f>: Run the function <f> (default: b9main)\n"
     "  -loop <n>:     Run the program <n> times (default: 1)\n"
+    "  -stacksize <n>: Operand stack size, in values (default: 1048576)\n"
     "  -inline <n>:   Set the jit's max inline depth (default: 0)\n"
+    "  -inlinebudget <n>: Most bytecodes inlined per function (default: 256)\n"
+    "  -inlinesize <n>: Largest callee inlined anywhere (default: 24)\n"
+    "  -inlinehotsize <n>: Largest callee inlined at a hot call (default: 96)\n"
     "  -debug:        Enable debug code\n"
     "  -verbose:      Run with verbose printing\n"
     "  -help:         Print this help message";
@@ -36,6 +77,10 @@ struct RunConfig {
   b9::Config b9;
   const char* moduleName = "";
   const char* mainFunction = "b9main";
+  const char* profileIn = nullptr;
+  const char* profileOut = nullptr;
+  const char* jitStats = nullptr;
+  b9::JitStatsSort jitSort = b9::JitStatsSort::TIME;
   std::size_t loopCount = 1;
   bool verbose = false;
   std::vector<b9::StackElement> usrArgs;
@@ -46,6 +91,13 @@ std::ostream& operator<<(std::ostream& out, const RunConfig& cfg) {
       << "Function:     " << cfg.mainFunction << std::endl
       << "Looping:      " << cfg.loopCount << std::endl;
 
+  if (cfg.profileIn != nullptr) {
+    out << "Profile in:   " << cfg.profileIn << std::endl;
+  }
+  if (cfg.profileOut != nullptr) {
+    out << "Profile out:  " << cfg.profileOut << std::endl;
+  }
+
   out << "Arguments:    [ ";
   for (const auto& arg : cfg.usrArgs) {
     out << arg << " ";
@@ -70,6 +122,12 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
       cfg.loopCount = atoi(argv[++i]);
     } else if (strcasecmp(arg, "-inline") == 0) {
       cfg.b9.maxInlineDepth = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-inlinebudget") == 0) {
+      cfg.b9.inlineBudget = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-inlinesize") == 0) {
+      cfg.b9.inlineSize = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-inlinehotsize") == 0) {
+      cfg.b9.inlineHotSize = atoi(argv[++i]);
     } else if (strcasecmp(arg, "-verbose") == 0) {
       cfg.verbose = true;
       cfg.b9.verbose = true;
@@ -77,6 +135,24 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
       cfg.b9.debug = true;
     } else if (strcasecmp(arg, "-function") == 0) {
       cfg.mainFunction = argv[++i];
+    } else if (strcasecmp(arg, "-stacksize") == 0) {
+      cfg.b9.stackSize = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-noverify") == 0) {
+      cfg.b9.verify = false;
+    } else if (strcasecmp(arg, "-tailcall") == 0) {
+      cfg.b9.tailCalls = true;
+    } else if (strcasecmp(arg, "-optimize") == 0) {
+      cfg.b9.optimize = true;
+    } else if (strcasecmp(arg, "-threaded") == 0) {
+      cfg.b9.threaded = true;
+    } else if (strcasecmp(arg, "-nofuse") == 0) {
+      cfg.b9.fuse = false;
+    } else if (strcasecmp(arg, "-framestack") == 0) {
+      cfg.b9.frameStack = true;
+    } else if (strcasecmp(arg, "-noinlinecache") == 0) {
+      cfg.b9.inlineCache = false;
+    } else if (strcasecmp(arg, "-quicken") == 0) {
+      cfg.b9.quicken = true;
     } else if (strcasecmp(arg, "-jit") == 0) {
       cfg.b9.jit = true;
     } else if (strcasecmp(arg, "-directcall") == 0) {
@@ -85,6 +161,43 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
       cfg.b9.passParam = true;
     } else if (strcasecmp(arg, "-lazyvmstate") == 0) {
       cfg.b9.lazyVmState = true;
+    } else if (strcasecmp(arg, "-speculate") == 0) {
+      cfg.b9.speculate = true;
+    } else if (strcasecmp(arg, "-deoptlimit") == 0) {
+      cfg.b9.deoptLimit = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-compilethreads") == 0) {
+      cfg.b9.compileThreads = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-recompile") == 0) {
+      cfg.b9.recompile = true;
+    } else if (strcasecmp(arg, "-recompilecalls") == 0) {
+      cfg.b9.recompileThreshold = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-hotinline") == 0) {
+      cfg.b9.hotInlineDepth = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-hotinlinebudget") == 0) {
+      cfg.b9.hotInlineBudget = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-tiered") == 0) {
+      cfg.b9.tiered = true;
+    } else if (strcasecmp(arg, "-invocations") == 0) {
+      cfg.b9.invocationThreshold = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-backedges") == 0) {
+      cfg.b9.backedgeThreshold = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-osr") == 0) {
+      cfg.b9.osr = true;
+    } else if (strcasecmp(arg, "-async") == 0) {
+      cfg.b9.asyncCompile = true;
+    } else if (strcasecmp(arg, "-compilequeue") == 0) {
+      cfg.b9.compileQueueLimit = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-profilein") == 0) {
+      cfg.profileIn = argv[++i];
+    } else if (strcasecmp(arg, "-profileout") == 0) {
+      cfg.profileOut = argv[++i];
+    } else if (strcasecmp(arg, "-jitstats") == 0) {
+      cfg.jitStats = argv[++i];
+    } else if (strcasecmp(arg, "-jitsort") == 0) {
+      if (!b9::parseJitStatsSort(argv[++i], cfg.jitSort)) {
+        std::cerr << "Unknown -jitsort column: " << argv[i] << std::endl;
+        return false;
+      }
     } else if (strcmp(arg, "--") == 0) {
       i++;
       break;
@@ -122,6 +235,63 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
     std::cerr << "-lazyvmstate requires -passparam" << std::endl;
     return false;
   }
+  if (cfg.b9.speculate && !cfg.b9.passParam) {
+    std::cerr << "-speculate requires -passparam" << std::endl;
+    return false;
+  }
+  if (cfg.b9.deoptLimit == 0) {
+    std::cerr << "-deoptlimit must be at least 1" << std::endl;
+    return false;
+  }
+  if (cfg.b9.recompile && !cfg.b9.passParam) {
+    std::cerr << "-recompile requires -passparam" << std::endl;
+    return false;
+  }
+  if (cfg.b9.recompile && cfg.b9.recompileThreshold == 0) {
+    std::cerr << "-recompilecalls must be at least 1" << std::endl;
+    return false;
+  }
+  if (cfg.b9.tiered && !cfg.b9.jit) {
+    std::cerr << "-tiered requires -jit" << std::endl;
+    return false;
+  }
+  if (cfg.b9.osr && !cfg.b9.tiered) {
+    std::cerr << "-osr requires -tiered" << std::endl;
+    return false;
+  }
+  if (cfg.b9.asyncCompile && !cfg.b9.tiered) {
+    std::cerr << "-async requires -tiered" << std::endl;
+    return false;
+  }
+  if (cfg.profileIn != nullptr && !cfg.b9.tiered) {
+    std::cerr << "-profilein requires -tiered" << std::endl;
+    return false;
+  }
+  if (cfg.profileOut != nullptr && !cfg.b9.tiered) {
+    std::cerr << "-profileout requires -tiered" << std::endl;
+    return false;
+  }
+  if (cfg.jitStats != nullptr && !cfg.b9.jit) {
+    std::cerr << "-jitstats requires -jit" << std::endl;
+    return false;
+  }
+  if (cfg.jitStats != nullptr && strcmp(cfg.jitStats, "table") != 0 &&
+      strcmp(cfg.jitStats, "json") != 0) {
+    std::cerr << "-jitstats must be table or json" << std::endl;
+    return false;
+  }
+  if (cfg.b9.quicken && cfg.b9.threaded) {
+    std::cerr << "-quicken can't be used with -threaded" << std::endl;
+    return false;
+  }
+  if (!cfg.b9.verify && cfg.b9.threaded) {
+    std::cerr << "-threaded can't be used with -noverify" << std::endl;
+    return false;
+  }
+  if (!cfg.b9.verify && cfg.b9.jit) {
+    std::cerr << "-jit can't be used with -noverify" << std::endl;
+    return false;
+  }
 
   return true;
 }
@@ -133,8 +303,31 @@ static void run(OMR::Om::ProcessRuntime& runtime, const RunConfig& cfg) {
   auto module = b9::deserialize(file);
   vm.load(module);
 
-  if (cfg.b9.jit) {
-    vm.generateAllCode();
+  if (cfg.verbose && cfg.b9.optimize) {
+    b9::writeOptimizeStats(std::cout, vm.optimizeStats());
+  }
+
+  if (cfg.verbose && cfg.b9.verify) {
+    std::cout << "Verified in:  " << vm.verifyTime().count() << " us"
+              << std::endl;
+  }
+
+  if (cfg.b9.jit && !cfg.b9.tiered) {
+    auto stats = vm.generateAllCode();
+    if (cfg.verbose) {
+      std::cout << stats << std::endl;
+    }
+  }
+
+  if (cfg.profileIn != nullptr) {
+    std::ifstream in(cfg.profileIn);
+    if (!in) {
+      throw b9::ProfileException{std::string("Can't open ") + cfg.profileIn};
+    }
+    auto warmed = vm.warmUp(b9::readProfile(in));
+    if (cfg.verbose) {
+      std::cout << "Warmed up:    " << warmed << " functions" << std::endl;
+    }
   }
 
   size_t functionIndex = module->getFunctionIndex(cfg.mainFunction);
@@ -142,6 +335,45 @@ static void run(OMR::Om::ProcessRuntime& runtime, const RunConfig& cfg) {
     auto result = vm.run(functionIndex, cfg.usrArgs);
     std::cout << std::endl << "=> " << result << std::endl;
   }
+
+  if (cfg.verbose && cfg.b9.inlineCache) {
+    std::cout << std::endl << vm.inlineCacheStats() << std::endl;
+  }
+
+  if (cfg.verbose && cfg.b9.quicken) {
+    std::cout << std::endl << vm.quickenStats() << std::endl;
+  }
+
+  if (cfg.verbose && cfg.b9.asyncCompile) {
+    std::cout << std::endl << vm.compileStats() << std::endl;
+  }
+
+  if (cfg.verbose && cfg.b9.speculate) {
+    std::cout << std::endl;
+    for (std::size_t i = 0; i < vm.getFunctionCount(); i++) {
+      std::cout << "Deopts:       " << vm.getFunction(i)->name << " "
+                << vm.getProfile(i).deopts << std::endl;
+    }
+  }
+
+  if (cfg.jitStats != nullptr) {
+    auto records = vm.jitStats();
+    std::cout << std::endl;
+    if (strcmp(cfg.jitStats, "json") == 0) {
+      b9::writeJitStatsJson(std::cout, records);
+    } else {
+      b9::sortCompileRecords(records, cfg.jitSort);
+      b9::writeJitStatsTable(std::cout, records);
+    }
+  }
+
+  if (cfg.profileOut != nullptr) {
+    std::ofstream out(cfg.profileOut);
+    if (!out) {
+      throw b9::ProfileException{std::string("Can't open ") + cfg.profileOut};
+    }
+    b9::writeProfile(out, vm.recordProfile());
+  }
 }
 
 int main(int argc, char* argv[]) {
@@ -162,15 +394,27 @@ int main(int argc, char* argv[]) {
   } catch (const b9::DeserializeException& e) {
     std::cerr << "Failed to load module: " << e.what() << std::endl;
     exit(EXIT_FAILURE);
+  } catch (const b9::VerifyException& e) {
+    std::cerr << "Failed to verify module: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  } catch (const b9::StackOverflowException& e) {
+    std::cerr << "Failed to run module: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   } catch (const b9::FunctionNotFoundException& e) {
     std::cerr << "Failed to find function: " << e.what() << std::endl;
     exit(EXIT_FAILURE);
   } catch (const b9::BadFunctionCallException& e) {
     std::cerr << "Failed to call function " << e.what() << std::endl;
     exit(EXIT_FAILURE);
+  } catch (const b9::ProfileException& e) {
+    std::cerr << "Failed to use profile: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   } catch (const b9::CompilationException& e) {
     std::cerr << "Failed to compile function: " << e.what() << std::endl;
     exit(EXIT_FAILURE);
+  } catch (const b9::ConfigException& e) {
+    std::cerr << "Invalid config: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   }
 
   exit(EXIT_SUCCESS);
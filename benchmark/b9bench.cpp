@@ -0,0 +1,454 @@
+#include <b9/ExecutionContext.hpp>
+#include <b9/deserialize.hpp>
+#include <b9/verifier.hpp>
+
+#include <OMR/Om/Context.inl.hpp>
+#include <OMR/Om/MemoryManager.inl.hpp>
+#include <OMR/Om/RootRef.inl.hpp>
+#include <OMR/Om/Runtime.hpp>
+
+#include <strings.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// B9bench's usage string. Printed when run with -help.
+static const char* usage =
+    "Usage: b9bench [<option>...] <benchmark> <module> <function> [<arg>...]\n"
+    "   Or: b9bench -help\n"
+    "Benchmarks:\n"
+    "  dispatch:      Compare the switch, threaded and fused interpreters\n"
+    "  calls:         Compare recursive calls with the frame stack\n"
+    "  tiered:        Compare compiling everything up front with tiering\n"
+    "  verify:        Weigh the verifier's cost against running the code\n"
+    "  run:           Compare a new context per run with pooled contexts\n"
+    "  threads:       Measure throughput on 1 to <n> threads sharing a VM\n"
+    "  batch:         Compare a loop of runs with one runBatch\n"
+    "Options:\n"
+    "  -loop <n>:     Call the function <n> times per sample (default: 1)\n"
+    "  -samples <n>:  Take <n> samples of each configuration (default: 5)\n"
+    "  -threads <n>:  Scale the threads benchmark up to <n> threads, and run\n"
+    "                 batches on <n> threads (default: the number of\n"
+    "                 hardware threads)\n"
+    "  -help:         Print this help message";
+
+/// The b9bench program's global configuration.
+struct BenchConfig {
+  const char* benchmark = "";
+  const char* moduleName = "";
+  const char* function = "";
+  std::size_t loopCount = 1;
+  std::size_t sampleCount = 5;
+  std::size_t threadCount = std::thread::hardware_concurrency();
+  std::vector<b9::StackElement> usrArgs;
+};
+
+/// Parse CLI arguments and set up the config.
+static bool parseArguments(BenchConfig& cfg, const int argc, char* argv[]) {
+  std::size_t i = 1;
+
+  for (; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (strcasecmp(arg, "-help") == 0) {
+      std::cout << usage << std::endl;
+      exit(EXIT_SUCCESS);
+    } else if (strcasecmp(arg, "-loop") == 0) {
+      cfg.loopCount = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-samples") == 0) {
+      cfg.sampleCount = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-threads") == 0) {
+      cfg.threadCount = atoi(argv[++i]);
+    } else if (strcmp(arg, "--") == 0) {
+      i++;
+      break;
+    } else if (arg[0] == '-') {
+      std::cerr << "Unrecognized option: " << arg << std::endl;
+      return false;
+    } else {
+      break;
+    }
+  }
+
+  if (i + 3 > argc) {
+    std::cerr << "Expected a benchmark, module and function" << std::endl;
+    return false;
+  }
+
+  cfg.benchmark = argv[i++];
+  cfg.moduleName = argv[i++];
+  cfg.function = argv[i++];
+
+  for (; i < argc; i++) {
+    cfg.usrArgs.push_back(OMR::Om::Value(std::atoi(argv[i])));
+  }
+
+  return true;
+}
+
+using Clock = std::chrono::steady_clock;
+
+/// The fastest of cfg.sampleCount samples, in milliseconds. Each sample calls
+/// the benchmarked function cfg.loopCount times.
+static double sample(b9::VirtualMachine& vm, const BenchConfig& cfg) {
+  auto functionIndex = vm.module()->getFunctionIndex(cfg.function);
+  double best = 0;
+
+  for (std::size_t s = 0; s < cfg.sampleCount; s++) {
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < cfg.loopCount; i++) {
+      vm.run(functionIndex, cfg.usrArgs);
+    }
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    if (s == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+  }
+
+  return best;
+}
+
+/// Compare the switch interpreter with the threaded interpreter, with and
+/// without superinstructions. The speedup is of the fused threaded code.
+static void benchDispatch(OMR::Om::ProcessRuntime& runtime,
+                          std::shared_ptr<b9::Module> module,
+                          const BenchConfig& cfg) {
+  b9::Config switchCfg;
+  b9::Config unfusedCfg;
+  unfusedCfg.threaded = true;
+  unfusedCfg.fuse = false;
+  b9::Config threadedCfg;
+  threadedCfg.threaded = true;
+
+  b9::VirtualMachine switchVm{runtime, switchCfg};
+  switchVm.load(module);
+  b9::VirtualMachine unfusedVm{runtime, unfusedCfg};
+  unfusedVm.load(module);
+  b9::VirtualMachine threadedVm{runtime, threadedCfg};
+  threadedVm.load(module);
+
+  auto switchTime = sample(switchVm, cfg);
+  auto unfusedTime = sample(unfusedVm, cfg);
+  auto threadedTime = sample(threadedVm, cfg);
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "Function:     " << cfg.function << " x" << cfg.loopCount
+            << std::endl
+            << "switch:       " << switchTime << " ms" << std::endl
+            << "unfused:      " << unfusedTime << " ms" << std::endl
+            << "threaded:     " << threadedTime << " ms" << std::endl
+            << "speedup:      " << switchTime / threadedTime << "x"
+            << std::endl;
+}
+
+/// Compare the threaded interpreter recursing on calls with the threaded
+/// interpreter using the frame stack.
+static void benchCalls(OMR::Om::ProcessRuntime& runtime,
+                       std::shared_ptr<b9::Module> module,
+                       const BenchConfig& cfg) {
+  b9::Config recursiveCfg;
+  recursiveCfg.threaded = true;
+  b9::Config frameStackCfg;
+  frameStackCfg.threaded = true;
+  frameStackCfg.frameStack = true;
+
+  b9::VirtualMachine recursiveVm{runtime, recursiveCfg};
+  recursiveVm.load(module);
+  b9::VirtualMachine frameStackVm{runtime, frameStackCfg};
+  frameStackVm.load(module);
+
+  auto recursiveTime = sample(recursiveVm, cfg);
+  auto frameStackTime = sample(frameStackVm, cfg);
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "Function:     " << cfg.function << " x" << cfg.loopCount
+            << std::endl
+            << "recursive:    " << recursiveTime << " ms" << std::endl
+            << "framestack:   " << frameStackTime << " ms" << std::endl
+            << "speedup:      " << recursiveTime / frameStackTime << "x"
+            << std::endl;
+}
+
+/// The fastest of cfg.sampleCount samples, in milliseconds, of loading the
+/// module into a new VM and calling the function cfg.loopCount times. When
+/// the JIT is enabled but tiering isn't, all the code is compiled up front.
+static double sampleStartup(OMR::Om::ProcessRuntime& runtime,
+                            std::shared_ptr<b9::Module> module,
+                            const b9::Config& vmCfg, const BenchConfig& cfg) {
+  double best = 0;
+
+  for (std::size_t s = 0; s < cfg.sampleCount; s++) {
+    auto start = Clock::now();
+    b9::VirtualMachine vm{runtime, vmCfg};
+    vm.load(module);
+    if (vmCfg.jit && !vmCfg.tiered) {
+      vm.generateAllCode();
+    }
+    auto functionIndex = module->getFunctionIndex(cfg.function);
+    for (std::size_t i = 0; i < cfg.loopCount; i++) {
+      vm.run(functionIndex, cfg.usrArgs);
+    }
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    if (s == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+  }
+
+  return best;
+}
+
+/// Compare the interpreter, compiling every function up front, and tiered
+/// compilation. Times include loading and compiling.
+static void benchTiered(OMR::Om::ProcessRuntime& runtime,
+                        std::shared_ptr<b9::Module> module,
+                        const BenchConfig& cfg) {
+  b9::Config interpreterCfg;
+  b9::Config eagerCfg;
+  eagerCfg.jit = true;
+  b9::Config tieredCfg;
+  tieredCfg.jit = true;
+  tieredCfg.tiered = true;
+
+  auto interpreterTime = sampleStartup(runtime, module, interpreterCfg, cfg);
+  auto eagerTime = sampleStartup(runtime, module, eagerCfg, cfg);
+  auto tieredTime = sampleStartup(runtime, module, tieredCfg, cfg);
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "Function:     " << cfg.function << " x" << cfg.loopCount
+            << std::endl
+            << "interpreter:  " << interpreterTime << " ms" << std::endl
+            << "eager jit:    " << eagerTime << " ms" << std::endl
+            << "tiered jit:   " << tieredTime << " ms" << std::endl
+            << "speedup:      " << eagerTime / tieredTime << "x" << std::endl;
+}
+
+/// Time the verifier on the whole module, against running the function with
+/// the verified module. The switch interpreter only skips its checks on
+/// verified code, so the verifier is the price of the unchecked loop.
+static void benchVerify(OMR::Om::ProcessRuntime& runtime,
+                        std::shared_ptr<b9::Module> module,
+                        const BenchConfig& cfg) {
+  double verifyTime = 0;
+  for (std::size_t s = 0; s < cfg.sampleCount; s++) {
+    auto start = Clock::now();
+    b9::verify(*module);
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    if (s == 0 || elapsed.count() < verifyTime) {
+      verifyTime = elapsed.count();
+    }
+  }
+
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(module);
+  auto runTime = sample(vm, cfg);
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "Function:     " << cfg.function << " x" << cfg.loopCount
+            << std::endl
+            << "verifier:     " << verifyTime << " ms" << std::endl
+            << "verified run: " << runTime << " ms" << std::endl
+            << "verify share: "
+            << 100 * verifyTime / (verifyTime + runTime) << "%" << std::endl;
+}
+
+/// The fastest of cfg.sampleCount samples, in milliseconds, of calling the
+/// function cfg.loopCount times, each time on a new ExecutionContext. This is
+/// what VirtualMachine::run did before contexts were pooled, less the leak.
+static double sampleNewContexts(b9::VirtualMachine& vm,
+                                const BenchConfig& cfg) {
+  auto functionIndex = vm.module()->getFunctionIndex(cfg.function);
+  double best = 0;
+
+  for (std::size_t s = 0; s < cfg.sampleCount; s++) {
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < cfg.loopCount; i++) {
+      b9::ExecutionContext context{vm, vm.config()};
+      for (auto arg = cfg.usrArgs.rbegin(); arg != cfg.usrArgs.rend(); ++arg) {
+        context.push(*arg);
+      }
+      context.interpret(functionIndex);
+    }
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    if (s == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+  }
+
+  return best;
+}
+
+/// Compare the cost of VirtualMachine::run with a new context per call, and
+/// with contexts leased from the VM's pool. Meant for small functions, where
+/// the per-call overhead dominates.
+static void benchRun(OMR::Om::ProcessRuntime& runtime,
+                     std::shared_ptr<b9::Module> module,
+                     const BenchConfig& cfg) {
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(module);
+
+  auto newTime = sampleNewContexts(vm, cfg);
+  auto pooledTime = sample(vm, cfg);
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "Function:     " << cfg.function << " x" << cfg.loopCount
+            << std::endl
+            << "new context:  " << newTime << " ms, "
+            << newTime * 1000 / cfg.loopCount << " us per run" << std::endl
+            << "pooled:       " << pooledTime << " ms, "
+            << pooledTime * 1000 / cfg.loopCount << " us per run" << std::endl
+            << "speedup:      " << newTime / pooledTime << "x" << std::endl;
+}
+
+/// The fastest of cfg.sampleCount samples, in milliseconds, of `threadCount`
+/// threads each calling the function cfg.loopCount times on the same VM.
+static double sampleThreads(b9::VirtualMachine& vm, const BenchConfig& cfg,
+                            std::size_t threadCount) {
+  auto functionIndex = vm.module()->getFunctionIndex(cfg.function);
+  double best = 0;
+
+  for (std::size_t s = 0; s < cfg.sampleCount; s++) {
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (std::size_t t = 0; t < threadCount; t++) {
+      threads.emplace_back([&] {
+        for (std::size_t i = 0; i < cfg.loopCount; i++) {
+          vm.run(functionIndex, cfg.usrArgs);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    if (s == 0 || elapsed.count() < best) {
+      best = elapsed.count();
+    }
+  }
+
+  return best;
+}
+
+/// Run the function on 1 to cfg.threadCount threads sharing one VM. Every
+/// thread does the same work, so with perfect scaling the time stays flat.
+/// The efficiency is the throughput over the single thread throughput times
+/// the number of threads.
+static void benchThreads(OMR::Om::ProcessRuntime& runtime,
+                         std::shared_ptr<b9::Module> module,
+                         const BenchConfig& cfg) {
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(module);
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "Function:     " << cfg.function << " x" << cfg.loopCount
+            << " per thread" << std::endl
+            << "threads       time (ms)     calls/ms      efficiency"
+            << std::endl;
+
+  double singleThroughput = 0;
+  for (std::size_t t = 1; t <= std::max<std::size_t>(cfg.threadCount, 1);
+       t++) {
+    auto time = sampleThreads(vm, cfg, t);
+    auto throughput = t * cfg.loopCount / time;
+    if (t == 1) {
+      singleThroughput = throughput;
+    }
+    std::cout << std::left << std::setw(14) << t << std::setw(14) << time
+              << std::setw(14) << throughput
+              << throughput / (singleThroughput * t) * 100 << "%"
+              << std::right << std::endl;
+  }
+}
+
+/// Compare calling the function cfg.loopCount times with run, and with a
+/// single runBatch on cfg.threadCount threads. Every call gets the same
+/// arguments.
+static void benchBatch(OMR::Om::ProcessRuntime& runtime,
+                       std::shared_ptr<b9::Module> module,
+                       const BenchConfig& cfg) {
+  b9::Config vmCfg;
+  vmCfg.batchThreads = cfg.threadCount;
+  b9::VirtualMachine vm{runtime, vmCfg};
+  vm.load(module);
+  auto functionIndex = module->getFunctionIndex(cfg.function);
+
+  std::vector<b9::StackElement> args;
+  for (std::size_t i = 0; i < cfg.loopCount; i++) {
+    args.insert(args.end(), cfg.usrArgs.begin(), cfg.usrArgs.end());
+  }
+  std::vector<b9::StackElement> results(cfg.loopCount);
+
+  auto runTime = sample(vm, cfg);
+  b9::BatchStats best;
+  for (std::size_t s = 0; s < cfg.sampleCount; s++) {
+    auto stats = vm.runBatch(functionIndex, {args.data(), args.size()},
+                             {results.data(), results.size()});
+    if (s == 0 || stats.time < best.time) {
+      best = stats;
+    }
+  }
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "Function:     " << cfg.function << " x" << cfg.loopCount
+            << std::endl
+            << "run loop:     " << runTime << " ms" << std::endl
+            << best << std::endl
+            << "speedup:      " << runTime / best.time.count() << "x"
+            << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  OMR::Om::ProcessRuntime runtime;
+  BenchConfig cfg;
+
+  if (!parseArguments(cfg, argc, argv)) {
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  try {
+    std::ifstream file(cfg.moduleName,
+                       std::ios_base::in | std::ios_base::binary);
+    auto module = b9::deserialize(file);
+
+    if (strcmp(cfg.benchmark, "dispatch") == 0) {
+      benchDispatch(runtime, module, cfg);
+    } else if (strcmp(cfg.benchmark, "calls") == 0) {
+      benchCalls(runtime, module, cfg);
+    } else if (strcmp(cfg.benchmark, "tiered") == 0) {
+      benchTiered(runtime, module, cfg);
+    } else if (strcmp(cfg.benchmark, "verify") == 0) {
+      benchVerify(runtime, module, cfg);
+    } else if (strcmp(cfg.benchmark, "run") == 0) {
+      benchRun(runtime, module, cfg);
+    } else if (strcmp(cfg.benchmark, "threads") == 0) {
+      benchThreads(runtime, module, cfg);
+    } else if (strcmp(cfg.benchmark, "batch") == 0) {
+      benchBatch(runtime, module, cfg);
+    } else {
+      std::cerr << "Unknown benchmark: " << cfg.benchmark << std::endl;
+      std::cerr << usage << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  } catch (const b9::DeserializeException& e) {
+    std::cerr << "Failed to load module: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  } catch (const b9::VerifyException& e) {
+    std::cerr << "Failed to verify module: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  } catch (const b9::FunctionNotFoundException& e) {
+    std::cerr << "Failed to find function: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  } catch (const b9::BadFunctionCallException& e) {
+    std::cerr << "Failed to call function " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  exit(EXIT_SUCCESS);
+}
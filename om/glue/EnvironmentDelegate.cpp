@@ -23,6 +23,8 @@
 #include "omr.h"
 #include "omrExampleVM.hpp"
 
+#include <OMR/Om/MemoryManager.hpp>
+
 #include "AtomicOperations.hpp"
 #include "EnvironmentDelegate.hpp"
 #include "EnvironmentStandard.hpp"
@@ -81,7 +83,8 @@ void MM_EnvironmentDelegate::releaseVMAccess() {
  * @return true if another thread is waiting to acquire exclusive VM access
  */
 bool MM_EnvironmentDelegate::isExclusiveAccessRequestWaiting() {
-  assert(0);
+  auto manager = (OMR::Om::MemoryManager *)_env->getOmrVM()->_language_vm;
+  return manager->safepoint().requested();
 #if 0
   OMR_VM_Example *exampleVM = (OMR_VM_Example *)_env->getOmrVM()->_language_vm;
   if ((0 < exampleVM->_vmExclusiveAccessCount) ||
@@ -102,7 +105,12 @@ bool MM_EnvironmentDelegate::isExclusiveAccessRequestWaiting() {
  * access have release VM access.
  */
 void MM_EnvironmentDelegate::acquireExclusiveVMAccess() {
-  std::cerr << ">AQUIRE EXCLUSIVE ACCESS" << std::endl;
+  // Om runs the mutators under the memory manager's safepoint. Exclusive
+  // access parks every other thread attached to it.
+  if (0 == _env->getOmrVMThread()->exclusiveCount) {
+    auto manager = (OMR::Om::MemoryManager *)_env->getOmrVM()->_language_vm;
+    manager->safepoint().stop();
+  }
   _env->getOmrVMThread()->exclusiveCount += 1;
 #if 0
   auto manager = getManager(env);
@@ -132,8 +140,11 @@ void MM_EnvironmentDelegate::acquireExclusiveVMAccess() {
  * continue and acquire shared VM access.
  */
 void MM_EnvironmentDelegate::releaseExclusiveVMAccess() {
-  std::cerr << ">RELEASE EXCLUSIVE ACCESS" << std::endl;
   _env->getOmrVMThread()->exclusiveCount -= 1;
+  if (0 == _env->getOmrVMThread()->exclusiveCount) {
+    auto manager = (OMR::Om::MemoryManager *)_env->getOmrVM()->_language_vm;
+    manager->safepoint().resume();
+  }
 #if 0
   if (1 == _env->getOmrVMThread()->exclusiveCount) {
     OMR_VM_Example *exampleVM =
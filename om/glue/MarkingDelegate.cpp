@@ -60,14 +60,19 @@ void MarkingDelegate::scanRoots(MM_EnvironmentBase* env) {
     }
   }
 
-  const auto& roots = cx.stackRoots();
-  for (const auto& p : roots) {
-    std::cout << "NATIVE_STACK: " << p << std::endl;
-    _markingScheme->markObject(env, p);
-  }
+  // The world is stopped, so every context's roots are stable. Each context
+  // is scanned, not just the collecting one, since other threads' contexts
+  // hold the values they were running with.
+  std::lock_guard<std::mutex> lock(manager.contextsMutex());
+  for (auto* context : manager.contexts()) {
+    for (const auto& p : context->stackRoots()) {
+      std::cout << "NATIVE_STACK: " << p << std::endl;
+      _markingScheme->markObject(env, p);
+    }
 
-  for (auto& fn : cx.userRoots()) {
-    fn(cx, marker);
+    for (auto& fn : context->userRoots()) {
+      fn(*context, marker);
+    }
   }
 }
 
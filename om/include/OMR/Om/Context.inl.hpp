@@ -16,12 +16,18 @@ namespace Om {
 inline Context::Context(MemoryManager& manager) : manager_(&manager) {
   auto e =
       OMR_Thread_Init(&manager.omrVm(), this, &omrVmThread_, "b9::Context");
-  manager_->contexts().insert(this);
+  {
+    std::lock_guard<std::mutex> lock(manager_->contextsMutex());
+    manager_->contexts().insert(this);
+  }
   if (e != 0) throw std::runtime_error("Failed to attach OMR thread to OMR VM");
 }
 
 inline Context::~Context() noexcept {
-  manager_->contexts().erase(this);
+  {
+    std::lock_guard<std::mutex> lock(manager_->contextsMutex());
+    manager_->contexts().erase(this);
+  }
   OMR_Thread_Free(omrVmThread_);
 }
 
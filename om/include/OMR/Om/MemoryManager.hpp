@@ -6,7 +6,9 @@
 #include <OMR/Om/MetaMap.hpp>
 #include <OMR/Om/RootRef.hpp>
 #include <OMR/Om/Runtime.hpp>
+#include <OMR/Om/Safepoint.hpp>
 
+#include <mutex>
 #include <set>
 #include <stdexcept>
 
@@ -80,10 +82,17 @@ class MemoryManager {
     }
   }
 
+  /// Every live context, on every thread. Hold contextsMutex() while using
+  /// the set, since contexts come and go on other threads.
   const ContextSet& contexts() const { return contexts_; }
 
   ContextSet& contexts() { return contexts_; }
 
+  std::mutex& contextsMutex() const { return contextsMutex_; }
+
+  /// Stops the threads running with this heap for collections.
+  Safepoint& safepoint() { return safepoint_; }
+
  protected:
   friend class Context;
 
@@ -97,6 +106,8 @@ class MemoryManager {
   Globals globals_;
   MarkingFnVector userRoots_;
   ContextSet contexts_;
+  mutable std::mutex contextsMutex_;
+  Safepoint safepoint_;
 };
 
 }  // namespace Om
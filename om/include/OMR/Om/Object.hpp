@@ -7,6 +7,7 @@
 #include <OMR/Om/ObjectMap.hpp>
 #include <OMR/Om/Value.hpp>
 
+#include <cstddef>
 #include <type_traits>
 
 namespace OMR {
@@ -170,6 +171,7 @@ struct Object {
 
  protected:
   friend struct ObjectInitializer;
+  friend struct ObjectOffsets;
 
   Base base_;
   // TODO: Dynamic slots in objects: MemVector<Value> dynamicSlots;
@@ -185,6 +187,19 @@ struct Object {
 static_assert(std::is_standard_layout<Object>::value,
               "Object must be a StandardLayoutType.");
 
+/// An offset table for the jit compilers.
+struct ObjectOffsets {
+  /// The cell header, which holds the object's map.
+  static constexpr std::size_t header =
+      offsetof(Object, base_) + offsetof(Cell, header);
+  static constexpr std::size_t fixedSlots = offsetof(Object, fixedSlots_);
+
+  /// The offset of a slot from the start of the object.
+  static std::size_t slot(SlotIndex index) noexcept {
+    return fixedSlots + index.offset();
+  }
+};
+
 }  // namespace Om
 }  // namespace OMR
 
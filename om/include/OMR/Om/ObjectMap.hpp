@@ -38,6 +38,7 @@ class SlotIndex {
  protected:
   friend struct ObjectMap;
   friend struct Object;
+  friend struct ObjectOffsets;
 
   std::size_t offset() const noexcept { return offset_; }
 
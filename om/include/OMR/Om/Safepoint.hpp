@@ -0,0 +1,146 @@
+#if !defined(OMR_OM_SAFEPOINT_HPP_)
+#define OMR_OM_SAFEPOINT_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace OMR {
+namespace Om {
+
+/// Stops every mutator thread for a stop-the-world operation, like a GC.
+///
+/// A thread attaches while it runs code that touches the heap, and detaches
+/// when it's done. Attached threads must poll regularly. When a thread asks
+/// to stop the world, it waits until every other attached thread has parked
+/// in a poll, or detached. Threads that attach while the world is stopped
+/// wait until it resumes. Attaching nests, so a thread that is already
+/// attached never blocks in attach.
+class Safepoint {
+ public:
+  Safepoint() = default;
+
+  Safepoint(const Safepoint&) = delete;
+
+  /// Start running mutator code on the calling thread.
+  void attach() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto& depth = depths_[std::this_thread::get_id()];
+    if (depth++ == 0) {
+      resumed_.wait(lock, [this] { return !stopping_; });
+      running_++;
+    }
+  }
+
+  /// Stop running mutator code on the calling thread.
+  void detach() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = depths_.find(std::this_thread::get_id());
+    if (--found->second == 0) {
+      depths_.erase(found);
+      running_--;
+      parked_.notify_all();
+    }
+  }
+
+  /// True if another thread is waiting to stop the world. Cheap enough to
+  /// check on every backedge.
+  bool requested() const { return requested_.load(std::memory_order_relaxed); }
+
+  /// The flag behind requested(), for jitted code that checks it inline. It
+  /// lives as long as the Safepoint does.
+  const std::atomic<bool>* requestedFlag() const { return &requested_; }
+
+  /// Park the calling thread if another thread is waiting to stop the world.
+  /// Polling from a thread that isn't attached does nothing.
+  void poll() {
+    if (requested()) {
+      park();
+    }
+  }
+
+  /// Wait until every other attached thread has parked or detached. The
+  /// calling thread may be attached or not. Stops don't nest.
+  void stop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto attached = depths_.count(std::this_thread::get_id()) != 0;
+    if (attached) {
+      running_--;
+      parked_.notify_all();
+    }
+    // Another thread got here first. Let it finish.
+    resumed_.wait(lock, [this] { return !stopping_; });
+    stopping_ = true;
+    requested_.store(true, std::memory_order_relaxed);
+    parked_.wait(lock, [this] { return running_ == 0; });
+    stops_++;
+  }
+
+  /// Let the parked threads run again. Only called by the thread that
+  /// stopped the world.
+  void resume() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (depths_.count(std::this_thread::get_id()) != 0) {
+      running_++;
+    }
+    stopping_ = false;
+    requested_.store(false, std::memory_order_relaxed);
+    resumed_.notify_all();
+  }
+
+  /// The number of attached threads that aren't parked.
+  std::size_t running() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return running_;
+  }
+
+  /// The number of times the world was stopped.
+  std::size_t stops() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stops_;
+  }
+
+ private:
+  void park() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!stopping_ || depths_.count(std::this_thread::get_id()) == 0) {
+      return;
+    }
+    running_--;
+    parked_.notify_all();
+    resumed_.wait(lock, [this] { return !stopping_; });
+    running_++;
+  }
+
+  mutable std::mutex mutex_;
+  std::condition_variable parked_;   //< A running thread parked or detached
+  std::condition_variable resumed_;  //< The world resumed
+  std::unordered_map<std::thread::id, std::size_t> depths_;
+  std::size_t running_ = 0;
+  std::size_t stops_ = 0;
+  bool stopping_ = false;
+  std::atomic<bool> requested_{false};
+};
+
+/// Attaches the calling thread to a Safepoint for the scope's lifetime.
+class SafepointScope {
+ public:
+  explicit SafepointScope(Safepoint& safepoint) : safepoint_(safepoint) {
+    safepoint_.attach();
+  }
+
+  SafepointScope(const SafepointScope&) = delete;
+
+  ~SafepointScope() { safepoint_.detach(); }
+
+ private:
+  Safepoint& safepoint_;
+};
+
+}  // namespace Om
+}  // namespace OMR
+
+#endif  // OMR_OM_SAFEPOINT_HPP_
@@ -0,0 +1,100 @@
+#include <OMR/Om/Safepoint.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace OMR {
+namespace Om {
+namespace Test {
+
+TEST(SafepointTest, attachNests) {
+  Safepoint safepoint;
+  EXPECT_EQ(safepoint.running(), 0);
+  {
+    SafepointScope outer(safepoint);
+    SafepointScope inner(safepoint);
+    EXPECT_EQ(safepoint.running(), 1);
+  }
+  EXPECT_EQ(safepoint.running(), 0);
+}
+
+TEST(SafepointTest, stopWithoutMutators) {
+  Safepoint safepoint;
+  safepoint.stop();
+  EXPECT_TRUE(safepoint.requested());
+  safepoint.resume();
+  EXPECT_FALSE(safepoint.requested());
+  EXPECT_EQ(safepoint.stops(), 1);
+}
+
+TEST(SafepointTest, stopParksEveryMutator) {
+  static constexpr std::size_t THREADS = 4;
+  Safepoint safepoint;
+  std::atomic<bool> done{false};
+  std::atomic<std::size_t> counters[THREADS];
+  std::vector<std::thread> threads;
+
+  for (std::size_t i = 0; i < THREADS; i++) {
+    counters[i] = 0;
+    threads.emplace_back([&, i] {
+      SafepointScope attached(safepoint);
+      while (!done) {
+        counters[i]++;
+        safepoint.poll();
+      }
+    });
+  }
+
+  for (std::size_t round = 0; round < 10; round++) {
+    SafepointScope attached(safepoint);
+    safepoint.stop();
+    EXPECT_EQ(safepoint.running(), 0);
+    // Nobody runs while the world is stopped.
+    std::size_t before[THREADS];
+    for (std::size_t i = 0; i < THREADS; i++) {
+      before[i] = counters[i];
+    }
+    std::this_thread::yield();
+    for (std::size_t i = 0; i < THREADS; i++) {
+      EXPECT_EQ(counters[i], before[i]);
+    }
+    safepoint.resume();
+  }
+
+  done = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(safepoint.stops(), 10);
+  EXPECT_EQ(safepoint.running(), 0);
+}
+
+TEST(SafepointTest, concurrentStops) {
+  static constexpr std::size_t THREADS = 4;
+  static constexpr std::size_t STOPS = 100;
+  Safepoint safepoint;
+  std::vector<std::thread> threads;
+
+  for (std::size_t i = 0; i < THREADS; i++) {
+    threads.emplace_back([&] {
+      SafepointScope attached(safepoint);
+      for (std::size_t j = 0; j < STOPS; j++) {
+        safepoint.poll();
+        safepoint.stop();
+        safepoint.resume();
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(safepoint.stops(), THREADS * STOPS);
+}
+
+}  // namespace Test
+}  // namespace Om
+}  // namespace OMR
@@ -1,10 +1,24 @@
 #include <b9/ExecutionContext.hpp>
+#include <b9/JitStats.hpp>
+#include <b9/WarmProfile.hpp>
+#include <b9/compiler/InlinePlan.hpp>
 #include <b9/deserialize.hpp>
+#include <b9/fusion.hpp>
+#include <b9/optimize.hpp>
+#include <b9/tailcall.hpp>
+#include <b9/verifier.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -41,7 +55,9 @@ const std::vector<const char*> TEST_NAMES = {
   "test_string_return_string",
   "test_while",
   "test_for_never_run_body",
-  "test_for_sum"
+  "test_for_sum",
+  "test_call_many_args",
+  "test_call_many_locals"
 };
 // clang-format on
 
@@ -72,6 +88,57 @@ TEST_F(InterpreterTest, interpreter) {
   }
 }
 
+TEST_F(InterpreterTest, threaded) {
+  Config cfg;
+  cfg.threaded = true;
+
+  VirtualMachine vm{runtime, cfg};
+  vm.load(module_);
+
+  for (auto test : TEST_NAMES) {
+    EXPECT_TRUE(vm.run(test, {}).getInteger()) << "Test Failed: " << test;
+  }
+}
+
+TEST_F(InterpreterTest, threaded_nofuse) {
+  Config cfg;
+  cfg.threaded = true;
+  cfg.fuse = false;
+
+  VirtualMachine vm{runtime, cfg};
+  vm.load(module_);
+
+  for (auto test : TEST_NAMES) {
+    EXPECT_TRUE(vm.run(test, {}).getInteger()) << "Test Failed: " << test;
+  }
+}
+
+TEST_F(InterpreterTest, threaded_framestack) {
+  Config cfg;
+  cfg.threaded = true;
+  cfg.frameStack = true;
+
+  VirtualMachine vm{runtime, cfg};
+  vm.load(module_);
+
+  for (auto test : TEST_NAMES) {
+    EXPECT_TRUE(vm.run(test, {}).getInteger()) << "Test Failed: " << test;
+  }
+}
+
+TEST_F(InterpreterTest, optimized) {
+  Config cfg;
+  cfg.optimize = true;
+
+  VirtualMachine vm{runtime, cfg};
+  vm.load(module_);
+  EXPECT_LT(vm.optimizeStats().after, vm.optimizeStats().before);
+
+  for (auto test : TEST_NAMES) {
+    EXPECT_TRUE(vm.run(test, {}).getInteger()) << "Test Failed: " << test;
+  }
+}
+
 TEST_F(InterpreterTest, jit) {
   Config cfg;
   cfg.jit = true;
@@ -85,6 +152,28 @@ TEST_F(InterpreterTest, jit) {
   }
 }
 
+TEST_F(InterpreterTest, jit_tiered) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.invocationThreshold = 2;
+  cfg.backedgeThreshold = 10;
+
+  VirtualMachine vm{runtime, cfg};
+  vm.load(module_);
+
+  for (int i = 0; i < 3; i++) {
+    for (auto test : TEST_NAMES) {
+      EXPECT_TRUE(vm.run(test, {}).getInteger()) << "Test Failed: " << test;
+    }
+  }
+
+  for (auto test : TEST_NAMES) {
+    auto index = module_->getFunctionIndex(test);
+    EXPECT_EQ(vm.getTier(index), Tier::COMPILED) << "Not Compiled: " << test;
+  }
+}
+
 TEST_F(InterpreterTest, jit_dc) {
   Config cfg;
   cfg.jit = true;
@@ -130,6 +219,32 @@ TEST_F(InterpreterTest, jit_lvms) {
   }
 }
 
+TEST(ConfigTest, rejectTieredWithoutJit) {
+  Config cfg;
+  cfg.tiered = true;
+  EXPECT_THROW(VirtualMachine(runtime, cfg), ConfigException);
+}
+
+TEST(ConfigTest, rejectThreadedWithoutVerify) {
+  Config cfg;
+  cfg.threaded = true;
+  cfg.verify = false;
+  EXPECT_THROW(VirtualMachine(runtime, cfg), ConfigException);
+}
+
+TEST(ConfigTest, rejectJitWithoutVerify) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.verify = false;
+  EXPECT_THROW(VirtualMachine(runtime, cfg), ConfigException);
+}
+
+TEST(ConfigTest, rejectZeroDeoptLimit) {
+  Config cfg;
+  cfg.deoptLimit = 0;
+  EXPECT_THROW(VirtualMachine(runtime, cfg), ConfigException);
+}
+
 TEST(MyTest, arguments) {
   Config cfg;
   cfg.jit = true;
@@ -162,6 +277,351 @@ TEST(MyTest, jitSimpleProgram) {
   EXPECT_EQ(r, Value(0xdead));
 }
 
+TEST(MyTest, jitTierUpOnInvocations) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.invocationThreshold = 3;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{ByteCode::INT_PUSH_CONSTANT, 0xdead},
+                                {ByteCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"constant", 0, i, 0, 0});
+  vm.load(m);
+  for (int n = 1; n < 3; n++) {
+    EXPECT_EQ(vm.run("constant", {}), Value(0xdead));
+    EXPECT_EQ(vm.getTier(0), Tier::INTERPRETED);
+    EXPECT_EQ(vm.getProfile(0).invocations, n);
+  }
+  EXPECT_EQ(vm.run("constant", {}), Value(0xdead));
+  EXPECT_EQ(vm.getTier(0), Tier::COMPILED);
+  EXPECT_NE(vm.getJitAddress(0), nullptr);
+  EXPECT_EQ(vm.run("constant", {}), Value(0xdead));
+}
+
+TEST(MyTest, jitAsyncTierUp) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.asyncCompile = true;
+  cfg.invocationThreshold = 3;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{ByteCode::INT_PUSH_CONSTANT, 0xdead},
+                                {ByteCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"constant", 0, i, 0, 0});
+  vm.load(m);
+  for (int n = 1; n < 10; n++) {
+    // Runs in the interpreter until the compiler thread publishes the code.
+    EXPECT_EQ(vm.run("constant", {}), Value(0xdead));
+  }
+  vm.drainCompileQueue();
+  EXPECT_EQ(vm.getTier(0), Tier::COMPILED);
+  EXPECT_NE(vm.getJitAddress(0), nullptr);
+  EXPECT_EQ(vm.run("constant", {}), Value(0xdead));
+  EXPECT_EQ(vm.compileStats().compiled, 1);
+}
+
+TEST(MyTest, jitTierUpOnBackedges) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.backedgeThreshold = 5;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  // for (n = arg0; n > 0; n -= 1) {} return 1;
+  std::vector<Instruction> i = {{ByteCode::PUSH_FROM_VAR, 0},      // 0
+                                {ByteCode::INT_PUSH_CONSTANT, 0},  // 1
+                                {ByteCode::INT_JMP_LE, 5},         // 2
+                                {ByteCode::PUSH_FROM_VAR, 0},      // 3
+                                {ByteCode::INT_PUSH_CONSTANT, 1},  // 4
+                                {ByteCode::INT_SUB},               // 5
+                                {ByteCode::POP_INTO_VAR, 0},       // 6
+                                {ByteCode::JMP, -8},               // 7
+                                {ByteCode::INT_PUSH_CONSTANT, 1},  // 8
+                                {ByteCode::FUNCTION_RETURN},       // 9
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"loop", 0, i, 1, 0});
+  vm.load(m);
+  EXPECT_EQ(vm.run("loop", {Value(4)}), Value(1));
+  EXPECT_EQ(vm.getTier(0), Tier::INTERPRETED);
+  EXPECT_EQ(vm.getProfile(0).backedges, 4);
+  EXPECT_EQ(vm.run("loop", {Value(4)}), Value(1));
+  EXPECT_EQ(vm.getTier(0), Tier::COMPILED);
+}
+
+/// for (n = arg0; n > 0; n -= 1) one(); return 1;
+static Module callLoop() {
+  Module m;
+  m.functions.push_back(b9::FunctionDef{
+      "one",
+      0,
+      {{ByteCode::INT_PUSH_CONSTANT, 1}, {ByteCode::FUNCTION_RETURN},
+       END_SECTION},
+      0,
+      0});
+  m.functions.push_back(
+      b9::FunctionDef{"loop",
+                      0,
+                      {{ByteCode::PUSH_FROM_VAR, 0},      // 0
+                       {ByteCode::INT_PUSH_CONSTANT, 0},  // 1
+                       {ByteCode::INT_JMP_LE, 7},         // 2
+                       {ByteCode::FUNCTION_CALL, 0},      // 3
+                       {ByteCode::DROP},                  // 4
+                       {ByteCode::PUSH_FROM_VAR, 0},      // 5
+                       {ByteCode::INT_PUSH_CONSTANT, 1},  // 6
+                       {ByteCode::INT_SUB},               // 7
+                       {ByteCode::POP_INTO_VAR, 0},       // 8
+                       {ByteCode::JMP, -10},              // 9
+                       {ByteCode::INT_PUSH_CONSTANT, 1},  // 10
+                       {ByteCode::FUNCTION_RETURN},       // 11
+                       END_SECTION},
+                      1,
+                      0});
+  return m;
+}
+
+TEST(CallCountTest, countCallSites) {
+  Config threaded;
+  threaded.threaded = true;
+  Config frameStack = threaded;
+  frameStack.frameStack = true;
+  for (auto cfg : {Config(), threaded, frameStack}) {
+    // Tiered, but never hot, so the counters run and nothing is compiled.
+    cfg.jit = true;
+    cfg.tiered = true;
+    cfg.invocationThreshold = 1000;
+    cfg.backedgeThreshold = 1000;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(std::make_shared<Module>(callLoop()));
+    EXPECT_EQ(vm.run("loop", {Value(7)}), Value(1));
+    EXPECT_EQ(vm.getCallCount(1, 3), 7);
+    EXPECT_EQ(vm.getProfile(0).invocations, 7);
+  }
+}
+
+TEST(CallCountTest, jitInlineSmallCallees) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  cfg.maxInlineDepth = 1;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(std::make_shared<Module>(callLoop()));
+  vm.generateAllCode();
+  EXPECT_EQ(vm.run("loop", {Value(7)}), Value(1));
+
+  auto decisions = vm.inlineDecisions();
+  ASSERT_EQ(decisions.size(), 1);
+  EXPECT_EQ(decisions[0].caller, "loop");
+  EXPECT_EQ(decisions[0].bytecodeIndex, 3);
+  EXPECT_EQ(decisions[0].callee, "one");
+  EXPECT_EQ(decisions[0].size, 3);
+  EXPECT_TRUE(decisions[0].inlined);
+  EXPECT_STREQ(decisions[0].reason, "small");
+}
+
+TEST(CallCountTest, jitInlineWithinBudget) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  cfg.maxInlineDepth = 1;
+  cfg.inlineBudget = 2;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(std::make_shared<Module>(callLoop()));
+  vm.generateAllCode();
+  EXPECT_EQ(vm.run("loop", {Value(7)}), Value(1));
+
+  auto decisions = vm.inlineDecisions();
+  ASSERT_EQ(decisions.size(), 1);
+  EXPECT_FALSE(decisions[0].inlined);
+  EXPECT_STREQ(decisions[0].reason, "over budget");
+}
+
+/// sum = 0; for (n = arg0; n > 0; n -= 1) sum += addThree(n); return sum;
+/// addThree leaves its argument under its result.
+static Module sumCallLoop() {
+  Module m;
+  m.functions.push_back(
+      b9::FunctionDef{"addThree",
+                      0,
+                      {{ByteCode::PUSH_FROM_VAR, 0},      // 0
+                       {ByteCode::INT_PUSH_CONSTANT, 3},  // 1
+                       {ByteCode::INT_ADD},               // 2
+                       {ByteCode::POP_INTO_VAR, 1},       // 3
+                       {ByteCode::PUSH_FROM_VAR, 0},      // 4
+                       {ByteCode::PUSH_FROM_VAR, 1},      // 5
+                       {ByteCode::FUNCTION_RETURN},       // 6
+                       END_SECTION},
+                      1,
+                      1});
+  m.functions.push_back(
+      b9::FunctionDef{"sumCalls",
+                      0,
+                      {{ByteCode::INT_PUSH_CONSTANT, 0},  // 0
+                       {ByteCode::POP_INTO_VAR, 1},       // 1
+                       {ByteCode::PUSH_FROM_VAR, 0},      // 2
+                       {ByteCode::INT_PUSH_CONSTANT, 0},  // 3
+                       {ByteCode::INT_JMP_LE, 10},        // 4
+                       {ByteCode::PUSH_FROM_VAR, 1},      // 5
+                       {ByteCode::PUSH_FROM_VAR, 0},      // 6
+                       {ByteCode::FUNCTION_CALL, 0},      // 7
+                       {ByteCode::INT_ADD},               // 8
+                       {ByteCode::POP_INTO_VAR, 1},       // 9
+                       {ByteCode::PUSH_FROM_VAR, 0},      // 10
+                       {ByteCode::INT_PUSH_CONSTANT, 1},  // 11
+                       {ByteCode::INT_SUB},               // 12
+                       {ByteCode::POP_INTO_VAR, 0},       // 13
+                       {ByteCode::JMP, -13},              // 14
+                       {ByteCode::PUSH_FROM_VAR, 1},      // 15
+                       {ByteCode::FUNCTION_RETURN},       // 16
+                       END_SECTION},
+                      1,
+                      1});
+  return m;
+}
+
+TEST(CallCountTest, jitInlinedReturnsToCaller) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  b9::VirtualMachine called{runtime, cfg};
+  called.load(std::make_shared<Module>(sumCallLoop()));
+  called.generateAllCode();
+  auto expected = called.run("sumCalls", {Value(7)});
+  EXPECT_EQ(expected, Value(49));
+  EXPECT_TRUE(called.inlineDecisions().empty());
+
+  cfg.maxInlineDepth = 1;
+  b9::VirtualMachine inlined{runtime, cfg};
+  inlined.load(std::make_shared<Module>(sumCallLoop()));
+  inlined.generateAllCode();
+  EXPECT_EQ(inlined.run("sumCalls", {Value(7)}), expected);
+  EXPECT_EQ(inlined.run("sumCalls", {Value(0)}), Value(0));
+
+  auto decisions = inlined.inlineDecisions();
+  ASSERT_EQ(decisions.size(), 1);
+  EXPECT_EQ(decisions[0].callee, "addThree");
+  EXPECT_TRUE(decisions[0].inlined);
+}
+
+/// sum = 0; for (n = arg0; n > 0; n -= 1) sum += n; return sum;
+static std::vector<Instruction> sumLoop() {
+  return {{ByteCode::INT_PUSH_CONSTANT, 0},  // 0
+          {ByteCode::POP_INTO_VAR, 1},       // 1
+          {ByteCode::PUSH_FROM_VAR, 0},      // 2
+          {ByteCode::INT_PUSH_CONSTANT, 0},  // 3
+          {ByteCode::INT_JMP_LE, 9},         // 4
+          {ByteCode::PUSH_FROM_VAR, 1},      // 5
+          {ByteCode::PUSH_FROM_VAR, 0},      // 6
+          {ByteCode::INT_ADD},               // 7
+          {ByteCode::POP_INTO_VAR, 1},       // 8
+          {ByteCode::PUSH_FROM_VAR, 0},      // 9
+          {ByteCode::INT_PUSH_CONSTANT, 1},  // 10
+          {ByteCode::INT_SUB},               // 11
+          {ByteCode::POP_INTO_VAR, 0},       // 12
+          {ByteCode::JMP, -12},              // 13
+          {ByteCode::PUSH_FROM_VAR, 1},      // 14
+          {ByteCode::FUNCTION_RETURN},       // 15
+          END_SECTION};
+}
+
+/// `identity` returns its argument, which `main` makes an object. Before
+/// anything runs, there's no feedback, so the JIT assumes it's an integer.
+static std::shared_ptr<Module> passAnObject() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> identity = {{ByteCode::PUSH_FROM_VAR, 0},
+                                       {ByteCode::FUNCTION_RETURN},
+                                       END_SECTION};
+  std::vector<Instruction> main = {{ByteCode::NEW_OBJECT},
+                                   {ByteCode::FUNCTION_CALL, 0},
+                                   {ByteCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"identity", 0, identity, 1, 0});
+  m->functions.push_back(b9::FunctionDef{"main", 1, main, 0, 0});
+  return m;
+}
+
+TEST(SpeculationTest, recordNonIntegerVars) {
+  Config plain;
+  plain.speculate = true;
+  Config threaded = plain;
+  threaded.threaded = true;
+  Config frameStack = threaded;
+  frameStack.frameStack = true;
+  for (auto cfg : {plain, threaded, frameStack}) {
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(passAnObject());
+    EXPECT_TRUE(vm.isIntegerVar(0, 0));
+    EXPECT_TRUE(vm.run("main", {}).isPtr());
+    EXPECT_FALSE(vm.isIntegerVar(0, 0));
+  }
+}
+
+TEST(SpeculationTest, jitDeoptimizeOnObject) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  cfg.lazyVmState = true;
+  cfg.speculate = true;
+  cfg.deoptLimit = 2;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(passAnObject());
+  vm.generateAllCode();
+  auto identity = vm.getJitAddress(0);
+
+  EXPECT_TRUE(vm.run("main", {}).isPtr());
+  EXPECT_EQ(vm.getProfile(0).deopts, 1);
+  EXPECT_FALSE(vm.isIntegerVar(0, 0));
+  EXPECT_EQ(vm.getJitAddress(0), identity);
+
+  // identity is still the old code, so it deopts again, and the limit
+  // recompiles it without the bad assumption.
+  EXPECT_TRUE(vm.run("main", {}).isPtr());
+  EXPECT_EQ(vm.getProfile(0).deopts, 2);
+  EXPECT_NE(vm.getJitAddress(0), identity);
+  EXPECT_EQ(vm.run("identity", {Value(7)}), Value(7));
+  EXPECT_EQ(vm.getProfile(0).deopts, 2);
+}
+
+TEST(MyTest, jitOsrFromLoop) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.osr = true;
+  cfg.backedgeThreshold = 10;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, sumLoop(), 1, 1});
+  vm.load(m);
+  EXPECT_EQ(vm.run("sum", {Value(100)}), Value(5050));
+  EXPECT_EQ(vm.getTier(0), Tier::COMPILED);
+  EXPECT_EQ(vm.getProfile(0).backedges, 10);
+  EXPECT_NE(vm.getOsrEntry(0, 2, 0), nullptr);
+}
+
+TEST(MyTest, jitOsrFromThreadedLoop) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.osr = true;
+  cfg.threaded = true;
+  cfg.frameStack = true;
+  cfg.backedgeThreshold = 10;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, sumLoop(), 1, 1});
+  vm.load(m);
+  EXPECT_EQ(vm.run("sum", {Value(100)}), Value(5050));
+  EXPECT_EQ(vm.getProfile(0).backedges, 10);
+  EXPECT_NE(vm.getOsrEntry(0, 2, 0), nullptr);
+}
+
 TEST(MyTest, haveAVariable) {
   Config cfg;
   cfg.jit = true;
@@ -177,6 +637,152 @@ TEST(MyTest, haveAVariable) {
   EXPECT_EQ(r, Value(0xdead));
 }
 
+TEST(FusionTest, fuseAndFixUpJumps) {
+  std::vector<Instruction> i = {{ByteCode::PUSH_FROM_VAR, 0},      // 0
+                                {ByteCode::INT_PUSH_CONSTANT, 5},  // 1
+                                {ByteCode::INT_JMP_GE, 5},         // 2
+                                {ByteCode::PUSH_FROM_VAR, 0},      // 3
+                                {ByteCode::PUSH_FROM_VAR, 1},      // 4
+                                {ByteCode::INT_ADD},               // 5
+                                {ByteCode::POP_INTO_VAR, 1},       // 6
+                                {ByteCode::JMP, -8},               // 7
+                                {ByteCode::PUSH_FROM_VAR, 1},      // 8
+                                {ByteCode::FUNCTION_RETURN},       // 9
+                                END_SECTION};
+  auto fused = fuseInstructions(i);
+  ASSERT_EQ(fused.size(), 7);
+  EXPECT_EQ(fused[0].byteCode, ByteCode::VAR_CONST_JMP_GE);
+  EXPECT_EQ(fused[0].operand, 3);
+  EXPECT_EQ(unpackVar(fused[0].operand2), 0);
+  EXPECT_EQ(unpackConst(fused[0].operand2), 5);
+  EXPECT_EQ(fused[1].byteCode, ByteCode::VAR_VAR_INT_ADD);
+  EXPECT_EQ(fused[2].byteCode, ByteCode::POP_INTO_VAR);
+  EXPECT_EQ(fused[3].byteCode, ByteCode::JMP);
+  EXPECT_EQ(fused[3].operand, -4);
+  EXPECT_EQ(fused[4].byteCode, ByteCode::PUSH_FROM_VAR);
+}
+
+TEST(FusionTest, neverFuseJumpTargets) {
+  std::vector<Instruction> i = {{ByteCode::INT_PUSH_CONSTANT, 0},  // 0
+                                {ByteCode::INT_JMP_EQ, 1},         // 1
+                                {ByteCode::PUSH_FROM_VAR, 0},      // 2
+                                {ByteCode::PUSH_FROM_VAR, 1},      // 3
+                                {ByteCode::INT_ADD},               // 4
+                                {ByteCode::FUNCTION_RETURN},       // 5
+                                END_SECTION};
+  auto fused = fuseInstructions(i);
+  ASSERT_EQ(fused.size(), i.size());
+  for (std::size_t j = 0; j < i.size(); j++) {
+    EXPECT_EQ(fused[j].byteCode, i[j].byteCode());
+  }
+}
+
+TEST(FusionTest, runFused) {
+  Config cfg;
+  cfg.threaded = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  // sum = 0; for (n = arg0; n > 0; n -= 1) sum += n; return sum;
+  std::vector<Instruction> i = {{ByteCode::INT_PUSH_CONSTANT, 0},  // 0
+                                {ByteCode::POP_INTO_VAR, 1},       // 1
+                                {ByteCode::PUSH_FROM_VAR, 0},      // 2
+                                {ByteCode::INT_PUSH_CONSTANT, 0},  // 3
+                                {ByteCode::INT_JMP_LE, 9},         // 4
+                                {ByteCode::PUSH_FROM_VAR, 1},      // 5
+                                {ByteCode::PUSH_FROM_VAR, 0},      // 6
+                                {ByteCode::INT_ADD},               // 7
+                                {ByteCode::POP_INTO_VAR, 1},       // 8
+                                {ByteCode::PUSH_FROM_VAR, 0},      // 9
+                                {ByteCode::INT_PUSH_CONSTANT, 1},  // 10
+                                {ByteCode::INT_SUB},               // 11
+                                {ByteCode::POP_INTO_VAR, 0},       // 12
+                                {ByteCode::JMP, -12},              // 13
+                                {ByteCode::PUSH_FROM_VAR, 1},      // 14
+                                {ByteCode::FUNCTION_RETURN},       // 15
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"sum", 0, i, 1, 1});
+  vm.load(m);
+  auto r = vm.run("sum", {OMR::Om::Value{10}});
+  EXPECT_EQ(r, Value(55));
+}
+
+/// if (n == 0) return 0; return n + sum(n - 1);
+static std::vector<Instruction> recursiveSum() {
+  return {{ByteCode::PUSH_FROM_VAR, 0},      // 0
+          {ByteCode::INT_PUSH_CONSTANT, 0},  // 1
+          {ByteCode::INT_JMP_NEQ, 2},        // 2
+          {ByteCode::INT_PUSH_CONSTANT, 0},  // 3
+          {ByteCode::FUNCTION_RETURN},       // 4
+          {ByteCode::PUSH_FROM_VAR, 0},      // 5
+          {ByteCode::PUSH_FROM_VAR, 0},      // 6
+          {ByteCode::INT_PUSH_CONSTANT, 1},  // 7
+          {ByteCode::INT_SUB},               // 8
+          {ByteCode::FUNCTION_CALL, 0},      // 9
+          {ByteCode::INT_ADD},               // 10
+          {ByteCode::FUNCTION_RETURN},       // 11
+          END_SECTION};
+}
+
+TEST(FrameStackTest, recursiveSum) {
+  Config cfg;
+  cfg.threaded = true;
+  cfg.frameStack = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, recursiveSum(), 1, 0});
+  vm.load(m);
+  auto r = vm.run("sum", {OMR::Om::Value{200}});
+  EXPECT_EQ(r, Value(20100));
+}
+
+TEST(OperandStackTest, reserve) {
+  OperandStack stack(16);
+  EXPECT_GE(stack.size(), 16);
+  EXPECT_NO_THROW(stack.reserve(stack.size()));
+  stack.push(Value(1));
+  EXPECT_THROW(stack.reserve(stack.size()), StackOverflowException);
+  EXPECT_NO_THROW(stack.reserve(stack.size() - 1));
+}
+
+TEST(OperandStackTest, deepRecursion) {
+  Config cfg;
+  cfg.threaded = true;
+  cfg.frameStack = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, recursiveSum(), 1, 0});
+  vm.load(m);
+  EXPECT_EQ(vm.run("sum", {Value(60000)}), Value(1800030000));
+}
+
+TEST(OperandStackTest, reportOverflow) {
+  Config cfg;
+  cfg.stackSize = 1024;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, recursiveSum(), 1, 0});
+  vm.load(m);
+  EXPECT_EQ(vm.getFrameSize(0), 3);
+  EXPECT_THROW(vm.run("sum", {Value(10000)}), StackOverflowException);
+}
+
+TEST(OperandStackTest, jitReportOverflow) {
+  Config direct;
+  direct.jit = true;
+  direct.directCall = true;
+  direct.stackSize = 1024;
+  Config passParam = direct;
+  passParam.passParam = true;
+  for (auto cfg : {direct, passParam}) {
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"sum", 0, recursiveSum(), 1, 0});
+    vm.load(m);
+    vm.generateAllCode();
+    EXPECT_THROW(vm.run("sum", {Value(10000)}), StackOverflowException);
+  }
+}
+
 TEST(ObjectTest, allocateSomething) {
   b9::VirtualMachine vm{runtime, {}};
   auto m = std::make_shared<Module>();
@@ -200,5 +806,1492 @@ TEST(ObjectTest, allocateSomething) {
   EXPECT_EQ(r, Value(0));
 }
 
+TEST(ObjectTest, jitKeepObjectsInLocalsAlive) {
+  std::vector<Instruction> i = {
+      {ByteCode::NEW_OBJECT},            // only held by var0
+      {ByteCode::POP_INTO_VAR, 0},       //
+      {ByteCode::INT_PUSH_CONSTANT, 7},  //
+      {ByteCode::PUSH_FROM_VAR, 0},      //
+      {ByteCode::POP_INTO_OBJECT, 0},    // var0.x = 7
+      {ByteCode::NEW_OBJECT},            // only held by the operand stack
+      {ByteCode::SYSTEM_COLLECT},        //
+      {ByteCode::DROP},                  //
+      {ByteCode::NEW_OBJECT},            // reuses anything freed
+      {ByteCode::DROP},                  //
+      {ByteCode::PUSH_FROM_VAR, 0},      //
+      {ByteCode::PUSH_FROM_OBJECT, 0},   // var0.x
+      {ByteCode::FUNCTION_RETURN},       //
+      END_SECTION};
+  for (bool lazyVmState : {false, true}) {
+    Config cfg;
+    cfg.jit = true;
+    cfg.directCall = true;
+    cfg.passParam = true;
+    cfg.lazyVmState = lazyVmState;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"collect", 0, i, 0, 1});
+    vm.load(m);
+    vm.generateAllCode();
+    EXPECT_EQ(vm.run("collect", {}), Value(7));
+  }
+}
+
+TEST(InlineCacheTest, monomorphicToMegamorphic) {
+  auto fakeMap = [](std::uintptr_t n) {
+    return reinterpret_cast<Om::ObjectMap *>(n * 8);
+  };
+
+  InlineCache cache;
+  EXPECT_EQ(cache.state(), InlineCacheState::UNINITIALIZED);
+  EXPECT_EQ(cache.find(fakeMap(1)), nullptr);
+
+  cache.insert({fakeMap(1), nullptr, Om::SlotIndex(8)});
+  EXPECT_EQ(cache.state(), InlineCacheState::MONOMORPHIC);
+  ASSERT_NE(cache.find(fakeMap(1)), nullptr);
+  EXPECT_EQ(cache.find(fakeMap(1))->index, Om::SlotIndex(8));
+
+  for (std::uintptr_t n = 2; n <= InlineCache::MAX_ENTRIES; n++) {
+    cache.insert({fakeMap(n), nullptr, Om::SlotIndex(n * 8)});
+  }
+  EXPECT_EQ(cache.state(), InlineCacheState::POLYMORPHIC);
+  ASSERT_NE(cache.find(fakeMap(3)), nullptr);
+  EXPECT_EQ(cache.find(fakeMap(3))->index, Om::SlotIndex(24));
+
+  cache.insert({fakeMap(InlineCache::MAX_ENTRIES + 1), nullptr, {}});
+  EXPECT_EQ(cache.state(), InlineCacheState::MEGAMORPHIC);
+  EXPECT_EQ(cache.find(fakeMap(1)), nullptr);
+  cache.insert({fakeMap(1), nullptr, {}});
+  EXPECT_EQ(cache.find(fakeMap(1)), nullptr);
+
+  EXPECT_EQ(cache.hits(), 4);
+  EXPECT_EQ(cache.misses(), 3);
+}
+
+/// sum = 0; for (n = arg0; n > 0; n -= 1) { o = {}; o.x = n; sum += o.x; }
+/// return sum;
+static std::vector<Instruction> objectLoop() {
+  return {{ByteCode::INT_PUSH_CONSTANT, 0},  // 0
+          {ByteCode::POP_INTO_VAR, 1},       // 1
+          {ByteCode::PUSH_FROM_VAR, 0},      // 2
+          {ByteCode::INT_PUSH_CONSTANT, 0},  // 3
+          {ByteCode::INT_JMP_LE, 15},        // 4
+          {ByteCode::NEW_OBJECT},            // 5
+          {ByteCode::POP_INTO_VAR, 2},       // 6
+          {ByteCode::PUSH_FROM_VAR, 0},      // 7
+          {ByteCode::PUSH_FROM_VAR, 2},      // 8
+          {ByteCode::POP_INTO_OBJECT, 0},    // 9
+          {ByteCode::PUSH_FROM_VAR, 1},      // 10
+          {ByteCode::PUSH_FROM_VAR, 2},      // 11
+          {ByteCode::PUSH_FROM_OBJECT, 0},   // 12
+          {ByteCode::INT_ADD},               // 13
+          {ByteCode::POP_INTO_VAR, 1},       // 14
+          {ByteCode::PUSH_FROM_VAR, 0},      // 15
+          {ByteCode::INT_PUSH_CONSTANT, 1},  // 16
+          {ByteCode::INT_SUB},               // 17
+          {ByteCode::POP_INTO_VAR, 0},       // 18
+          {ByteCode::JMP, -18},              // 19
+          {ByteCode::PUSH_FROM_VAR, 1},      // 20
+          {ByteCode::FUNCTION_RETURN},       // 21
+          END_SECTION};
+}
+
+/// Run objectLoop, and check that the store transitions and the load hit.
+static void checkObjectLoopCaches(const Config &cfg) {
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"objects", 0, objectLoop(), 1, 2});
+  vm.load(m);
+  EXPECT_EQ(vm.run("objects", {Value(100)}), Value(5050));
+
+  auto stats = vm.inlineCacheStats();
+  EXPECT_EQ(stats.hits, 198);
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.monomorphic, 2);
+  EXPECT_EQ(stats.megamorphic, 0);
+
+  auto store = vm.getInlineCache(0, 9);
+  ASSERT_NE(store, nullptr);
+  EXPECT_EQ(store->state(), InlineCacheState::MONOMORPHIC);
+}
+
+TEST(InlineCacheTest, sharedMapsHit) { checkObjectLoopCaches({}); }
+
+TEST(InlineCacheTest, sharedMapsHitThreaded) {
+  Config cfg;
+  cfg.threaded = true;
+  checkObjectLoopCaches(cfg);
+}
+
+TEST(InlineCacheTest, disabled) {
+  Config cfg;
+  cfg.inlineCache = false;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"objects", 0, objectLoop(), 1, 2});
+  vm.load(m);
+  EXPECT_EQ(vm.run("objects", {Value(100)}), Value(5050));
+  EXPECT_EQ(vm.getInlineCache(0, 9), nullptr);
+  EXPECT_EQ(vm.inlineCacheStats().hits, 0);
+}
+
+TEST(InlineCacheTest, jitGuardOnCachedMaps) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"objects", 0, objectLoop(), 1, 2});
+  vm.load(m);
+  EXPECT_EQ(vm.run("objects", {Value(100)}), Value(5050));
+  ASSERT_TRUE(vm.tierUp(0));
+
+  // The compiled accesses check the maps inline, so they skip the caches.
+  EXPECT_EQ(vm.run("objects", {Value(100)}), Value(5050));
+  EXPECT_EQ(vm.inlineCacheStats().hits, 198);
+}
+
+TEST(InlineCacheTest, jitWithoutCachedMaps) {
+  Config cfg;
+  cfg.jit = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"objects", 0, objectLoop(), 1, 2});
+  vm.load(m);
+  vm.generateAllCode();
+
+  // Nothing was cached when it compiled, so every access is out of line.
+  EXPECT_EQ(vm.run("objects", {Value(100)}), Value(5050));
+  EXPECT_EQ(vm.inlineCacheStats().hits, 198);
+}
+
+TEST(QuickenTest, quickenObjectAccesses) {
+  Config cfg;
+  cfg.quicken = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"objects", 0, objectLoop(), 1, 2});
+  vm.load(m);
+  EXPECT_EQ(vm.run("objects", {Value(100)}), Value(5050));
+  EXPECT_EQ(vm.getQuickInstruction(0, 9).byteCode(),
+            ByteCode::QUICK_POP_INTO_OBJECT);
+  EXPECT_EQ(vm.getQuickInstruction(0, 12).byteCode(),
+            ByteCode::QUICK_PUSH_FROM_OBJECT);
+  EXPECT_EQ(vm.quickenStats().quickened, 2);
+  EXPECT_EQ(vm.quickenStats().dequickened, 0);
+  EXPECT_EQ(m->functions[0].instructions[9].byteCode(),
+            ByteCode::POP_INTO_OBJECT);
+}
+
+TEST(QuickenTest, dequickenOnAnotherMap) {
+  Config cfg;
+  cfg.quicken = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  // a = {}; a.x = 1; b = {}; b.y = 2; b.x = 3; return get(a) + get(b);
+  std::vector<Instruction> main = {{ByteCode::NEW_OBJECT},            // 0
+                                   {ByteCode::POP_INTO_VAR, 0},       // 1
+                                   {ByteCode::INT_PUSH_CONSTANT, 1},  // 2
+                                   {ByteCode::PUSH_FROM_VAR, 0},      // 3
+                                   {ByteCode::POP_INTO_OBJECT, 0},    // 4
+                                   {ByteCode::NEW_OBJECT},            // 5
+                                   {ByteCode::POP_INTO_VAR, 1},       // 6
+                                   {ByteCode::INT_PUSH_CONSTANT, 2},  // 7
+                                   {ByteCode::PUSH_FROM_VAR, 1},      // 8
+                                   {ByteCode::POP_INTO_OBJECT, 1},    // 9
+                                   {ByteCode::INT_PUSH_CONSTANT, 3},  // 10
+                                   {ByteCode::PUSH_FROM_VAR, 1},      // 11
+                                   {ByteCode::POP_INTO_OBJECT, 0},    // 12
+                                   {ByteCode::PUSH_FROM_VAR, 0},      // 13
+                                   {ByteCode::FUNCTION_CALL, 1},      // 14
+                                   {ByteCode::PUSH_FROM_VAR, 1},      // 15
+                                   {ByteCode::FUNCTION_CALL, 1},      // 16
+                                   {ByteCode::INT_ADD},               // 17
+                                   {ByteCode::FUNCTION_RETURN},       // 18
+                                   END_SECTION};
+  // return o.x;
+  std::vector<Instruction> get = {{ByteCode::PUSH_FROM_VAR, 0},
+                                  {ByteCode::PUSH_FROM_OBJECT, 0},
+                                  {ByteCode::FUNCTION_RETURN},
+                                  END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"main", 0, main, 0, 2});
+  m->functions.push_back(b9::FunctionDef{"get", 1, get, 1, 0});
+  vm.load(m);
+
+  EXPECT_EQ(vm.run("main", {}), Value(4));
+  EXPECT_EQ(vm.getQuickInstruction(1, 1).byteCode(),
+            ByteCode::PUSH_FROM_OBJECT);
+  EXPECT_EQ(vm.quickenStats().quickened, 4);
+  EXPECT_EQ(vm.quickenStats().dequickened, 1);
+
+  // The site that fell back stays generic.
+  EXPECT_EQ(vm.run("main", {}), Value(4));
+  EXPECT_EQ(vm.getQuickInstruction(1, 1).byteCode(),
+            ByteCode::PUSH_FROM_OBJECT);
+  EXPECT_EQ(vm.quickenStats().quickened, 4);
+}
+
+TEST(QuickenTest, jitQuickenCall) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.quicken = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> main = {{ByteCode::FUNCTION_CALL, 1},
+                                   {ByteCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  std::vector<Instruction> one = {{ByteCode::INT_PUSH_CONSTANT, 1},
+                                  {ByteCode::FUNCTION_RETURN},
+                                  END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"main", 0, main, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"one", 1, one, 0, 0});
+  vm.load(m);
+  ASSERT_TRUE(vm.tierUp(1));
+  EXPECT_EQ(vm.run("main", {}), Value(1));
+  EXPECT_EQ(vm.getQuickInstruction(0, 0).byteCode(),
+            ByteCode::QUICK_FUNCTION_CALL);
+  EXPECT_EQ(vm.run("main", {}), Value(1));
+}
+
+TEST(QuickenTest, jitCountQuickCallOnce) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.quicken = true;
+  cfg.tiered = true;
+  cfg.invocationThreshold = 1000;
+  cfg.backedgeThreshold = 1000;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> main = {{ByteCode::FUNCTION_CALL, 1},
+                                   {ByteCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  std::vector<Instruction> one = {{ByteCode::INT_PUSH_CONSTANT, 1},
+                                  {ByteCode::FUNCTION_RETURN},
+                                  END_SECTION};
+  std::vector<Instruction> two = {{ByteCode::INT_PUSH_CONSTANT, 2},
+                                  {ByteCode::FUNCTION_RETURN},
+                                  END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"main", 0, main, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"one", 1, one, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"two", 2, two, 0, 0});
+  vm.load(m);
+  ASSERT_TRUE(vm.tierUp(1));
+  ASSERT_TRUE(vm.tierUp(2));
+  EXPECT_EQ(vm.run("main", {}), Value(1));
+  EXPECT_EQ(vm.run("main", {}), Value(1));
+  EXPECT_EQ(vm.getCallCount(0, 0), 2);
+
+  // The quick call's guard fails, and the call is only counted once.
+  vm.setJitAddress(1, vm.getJitAddress(2));
+  EXPECT_EQ(vm.run("main", {}), Value(2));
+  EXPECT_EQ(vm.getQuickInstruction(0, 0).byteCode(), ByteCode::FUNCTION_CALL);
+  EXPECT_EQ(vm.getCallCount(0, 0), 3);
+}
+
+/// A module with a single function, `f`, taking one argument.
+static Module singleFunction(std::vector<Instruction> instructions,
+                             std::uint32_t nregs = 0) {
+  Module m;
+  m.functions.push_back(b9::FunctionDef{"f", 0, instructions, 1, nregs});
+  return m;
+}
+
+TEST(VerifierTest, maxStackDepth) {
+  EXPECT_EQ(verifyFunction(singleFunction(sumLoop(), 1), 0), 2);
+  EXPECT_EQ(verifyFunction(singleFunction(objectLoop(), 2), 0), 2);
+}
+
+TEST(VerifierTest, skipUnreachableCode) {
+  auto m = singleFunction({{ByteCode::INT_PUSH_CONSTANT, 1},
+                           {ByteCode::FUNCTION_RETURN},
+                           {ByteCode::JMP, 100},
+                           END_SECTION});
+  EXPECT_EQ(verifyFunction(m, 0), 1);
+}
+
+TEST(VerifierTest, rejectBadCode) {
+  // Jumps out of the function.
+  EXPECT_THROW(verifyFunction(singleFunction({{ByteCode::JMP, -2},
+                                              {ByteCode::FUNCTION_RETURN},
+                                              END_SECTION}),
+                              0),
+               VerifyException);
+  // Runs off the end.
+  EXPECT_THROW(verifyFunction(singleFunction({{ByteCode::INT_PUSH_CONSTANT, 1},
+                                              END_SECTION}),
+                              0),
+               VerifyException);
+  // Missing END_SECTION.
+  EXPECT_THROW(
+      verifyFunction(singleFunction({{ByteCode::FUNCTION_RETURN}}), 0),
+      VerifyException);
+  // Local out of range.
+  EXPECT_THROW(verifyFunction(singleFunction({{ByteCode::PUSH_FROM_VAR, 1},
+                                              {ByteCode::FUNCTION_RETURN},
+                                              END_SECTION}),
+                              0),
+               VerifyException);
+  // Primitive out of range.
+  EXPECT_THROW(verifyFunction(singleFunction({{ByteCode::PUSH_FROM_VAR, 0},
+                                              {ByteCode::PRIMITIVE_CALL, 3},
+                                              {ByteCode::FUNCTION_RETURN},
+                                              END_SECTION}),
+                              0),
+               VerifyException);
+  // Pops an empty stack.
+  EXPECT_THROW(verifyFunction(singleFunction({{ByteCode::INT_ADD},
+                                              {ByteCode::FUNCTION_RETURN},
+                                              END_SECTION}),
+                              0),
+               VerifyException);
+  // A loop that grows the stack.
+  EXPECT_THROW(
+      verifyFunction(singleFunction({{ByteCode::INT_PUSH_CONSTANT, 1},
+                                     {ByteCode::PUSH_FROM_VAR, 0},
+                                     {ByteCode::INT_PUSH_CONSTANT, 0},
+                                     {ByteCode::INT_JMP_GT, -4},
+                                     {ByteCode::FUNCTION_RETURN},
+                                     END_SECTION}),
+                     0),
+      VerifyException);
+  // Internal bytecodes never appear in a module.
+  EXPECT_THROW(verifyFunction(singleFunction({{ByteCode::VAR_VAR_INT_ADD},
+                                              {ByteCode::FUNCTION_RETURN},
+                                              END_SECTION}),
+                              0),
+               VerifyException);
+}
+
+TEST(VerifierTest, loadRejectsBadModule) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = std::make_shared<Module>(singleFunction(
+      {{ByteCode::DROP}, {ByteCode::FUNCTION_RETURN}, END_SECTION}));
+  EXPECT_THROW(vm.load(m), VerifyException);
+}
+
+TEST(VerifierTest, checkUnverifiedCode) {
+  Config cfg;
+  cfg.verify = false;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>(singleFunction(
+      {{ByteCode::DROP}, {ByteCode::DROP}, {ByteCode::FUNCTION_RETURN},
+       END_SECTION}));
+  vm.load(m);
+  EXPECT_FALSE(vm.verified());
+  EXPECT_THROW(vm.run("f", {Value(1)}), std::runtime_error);
+}
+
+TEST(VerifierTest, runCheckedAndUnchecked) {
+  Config cfg;
+  cfg.verify = false;
+  b9::VirtualMachine checkedVm{runtime, cfg};
+  b9::VirtualMachine uncheckedVm{runtime, {}};
+  auto m = std::make_shared<Module>(singleFunction(sumLoop(), 1));
+  checkedVm.load(m);
+  uncheckedVm.load(m);
+  EXPECT_TRUE(uncheckedVm.verified());
+  EXPECT_EQ(uncheckedVm.getMaxStackDepth(0), 2);
+  EXPECT_EQ(checkedVm.run("f", {Value(100)}), Value(5050));
+  EXPECT_EQ(uncheckedVm.run("f", {Value(100)}), Value(5050));
+}
+
+/// sum(n, acc) returns acc + n + (n - 1) + ... + 1, calling itself in tail
+/// position.
+static std::vector<Instruction> tailRecursiveSum() {
+  return {{ByteCode::PUSH_FROM_VAR, 0},      // 0
+          {ByteCode::INT_PUSH_CONSTANT, 0},  // 1
+          {ByteCode::INT_JMP_NEQ, 2},        // 2
+          {ByteCode::PUSH_FROM_VAR, 1},      // 3
+          {ByteCode::FUNCTION_RETURN},       // 4
+          {ByteCode::PUSH_FROM_VAR, 0},      // 5
+          {ByteCode::INT_PUSH_CONSTANT, 1},  // 6
+          {ByteCode::INT_SUB},               // 7
+          {ByteCode::PUSH_FROM_VAR, 1},      // 8
+          {ByteCode::PUSH_FROM_VAR, 0},      // 9
+          {ByteCode::INT_ADD},               // 10
+          {ByteCode::FUNCTION_CALL, 0},      // 11
+          {ByteCode::FUNCTION_RETURN},       // 12
+          END_SECTION};
+}
+
+/// sum, and ping(n) and pong(n), which call each other in tail position
+/// until n is 0, then return 7.
+static std::shared_ptr<Module> tailCallModule() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> ping = {{ByteCode::PUSH_FROM_VAR, 0},
+                                   {ByteCode::INT_PUSH_CONSTANT, 0},
+                                   {ByteCode::INT_JMP_NEQ, 2},
+                                   {ByteCode::INT_PUSH_CONSTANT, 7},
+                                   {ByteCode::FUNCTION_RETURN},
+                                   {ByteCode::PUSH_FROM_VAR, 0},
+                                   {ByteCode::INT_PUSH_CONSTANT, 1},
+                                   {ByteCode::INT_SUB},
+                                   {ByteCode::FUNCTION_CALL, 2},
+                                   {ByteCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  std::vector<Instruction> pong = {{ByteCode::PUSH_FROM_VAR, 0},
+                                   {ByteCode::FUNCTION_CALL, 1},
+                                   {ByteCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"sum", 0, tailRecursiveSum(), 2, 0});
+  m->functions.push_back(b9::FunctionDef{"ping", 1, ping, 1, 0});
+  m->functions.push_back(b9::FunctionDef{"pong", 2, pong, 1, 0});
+  return m;
+}
+
+TEST(TailCallTest, rewriteTailCalls) {
+  auto m = tailCallModule();
+  // A call with a value under its arguments isn't in tail position.
+  std::vector<Instruction> under = {{ByteCode::INT_PUSH_CONSTANT, 1},
+                                    {ByteCode::PUSH_FROM_VAR, 0},
+                                    {ByteCode::FUNCTION_CALL, 1},
+                                    {ByteCode::FUNCTION_RETURN},
+                                    END_SECTION};
+  // Nor is one followed by anything but a return.
+  std::vector<Instruction> addOne = {{ByteCode::PUSH_FROM_VAR, 0},
+                                     {ByteCode::FUNCTION_CALL, 1},
+                                     {ByteCode::INT_PUSH_CONSTANT, 1},
+                                     {ByteCode::INT_ADD},
+                                     {ByteCode::FUNCTION_RETURN},
+                                     END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"under", 3, under, 1, 0});
+  m->functions.push_back(b9::FunctionDef{"addOne", 4, addOne, 1, 0});
+
+  EXPECT_EQ(rewriteTailCalls(*m), 3);
+  EXPECT_EQ(m->functions[0].instructions[11].byteCode(), ByteCode::TAIL_CALL);
+  EXPECT_EQ(m->functions[0].instructions[12].byteCode(),
+            ByteCode::FUNCTION_RETURN);
+  EXPECT_EQ(m->functions[1].instructions[8].byteCode(), ByteCode::TAIL_CALL);
+  EXPECT_EQ(m->functions[2].instructions[1].byteCode(), ByteCode::TAIL_CALL);
+  EXPECT_EQ(m->functions[3].instructions[2].byteCode(),
+            ByteCode::FUNCTION_CALL);
+  EXPECT_EQ(m->functions[4].instructions[1].byteCode(),
+            ByteCode::FUNCTION_CALL);
+  EXPECT_NO_THROW(verify(*m));
+}
+
+TEST(TailCallTest, rejectBadTailCalls) {
+  // Something under the arguments.
+  EXPECT_THROW(verifyFunction(singleFunction({{ByteCode::PUSH_FROM_VAR, 0},
+                                              {ByteCode::PUSH_FROM_VAR, 0},
+                                              {ByteCode::TAIL_CALL, 0},
+                                              {ByteCode::FUNCTION_RETURN},
+                                              END_SECTION}),
+                              0),
+               VerifyException);
+  // No return after the call.
+  EXPECT_THROW(verifyFunction(singleFunction({{ByteCode::PUSH_FROM_VAR, 0},
+                                              {ByteCode::TAIL_CALL, 0},
+                                              {ByteCode::DROP},
+                                              {ByteCode::PUSH_FROM_VAR, 0},
+                                              {ByteCode::FUNCTION_RETURN},
+                                              END_SECTION}),
+                              0),
+               VerifyException);
+}
+
+TEST(TailCallTest, runInConstantStack) {
+  Config plain;
+  plain.stackSize = 1024;
+  Config quicken = plain;
+  quicken.quicken = true;
+  Config unchecked = plain;
+  unchecked.verify = false;
+  Config threaded = plain;
+  threaded.threaded = true;
+  Config frameStack = threaded;
+  frameStack.frameStack = true;
+
+  for (auto cfg : {plain, quicken, unchecked, threaded, frameStack}) {
+    cfg.tailCalls = true;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(tailCallModule());
+    // run takes the arguments last first: acc, then n.
+    EXPECT_EQ(vm.run("sum", {Value(0), Value(10000)}), Value(50005000));
+    EXPECT_EQ(vm.run("ping", {Value(10001)}), Value(7));
+  }
+
+  b9::VirtualMachine vm{runtime, plain};
+  vm.load(tailCallModule());
+  EXPECT_THROW(vm.run("sum", {Value(0), Value(10000)}),
+               StackOverflowException);
+}
+
+TEST(TailCallTest, jitTailRecursionLoops) {
+  for (bool passParam : {false, true}) {
+    Config cfg;
+    cfg.jit = true;
+    cfg.directCall = true;
+    cfg.passParam = passParam;
+    cfg.tailCalls = true;
+    cfg.stackSize = 1024;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(tailCallModule());
+    vm.generateAllCode();
+    EXPECT_EQ(vm.run("sum", {Value(0), Value(10000)}), Value(50005000));
+    EXPECT_EQ(vm.run("ping", {Value(5)}), Value(7));
+  }
+}
+
+TEST(OptimizeTest, foldConstants) {
+  auto m = singleFunction({{ByteCode::INT_PUSH_CONSTANT, 6},  // 0
+                           {ByteCode::INT_PUSH_CONSTANT, 7},  // 1
+                           {ByteCode::INT_MUL},               // 2
+                           {ByteCode::INT_PUSH_CONSTANT, 2},  // 3
+                           {ByteCode::INT_PUSH_CONSTANT, 1},  // 4
+                           {ByteCode::INT_JMP_GT, 2},         // 5
+                           {ByteCode::INT_PUSH_CONSTANT, 0},  // 6
+                           {ByteCode::FUNCTION_RETURN},       // 7
+                           {ByteCode::INT_PUSH_CONSTANT, 0},  // 8
+                           {ByteCode::INT_NOT},               // 9
+                           {ByteCode::INT_ADD},               // 10
+                           {ByteCode::FUNCTION_RETURN},       // 11
+                           END_SECTION});
+  auto folded = m;
+  auto stats = optimize(folded, {OptimizerPass::CONSTANT_FOLDING});
+  std::vector<Instruction> expected = {{ByteCode::INT_PUSH_CONSTANT, 42},
+                                       {ByteCode::JMP, 2},
+                                       {ByteCode::INT_PUSH_CONSTANT, 0},
+                                       {ByteCode::FUNCTION_RETURN},
+                                       {ByteCode::INT_PUSH_CONSTANT, 1},
+                                       {ByteCode::INT_ADD},
+                                       {ByteCode::FUNCTION_RETURN},
+                                       END_SECTION};
+  EXPECT_EQ(folded.functions[0].instructions, expected);
+  EXPECT_EQ(stats.passes[0].rewrites, 3);
+  EXPECT_EQ(stats.passes[0].removed, 5);
+  EXPECT_EQ(stats.rounds, 2);
+
+  // The other passes clear the way for the add to fold too.
+  stats = optimize(m);
+  expected = {{ByteCode::INT_PUSH_CONSTANT, 43},
+              {ByteCode::FUNCTION_RETURN},
+              END_SECTION};
+  EXPECT_EQ(m.functions[0].instructions, expected);
+  EXPECT_EQ(stats.before, 12);
+  EXPECT_EQ(stats.after, 2);
+
+  // Results that don't fit a parameter, and division by zero, stay.
+  std::vector<Instruction> unfoldable = {
+      {ByteCode::INT_PUSH_CONSTANT, 0x400000},
+      {ByteCode::INT_PUSH_CONSTANT, 2},
+      {ByteCode::INT_MUL},
+      {ByteCode::INT_PUSH_CONSTANT, 0},
+      {ByteCode::INT_DIV},
+      {ByteCode::FUNCTION_RETURN},
+      END_SECTION};
+  m = singleFunction(unfoldable);
+  optimize(m, {OptimizerPass::CONSTANT_FOLDING});
+  EXPECT_EQ(m.functions[0].instructions, unfoldable);
+}
+
+TEST(OptimizeTest, threadJumps) {
+  auto m = singleFunction({{ByteCode::PUSH_FROM_VAR, 0},      // 0
+                           {ByteCode::INT_PUSH_CONSTANT, 0},  // 1
+                           {ByteCode::INT_JMP_EQ, 2},         // 2
+                           {ByteCode::JMP, 0},                // 3
+                           {ByteCode::JMP, 3},                // 4
+                           {ByteCode::JMP, -2},               // 5
+                           {ByteCode::INT_PUSH_CONSTANT, 0},  // 6
+                           {ByteCode::FUNCTION_RETURN},       // 7
+                           {ByteCode::INT_PUSH_CONSTANT, 7},  // 8
+                           {ByteCode::JMP, 1},                // 9
+                           {ByteCode::INT_PUSH_CONSTANT, 0},  // 10
+                           {ByteCode::FUNCTION_RETURN},       // 11
+                           END_SECTION});
+  auto threaded = m;
+  auto stats = optimize(threaded, {OptimizerPass::JUMP_THREADING});
+  const auto &instructions = threaded.functions[0].instructions;
+  EXPECT_EQ(instructions[2], Instruction(ByteCode::INT_JMP_EQ, 5));
+  EXPECT_EQ(instructions[3], Instruction(ByteCode::JMP, 4));
+  EXPECT_EQ(instructions[4], Instruction(ByteCode::JMP, 3));
+  EXPECT_EQ(instructions[5], Instruction(ByteCode::JMP, 2));
+  EXPECT_EQ(instructions[9], Instruction(ByteCode::FUNCTION_RETURN));
+  EXPECT_EQ(stats.passes[0].rewrites, 4);
+
+  optimize(m);
+  // Both paths of the branch go to the same place, so it stays.
+  EXPECT_EQ(m.functions[0].instructions.size(), 6);
+  EXPECT_EQ(m.functions[0].instructions[3],
+            Instruction(ByteCode::INT_PUSH_CONSTANT, 7));
+  EXPECT_NO_THROW(verify(m));
+}
+
+TEST(OptimizeTest, removeAssignments) {
+  // x = a + 1; return x;
+  auto m = singleFunction({{ByteCode::PUSH_FROM_VAR, 0},
+                           {ByteCode::INT_PUSH_CONSTANT, 1},
+                           {ByteCode::INT_ADD},
+                           {ByteCode::DUPLICATE},
+                           {ByteCode::POP_INTO_VAR, 1},
+                           {ByteCode::DROP},
+                           {ByteCode::PUSH_FROM_VAR, 1},
+                           {ByteCode::FUNCTION_RETURN},
+                           END_SECTION},
+                          1);
+  optimize(m);
+  std::vector<Instruction> expected = {{ByteCode::PUSH_FROM_VAR, 0},
+                                       {ByteCode::INT_PUSH_CONSTANT, 1},
+                                       {ByteCode::INT_ADD},
+                                       {ByteCode::FUNCTION_RETURN},
+                                       END_SECTION};
+  EXPECT_EQ(m.functions[0].instructions, expected);
+
+  // a = a; x = 5; return a;
+  m = singleFunction({{ByteCode::PUSH_FROM_VAR, 0},
+                      {ByteCode::POP_INTO_VAR, 0},
+                      {ByteCode::INT_PUSH_CONSTANT, 5},
+                      {ByteCode::POP_INTO_VAR, 1},
+                      {ByteCode::PUSH_FROM_VAR, 0},
+                      {ByteCode::FUNCTION_RETURN},
+                      END_SECTION},
+                     1);
+  optimize(m);
+  expected = {{ByteCode::PUSH_FROM_VAR, 0},
+              {ByteCode::FUNCTION_RETURN},
+              END_SECTION};
+  EXPECT_EQ(m.functions[0].instructions, expected);
+}
+
+TEST(OptimizeTest, keepJumpTargets) {
+  // The loop jumps to the POP_INTO_VAR, between the DUPLICATE and the DROP.
+  auto m = singleFunction({{ByteCode::PUSH_FROM_VAR, 0},      // 0
+                           {ByteCode::DUPLICATE},             // 1
+                           {ByteCode::POP_INTO_VAR, 1},       // 2
+                           {ByteCode::DROP},                  // 3
+                           {ByteCode::PUSH_FROM_VAR, 1},      // 4
+                           {ByteCode::INT_PUSH_CONSTANT, 0},  // 5
+                           {ByteCode::INT_JMP_EQ, 3},         // 6
+                           {ByteCode::PUSH_FROM_VAR, 1},      // 7
+                           {ByteCode::INT_PUSH_CONSTANT, 0},  // 8
+                           {ByteCode::JMP, -8},               // 9
+                           {ByteCode::PUSH_FROM_VAR, 1},      // 10
+                           {ByteCode::FUNCTION_RETURN},       // 11
+                           END_SECTION},
+                          1);
+  optimize(m);
+  EXPECT_NO_THROW(verify(m));
+  EXPECT_EQ(m.functions[0].instructions[3], Instruction(ByteCode::DROP));
+  EXPECT_EQ(m.functions[0].instructions[1], Instruction(ByteCode::DUPLICATE));
+}
+
+TEST(OptimizeTest, runOptimized) {
+  Config cfg;
+  cfg.optimize = true;
+  cfg.tailCalls = true;
+  cfg.stackSize = 1024;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(tailCallModule());
+  EXPECT_EQ(vm.run("sum", {Value(0), Value(10000)}), Value(50005000));
+  EXPECT_EQ(vm.run("ping", {Value(10001)}), Value(7));
+  EXPECT_EQ(vm.optimizeStats().passes.size(), allOptimizerPasses().size());
+
+  std::stringstream out;
+  writeOptimizeStats(out, vm.optimizeStats());
+  EXPECT_NE(out.str().find("peephole"), std::string::npos);
+
+  OptimizerPass pass;
+  EXPECT_TRUE(parseOptimizerPass("dce", pass));
+  EXPECT_EQ(pass, OptimizerPass::DEAD_CODE);
+  EXPECT_FALSE(parseOptimizerPass("inline", pass));
+}
+
+TEST(ContextPoolTest, reuseContexts) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, sumLoop(), 1, 1});
+  vm.load(m);
+
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(vm.run("sum", {Value(10)}), Value(55));
+  }
+  EXPECT_EQ(vm.contextCount(), 1);
+
+  ExecutionContext *first;
+  {
+    auto lease = vm.leaseContext();
+    first = lease.get();
+    // A nested lease gets its own context.
+    auto nested = vm.leaseContext();
+    EXPECT_NE(nested.get(), first);
+    lease->push(Value(1));
+  }
+  EXPECT_EQ(vm.contextCount(), 2);
+
+  // The pool hands out the last released context, reset.
+  auto lease = vm.leaseContext();
+  EXPECT_EQ(lease.get(), first);
+  EXPECT_EQ(lease->stack().begin(), lease->stack().end());
+}
+
+TEST(ContextPoolTest, moveAssignLease) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto lease = vm.leaseContext();
+  auto other = vm.leaseContext();
+  auto first = lease.get();
+  auto second = other.get();
+
+  // The old context goes back to the pool, and the lease takes the other's.
+  lease = std::move(other);
+  EXPECT_EQ(lease.get(), second);
+  EXPECT_EQ(other.get(), nullptr);
+  auto again = vm.leaseContext();
+  EXPECT_EQ(again.get(), first);
+  EXPECT_EQ(vm.contextCount(), 2);
+}
+
+TEST(ContextPoolTest, outliveVirtualMachine) {
+  std::thread thread([] {
+    {
+      b9::VirtualMachine vm{runtime, {}};
+      vm.leaseContext();
+      EXPECT_EQ(vm.contextCount(), 1);
+    }
+    // The thread's pool for the destroyed VM was freed, and a new VM starts
+    // with none of its contexts.
+    b9::VirtualMachine vm{runtime, {}};
+    vm.leaseContext();
+    vm.leaseContext();
+    EXPECT_EQ(vm.contextCount(), 1);
+  });
+  thread.join();
+}
+
+/// Run `body` on `count` threads at once, and wait for them.
+template <typename Body>
+static void runOnThreads(std::size_t count, Body body) {
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < count; i++) {
+    threads.emplace_back(body);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+static void checkConcurrentRuns(const Config &cfg) {
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, recursiveSum(), 1, 0});
+  m->functions.push_back(b9::FunctionDef{"objects", 0, objectLoop(), 1, 2});
+  vm.load(m);
+
+  runOnThreads(4, [&] {
+    for (int i = 0; i < 50; i++) {
+      EXPECT_EQ(vm.run("sum", {Value(100)}), Value(5050));
+      EXPECT_EQ(vm.run("objects", {Value(50)}), Value(1275));
+    }
+  });
+
+  // Every thread ran with a context of its own, from its own pool.
+  EXPECT_EQ(vm.contextCount(), 4);
+  EXPECT_EQ(vm.memoryManager().safepoint().running(), 0);
+}
+
+TEST(MultiThreadTest, runConcurrently) { checkConcurrentRuns({}); }
+
+TEST(MultiThreadTest, runConcurrentlyThreaded) {
+  Config cfg;
+  cfg.threaded = true;
+  cfg.frameStack = true;
+  checkConcurrentRuns(cfg);
+}
+
+TEST(MultiThreadTest, runConcurrentlyQuickened) {
+  Config cfg;
+  cfg.quicken = true;
+  checkConcurrentRuns(cfg);
+}
+
+TEST(MultiThreadTest, stopTheWorld) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, sumLoop(), 1, 1});
+  vm.load(m);
+
+  auto &safepoint = vm.memoryManager().safepoint();
+  std::atomic<bool> done{false};
+  std::thread stopper([&] {
+    while (!done) {
+      safepoint.stop();
+      // Every thread in the VM is parked, or out of it.
+      EXPECT_EQ(safepoint.running(), 0);
+      safepoint.resume();
+    }
+  });
+
+  runOnThreads(4, [&] {
+    for (int i = 0; i < 20; i++) {
+      EXPECT_EQ(vm.run("sum", {Value(10000)}), Value(50005000));
+    }
+  });
+  done = true;
+  stopper.join();
+  EXPECT_GT(safepoint.stops(), 0);
+}
+
+TEST(MultiThreadTest, jitLoopParksForCollect) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  // for (n = arg0; n > 0; n -= 1) {} return 1;
+  m->functions.push_back(
+      b9::FunctionDef{"loop",
+                      0,
+                      {{ByteCode::PUSH_FROM_VAR, 0},      // 0
+                       {ByteCode::INT_PUSH_CONSTANT, 0},  // 1
+                       {ByteCode::INT_JMP_LE, 5},         // 2
+                       {ByteCode::PUSH_FROM_VAR, 0},      // 3
+                       {ByteCode::INT_PUSH_CONSTANT, 1},  // 4
+                       {ByteCode::INT_SUB},               // 5
+                       {ByteCode::POP_INTO_VAR, 0},       // 6
+                       {ByteCode::JMP, -8},               // 7
+                       {ByteCode::INT_PUSH_CONSTANT, 1},  // 8
+                       {ByteCode::FUNCTION_RETURN},       // 9
+                       END_SECTION},
+                      1,
+                      0});
+  m->functions.push_back(b9::FunctionDef{"collect",
+                                         0,
+                                         {{ByteCode::SYSTEM_COLLECT},
+                                          {ByteCode::INT_PUSH_CONSTANT, 7},
+                                          {ByteCode::FUNCTION_RETURN},
+                                          END_SECTION},
+                                         0,
+                                         0});
+  vm.load(m);
+  vm.generateAllCode();
+
+  std::atomic<bool> started{false};
+  std::atomic<bool> finished{false};
+  std::thread looper([&] {
+    started = true;
+    EXPECT_EQ(vm.run("loop", {Value(300000000)}), Value(1));
+    finished = true;
+  });
+  while (!started) {
+    std::this_thread::yield();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  // Each collect stops the world, so the jitted loop parks at a backedge
+  // rather than holding it up until it returns.
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(vm.run("collect", {}), Value(7));
+  }
+  EXPECT_FALSE(finished);
+  looper.join();
+  EXPECT_GE(vm.memoryManager().safepoint().stops(), 3);
+}
+
+TEST(WorkRangesTest, coverEveryIndexOnce) {
+  WorkRanges ranges(1000, 4, 16);
+  std::vector<int> seen(1000, 0);
+  std::size_t first, last;
+  // Worker 0 does everything, stealing the other shares.
+  while (ranges.next(0, first, last)) {
+    EXPECT_LE(last - first, 16);
+    for (auto i = first; i < last; i++) {
+      seen[i]++;
+    }
+  }
+  EXPECT_EQ(std::count(seen.begin(), seen.end(), 1), 1000);
+  EXPECT_GE(ranges.steals(), 3);
+}
+
+static std::vector<Instruction> subtract() {
+  return {{ByteCode::PUSH_FROM_VAR, 0},
+          {ByteCode::PUSH_FROM_VAR, 1},
+          {ByteCode::INT_SUB},
+          {ByteCode::FUNCTION_RETURN},
+          END_SECTION};
+}
+
+TEST(BatchTest, runBatch) {
+  Config cfg;
+  cfg.batchThreads = 4;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, recursiveSum(), 1, 0});
+  m->functions.push_back(b9::FunctionDef{"subtract", 1, subtract(), 2, 0});
+  vm.load(m);
+
+  std::vector<StackElement> args;
+  for (int i = 0; i < 10000; i++) {
+    args.push_back(Value(i % 100));
+  }
+  std::vector<StackElement> results(args.size());
+  auto stats = vm.runBatch(0, {args.data(), args.size()},
+                           {results.data(), results.size()});
+  for (int i = 0; i < 10000; i++) {
+    EXPECT_EQ(results[i], Value((i % 100) * (i % 100 + 1) / 2));
+  }
+  EXPECT_EQ(stats.calls, 10000);
+  EXPECT_EQ(stats.threads, 4);
+
+  // Arguments are taken in the same order as run.
+  std::vector<StackElement> pairs = {Value(10), Value(3), Value(3), Value(10)};
+  std::vector<StackElement> differences(2);
+  vm.runBatch(1, {pairs.data(), pairs.size()},
+              {differences.data(), differences.size()});
+  EXPECT_EQ(differences[0], vm.run(1, {Value(10), Value(3)}));
+  EXPECT_EQ(differences[1], vm.run(1, {Value(3), Value(10)}));
+
+  // The workers keep their contexts between batches.
+  EXPECT_EQ(vm.contextCount(), 4);
+
+  EXPECT_THROW(vm.runBatch(1, {pairs.data(), 3},
+                           {differences.data(), differences.size()}),
+               BadFunctionCallException);
+}
+
+TEST(BatchTest, rethrowFromWorkers) {
+  Config cfg;
+  cfg.batchThreads = 2;
+  cfg.stackSize = 1024;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"sum", 0, recursiveSum(), 1, 0});
+  vm.load(m);
+
+  std::vector<StackElement> args(1000, Value(10));
+  args[500] = Value(100000);
+  std::vector<StackElement> results(args.size());
+  EXPECT_THROW(vm.runBatch(0, {args.data(), args.size()},
+                           {results.data(), results.size()}),
+               StackOverflowException);
+
+  // The pool is still usable.
+  args[500] = Value(10);
+  vm.runBatch(0, {args.data(), args.size()}, {results.data(), results.size()});
+  EXPECT_EQ(results[500], Value(55));
+}
+
+TEST(CompileQueueTest, hotLoopsFirst) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool started = false;
+  bool release = false;
+  std::vector<std::size_t> order;
+
+  CompileQueue queue(
+      [&](std::size_t functionIndex) {
+        std::unique_lock<std::mutex> lock(mutex);
+        order.push_back(functionIndex);
+        started = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return release; });
+        return functionIndex != 3;
+      },
+      64);
+
+  // Hold the compiler thread in the first compile while the rest queue up.
+  queue.push(0, CompilePriority::INVOCATION);
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return started; });
+  }
+  queue.push(1, CompilePriority::INVOCATION);
+  queue.push(2, CompilePriority::BACKEDGE);
+  queue.push(3, CompilePriority::INVOCATION);
+  queue.push(4, CompilePriority::INVOCATION);
+  // Pushing again moves a function up, but doesn't queue it twice.
+  queue.push(4, CompilePriority::BACKEDGE);
+  queue.push(1, CompilePriority::INVOCATION);
+  EXPECT_EQ(queue.depth(), 4);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    release = true;
+  }
+  cv.notify_all();
+  queue.drain();
+
+  EXPECT_EQ(order, std::vector<std::size_t>({0, 2, 4, 1, 3}));
+  auto stats = queue.stats();
+  EXPECT_EQ(stats.queued, 5);
+  EXPECT_EQ(stats.compiled, 4);
+  EXPECT_EQ(stats.failed, 1);
+  EXPECT_EQ(stats.maxDepth, 4);
+  EXPECT_GE(stats.compileTime, stats.maxCompileTime);
+  // The last four waited for the first.
+  EXPECT_GT(stats.maxWaitTime.count(), 0);
+}
+
+TEST(CompileQueueTest, dropWhenFull) {
+  std::mutex mutex;
+  std::unique_lock<std::mutex> hold(mutex);
+
+  CompileQueue queue(
+      [&](std::size_t) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return true;
+      },
+      2);
+
+  queue.push(0, CompilePriority::INVOCATION);
+  // The compiler thread may or may not have taken the first request yet.
+  queue.push(1, CompilePriority::INVOCATION);
+  queue.push(2, CompilePriority::INVOCATION);
+  queue.push(3, CompilePriority::INVOCATION);
+  EXPECT_EQ(queue.depth(), 2);
+  EXPECT_GE(queue.stats().dropped, 1);
+
+  hold.unlock();
+  queue.drain();
+  EXPECT_EQ(queue.depth(), 0);
+  auto stats = queue.stats();
+  EXPECT_EQ(stats.compiled, stats.queued);
+  EXPECT_EQ(stats.queued + stats.dropped, 4);
+}
+
+TEST(WarmProfileTest, roundTrip) {
+  WarmProfile profile;
+  profile.config.jit = true;
+  profile.config.tiered = true;
+  profile.config.invocationThreshold = 7;
+  profile.config.directCall = true;
+  profile.functions.push_back({"cold", 3, 0});
+  profile.functions.push_back({"a hot loop", 1, 20000});
+
+  std::stringstream buffer;
+  writeProfile(buffer, profile);
+  auto read = readProfile(buffer);
+
+  EXPECT_TRUE(read.config.jit);
+  EXPECT_TRUE(read.config.tiered);
+  EXPECT_EQ(read.config.invocationThreshold, 7);
+  EXPECT_EQ(read.config.backedgeThreshold, profile.config.backedgeThreshold);
+  EXPECT_TRUE(read.config.directCall);
+  EXPECT_FALSE(read.config.passParam);
+  ASSERT_EQ(read.functions.size(), 2);
+  EXPECT_EQ(read.functions[0].name, "cold");
+  EXPECT_EQ(read.functions[0].invocations, 3);
+  EXPECT_FALSE(read.hot(read.functions[0]));
+  EXPECT_EQ(read.functions[1].name, "a hot loop");
+  EXPECT_EQ(read.functions[1].backedges, 20000);
+  EXPECT_TRUE(read.hot(read.functions[1]));
+}
+
+TEST(WarmProfileTest, rejectMalformed) {
+  std::stringstream notProfile("b9module 1\n");
+  EXPECT_THROW(readProfile(notProfile), ProfileException);
+  std::stringstream newer("b9profile 2\n");
+  EXPECT_THROW(readProfile(newer), ProfileException);
+  std::stringstream unknown("b9profile 1\ncolour blue\n");
+  EXPECT_THROW(readProfile(unknown), ProfileException);
+  std::stringstream noName("b9profile 1\nfunction 1 2\n");
+  EXPECT_THROW(readProfile(noName), ProfileException);
+}
+
+TEST(WarmProfileTest, jitWarmUp) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.invocationThreshold = 3;
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{ByteCode::INT_PUSH_CONSTANT, 0xdead},
+                                {ByteCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"hot", 0, i, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"cold", 0, i, 0, 0});
+
+  WarmProfile profile;
+  {
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    for (int n = 0; n < 5; n++) {
+      vm.run("hot", {});
+    }
+    vm.run("cold", {});
+    profile = vm.recordProfile();
+  }
+  EXPECT_TRUE(profile.hot(profile.functions[0]));
+  EXPECT_FALSE(profile.hot(profile.functions[1]));
+
+  // A module that lost a function still warms up the rest.
+  profile.functions.push_back({"gone", 100, 0});
+
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  EXPECT_EQ(vm.warmUp(profile), 1);
+  EXPECT_EQ(vm.getTier(0), Tier::COMPILED);
+  EXPECT_EQ(vm.getTier(1), Tier::INTERPRETED);
+  EXPECT_EQ(vm.run("hot", {}), Value(0xdead));
+
+  // Running warm doesn't make the function look cold next time.
+  EXPECT_TRUE(profile.hot(vm.recordProfile().functions[0]));
+}
+
+TEST(WarmProfileTest, jitRejectOtherConfig) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  WarmProfile profile;
+  profile.config = cfg;
+  profile.functions.push_back({"hot", 5000, 0});
+  EXPECT_EQ(configMismatch(profile, cfg), nullptr);
+
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{ByteCode::INT_PUSH_CONSTANT, 1},
+                                {ByteCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"hot", 0, i, 0, 0});
+  cfg.maxInlineDepth = profile.config.maxInlineDepth + 1;
+  EXPECT_STREQ(configMismatch(profile, cfg), "inline");
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(m);
+  EXPECT_THROW(vm.warmUp(profile), ProfileException);
+  EXPECT_EQ(vm.getTier(0), Tier::INTERPRETED);
+}
+
+static CompileRecord compileRecord(const char *function, double time,
+                                   std::size_t bytecodes) {
+  CompileRecord record;
+  record.function = function;
+  record.ok = true;
+  record.time = CompileRecord::Duration(time);
+  record.bytecodes = bytecodes;
+  return record;
+}
+
+TEST(JitStatsTest, sortRecords) {
+  std::vector<CompileRecord> records = {compileRecord("b", 1, 30),
+                                        compileRecord("c", 3, 10),
+                                        compileRecord("a", 2, 20)};
+  records[0].inlined = {"a"};
+
+  sortCompileRecords(records, JitStatsSort::TIME);
+  EXPECT_EQ(records[0].function, "c");
+  EXPECT_EQ(records[2].function, "b");
+  sortCompileRecords(records, JitStatsSort::BYTECODES);
+  EXPECT_EQ(records[0].function, "b");
+  sortCompileRecords(records, JitStatsSort::NAME);
+  EXPECT_EQ(records[0].function, "a");
+  sortCompileRecords(records, JitStatsSort::INLINED);
+  EXPECT_EQ(records[0].function, "b");
+
+  JitStatsSort sort;
+  EXPECT_TRUE(parseJitStatsSort("bytecodes", sort));
+  EXPECT_EQ(sort, JitStatsSort::BYTECODES);
+  EXPECT_FALSE(parseJitStatsSort("colour", sort));
+}
+
+TEST(JitStatsTest, writeJson) {
+  auto ok = compileRecord("fib", 1.5, 12);
+  ok.inlined = {"add"};
+  auto failed = compileRecord("say \"hi\"", 0.5, 3);
+  failed.ok = false;
+  failed.osr = true;
+  failed.osrIndex = 4;
+  failed.error = "can't compile";
+
+  std::stringstream out;
+  writeJitStatsJson(out, {ok, failed});
+  auto json = out.str();
+  EXPECT_NE(json.find("\"function\": \"fib\", \"osr\": null, \"ok\": true"),
+            std::string::npos);
+  EXPECT_NE(json.find("\"inlined\": [\"add\"]"), std::string::npos);
+  EXPECT_NE(json.find("\"function\": \"say \\\"hi\\\"\", \"osr\": 4"),
+            std::string::npos);
+  EXPECT_NE(json.find("\"error\": \"can't compile\""), std::string::npos);
+  EXPECT_NE(json.find("\"level\": \"baseline\""), std::string::npos);
+
+  ok.level = CompileLevel::HOT;
+  std::stringstream table;
+  writeJitStatsTable(table, {ok, failed});
+  EXPECT_NE(table.str().find("say \"hi\"$osr4"), std::string::npos);
+  EXPECT_NE(table.str().find("fib$hot"), std::string::npos);
+}
+
+TEST(JitStatsTest, jitRecordCompiles) {
+  Config cfg;
+  cfg.jit = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{ByteCode::INT_PUSH_CONSTANT, 1},
+                                {ByteCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"one", 0, i, 0, 0});
+  vm.load(m);
+  vm.generateAllCode();
+
+  auto records = vm.jitStats();
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].function, "one");
+  EXPECT_TRUE(records[0].ok);
+  EXPECT_EQ(records[0].bytecodes, 2);
+  EXPECT_EQ(records[0].entry, (const void *)vm.getJitAddress(0));
+}
+
+/// caller returns callee(7), and comes first, so it's compiled first.
+static std::shared_ptr<Module> callLaterFunction() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> caller = {{ByteCode::INT_PUSH_CONSTANT, 7},
+                                     {ByteCode::FUNCTION_CALL, 1},
+                                     {ByteCode::FUNCTION_RETURN},
+                                     END_SECTION};
+  std::vector<Instruction> callee = {{ByteCode::PUSH_FROM_VAR, 0},
+                                     {ByteCode::FUNCTION_RETURN},
+                                     END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"caller", 0, caller, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"callee", 1, callee, 1, 0});
+  return m;
+}
+
+TEST(DispatchTest, patchDispatchSlots) {
+  Config cfg;
+  cfg.passParam = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(callLaterFunction());
+  EXPECT_EQ(vm.getDispatchSlot(0)->load(), (void *)&jit_dispatch_0);
+  EXPECT_EQ(vm.getDispatchSlot(1)->load(), (void *)&jit_dispatch_1);
+
+  auto fake = reinterpret_cast<JitFunction>(0x1000);
+  vm.setJitAddress(1, fake);
+  EXPECT_EQ(vm.getDispatchSlot(1)->load(), (void *)fake);
+  vm.setJitAddress(1, nullptr);
+  EXPECT_EQ(vm.getDispatchSlot(1)->load(), (void *)&jit_dispatch_1);
+
+  // A new context's dispatch index is the first function.
+  ExecutionContext context{vm, cfg};
+  EXPECT_EQ(Value(Om::FROM_RAW, jit_dispatch_0(&context)), Value(7));
+}
+
+TEST(DispatchTest, jitCallLaterCompiledFunction) {
+  for (bool passParam : {false, true}) {
+    Config cfg;
+    cfg.jit = true;
+    cfg.directCall = true;
+    cfg.passParam = passParam;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(callLaterFunction());
+    vm.generateAllCode();
+    EXPECT_EQ(vm.getDispatchSlot(1)->load(), (void *)vm.getJitAddress(1));
+    EXPECT_EQ(vm.run("caller", {}), Value(7));
+  }
+}
+
+TEST(GenerateAllCodeTest, jitInlineAsCompiledInOrder) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  cfg.maxInlineDepth = 1;
+
+  b9::VirtualMachine upFront{runtime, cfg};
+  upFront.load(std::make_shared<Module>(callLoop()));
+  auto stats = upFront.generateAllCode();
+  EXPECT_EQ(stats.functions, 2);
+
+  // generateAllCode makes the same decisions as compiling each function in
+  // turn, so the loop inlines the callee compiled before it.
+  b9::VirtualMachine inOrder{runtime, cfg};
+  inOrder.load(std::make_shared<Module>(callLoop()));
+  for (std::size_t i = 0; i < inOrder.getFunctionCount(); i++) {
+    EXPECT_TRUE(inOrder.tierUp(i));
+  }
+
+  auto expected = inOrder.inlineDecisions();
+  auto decisions = upFront.inlineDecisions();
+  ASSERT_EQ(decisions.size(), expected.size());
+  ASSERT_EQ(decisions.size(), 1);
+  EXPECT_TRUE(decisions[0].inlined);
+  for (std::size_t i = 0; i < decisions.size(); i++) {
+    EXPECT_EQ(decisions[i].caller, expected[i].caller);
+    EXPECT_EQ(decisions[i].bytecodeIndex, expected[i].bytecodeIndex);
+    EXPECT_EQ(decisions[i].callee, expected[i].callee);
+    EXPECT_EQ(decisions[i].inlined, expected[i].inlined);
+  }
+  EXPECT_EQ(upFront.run("loop", {Value(7)}), Value(1));
+}
+
+TEST(InlinePlanTest, planCompiledCallees) {
+  Config cfg;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  cfg.maxInlineDepth = 1;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(std::make_shared<Module>(callLoop()));
+
+  auto plan = planInlining(vm, 1, CompileLevel::BASELINE,
+                           [](std::size_t) { return true; });
+  ASSERT_EQ(plan.decisions.size(), 1);
+  EXPECT_EQ(plan.decisions[0].bytecodeIndex, 3);
+  EXPECT_TRUE(plan.decisions[0].inlined);
+  ASSERT_EQ(plan.body.callees.count(3), 1);
+  EXPECT_EQ(plan.body.callees[3]->functionIndex, 0);
+  EXPECT_EQ(plan.body.callees[3]->depth, 1);
+  EXPECT_EQ(plan.body.stackDepths[3], 0);
+
+  // A callee that won't have code yet is called.
+  plan = planInlining(vm, 1, CompileLevel::BASELINE,
+                      [](std::size_t) { return false; });
+  ASSERT_EQ(plan.decisions.size(), 1);
+  EXPECT_FALSE(plan.decisions[0].inlined);
+  EXPECT_STREQ(plan.decisions[0].reason, "callee not compiled");
+  EXPECT_TRUE(plan.body.callees.empty());
+}
+
+/// Functions that each return their index, by calling the one before and
+/// adding one.
+static std::shared_ptr<Module> callChain(std::size_t count) {
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{
+      "f0",
+      0,
+      {{ByteCode::INT_PUSH_CONSTANT, 0}, {ByteCode::FUNCTION_RETURN},
+       END_SECTION},
+      0,
+      0});
+  for (std::size_t i = 1; i < count; i++) {
+    std::vector<Instruction> code = {{ByteCode::FUNCTION_CALL, int(i - 1)},
+                                     {ByteCode::INT_PUSH_CONSTANT, 1},
+                                     {ByteCode::INT_ADD},
+                                     {ByteCode::FUNCTION_RETURN},
+                                     END_SECTION};
+    m->functions.push_back(
+        b9::FunctionDef{"f" + std::to_string(i), 0, code, 0, 0});
+  }
+  return m;
+}
+
+TEST(ParallelCompileTest, jitPlanOnThreads) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  cfg.maxInlineDepth = 2;
+
+  b9::VirtualMachine sequential{runtime, cfg};
+  sequential.load(callChain(8));
+  sequential.generateAllCode();
+
+  cfg.compileThreads = 4;
+  b9::VirtualMachine parallel{runtime, cfg};
+  parallel.load(callChain(8));
+  auto stats = parallel.generateAllCode();
+
+  EXPECT_EQ(stats.functions, 8);
+  ASSERT_EQ(stats.threadFunctions.size(), 4);
+  std::size_t planned = 0;
+  for (auto functions : stats.threadFunctions) {
+    planned += functions;
+  }
+  EXPECT_EQ(planned, 8);
+
+  // Planning on threads makes the same decisions, and the same code, as
+  // planning on one.
+  auto expected = sequential.inlineDecisions();
+  auto decisions = parallel.inlineDecisions();
+  ASSERT_EQ(decisions.size(), expected.size());
+  ASSERT_EQ(decisions.size(), 13);
+  for (std::size_t i = 0; i < decisions.size(); i++) {
+    EXPECT_EQ(decisions[i].caller, expected[i].caller);
+    EXPECT_EQ(decisions[i].bytecodeIndex, expected[i].bytecodeIndex);
+    EXPECT_EQ(decisions[i].callee, expected[i].callee);
+    EXPECT_EQ(decisions[i].depth, expected[i].depth);
+    EXPECT_EQ(decisions[i].inlined, expected[i].inlined);
+    EXPECT_STREQ(decisions[i].reason, expected[i].reason);
+    EXPECT_TRUE(decisions[i].inlined);
+  }
+  auto expectedStats = sequential.jitStats();
+  auto records = parallel.jitStats();
+  ASSERT_EQ(records.size(), expectedStats.size());
+  for (std::size_t i = 0; i < records.size(); i++) {
+    EXPECT_EQ(records[i].function, expectedStats[i].function);
+    EXPECT_EQ(records[i].bytecodes, expectedStats[i].bytecodes);
+    EXPECT_EQ(records[i].inlined, expectedStats[i].inlined);
+  }
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(parallel.getTier(i), Tier::COMPILED);
+    EXPECT_EQ(parallel.run(i, {}), Value(i));
+  }
+}
+
+TEST(RecompileTest, jitRecompileHotFunction) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  cfg.recompile = true;
+  cfg.recompileThreshold = 3;
+  cfg.hotInlineDepth = 1;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(callLaterFunction());
+  vm.generateAllCode();
+  auto baseline = vm.getJitAddress(0);
+
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(vm.getProfile(0).level, CompileLevel::BASELINE);
+    EXPECT_EQ(vm.run("caller", {}), Value(7));
+  }
+  EXPECT_EQ(vm.getProfile(0).level, CompileLevel::HOT);
+  EXPECT_NE(vm.getJitAddress(0), baseline);
+  EXPECT_EQ(vm.getDispatchSlot(0)->load(), (void *)vm.getJitAddress(0));
+  EXPECT_EQ(vm.run("caller", {}), Value(7));
+
+  // Only the hot compile inlines the callee.
+  auto records = vm.jitStats();
+  ASSERT_EQ(records.size(), 4);
+  EXPECT_EQ(records[0].level, CompileLevel::BASELINE);
+  EXPECT_TRUE(records[0].inlined.empty());
+  EXPECT_EQ(records[2].function, "caller");
+  EXPECT_EQ(records[2].level, CompileLevel::HOT);
+  EXPECT_EQ(records[2].inlined, std::vector<std::string>{"callee"});
+  // The callee got hot too, on its third call.
+  EXPECT_EQ(records[3].function, "callee");
+  EXPECT_EQ(records[3].level, CompileLevel::HOT);
+}
+
+TEST(RecompileTest, jitHotInlinedReturnsToCaller) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  cfg.recompile = true;
+  cfg.recompileThreshold = 3;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(std::make_shared<Module>(sumCallLoop()));
+  vm.generateAllCode();
+
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(vm.run("sumCalls", {Value(7)}), Value(49));
+  }
+  EXPECT_EQ(vm.getProfile(1).level, CompileLevel::HOT);
+  EXPECT_EQ(vm.run("sumCalls", {Value(7)}), Value(49));
+
+  auto records = vm.jitStats();
+  auto hot = std::find_if(records.begin(), records.end(), [](auto &record) {
+    return record.function == "sumCalls" && record.level == CompileLevel::HOT;
+  });
+  ASSERT_NE(hot, records.end());
+  EXPECT_EQ(hot->inlined, std::vector<std::string>{"addThree"});
+}
+
+TEST(RecompileTest, jitQueueHotRecompile) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  cfg.recompile = true;
+  cfg.recompileThreshold = 3;
+  cfg.asyncCompile = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(callLaterFunction());
+  vm.generateAllCode();
+
+  for (int i = 0; i < 6; i++) {
+    EXPECT_EQ(vm.run("caller", {}), Value(7));
+  }
+  vm.drainCompileQueue();
+  EXPECT_EQ(vm.getProfile(0).level, CompileLevel::HOT);
+  EXPECT_GE(vm.compileStats().compiled, 1);
+  EXPECT_EQ(vm.run("caller", {}), Value(7));
+}
+
 }  // namespace test
 }  // namespace b9